@@ -8,4 +8,4 @@ SET defines=/D DEBUG /D WINDOWS_BUILD /D CAKEZGINE
 
 echo "Building main..."
 
-cl /EHsc /MD /nologo /Z7 /Fe"main" %includes% %defines% main.cpp %links%
\ No newline at end of file
+cl /std:c++17 /EHsc /MD /nologo /Z7 /Fe"main" %includes% %defines% main.cpp %links%
\ No newline at end of file
@@ -1,6 +1,30 @@
 // Use to switch Vulkan ON and OFF
 #define USE_VULKAN
 
+// Use to run the renderer benchmarks instead of the render loop (Vulkan only)
+// #define RUN_BENCHMARKS
+
+// Optional parts of the Vulkan scene, "main --voxels" adds a voxel terrain behind
+// the cube, "main --meshlets" a dense sphere drawn as culled meshlets and
+// "main --particles" a GPU particle fountain. The benchmarks build their own
+// scenes and ignore them.
+
+// Use to record all frames into a trace, replay it with "main --replay <file> [loops]"
+// #define CAPTURE_TRACE "capture.vktrace"
+
+// Validation Layers are on in DEBUG builds, "main --validation" or "main --no-validation"
+// overrides that at runtime
+#ifdef DEBUG
+#define ENABLE_VALIDATION true
+#else
+#define ENABLE_VALIDATION false
+#endif
+
+// Frames and image of the software rasterizer, run with "main --software [frames] [image]"
+// or when no Vulkan device is available
+#define SOFTWARE_FRAMES 300
+#define SOFTWARE_IMAGE "software.ppm"
+
 // include C++ headers
 // GLM
 #include <glm/glm.hpp>
@@ -19,10 +43,16 @@
 // Standard Library
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
 #include <vector>
 #include <array>
 #include <map>
 
+// Transform Hierarchy
+#include "scene_graph.h"
+
 // ##########################################################
 // 				Global Variables
 // ##########################################################
@@ -36,9 +66,11 @@ struct VertexColor // vertex attribute format
 	glm::vec3 color;
 };
 
-std::map<std::string, glm::mat4> gModelMatrix; // object matrices
-glm::mat4 gViewMatrix;						   // view matrix
-glm::mat4 gProjectionMatrix;				   // projection matrix
+SceneGraph gScene;			  // object matrices
+uint32_t gCubeNode;			  // handle of the cube in gScene
+uint32_t gWorldNode;		  // parent of the static voxel and meshlet arenas
+glm::mat4 gViewMatrix;		  // view matrix
+glm::mat4 gProjectionMatrix; // projection matrix
 glm::mat4 MVP;
 
 std::vector<GLfloat> vertices =
@@ -78,6 +110,9 @@ static std::array<GLuint, 36> indices = {
 	7, 4, 6, // triangle 12
 };
 
+// CPU reference and fallback, needs no graphics API
+#include "software_rasterizer.h"
+
 // ##########################################################
 // 				Vulkan or OpenGL Includes
 // ##########################################################
@@ -189,9 +224,34 @@ static void update_scene()
 {
 	static float rotationAngle = 0.0f;
 	rotationAngle += 0.016f;
-	gModelMatrix["cube"] = glm::rotate(rotationAngle, glm::vec3(1.0f, 0.0f, 0.0f)); // Update model matrix
+	scene_set_local(&gScene, gCubeNode, glm::rotate(rotationAngle, glm::vec3(1.0f, 0.0f, 0.0f))); // Update model matrix
+	scene_update(&gScene);																		  // only changed subtrees
 
-	MVP = gProjectionMatrix * gViewMatrix * gModelMatrix["cube"];
+	MVP = gProjectionMatrix * gViewMatrix * scene_world(&gScene, gCubeNode);
+}
+
+// Same scene and state as the cube pipeline, written to an image at the end
+static bool run_software_renderer(uint32_t frameCount, const char *imagePath)
+{
+	SoftRasterizer rast = {};
+	if (!soft_init(&rast, SCREEN_WIDTH, SCREEN_HEIGHT, SOFT_MAX_THREADS))
+	{
+		return false;
+	}
+
+	for (uint32_t frame = 0; frame < frameCount; frame++)
+	{
+		update_scene();
+
+		soft_clear(&rast, glm::vec4(0.2f, 0.2f, 0.2f, 1.0f));
+		soft_draw(&rast, MVP, (const VertexColor *)vertices.data(), indices.data(), indices.size(), SOFT_CULL_FRONT, false);
+		soft_flush(&rast);
+	}
+
+	bool written = soft_write_ppm(&rast, imagePath);
+	soft_print_stats(&rast);
+	soft_shutdown(&rast);
+	return written;
 }
 
 static void error_callback(int error, const char *error_description)
@@ -199,19 +259,103 @@ static void error_callback(int error, const char *error_description)
 	std::cerr << error_description << std::endl; // show error description
 }
 
-int main(void)
+// Positive decimal count of a command line argument, false for anything else
+static bool parse_count(const char *arg, uint32_t *count)
 {
+	if (*arg < '0' || *arg > '9')
+	{
+		std::cerr << "Not a count: " << arg << std::endl;
+		return false;
+	}
+
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(arg, &end, 10);
+	if (*end || errno == ERANGE || !value || value > UINT32_MAX)
+	{
+		std::cerr << "Not a count: " << arg << std::endl;
+		return false;
+	}
+
+	*count = (uint32_t)value;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+#ifdef USE_VULKAN
+	// Headless, no window or scene needed
+	if (argc >= 3 && !strcmp(argv[1], "--replay"))
+	{
+		uint32_t loops = 1;
+		if (argc >= 4 && !parse_count(argv[3], &loops))
+		{
+			exit(EXIT_FAILURE);
+		}
+		exit(replay_trace(argv[2], loops) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	// Time to the first frame, see vulkan_startup.h
+	startup_begin();
+
+	bool validation = ENABLE_VALIDATION;
+	uint32_t renderFlags = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--validation"))
+		{
+			validation = true;
+		}
+		else if (!strcmp(argv[i], "--no-validation"))
+		{
+			validation = false;
+		}
+		else if (!strcmp(argv[i], "--voxels"))
+		{
+			renderFlags |= RENDER_VOXELS;
+		}
+		else if (!strcmp(argv[i], "--meshlets"))
+		{
+			renderFlags |= RENDER_MESHLETS;
+		}
+		else if (!strcmp(argv[i], "--particles"))
+		{
+			renderFlags |= RENDER_PARTICLES;
+		}
+	}
+#ifdef RUN_BENCHMARKS
+	renderFlags = 0;
+#endif
+#endif
+
 	// Global Data init
 	gViewMatrix = glm::lookAt(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f)); // initialise view matrix
 	float aspectRatio = static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT;											  // initialise projection matrix
 	gProjectionMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 10.0f);
-	gModelMatrix["cube"] = glm::mat4(1.0f);
+	gCubeNode = scene_add_node(&gScene, SCENE_NO_PARENT, glm::mat4(1.0f));
+	gWorldNode = scene_add_node(&gScene, SCENE_NO_PARENT, glm::mat4(1.0f));
+
+	if (argc >= 2 && !strcmp(argv[1], "--software"))
+	{
+		uint32_t frames = SOFTWARE_FRAMES;
+		if (argc >= 3 && !parse_count(argv[2], &frames))
+		{
+			exit(EXIT_FAILURE);
+		}
+		const char *image = argc >= 4 ? argv[3] : SOFTWARE_IMAGE;
+		exit(run_software_renderer(frames, image) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
 
 	GLFWwindow *app_window = nullptr;	  // Define application window
 	glfwSetErrorCallback(error_callback); // Set GLFW error callback function
 
 	if (!glfwInit())
 	{
+#ifdef USE_VULKAN
+		// Headless, no display to open a window on
+		std::cerr << "GLFW Failed to initialise, using the software rasterizer" << std::endl;
+		exit(run_software_renderer(SOFTWARE_FRAMES, SOFTWARE_IMAGE) ? EXIT_SUCCESS : EXIT_FAILURE);
+#endif
 		exit(EXIT_FAILURE); //if GLFW failed to initialise -> Exit
 	}
 
@@ -234,11 +378,22 @@ int main(void)
 	}
 
 #ifdef USE_VULKAN
-	if (!init_vulkan(app_window))
+	if (!init_vulkan(app_window, validation, renderFlags))
 	{
-		std::cerr << "Vulkan Failed to initialise" << std::endl;
-		exit(EXIT_FAILURE);
+		std::cerr << "Vulkan Failed to initialise, using the software rasterizer" << std::endl;
+		glfwDestroyWindow(app_window);
+		glfwTerminate();
+		exit(run_software_renderer(SOFTWARE_FRAMES, SOFTWARE_IMAGE) ? EXIT_SUCCESS : EXIT_FAILURE);
 	}
+
+#ifdef CAPTURE_TRACE
+	capture_vulkan_trace(CAPTURE_TRACE);
+#endif
+
+#ifdef RUN_BENCHMARKS
+	run_vulkan_benchmarks();
+	glfwSetWindowShouldClose(app_window, GLFW_TRUE);
+#endif
 #else
 	glfwMakeContextCurrent(app_window); //  set window context as current context
 	glfwSwapInterval(1);				//	swap buffer interval
@@ -266,6 +421,7 @@ int main(void)
 
 	// Clean ups
 #ifdef USE_VULKAN
+	shutdown_vulkan();
 #else
 	glDeleteBuffers(1, &gVBO);
 	glDeleteBuffers(1, &gIBO);
@@ -0,0 +1,230 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Transform hierarchy in flat arrays. Nodes are kept in depth first order, so
+// every parent comes before its children and the subtree of node i is the
+// contiguous range [i, i + subtreeSizes[i]). A changed local matrix marks its
+// node dirty, scene_update() then recomputes only the dirty subtrees and
+// records them as ranges, which is all that has to be uploaded.
+//
+// Nodes are addressed by handles, the order changes when nodes are added.
+
+#define SCENE_NO_PARENT UINT32_MAX
+
+struct SceneRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+struct SceneGraph
+{
+    // By node index, in depth first order
+    std::vector<uint32_t> parents; // Node index, SCENE_NO_PARENT for roots
+    std::vector<uint32_t> subtreeSizes;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint32_t> handles;
+
+    // By handle
+    std::vector<uint32_t> nodeIndices;
+    std::vector<uint32_t> parentHandles;
+    std::vector<uint8_t> dirty;
+
+    // Locals changed since the last scene_update()
+    std::vector<uint32_t> dirtyHandles;
+
+    // Added nodes are appended, the next update restores the order
+    bool orderDirty;
+
+    // World matrices recomputed by the last scene_update(), by node index
+    std::vector<SceneRange> changedRanges;
+    uint32_t changedCount;
+};
+
+// Returns the handle of the new node
+static uint32_t scene_add_node(SceneGraph *scene, uint32_t parentHandle, const glm::mat4 &local)
+{
+    uint32_t handle = scene->nodeIndices.size();
+    uint32_t idx = scene->locals.size();
+
+    scene->nodeIndices.push_back(idx);
+    scene->parentHandles.push_back(parentHandle);
+    scene->dirty.push_back(false);
+
+    scene->parents.push_back(parentHandle == SCENE_NO_PARENT ? SCENE_NO_PARENT : scene->nodeIndices[parentHandle]);
+    scene->subtreeSizes.push_back(1);
+    scene->locals.push_back(local);
+    scene->worlds.push_back(local);
+    scene->handles.push_back(handle);
+
+    scene->orderDirty = true;
+    return handle;
+}
+
+static void scene_set_local(SceneGraph *scene, uint32_t handle, const glm::mat4 &local)
+{
+    scene->locals[scene->nodeIndices[handle]] = local;
+
+    if (!scene->dirty[handle])
+    {
+        scene->dirty[handle] = true;
+        scene->dirtyHandles.push_back(handle);
+    }
+}
+
+// Up to date as of the last scene_update()
+static const glm::mat4 &scene_world(SceneGraph *scene, uint32_t handle)
+{
+    return scene->worlds[scene->nodeIndices[handle]];
+}
+
+static uint32_t scene_node_idx(SceneGraph *scene, uint32_t handle)
+{
+    return scene->nodeIndices[handle];
+}
+
+// Rebuilds the depth first order, only after nodes were added
+static void scene_sort(SceneGraph *scene)
+{
+    uint32_t count = scene->nodeIndices.size();
+
+    // Children as linked lists by handle, built backwards to keep the order they were added in
+    std::vector<uint32_t> firstChild(count, SCENE_NO_PARENT);
+    std::vector<uint32_t> nextSibling(count, SCENE_NO_PARENT);
+    std::vector<uint32_t> stack;
+    for (uint32_t handle = count; handle-- > 0;)
+    {
+        uint32_t parent = scene->parentHandles[handle];
+        if (parent == SCENE_NO_PARENT)
+        {
+            stack.push_back(handle);
+        }
+        else
+        {
+            nextSibling[handle] = firstChild[parent];
+            firstChild[parent] = handle;
+        }
+    }
+
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    while (stack.size())
+    {
+        uint32_t handle = stack.back();
+        stack.pop_back();
+        order.push_back(handle);
+
+        // Pushed in reverse, so the first child is visited next
+        uint32_t childStart = stack.size();
+        for (uint32_t child = firstChild[handle]; child != SCENE_NO_PARENT; child = nextSibling[child])
+        {
+            stack.push_back(child);
+        }
+        std::reverse(stack.begin() + childStart, stack.end());
+    }
+
+    std::vector<glm::mat4> locals(count);
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        locals[idx] = scene->locals[scene->nodeIndices[order[idx]]];
+    }
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        scene->nodeIndices[order[idx]] = idx;
+    }
+
+    scene->locals = std::move(locals);
+    scene->handles = std::move(order);
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        uint32_t parent = scene->parentHandles[scene->handles[idx]];
+        scene->parents[idx] = parent == SCENE_NO_PARENT ? SCENE_NO_PARENT : scene->nodeIndices[parent];
+        scene->subtreeSizes[idx] = 1;
+    }
+
+    // Children come after their parent, so going backwards every subtree is complete
+    for (uint32_t idx = count; idx-- > 0;)
+    {
+        if (scene->parents[idx] != SCENE_NO_PARENT)
+        {
+            scene->subtreeSizes[scene->parents[idx]] += scene->subtreeSizes[idx];
+        }
+    }
+
+    scene->orderDirty = false;
+}
+
+static void scene_compute_range(SceneGraph *scene, uint32_t first, uint32_t count)
+{
+    for (uint32_t idx = first; idx < first + count; idx++)
+    {
+        uint32_t parent = scene->parents[idx];
+        scene->worlds[idx] = parent == SCENE_NO_PARENT ? scene->locals[idx] : scene->worlds[parent] * scene->locals[idx];
+    }
+
+    if (scene->changedRanges.size() && scene->changedRanges.back().first + scene->changedRanges.back().count == first)
+    {
+        scene->changedRanges.back().count += count;
+    }
+    else
+    {
+        scene->changedRanges.push_back({first, count});
+    }
+    scene->changedCount += count;
+}
+
+// Nothing is touched if no local changed
+static void scene_update(SceneGraph *scene)
+{
+    scene->changedRanges.clear();
+    scene->changedCount = 0;
+
+    if (scene->orderDirty)
+    {
+        scene_sort(scene);
+        scene_compute_range(scene, 0, scene->locals.size());
+    }
+    else if (scene->dirtyHandles.size())
+    {
+        std::vector<uint32_t> dirtyNodes;
+        dirtyNodes.reserve(scene->dirtyHandles.size());
+        for (uint32_t handle : scene->dirtyHandles)
+        {
+            dirtyNodes.push_back(scene->nodeIndices[handle]);
+        }
+        std::sort(dirtyNodes.begin(), dirtyNodes.end());
+
+        // A dirty node inside an already recomputed subtree is covered
+        uint32_t end = 0;
+        for (uint32_t idx : dirtyNodes)
+        {
+            if (idx < end)
+            {
+                continue;
+            }
+
+            scene_compute_range(scene, idx, scene->subtreeSizes[idx]);
+            end = idx + scene->subtreeSizes[idx];
+        }
+    }
+
+    for (uint32_t handle : scene->dirtyHandles)
+    {
+        scene->dirty[handle] = false;
+    }
+    scene->dirtyHandles.clear();
+}
+
+// Copies the world matrices changed by the last scene_update() to dst, which
+// holds all of them by node index, e.g. a mapped buffer. Returns the bytes written.
+static uint32_t scene_copy_changed(SceneGraph *scene, void *dst)
+{
+    for (SceneRange &range : scene->changedRanges)
+    {
+        memcpy((glm::mat4 *)dst + range.first, &scene->worlds[range.first], range.count * sizeof(glm::mat4));
+    }
+    return scene->changedCount * sizeof(glm::mat4);
+}
@@ -2,12 +2,137 @@
 
 // input data
 layout(location = 0) in vec3 vColor;
+layout(location = 1) in vec2 vUV;
+layout(location = 2) in vec3 vViewPos;
+
+struct PointLight
+{
+	vec3 position;
+	float radius;
+	vec3 color;
+	float intensity;
+};
+
+// White unless a texture is resident, see TextureManager
+layout(set = 0, binding = 2) uniform sampler2D albedo;
+
+// View space lights and the lights of each cluster, see vulkan_lighting.h
+layout(set = 0, binding = 3) readonly buffer Lights
+{
+	PointLight lights[];
+};
+
+layout(set = 0, binding = 4) readonly buffer ClusterCounts
+{
+	uint clusterCounts[];
+};
+
+layout(set = 0, binding = 5) readonly buffer ClusterIndices
+{
+	uint clusterIndices[];
+};
+
+layout(set = 0, binding = 6) uniform LightingData
+{
+	mat4 view;
+	uvec4 gridSize; // x, y, z, max lights per cluster
+	vec4 depthSlices; // near, far, slice scale and bias
+	vec2 renderSize;
+	float ambient;
+	uint lightCount;
+	uint clustered;
+};
+
+// Cascades of the sun in one depth atlas, see vulkan_shadows.h
+layout(set = 0, binding = 7) uniform sampler2DShadow shadowAtlas;
+
+layout(set = 0, binding = 8) uniform ShadowData
+{
+	mat4 cascades[4]; // View space to atlas uv and depth
+	vec4 tileRects[4];
+	vec4 splits; // Far view depth of every cascade
+	vec4 sunDirection; // View space, toward the sun
+	vec4 sunColor;
+	uint cascadeCount;
+	float shadowTexelSize;
+};
+
+// Specialization Constants, see PipelineState
+layout(constant_id = 1) const bool SHADE_BACK_FACES = false;
 
 // output data
 layout(location = 0) out vec3 fColor;
 
+vec3 shade_light(PointLight light, vec3 normal)
+{
+	vec3 toLight = light.position - vViewPos;
+	float dist = length(toLight);
+	float falloff = clamp(1.0 - dist / light.radius, 0.0, 1.0);
+	return light.color * light.intensity * max(dot(normal, toLight / dist), 0.0) * falloff * falloff;
+}
+
+// 1 where the sun reaches, past the last cascade everything is lit
+float sun_shadow()
+{
+	float depth = -vViewPos.z;
+	if (cascadeCount == 0 || depth > splits[cascadeCount - 1])
+	{
+		return 1.0;
+	}
+
+	uint cascade = 0;
+	while (cascade < cascadeCount - 1 && depth > splits[cascade])
+	{
+		cascade++;
+	}
+
+	// 4 taps, kept inside the tile of the cascade
+	vec3 p = (cascades[cascade] * vec4(vViewPos, 1.0)).xyz;
+	vec4 rect = tileRects[cascade];
+	float shadow = 0.0;
+	for (int i = 0; i < 4; i++)
+	{
+		vec2 offset = (vec2(i & 1, i >> 1) - 0.5) * shadowTexelSize;
+		shadow += texture(shadowAtlas, vec3(clamp(p.xy + offset, rect.xy, rect.zw), p.z));
+	}
+	return shadow * 0.25;
+}
+
 void main()
 {
+	// There are no vertex normals, use the face normal facing the camera
+	vec3 normal = normalize(cross(dFdx(vViewPos), dFdy(vViewPos)));
+	normal = dot(normal, vViewPos) > 0.0 ? -normal : normal;
+
+	// The cluster lists are only written while there are lights
+	vec3 light = vec3(ambient);
+	light += sunColor.rgb * max(dot(normal, sunDirection.xyz), 0.0) * sun_shadow();
+	if (clustered != 0 && lightCount != 0)
+	{
+		uvec2 tile = min(uvec2(gl_FragCoord.xy / renderSize * vec2(gridSize.xy)), gridSize.xy - 1);
+		float slice = log(max(-vViewPos.z, depthSlices.x)) * depthSlices.z + depthSlices.w;
+		uint z = min(uint(max(slice, 0.0)), gridSize.z - 1);
+		uint cluster = (z * gridSize.y + tile.y) * gridSize.x + tile.x;
+
+		for (uint i = 0; i < clusterCounts[cluster]; i++)
+		{
+			light += shade_light(lights[clusterIndices[cluster * gridSize.w + i]], normal);
+		}
+	}
+	else
+	{
+		for (uint i = 0; i < lightCount; i++)
+		{
+			light += shade_light(lights[i], normal);
+		}
+	}
+
 	// set output color
-	fColor = vColor;
+	fColor = vColor * texture(albedo, vUV).rgb * light;
+
+	// darken back faces, only visible without back face culling
+	if (SHADE_BACK_FACES && !gl_FrontFacing)
+	{
+		fColor *= 0.5;
+	}
 }
@@ -6,19 +6,47 @@ layout(location = 1) in vec3 aColor;
 
 // output data
 layout(location = 0) out vec3 vColor;
+layout(location = 1) out vec2 vUV;
+layout(location = 2) out vec3 vViewPos;
 
-// ModelViewProjection matrix
+// Specialization Constants, see PipelineState
+layout(constant_id = 0) const bool INSTANCED = false;
+
+// ViewProjection matrix, View for the lighting
 layout(set = 0, binding = 0) uniform GlobalUBO
 {
-	mat4 MVPMatrix;
+	mat4 VPMatrix;
+	mat4 VMatrix;
+};
+
+// World matrices of the scene graph by node index, see vk_upload_scene()
+layout(set = 0, binding = 1) readonly buffer SceneWorlds
+{
+	mat4 worlds[];
+};
+
+// Node of the draw, every arena is drawn with one
+layout(push_constant) uniform Draw
+{
+	uint nodeIndex;
 };
 
 void main()
 {
-	// set vertex position
-    gl_Position = MVPMatrix * vec4(aPosition, 1.0);
+	// set vertex position, instances are lined up next to each other
+	vec3 position = aPosition;
+	if (INSTANCED)
+	{
+		position.x += float(gl_InstanceIndex) * 1.5;
+	}
+	vec4 worldPos = worlds[nodeIndex] * vec4(position, 1.0);
+    gl_Position = VPMatrix * worldPos;
+	vViewPos = (VMatrix * worldPos).xyz;
 
 	// set vertex shader output color 
 	// will be interpolated for each fragment
 	vColor = aColor;
+
+	// planar mapping, the cube has no texture coordinates
+	vUV = aPosition.xy + 0.5;
 }
\ No newline at end of file
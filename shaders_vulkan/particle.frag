@@ -0,0 +1,15 @@
+#version 450
+
+// input data
+layout(location = 0) in vec3 vColor;
+layout(location = 1) in vec2 vCorner;
+
+// output data, blended additively
+layout(location = 0) out vec4 fColor;
+
+void main()
+{
+	// Round and soft towards the edge of the quad
+	float falloff = max(1.0 - dot(vCorner, vCorner), 0.0);
+	fColor = vec4(vColor * falloff, 0.0);
+}
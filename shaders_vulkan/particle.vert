@@ -0,0 +1,45 @@
+#version 450
+
+// A camera facing quad per particle, the instance is the particle, see
+// particle_draw() in vulkan_particles.h
+struct Particle
+{
+	vec3 position;
+	float life;
+	vec3 velocity;
+	float lifetime;
+};
+
+layout(set = 0, binding = 0) readonly buffer Particles
+{
+	Particle particles[];
+};
+
+layout(push_constant) uniform Constants
+{
+	mat4 viewProj;
+	vec4 right; // w is the size of a particle
+	vec4 up;
+};
+
+// output data
+layout(location = 0) out vec3 vColor;
+layout(location = 1) out vec2 vCorner;
+
+const vec2 corners[6] = vec2[](
+	vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+	vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main()
+{
+	Particle p = particles[gl_InstanceIndex];
+	vec2 corner = corners[gl_VertexIndex];
+
+	vec3 position = p.position + (right.xyz * corner.x + up.xyz * corner.y) * right.w;
+	gl_Position = viewProj * vec4(position, 1.0);
+
+	// Hot while young, fading out towards the end of its life
+	float t = clamp(p.life / p.lifetime, 0.0, 1.0);
+	vColor = mix(vec3(0.6, 0.1, 0.02), vec3(1.0, 0.8, 0.3), t) * t;
+	vCorner = corner;
+}
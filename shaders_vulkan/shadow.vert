@@ -0,0 +1,15 @@
+#version 450
+
+// input data, only the position of the scene vertices
+layout(location = 0) in vec3 aPosition;
+
+// Light space of the cascade times the model matrix, see vulkan_shadows.h
+layout(push_constant) uniform Constants
+{
+	mat4 lightMVP;
+};
+
+void main()
+{
+	gl_Position = lightMVP * vec4(aPosition, 1.0);
+}
@@ -0,0 +1,619 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <emmintrin.h>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Rasterizer on the CPU for the same vertex and index data and MVP the GPU
+// draws, as a fallback without a Vulkan device and as a reference image.
+// Triangles are clipped, set up in 1/16 pixel fixed point and binned into
+// tiles. Tiles are rasterized in parallel, 4 pixels at a time with SSE2, and
+// keep the submission order, so the image doesn't depend on the thread count.
+//
+// Follows the Vulkan rules: depth 0 to 1, y down, counter clockwise front
+// faces, LESS depth test and the top-left fill rule. Only the vertex colors
+// are drawn, like the cube with no texture resident.
+
+#define SOFT_TILE_SIZE 64
+#define SOFT_MAX_SIZE 4096
+#define SOFT_GUARD_BAND 8192 // In pixels, larger triangles are clipped
+#define SOFT_SUBPIXEL 16
+#define SOFT_EDGE_LIMIT (1 << 29) // Edge values are clamped to this, tile steps stay below 2^28
+#define SOFT_MAX_THREADS 8
+
+enum SoftCullMode
+{
+    SOFT_CULL_NONE,
+    SOFT_CULL_BACK,
+    SOFT_CULL_FRONT,
+};
+
+struct SoftVertex
+{
+    glm::vec4 clip;
+    glm::vec3 color;
+};
+
+// Interpolated attributes, colors are divided by w for perspective correction
+enum SoftAttribute
+{
+    SOFT_ATTR_Z,
+    SOFT_ATTR_INV_W,
+    SOFT_ATTR_R,
+    SOFT_ATTR_G,
+    SOFT_ATTR_B,
+    SOFT_ATTR_COUNT,
+};
+
+// Value at the first vertex and the change per pixel
+struct SoftPlane
+{
+    float value;
+    float dx, dy;
+};
+
+struct SoftTriangle
+{
+    int32_t x[3], y[3];             // 1/16 pixels, clockwise on screen
+    int32_t minX, minY, maxX, maxY; // Pixels, inside the target
+    SoftPlane planes[SOFT_ATTR_COUNT];
+    bool depthTest;
+};
+
+struct SoftStats
+{
+    uint64_t frames;
+    uint64_t triangles;
+    uint64_t trianglesCulled; // Back faces, degenerate or outside
+    uint64_t trianglesClipped;
+    uint64_t trianglesSetup;  // Including the pieces of clipped ones
+    uint64_t binnedTriangles; // Counted once per tile
+    uint64_t pixels;          // Written, after the depth test
+    double setupMs;
+    double rasterMs;
+};
+
+struct SoftRasterizer
+{
+    uint32_t width, height;
+    uint32_t stride; // Rounded up to whole tiles
+    uint32_t tilesX, tilesY;
+    glm::vec4 clipPlanes[6];
+
+    std::vector<uint32_t> color; // RGBA8
+    std::vector<float> depth;
+    uint32_t clearColor;
+    bool clearPending;
+
+    // Of the current frame, in submission order
+    std::vector<SoftTriangle> triangles;
+    std::vector<std::vector<uint32_t>> bins;
+    std::vector<uint64_t> tilePixels;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobsDone;
+    bool running;
+
+    // Guarded by the mutex
+    std::deque<uint32_t> jobs;
+    uint32_t pendingJobs;
+
+    SoftStats stats;
+};
+
+static uint32_t soft_pack_color(glm::vec4 color)
+{
+    glm::uvec4 c = glm::uvec4(glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f);
+    return c.r | c.g << 8 | c.b << 16 | c.a << 24;
+}
+
+// Sutherland-Hodgman against one plane, dot(plane, clip) >= 0 is inside
+static uint32_t soft_clip_polygon(const SoftVertex *in, uint32_t count, glm::vec4 plane, SoftVertex *out)
+{
+    uint32_t outCount = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const SoftVertex &a = in[i];
+        const SoftVertex &b = in[(i + 1) % count];
+        float da = glm::dot(plane, a.clip);
+        float db = glm::dot(plane, b.clip);
+
+        if (da >= 0.0f)
+        {
+            out[outCount++] = a;
+        }
+        if ((da >= 0.0f) != (db >= 0.0f))
+        {
+            float t = da / (da - db);
+            out[outCount++] = {glm::mix(a.clip, b.clip, t), glm::mix(a.color, b.color, t)};
+        }
+    }
+    return outCount;
+}
+
+static void soft_raster_tile(SoftRasterizer *rast, uint32_t tileIdx)
+{
+    int32_t tileX = (tileIdx % rast->tilesX) * SOFT_TILE_SIZE;
+    int32_t tileY = (tileIdx / rast->tilesX) * SOFT_TILE_SIZE;
+    int32_t tileMaxX = tileX + SOFT_TILE_SIZE - 1;
+    int32_t tileMaxY = tileY + SOFT_TILE_SIZE - 1;
+
+    if (rast->clearPending)
+    {
+        for (int32_t y = tileY; y <= tileMaxY; y++)
+        {
+            std::fill_n(&rast->color[y * rast->stride + tileX], SOFT_TILE_SIZE, rast->clearColor);
+            std::fill_n(&rast->depth[y * rast->stride + tileX], SOFT_TILE_SIZE, 1.0f);
+        }
+    }
+
+    const __m128i laneIdx = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    const __m128 colorScale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    uint64_t pixels = 0;
+
+    for (uint32_t triIdx : rast->bins[tileIdx])
+    {
+        const SoftTriangle &tri = rast->triangles[triIdx];
+
+        int32_t x0 = std::max(tri.minX, tileX) & ~3;
+        int32_t x1 = std::min(tri.maxX, tileMaxX);
+        int32_t y0 = std::max(tri.minY, tileY);
+        int32_t y1 = std::min(tri.maxY, tileMaxY);
+
+        // Edge e is opposite of vertex e, only used for coverage
+        int64_t A[3], B[3], bias[3];
+        __m128i laneStep[3], step4[3];
+        for (uint32_t e = 0; e < 3; e++)
+        {
+            uint32_t a = (e + 1) % 3, b = (e + 2) % 3;
+            A[e] = tri.y[a] - tri.y[b];
+            B[e] = tri.x[b] - tri.x[a];
+
+            // Pixels exactly on an edge belong to the triangle on its top or left
+            bias[e] = A[e] > 0 || (A[e] == 0 && B[e] > 0) ? 0 : -1;
+
+            int32_t stepX = (int32_t)A[e] * SOFT_SUBPIXEL;
+            laneStep[e] = _mm_setr_epi32(0, stepX, 2 * stepX, 3 * stepX);
+            step4[e] = _mm_set1_epi32(4 * stepX);
+        }
+
+        __m128 attrLaneStep[SOFT_ATTR_COUNT], attrStep4[SOFT_ATTR_COUNT];
+        for (uint32_t i = 0; i < SOFT_ATTR_COUNT; i++)
+        {
+            float dx = tri.planes[i].dx;
+            attrLaneStep[i] = _mm_setr_ps(0.0f, dx, 2.0f * dx, 3.0f * dx);
+            attrStep4[i] = _mm_set1_ps(4.0f * dx);
+        }
+        float refX = (float)tri.x[0] / SOFT_SUBPIXEL;
+        float refY = (float)tri.y[0] / SOFT_SUBPIXEL;
+        __m128i lastX = _mm_set1_epi32(x1 + 1);
+
+        for (int32_t y = y0; y <= y1; y++)
+        {
+            int64_t px = x0 * SOFT_SUBPIXEL + SOFT_SUBPIXEL / 2;
+            int64_t py = y * SOFT_SUBPIXEL + SOFT_SUBPIXEL / 2;
+
+            // Far outside of an edge, no step inside the tile gets back in
+            __m128i w[3];
+            bool outside = false;
+            for (uint32_t e = 0; e < 3; e++)
+            {
+                uint32_t a = (e + 1) % 3;
+                int64_t value = A[e] * (px - tri.x[a]) + B[e] * (py - tri.y[a]) + bias[e];
+                outside = outside || value < -SOFT_EDGE_LIMIT;
+                value = value > SOFT_EDGE_LIMIT ? SOFT_EDGE_LIMIT : value;
+                w[e] = _mm_add_epi32(_mm_set1_epi32((int32_t)value), laneStep[e]);
+            }
+            if (outside)
+            {
+                continue;
+            }
+
+            __m128 attr[SOFT_ATTR_COUNT];
+            for (uint32_t i = 0; i < SOFT_ATTR_COUNT; i++)
+            {
+                const SoftPlane &plane = tri.planes[i];
+                float value = plane.value + plane.dx * (x0 + 0.5f - refX) + plane.dy * (y + 0.5f - refY);
+                attr[i] = _mm_add_ps(_mm_set1_ps(value), attrLaneStep[i]);
+            }
+
+            uint32_t *colorRow = &rast->color[y * rast->stride];
+            float *depthRow = &rast->depth[y * rast->stride];
+
+            for (int32_t x = x0; x <= x1; x += 4)
+            {
+                // Inside if no weight is negative
+                __m128i mask = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w[0], w[1]), w[2]), minusOne);
+                mask = _mm_and_si128(mask, _mm_cmplt_epi32(_mm_add_epi32(_mm_set1_epi32(x), laneIdx), lastX));
+
+                if (_mm_movemask_epi8(mask))
+                {
+                    __m128 depth = attr[SOFT_ATTR_Z];
+                    __m128 oldDepth = _mm_loadu_ps(depthRow + x);
+                    if (tri.depthTest)
+                    {
+                        mask = _mm_and_si128(mask, _mm_castps_si128(_mm_cmplt_ps(depth, oldDepth)));
+                        __m128 depthMask = _mm_castsi128_ps(mask);
+                        _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(depthMask, depth), _mm_andnot_ps(depthMask, oldDepth)));
+                    }
+
+                    int laneMask = _mm_movemask_ps(_mm_castsi128_ps(mask));
+                    if (laneMask)
+                    {
+                        // Perspective correct colors
+                        __m128 scale = _mm_div_ps(colorScale, attr[SOFT_ATTR_INV_W]);
+
+                        __m128i channels[3];
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                            __m128 value = _mm_mul_ps(attr[SOFT_ATTR_R + c], scale);
+                            value = _mm_min_ps(_mm_max_ps(_mm_add_ps(value, half), zero), colorScale);
+                            channels[c] = _mm_cvttps_epi32(value);
+                        }
+
+                        __m128i packed = _mm_or_si128(_mm_or_si128(channels[0], _mm_slli_epi32(channels[1], 8)),
+                                                      _mm_or_si128(_mm_slli_epi32(channels[2], 16), alpha));
+                        __m128i oldColor = _mm_loadu_si128((__m128i *)(colorRow + x));
+                        _mm_storeu_si128((__m128i *)(colorRow + x),
+                                         _mm_or_si128(_mm_and_si128(mask, packed), _mm_andnot_si128(mask, oldColor)));
+
+                        pixels += (laneMask & 1) + (laneMask >> 1 & 1) + (laneMask >> 2 & 1) + (laneMask >> 3 & 1);
+                    }
+                }
+
+                for (uint32_t e = 0; e < 3; e++)
+                {
+                    w[e] = _mm_add_epi32(w[e], step4[e]);
+                }
+                for (uint32_t i = 0; i < SOFT_ATTR_COUNT; i++)
+                {
+                    attr[i] = _mm_add_ps(attr[i], attrStep4[i]);
+                }
+            }
+        }
+    }
+
+    rast->tilePixels[tileIdx] = pixels;
+}
+
+static void soft_raster_thread(SoftRasterizer *rast)
+{
+    std::unique_lock<std::mutex> lock(rast->mutex);
+
+    while (true)
+    {
+        rast->jobAvailable.wait(lock, [rast]
+                                { return !rast->running || !rast->jobs.empty(); });
+        if (!rast->running)
+        {
+            return;
+        }
+
+        uint32_t tileIdx = rast->jobs.front();
+        rast->jobs.pop_front();
+
+        lock.unlock();
+        soft_raster_tile(rast, tileIdx);
+        lock.lock();
+
+        if (!--rast->pendingJobs)
+        {
+            rast->jobsDone.notify_all();
+        }
+    }
+}
+
+// Uses up to maxThreads workers next to the calling thread, 0 rasterizes on the calling thread only
+static bool soft_init(SoftRasterizer *rast, uint32_t width, uint32_t height, uint32_t maxThreads)
+{
+    if (!width || !height || width > SOFT_MAX_SIZE || height > SOFT_MAX_SIZE)
+    {
+        std::cerr << "Software Rasterizer: unsupported size " << width << "x" << height << std::endl;
+        return false;
+    }
+
+    rast->width = width;
+    rast->height = height;
+    rast->tilesX = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    rast->tilesY = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    rast->stride = rast->tilesX * SOFT_TILE_SIZE;
+
+    rast->color.resize(rast->stride * rast->tilesY * SOFT_TILE_SIZE);
+    rast->depth.resize(rast->stride * rast->tilesY * SOFT_TILE_SIZE);
+    rast->bins.resize(rast->tilesX * rast->tilesY);
+    rast->tilePixels.resize(rast->tilesX * rast->tilesY);
+
+    // Vulkan clip volume in z, a guard band in x and y keeps the fixed point coordinates small
+    float guardX = 2.0f * SOFT_GUARD_BAND / width - 1.0f;
+    float guardY = 2.0f * SOFT_GUARD_BAND / height - 1.0f;
+    rast->clipPlanes[0] = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+    rast->clipPlanes[1] = glm::vec4(0.0f, 0.0f, -1.0f, 1.0f);
+    rast->clipPlanes[2] = glm::vec4(1.0f, 0.0f, 0.0f, guardX);
+    rast->clipPlanes[3] = glm::vec4(-1.0f, 0.0f, 0.0f, guardX);
+    rast->clipPlanes[4] = glm::vec4(0.0f, 1.0f, 0.0f, guardY);
+    rast->clipPlanes[5] = glm::vec4(0.0f, -1.0f, 0.0f, guardY);
+
+    uint32_t threadCount = std::thread::hardware_concurrency();
+    threadCount = threadCount > 1 ? threadCount - 1 : 0;
+    threadCount = threadCount > maxThreads ? maxThreads : threadCount;
+
+    rast->running = true;
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        rast->threads.push_back(std::thread(soft_raster_thread, rast));
+    }
+
+    return true;
+}
+
+// Applied by the next soft_flush(), before its triangles
+static void soft_clear(SoftRasterizer *rast, glm::vec4 clearColor)
+{
+    rast->clearColor = soft_pack_color(clearColor);
+    rast->clearPending = true;
+}
+
+static void soft_setup_triangle(SoftRasterizer *rast, const SoftVertex *v, SoftCullMode cullMode, bool depthTest)
+{
+    SoftTriangle tri = {};
+    float attr[3][SOFT_ATTR_COUNT];
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        float invW = 1.0f / v[i].clip.w;
+        float x = (v[i].clip.x * invW + 1.0f) * 0.5f * rast->width;
+        float y = (v[i].clip.y * invW + 1.0f) * 0.5f * rast->height;
+
+        tri.x[i] = (int32_t)floorf(x * SOFT_SUBPIXEL + 0.5f);
+        tri.y[i] = (int32_t)floorf(y * SOFT_SUBPIXEL + 0.5f);
+        attr[i][SOFT_ATTR_Z] = v[i].clip.z * invW;
+        attr[i][SOFT_ATTR_INV_W] = invW;
+        attr[i][SOFT_ATTR_R] = v[i].color.r * invW;
+        attr[i][SOFT_ATTR_G] = v[i].color.g * invW;
+        attr[i][SOFT_ATTR_B] = v[i].color.b * invW;
+    }
+
+    // Negative is counter clockwise on screen with y down, the front face
+    int64_t area = (int64_t)(tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) -
+                   (int64_t)(tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+    if (!area || (cullMode == SOFT_CULL_BACK && area > 0) || (cullMode == SOFT_CULL_FRONT && area < 0))
+    {
+        rast->stats.trianglesCulled++;
+        return;
+    }
+
+    // Clockwise from here on, inside is where all edge functions are positive
+    if (area < 0)
+    {
+        std::swap(tri.x[1], tri.x[2]);
+        std::swap(tri.y[1], tri.y[2]);
+        std::swap(attr[1], attr[2]);
+        area = -area;
+    }
+    tri.depthTest = depthTest;
+
+    // Gradients of the attributes on screen, in pixels
+    double dx1 = (double)(tri.x[1] - tri.x[0]) / SOFT_SUBPIXEL, dy1 = (double)(tri.y[1] - tri.y[0]) / SOFT_SUBPIXEL;
+    double dx2 = (double)(tri.x[2] - tri.x[0]) / SOFT_SUBPIXEL, dy2 = (double)(tri.y[2] - tri.y[0]) / SOFT_SUBPIXEL;
+    double invDet = 1.0 / (dx1 * dy2 - dx2 * dy1);
+    for (uint32_t i = 0; i < SOFT_ATTR_COUNT; i++)
+    {
+        double d1 = attr[1][i] - attr[0][i];
+        double d2 = attr[2][i] - attr[0][i];
+        tri.planes[i].value = attr[0][i];
+        tri.planes[i].dx = (float)((d1 * dy2 - d2 * dy1) * invDet);
+        tri.planes[i].dy = (float)((d2 * dx1 - d1 * dx2) * invDet);
+    }
+
+    // Conservative, the edge functions decide per pixel
+    tri.minX = std::max(std::min({tri.x[0], tri.x[1], tri.x[2]}) >> 4, 0);
+    tri.minY = std::max(std::min({tri.y[0], tri.y[1], tri.y[2]}) >> 4, 0);
+    tri.maxX = std::min(std::max({tri.x[0], tri.x[1], tri.x[2]}) >> 4, (int32_t)rast->width - 1);
+    tri.maxY = std::min(std::max({tri.y[0], tri.y[1], tri.y[2]}) >> 4, (int32_t)rast->height - 1);
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+    {
+        rast->stats.trianglesCulled++;
+        return;
+    }
+
+    uint32_t triIdx = rast->triangles.size();
+    rast->triangles.push_back(tri);
+    rast->stats.trianglesSetup++;
+
+    for (int32_t ty = tri.minY / SOFT_TILE_SIZE; ty <= tri.maxY / SOFT_TILE_SIZE; ty++)
+    {
+        for (int32_t tx = tri.minX / SOFT_TILE_SIZE; tx <= tri.maxX / SOFT_TILE_SIZE; tx++)
+        {
+            rast->bins[ty * rast->tilesX + tx].push_back(triIdx);
+            rast->stats.binnedTriangles++;
+        }
+    }
+}
+
+// Transforms, clips and bins the triangles, soft_flush() draws them
+static void soft_draw(
+    SoftRasterizer *rast,
+    const glm::mat4 &mvp,
+    const VertexColor *vertices,
+    const uint32_t *indices,
+    uint32_t indexCount,
+    SoftCullMode cullMode,
+    bool depthTest)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // At most one more vertex per plane
+    SoftVertex polygon[9], clipped[9];
+
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        rast->stats.triangles++;
+
+        uint32_t outsideAll = 0x3F, insideAll = 0x3F;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            const VertexColor &vertex = vertices[indices[i + k]];
+            polygon[k] = {mvp * glm::vec4(vertex.position, 1.0f), vertex.color};
+
+            uint32_t outside = 0;
+            for (uint32_t p = 0; p < 6; p++)
+            {
+                outside |= (glm::dot(rast->clipPlanes[p], polygon[k].clip) < 0.0f) << p;
+            }
+            outsideAll &= outside;
+            insideAll &= ~outside;
+        }
+
+        if (outsideAll)
+        {
+            rast->stats.trianglesCulled++;
+            continue;
+        }
+
+        if (insideAll == 0x3F)
+        {
+            soft_setup_triangle(rast, polygon, cullMode, depthTest);
+            continue;
+        }
+
+        rast->stats.trianglesClipped++;
+        uint32_t count = 3;
+        for (uint32_t p = 0; p < 6 && count >= 3; p++)
+        {
+            if (!(insideAll & (1 << p)))
+            {
+                count = soft_clip_polygon(polygon, count, rast->clipPlanes[p], clipped);
+                std::copy(clipped, clipped + count, polygon);
+            }
+        }
+
+        // Fan, the pieces keep the winding of the triangle
+        for (uint32_t k = 1; k + 1 < count; k++)
+        {
+            SoftVertex fan[3] = {polygon[0], polygon[k], polygon[k + 1]};
+            soft_setup_triangle(rast, fan, cullMode, depthTest);
+        }
+    }
+
+    rast->stats.setupMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Rasterizes everything drawn since the last flush, blocks until the image is done
+static void soft_flush(SoftRasterizer *rast)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(rast->mutex);
+        for (uint32_t tileIdx = 0; tileIdx < rast->bins.size(); tileIdx++)
+        {
+            rast->tilePixels[tileIdx] = 0;
+            if (rast->clearPending || rast->bins[tileIdx].size())
+            {
+                rast->jobs.push_back(tileIdx);
+            }
+        }
+        rast->pendingJobs = rast->jobs.size();
+    }
+    rast->jobAvailable.notify_all();
+
+    // The calling thread helps until the queue is empty
+    std::unique_lock<std::mutex> lock(rast->mutex);
+    while (rast->jobs.size())
+    {
+        uint32_t tileIdx = rast->jobs.front();
+        rast->jobs.pop_front();
+
+        lock.unlock();
+        soft_raster_tile(rast, tileIdx);
+        lock.lock();
+
+        rast->pendingJobs--;
+    }
+    rast->jobsDone.wait(lock, [rast]
+                        { return !rast->pendingJobs; });
+    lock.unlock();
+
+    for (uint32_t tileIdx = 0; tileIdx < rast->bins.size(); tileIdx++)
+    {
+        rast->stats.pixels += rast->tilePixels[tileIdx];
+        rast->bins[tileIdx].clear();
+    }
+    rast->triangles.clear();
+    rast->clearPending = false;
+
+    rast->stats.frames++;
+    rast->stats.rasterMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Binary PPM of the visible part, as a reference image
+static bool soft_write_ppm(SoftRasterizer *rast, const char *path)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to write: " << path << std::endl;
+        return false;
+    }
+
+    file << "P6\n"
+         << rast->width << " " << rast->height << "\n255\n";
+
+    std::vector<uint8_t> row(rast->width * 3);
+    for (uint32_t y = 0; y < rast->height; y++)
+    {
+        for (uint32_t x = 0; x < rast->width; x++)
+        {
+            uint32_t color = rast->color[y * rast->stride + x];
+            row[x * 3 + 0] = color & 0xFF;
+            row[x * 3 + 1] = color >> 8 & 0xFF;
+            row[x * 3 + 2] = color >> 16 & 0xFF;
+        }
+        file.write((const char *)row.data(), row.size());
+    }
+
+    return file.good();
+}
+
+static void soft_print_stats(SoftRasterizer *rast)
+{
+    SoftStats &stats = rast->stats;
+    if (!stats.frames)
+    {
+        return;
+    }
+
+    double totalMs = stats.setupMs + stats.rasterMs;
+    std::cout << "Software Rasterizer: " << stats.frames << " frames at " << rast->width << "x" << rast->height
+              << " on " << rast->threads.size() + 1 << " threads, avg " << totalMs / stats.frames << "ms ("
+              << stats.setupMs / stats.frames << "ms setup), " << stats.triangles / totalMs / 1000.0 << "M triangles/s, "
+              << stats.pixels / totalMs / 1000.0 << "M pixels/s, " << stats.trianglesCulled * 100.0 / stats.triangles
+              << "% culled, " << stats.trianglesClipped << " clipped, "
+              << (stats.trianglesSetup ? (double)stats.binnedTriangles / stats.trianglesSetup : 0.0)
+              << " tiles per triangle" << std::endl;
+}
+
+static void soft_shutdown(SoftRasterizer *rast)
+{
+    {
+        std::lock_guard<std::mutex> lock(rast->mutex);
+        rast->running = false;
+    }
+    rast->jobAvailable.notify_all();
+
+    for (std::thread &thread : rast->threads)
+    {
+        thread.join();
+    }
+    rast->threads.clear();
+}
@@ -0,0 +1,1409 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+
+// Microbenchmarks of the renderer, run with RUN_BENCHMARKS defined in main.cpp.
+// They need an initialized vkcontext and print their results to stdout.
+
+#define BENCHMARK_RUNS 5
+
+static double benchmark_ms(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Records the same large command buffer through the loader trampolines and
+// through the dispatch table. With validation enabled both end up in the
+// layer, the difference is then only the trampoline itself.
+static void benchmark_dispatch()
+{
+    const uint32_t drawCount = 100000;
+
+    VkCommandBuffer cmd;
+    VkCommandBufferAllocateInfo allocInfo = cmd_alloc_info(vkcontext.commandPool);
+    VK_CHECK(vkcontext.vk.vkAllocateCommandBuffers(vkcontext.device, &allocInfo, &cmd));
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkRenderPassBeginInfo rpBeginInfo = {};
+    rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    rpBeginInfo.renderArea.extent = {SCREEN_WIDTH, SCREEN_HEIGHT};
+    rpBeginInfo.renderPass = vkcontext.renderPass;
+    rpBeginInfo.framebuffer = vkcontext.framebuffer;
+
+    VkPipeline pipeline = pipeline_library_get(&vkcontext.pipelines, vkcontext.pipelineState, true);
+    VkDeviceSize offsets[] = {0};
+
+    double loaderMs = 1e9, tableMs = 1e9;
+    for (uint32_t run = 0; run < BENCHMARK_RUNS; run++)
+    {
+        // Loader Trampolines
+        {
+            vkResetCommandBuffer(cmd, 0);
+            vkBeginCommandBuffer(cmd, &beginInfo);
+            vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t i = 0; i < drawCount; i++)
+            {
+                vkCmdBindVertexBuffers(cmd, 0, 1, &vkcontext.geometry.vertexBuffer.buffer, offsets);
+                vkCmdDrawIndexed(cmd, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+            }
+            double ms = benchmark_ms(start);
+            loaderMs = ms < loaderMs ? ms : loaderMs;
+
+            vkCmdEndRenderPass(cmd);
+            vkEndCommandBuffer(cmd);
+        }
+
+        // Dispatch Table
+        {
+            VkDispatch &vk = vkcontext.vk;
+            vk.vkResetCommandBuffer(cmd, 0);
+            vk.vkBeginCommandBuffer(cmd, &beginInfo);
+            vk.vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t i = 0; i < drawCount; i++)
+            {
+                vk.vkCmdBindVertexBuffers(cmd, 0, 1, &vkcontext.geometry.vertexBuffer.buffer, offsets);
+                vk.vkCmdDrawIndexed(cmd, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+            }
+            double ms = benchmark_ms(start);
+            tableMs = ms < tableMs ? ms : tableMs;
+
+            vk.vkCmdEndRenderPass(cmd);
+            vk.vkEndCommandBuffer(cmd);
+        }
+    }
+
+    // The command buffer was never submitted, so it can go right away
+    vkcontext.vk.vkFreeCommandBuffers(vkcontext.device, vkcontext.commandPool, 1, &cmd);
+
+    double callCount = 2.0 * drawCount;
+    std::cout << "Dispatch: " << callCount << " calls, loader " << loaderMs * 1e6 / callCount << "ns/call, "
+              << "table " << tableMs * 1e6 / callCount << "ns/call, saved "
+              << (loaderMs - tableMs) * 1e6 / callCount << "ns/call" << std::endl;
+}
+
+// Draws the same meshes with a vertex/index buffer bind and vkCmdDrawIndexed
+// each, like separate buffers per mesh would, and with the single indirect
+// draw of the Geometry Arena. Only measures recording on the CPU.
+static void benchmark_geometry()
+{
+    const uint32_t meshCount = 10000;
+    GeometryArena *arena = &vkcontext.geometry;
+
+    std::vector<uint32_t> meshIds;
+    for (uint32_t i = 1; i < meshCount; i++)
+    {
+        uint32_t meshId = geometry_add_mesh(
+            arena,
+            (const VertexColor *)vertices.data(),
+            static_cast<uint32_t>(vertices.size() * sizeof(GLfloat) / sizeof(VertexColor)),
+            indices.data(),
+            static_cast<uint32_t>(indices.size()));
+
+        if (meshId == INVALID_IDX)
+        {
+            break;
+        }
+        meshIds.push_back(meshId);
+    }
+    geometry_update(arena);
+
+    VkCommandBuffer cmd;
+    VkCommandBufferAllocateInfo allocInfo = cmd_alloc_info(vkcontext.commandPool);
+    VK_CHECK(vkcontext.vk.vkAllocateCommandBuffers(vkcontext.device, &allocInfo, &cmd));
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkRenderPassBeginInfo rpBeginInfo = {};
+    rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    rpBeginInfo.renderArea.extent = {SCREEN_WIDTH, SCREEN_HEIGHT};
+    rpBeginInfo.renderPass = vkcontext.renderPass;
+    rpBeginInfo.framebuffer = vkcontext.framebuffer;
+
+    VkPipeline pipeline = pipeline_library_get(&vkcontext.pipelines, vkcontext.pipelineState, true);
+    VkDispatch &vk = vkcontext.vk;
+
+    double perMeshMs = 1e9, indirectMs = 1e9;
+    uint32_t perMeshCalls = 0, indirectCalls = 0;
+    for (uint32_t run = 0; run < BENCHMARK_RUNS; run++)
+    {
+        // Bind and Draw per Mesh
+        {
+            vk.vkResetCommandBuffer(cmd, 0);
+            vk.vkBeginCommandBuffer(cmd, &beginInfo);
+            vk.vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+            perMeshCalls = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (GeometryMesh &mesh : arena->meshes)
+            {
+                if (!mesh.alive)
+                {
+                    continue;
+                }
+
+                VkDeviceSize offset = mesh.vertexOffset * sizeof(VertexColor);
+                vk.vkCmdBindVertexBuffers(cmd, 0, 1, &arena->vertexBuffer.buffer, &offset);
+                vk.vkCmdBindIndexBuffer(cmd, arena->indexBuffer.buffer, mesh.firstIndex * sizeof(uint32_t), VK_INDEX_TYPE_UINT32);
+                vk.vkCmdDrawIndexed(cmd, mesh.indexCount, 1, 0, 0, 0);
+                perMeshCalls += 3;
+            }
+            double ms = benchmark_ms(start);
+            perMeshMs = ms < perMeshMs ? ms : perMeshMs;
+
+            vk.vkCmdEndRenderPass(cmd);
+            vk.vkEndCommandBuffer(cmd);
+        }
+
+        // Geometry Arena
+        {
+            vk.vkResetCommandBuffer(cmd, 0);
+            vk.vkBeginCommandBuffer(cmd, &beginInfo);
+            vk.vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            geometry_draw(arena, &vk, cmd);
+            double ms = benchmark_ms(start);
+            indirectMs = ms < indirectMs ? ms : indirectMs;
+
+            vk.vkCmdEndRenderPass(cmd);
+            vk.vkEndCommandBuffer(cmd);
+        }
+    }
+    indirectCalls = 2 + (arena->multiDraw ? 1 : arena->drawCount);
+
+    std::cout << "Geometry: " << arena->drawCount << " meshes, per mesh " << perMeshCalls << " calls in "
+              << perMeshMs << "ms, arena " << indirectCalls << " calls in " << indirectMs << "ms"
+              << (arena->multiDraw ? "" : " (no multiDrawIndirect)") << std::endl;
+
+    // Punch holes into the arena and compact it again, nothing was submitted
+    // so the meshes are free right away
+    for (uint32_t i = 0; i < meshIds.size(); i += 2)
+    {
+        geometry_remove_mesh(arena, meshIds[i], vkcontext.frameValue);
+    }
+    geometry_collect(arena, &vkcontext.graphicsSync);
+    float fragmentation = geometry_fragmentation(arena);
+
+    // The copies run on the GPU, measured until they completed
+    auto start = std::chrono::high_resolution_clock::now();
+    vk.vkResetCommandBuffer(cmd, 0);
+    vk.vkBeginCommandBuffer(cmd, &beginInfo);
+    geometry_defragment(arena, &vk, cmd, &vkcontext.graphicsSync);
+    vk.vkEndCommandBuffer(cmd);
+
+    SyncBatch batch = {};
+    SyncSubmit *submit = sync_batch_add(&vkcontext.graphicsSync, &batch);
+    sync_submit_add_cmd(submit, cmd);
+    sync_wait(&vkcontext.graphicsSync, sync_flush(&vkcontext.graphicsSync, &batch));
+    double defragMs = benchmark_ms(start);
+
+    vk.vkFreeCommandBuffers(vkcontext.device, vkcontext.commandPool, 1, &cmd);
+
+    std::cout << "Geometry: defragmented " << meshIds.size() / 2 << " meshes in " << defragMs
+              << "ms, fragmentation " << fragmentation * 100.0f << "% -> "
+              << geometry_fragmentation(arena) * 100.0f << "%" << std::endl;
+
+    for (uint32_t i = 1; i < meshIds.size(); i += 2)
+    {
+        geometry_remove_mesh(arena, meshIds[i], vkcontext.frameValue);
+    }
+    geometry_collect(arena, &vkcontext.graphicsSync);
+    geometry_update(arena);
+}
+
+struct FrameTimes
+{
+    uint32_t count;
+    double totalMs;
+    double maxMs;
+};
+
+static void benchmark_frame(FrameTimes *times)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    glfwPollEvents();
+    render_scene_vulkan();
+    double ms = benchmark_ms(start);
+
+    times->count++;
+    times->totalMs += ms;
+    times->maxMs = ms > times->maxMs ? ms : times->maxMs;
+}
+
+// Writes a grid of size x size quads as OBJ with vertex colors
+static void benchmark_write_grid(const char *path, uint32_t size)
+{
+    std::ofstream file(path);
+    for (uint32_t y = 0; y <= size; y++)
+    {
+        for (uint32_t x = 0; x <= size; x++)
+        {
+            float u = (float)x / size, v = (float)y / size;
+            file << "v " << u - 0.5f << " " << v - 0.5f << " 0.0 " << u << " " << v << " 0.5\n";
+        }
+    }
+
+    for (uint32_t y = 0; y < size; y++)
+    {
+        for (uint32_t x = 0; x < size; x++)
+        {
+            uint32_t i = y * (size + 1) + x + 1;
+            file << "f " << i << " " << i + 1 << " " << i + size + 2 << " " << i + size + 1 << "\n";
+        }
+    }
+}
+
+// Streams generated meshes while rendering and compares the frame times
+// against frames without streaming
+static void benchmark_streaming()
+{
+    const uint32_t assetCount = 32;
+    const uint32_t gridSize = 64;
+    const uint32_t frameCount = 120;
+    const char *dir = "stream_benchmark";
+
+    std::filesystem::create_directories(dir);
+    std::vector<std::string> paths;
+    for (uint32_t i = 0; i < assetCount; i++)
+    {
+        paths.push_back(std::string(dir) + "/grid_" + std::to_string(i) + ".obj");
+        benchmark_write_grid(paths.back().c_str(), gridSize);
+    }
+
+    FrameTimes idleTimes = {};
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        benchmark_frame(&idleTimes);
+    }
+
+    Streamer *streamer = &vkcontext.streamer;
+    StreamStats statsBefore;
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+        statsBefore = streamer->stats;
+    }
+
+    // The files were just written, so this mostly measures the OS file cache
+    std::vector<uint32_t> assetIds;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (std::string &path : paths)
+    {
+        assetIds.push_back(stream_mesh(streamer, path.c_str()));
+    }
+
+    FrameTimes streamTimes = {};
+    while (!stream_idle(streamer))
+    {
+        benchmark_frame(&streamTimes);
+    }
+    double streamMs = benchmark_ms(start);
+
+    StreamStats stats;
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+        stats = streamer->stats;
+    }
+
+    double readMB = (stats.bytesRead - statsBefore.bytesRead) / (1024.0 * 1024.0);
+    double uploadMB = (stats.bytesUploaded - statsBefore.bytesUploaded) / (1024.0 * 1024.0);
+    std::cout << "Streaming: " << assetCount << " assets in " << streamMs << "ms, "
+              << readMB * 1000.0 / streamMs << "MB/s read, " << uploadMB * 1000.0 / streamMs << "MB/s uploaded, "
+              << stats.assetsFailed - statsBefore.assetsFailed << " failed" << std::endl;
+    std::cout << "Streaming: frames idle avg " << idleTimes.totalMs / idleTimes.count << "ms max " << idleTimes.maxMs
+              << "ms, streaming avg " << (streamTimes.count ? streamTimes.totalMs / streamTimes.count : 0.0)
+              << "ms max " << streamTimes.maxMs << "ms over " << streamTimes.count << " frames" << std::endl;
+
+    for (uint32_t assetId : assetIds)
+    {
+        geometry_remove_mesh(&vkcontext.geometry, stream_mesh_id(streamer, assetId), vkcontext.frameValue);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+// BC1 checker board with a full mip chain, each level tinted differently.
+// Levels are stored smallest first like the spec asks, the Data Format
+// Descriptor is left out since the loader doesn't read it.
+static void benchmark_write_ktx2(const char *path, uint32_t size)
+{
+    uint32_t levelCount = 1;
+    while ((size >> levelCount) > 0)
+    {
+        levelCount++;
+    }
+
+    std::vector<char> levels[TEXTURE_MAX_LEVELS];
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        uint32_t blocks = ((size >> level) + 3) / 4;
+        uint16_t colors[2] = {(uint16_t)(0x001F << (level % 3 * 5)), 0xFFFF}; // 565
+
+        for (uint32_t y = 0; y < blocks; y++)
+        {
+            for (uint32_t x = 0; x < blocks; x++)
+            {
+                // Both endpoints the same color, all indices 0
+                uint16_t color = colors[(x + y) & 1];
+                uint8_t block[8] = {(uint8_t)color, (uint8_t)(color >> 8), (uint8_t)color, (uint8_t)(color >> 8)};
+                levels[level].insert(levels[level].end(), block, block + 8);
+            }
+        }
+    }
+
+    uint32_t header[20] = {};
+    const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+    memcpy(header, identifier, sizeof(identifier));
+    header[3] = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    header[4] = 1; // typeSize
+    header[5] = size;
+    header[6] = size;
+    header[9] = 1; // faceCount
+    header[10] = levelCount;
+
+    std::vector<uint64_t> levelIndex(levelCount * 3);
+    uint64_t offset = sizeof(header) + levelIndex.size() * sizeof(uint64_t);
+    for (int32_t level = levelCount - 1; level >= 0; level--)
+    {
+        levelIndex[level * 3 + 0] = offset;
+        levelIndex[level * 3 + 1] = levels[level].size();
+        levelIndex[level * 3 + 2] = levels[level].size();
+        offset += levels[level].size();
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *)header, sizeof(header));
+    file.write((const char *)levelIndex.data(), levelIndex.size() * sizeof(uint64_t));
+    for (int32_t level = levelCount - 1; level >= 0; level--)
+    {
+        file.write(levels[level].data(), levels[level].size());
+    }
+}
+
+// Renders until every texture holds its target mips, returns the frame count
+static uint32_t benchmark_wait_resident(TextureManager *manager, FrameTimes *times)
+{
+    for (uint32_t frame = 0; frame < 1000; frame++)
+    {
+        bool resident = true;
+        for (Texture &texture : manager->textures)
+        {
+            resident &= texture.resident.image && texture.resident.topMip == texture.targetMip && !texture.pendingValue;
+        }
+
+        if (resident && frame)
+        {
+            return frame;
+        }
+        benchmark_frame(times);
+    }
+
+    return 1000;
+}
+
+// Loads large BC1 textures and moves the view from close up to far away,
+// under the default budget and under a small one
+static void benchmark_textures()
+{
+    const uint32_t textureCount = 8;
+    const uint32_t textureSize = 2048;
+    const char *dir = "texture_benchmark";
+
+    TextureManager *manager = &vkcontext.textures;
+
+    std::filesystem::create_directories(dir);
+    std::vector<uint32_t> textureIds;
+    for (uint32_t i = 0; i < textureCount; i++)
+    {
+        std::string path = std::string(dir) + "/checker_" + std::to_string(i) + ".ktx2";
+        benchmark_write_ktx2(path.c_str(), textureSize);
+
+        uint32_t textureId = texture_load(manager, path.c_str());
+        if (textureId == INVALID_IDX)
+        {
+            std::cout << "Textures: BC1 not supported, skipped" << std::endl;
+            std::filesystem::remove_all(dir);
+            return;
+        }
+        textureIds.push_back(textureId);
+    }
+    std::filesystem::remove_all(dir);
+
+    struct Phase
+    {
+        const char *name;
+        float screenPixels;
+        VkDeviceSize budget;
+    };
+    Phase phases[] = {
+        {"close", (float)textureSize, TEXTURE_MEMORY_BUDGET},
+        {"close, 8MB budget", (float)textureSize, 8 * 1024 * 1024},
+        {"far", 64.0f, TEXTURE_MEMORY_BUDGET},
+    };
+
+    for (Phase &phase : phases)
+    {
+        manager->budget = phase.budget;
+        for (uint32_t textureId : textureIds)
+        {
+            texture_request(manager, textureId, phase.screenPixels);
+        }
+
+        uint64_t uploadedBefore = manager->stats.uploadedBytes;
+        FrameTimes times = {};
+        auto start = std::chrono::high_resolution_clock::now();
+        uint32_t frames = benchmark_wait_resident(manager, &times);
+        double ms = benchmark_ms(start);
+
+        double uploadMB = (manager->stats.uploadedBytes - uploadedBefore) / (1024.0 * 1024.0);
+        std::cout << "Textures " << phase.name << ": resident after " << frames << " frames (" << ms << "ms), "
+                  << manager->stats.residentBytes / 1024 << "KB resident of " << manager->stats.requestedBytes / 1024
+                  << "KB requested, " << uploadMB << "MB uploaded at " << uploadMB * 1000.0 / ms << "MB/s, "
+                  << "frame avg " << (times.count ? times.totalMs / times.count : 0.0) << "ms max " << times.maxMs << "ms"
+                  << std::endl;
+    }
+
+    // Only the smallest mips stay resident
+    manager->budget = TEXTURE_MEMORY_BUDGET;
+    for (uint32_t textureId : textureIds)
+    {
+        texture_request(manager, textureId, 0.0f);
+    }
+}
+
+static float benchmark_avg_gpu_ms(DynamicResolution *drs, uint32_t frames)
+{
+    float totalMs = 0.0f;
+    frames = frames < drs->historyCount ? frames : drs->historyCount;
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        totalMs += drs_history_sample(drs, i).gpuMs;
+    }
+    return frames ? totalMs / frames : 0.0f;
+}
+
+// The cube alone never gets near a real budget, so the budget is lowered to
+// half of the measured GPU time instead of raising the load. Reports how fast
+// the controller settles and how close it gets to the budget.
+static void benchmark_resolution()
+{
+    const uint32_t frameCount = 240;
+    const uint32_t stableFrames = 30;
+
+    DynamicResolution *drs = &vkcontext.resolution;
+    if (!drs->enabled)
+    {
+        std::cout << "Dynamic Resolution: disabled, skipped" << std::endl;
+        return;
+    }
+
+    FrameTimes times = {};
+    for (uint32_t i = 0; i < 120; i++)
+    {
+        benchmark_frame(&times);
+    }
+    float fullMs = benchmark_avg_gpu_ms(drs, 60);
+    float fullScale = drs->scale;
+
+    struct Phase
+    {
+        const char *name;
+        float targetMs;
+    };
+    Phase phases[] = {
+        {"half budget", fullMs * 0.5f},
+        {"restored budget", DRS_TARGET_MS},
+    };
+
+    for (Phase &phase : phases)
+    {
+        drs->targetMs = phase.targetMs;
+
+        uint32_t settledFrame = 0;
+        float lastScale = drs->scale;
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            benchmark_frame(&times);
+            if (drs->scale != lastScale)
+            {
+                lastScale = drs->scale;
+                settledFrame = i + 1;
+            }
+        }
+
+        std::cout << "Dynamic Resolution " << phase.name << ": target " << phase.targetMs << "ms (full scale "
+                  << fullMs << "ms at " << fullScale << "), scale " << drs->scale << " (" << drs->width << "x"
+                  << drs->height << "), settled after " << settledFrame << " frames"
+                  << (frameCount - settledFrame >= stableFrames ? "" : " (still moving)")
+                  << ", avg GPU " << benchmark_avg_gpu_ms(drs, 60) << "ms" << std::endl;
+    }
+
+    drs->targetMs = DRS_TARGET_MS;
+}
+
+// Meshes a whole world through the render loop, then digs a hole into it and
+// measures how long the affected chunks take to come back
+static void benchmark_voxels()
+{
+    const uint32_t sizeX = 16, sizeY = 4, sizeZ = 16;
+    const int S = VOXEL_CHUNK_SIZE;
+
+    VoxelWorld *world = &vkcontext.voxels;
+    voxel_world_init(world, vkcontext.device, vkcontext.gpu, &vkcontext.graphicsSync,
+                     sizeX, sizeY, sizeZ, vkcontext.multiDrawSupport);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    voxel_generate_terrain(world);
+    double generateMs = benchmark_ms(start);
+
+    FrameTimes meshTimes = {};
+    start = std::chrono::high_resolution_clock::now();
+    while (!voxel_idle(world))
+    {
+        benchmark_frame(&meshTimes);
+    }
+    double meshMs = benchmark_ms(start);
+
+    uint64_t chunksMeshed;
+    double totalMeshMs;
+    {
+        std::lock_guard<std::mutex> lock(world->mutex);
+        chunksMeshed = world->stats.chunksMeshed;
+        totalMeshMs = world->stats.totalMeshMs;
+    }
+
+    uint64_t quads = 0, faces = 0, solid = 0, bytes = 0;
+    for (VoxelChunk &chunk : world->chunks)
+    {
+        quads += chunk.quadCount;
+        faces += chunk.faceCount;
+        solid += chunk.solidCount;
+        bytes += chunk.palette.size() + chunk.indices.size() * sizeof(uint64_t);
+    }
+
+    std::cout << "Voxels: " << world->chunks.size() << " chunks generated in " << generateMs << "ms, "
+              << bytes / 1024 << "KB palette compressed vs " << world->chunks.size() * VOXEL_CHUNK_VOLUME / 1024
+              << "KB dense" << std::endl;
+    std::cout << "Voxels: " << chunksMeshed << " chunks meshed in " << meshMs << "ms over " << meshTimes.count
+              << " frames, " << chunksMeshed * 1000.0 / meshMs << " chunks/s ("
+              << (chunksMeshed ? totalMeshMs / chunksMeshed : 0.0) << "ms per chunk on "
+              << world->threads.size() << " threads), frames avg "
+              << (meshTimes.count ? meshTimes.totalMs / meshTimes.count : 0.0) << "ms max " << meshTimes.maxMs << "ms" << std::endl;
+    std::cout << "Voxels: " << quads * 2 << " triangles greedy, " << faces * 2 << " with hidden faces culled, "
+              << solid * 12 << " naive, " << (quads ? solid * 6.0 / quads : 0.0) << "x fewer than naive" << std::endl;
+
+    // Sphere at the corner of 8 chunks, all of them and their neighbours on the border re-mesh
+    int cx = sizeX / 2 * S, cy = 40, cz = sizeZ / 2 * S;
+    int radius = 6;
+    uint64_t meshedBefore = chunksMeshed;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int z = -radius; z <= radius; z++)
+    {
+        for (int y = -radius; y <= radius; y++)
+        {
+            for (int x = -radius; x <= radius; x++)
+            {
+                if (x * x + y * y + z * z <= radius * radius)
+                {
+                    voxel_set(world, cx + x, cy + y, cz + z, VOXEL_AIR);
+                }
+            }
+        }
+    }
+    uint32_t dirtyCount = world->dirtyChunks.size();
+
+    FrameTimes editTimes = {};
+    while (!voxel_idle(world))
+    {
+        benchmark_frame(&editTimes);
+    }
+    double editMs = benchmark_ms(start);
+    {
+        std::lock_guard<std::mutex> lock(world->mutex);
+        chunksMeshed = world->stats.chunksMeshed;
+    }
+
+    std::cout << "Voxels: edit of radius " << radius << " dirtied " << dirtyCount << " chunks, "
+              << chunksMeshed - meshedBefore << " re-meshed and visible after " << editTimes.count
+              << " frames (" << editMs << "ms)" << std::endl;
+
+    VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+    voxel_world_shutdown(world);
+}
+
+// Draws a dense sphere as meshlets from a distance and close up, without
+// culling, culled on the CPU and culled in the compute shader
+static void benchmark_meshlets()
+{
+    const uint32_t warmupFrames = 60, frameCount = 120;
+
+    std::vector<VertexColor> vertices;
+    std::vector<uint32_t> indices;
+    meshlet_sphere(384, 768, vertices, indices);
+
+    MeshletMesh mesh;
+    auto start = std::chrono::high_resolution_clock::now();
+    meshlet_build(vertices.data(), vertices.size(), indices.data(), indices.size(), &mesh);
+    double buildMs = benchmark_ms(start);
+
+    std::cout << "Meshlets: " << indices.size() / 3 << " triangles into " << mesh.meshlets.size() << " meshlets in "
+              << buildMs << "ms, " << indices.size() / 3.0 / mesh.meshlets.size() << " triangles and "
+              << (double)mesh.vertices.size() / mesh.meshlets.size() << " vertices per meshlet" << std::endl;
+
+    MeshletCuller *culler = &vkcontext.meshlets;
+    if (!vk_init_meshlet_culler() ||
+        meshlet_add_mesh(culler, mesh, vertices.data(), vertices.size()) == INVALID_IDX)
+    {
+        std::cout << "Meshlets: failed to create the culler, skipped" << std::endl;
+        VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+        meshlet_culler_shutdown(culler);
+        return;
+    }
+
+    // Full resolution, otherwise the GPU times aren't comparable
+    DynamicResolution *drs = &vkcontext.resolution;
+    float targetMs = drs->targetMs;
+    drs->targetMs = 1000.0f;
+
+    // Only frustum and cone culling, benchmark_occlusion() measures the rest
+    culler->occlusion = false;
+
+    glm::mat4 savedMVP = MVP, savedView = gViewMatrix, savedProjection = gProjectionMatrix;
+    gProjectionMatrix = glm::perspective(glm::radians(45.0f), (float)SCREEN_WIDTH / SCREEN_HEIGHT, 0.1f, 100.0f);
+
+    struct View
+    {
+        const char *name;
+        glm::vec3 eye;
+    };
+    View views[] = {
+        {"whole", glm::vec3(0.0f, 0.0f, 3.0f)},
+        {"close up", glm::vec3(0.6f, 0.3f, 1.4f)},
+    };
+    const char *modeNames[] = {"no culling", "CPU", "compute"};
+
+    for (View &view : views)
+    {
+        gViewMatrix = glm::lookAt(view.eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        MVP = gProjectionMatrix * gViewMatrix;
+
+        for (uint32_t mode = MESHLET_CULL_NONE; mode <= MESHLET_CULL_GPU; mode++)
+        {
+            culler->mode = (MeshletCullMode)mode;
+
+            FrameTimes times = {};
+            for (uint32_t frame = 0; frame < warmupFrames; frame++)
+            {
+                benchmark_frame(&times);
+            }
+
+            times = {};
+            culler->stats = {};
+            for (uint32_t frame = 0; frame < frameCount; frame++)
+            {
+                benchmark_frame(&times);
+            }
+
+            MeshletStats &stats = culler->stats;
+            std::cout << "Meshlets: " << view.name << ", " << modeNames[mode] << " frames avg "
+                      << times.totalMs / times.count << "ms, GPU " << benchmark_avg_gpu_ms(drs, frameCount) << "ms, "
+                      << stats.meshletsCulled * 100.0 / stats.meshlets << "% of meshlets culled, "
+                      << stats.trianglesCulled * 100.0 / stats.triangles << "% of triangles saved";
+            if (mode == MESHLET_CULL_CPU)
+            {
+                std::cout << " (" << stats.frustumCulled / stats.frames << " frustum, " << stats.backfaceCulled / stats.frames
+                          << " backface per frame, " << stats.cpuCullMs * 1000.0 / stats.frames << "us)";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    MVP = savedMVP;
+    gViewMatrix = savedView;
+    gProjectionMatrix = savedProjection;
+    drs->targetMs = targetMs;
+
+    meshlet_print_stats(culler);
+    VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+    meshlet_culler_shutdown(culler);
+}
+
+// Rows of spheres seen from low in front, so the first rows hide most of
+// the rest. Compute culling with and without the Hi-Z test, once from a
+// still camera and once from one moving sideways, where the pyramid of the
+// last frame is off and the late phase has to recover what came into view.
+static void benchmark_occlusion()
+{
+    const uint32_t warmupFrames = 60, frameCount = 120;
+    const uint32_t gridSize = 10;
+    const float sphereScale = 0.45f;
+
+    std::vector<VertexColor> vertices;
+    std::vector<uint32_t> indices;
+    meshlet_sphere(48, 96, vertices, indices);
+
+    MeshletMesh mesh;
+    meshlet_build(vertices.data(), vertices.size(), indices.data(), indices.size(), &mesh);
+
+    MeshletCuller *culler = &vkcontext.meshlets;
+    if (!vk_init_meshlet_culler())
+    {
+        std::cout << "Occlusion: failed to create the culler, skipped" << std::endl;
+        VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+        meshlet_culler_shutdown(culler);
+        return;
+    }
+
+    // Same meshlets for every sphere, only moved
+    for (uint32_t z = 0; z < gridSize; z++)
+    {
+        for (uint32_t x = 0; x < gridSize; x++)
+        {
+            glm::vec3 offset(x - (gridSize - 1) * 0.5f, 0.0f, -(float)z);
+
+            std::vector<VertexColor> moved = vertices;
+            for (VertexColor &vertex : moved)
+            {
+                vertex.position = vertex.position * sphereScale + offset;
+            }
+
+            MeshletMesh movedMesh = mesh;
+            for (MeshletBounds &bounds : movedMesh.bounds)
+            {
+                bounds.center = bounds.center * sphereScale + offset;
+                bounds.radius *= sphereScale;
+            }
+
+            if (meshlet_add_mesh(culler, movedMesh, moved.data(), moved.size()) == INVALID_IDX)
+            {
+                std::cout << "Occlusion: grid doesn't fit, skipped" << std::endl;
+                VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+                meshlet_culler_shutdown(culler);
+                return;
+            }
+        }
+    }
+
+    std::cout << "Occlusion: " << gridSize * gridSize << " spheres, " << culler->commands.size() << " meshlets, "
+              << culler->triangleCount << " triangles" << std::endl;
+
+    // Full resolution, otherwise the GPU times aren't comparable
+    DynamicResolution *drs = &vkcontext.resolution;
+    HiZPyramid *hiz = &vkcontext.hiz;
+    float targetMs = drs->targetMs;
+    drs->targetMs = 1000.0f;
+
+    glm::mat4 savedMVP = MVP, savedView = gViewMatrix, savedProjection = gProjectionMatrix;
+    gProjectionMatrix = glm::perspective(glm::radians(45.0f), (float)SCREEN_WIDTH / SCREEN_HEIGHT, 0.1f, 100.0f);
+
+    for (uint32_t moving = 0; moving < 2; moving++)
+    {
+        float offGpuMs = 0.0f;
+        for (uint32_t occlusion = 0; occlusion < 2; occlusion++)
+        {
+            culler->occlusion = occlusion;
+
+            uint32_t frame = 0;
+            auto update_camera = [&]()
+            {
+                float side = moving ? sinf(frame * 0.05f) * 2.0f : 0.0f;
+                glm::vec3 eye(side, 0.3f, 2.0f);
+                gViewMatrix = glm::lookAt(eye, glm::vec3(side, 0.0f, -(float)gridSize), glm::vec3(0.0f, 1.0f, 0.0f));
+                MVP = gProjectionMatrix * gViewMatrix;
+                frame++;
+            };
+
+            FrameTimes times = {};
+            for (uint32_t i = 0; i < warmupFrames; i++)
+            {
+                update_camera();
+                benchmark_frame(&times);
+            }
+
+            times = {};
+            culler->stats = {};
+            hiz->stats = {};
+            for (uint32_t i = 0; i < frameCount; i++)
+            {
+                update_camera();
+                benchmark_frame(&times);
+            }
+
+            MeshletStats &stats = culler->stats;
+            float gpuMs = benchmark_avg_gpu_ms(drs, frameCount);
+            std::cout << "Occlusion: " << (moving ? "moving" : "still") << " camera, "
+                      << (occlusion ? "Hi-Z" : "frustum and cone only") << " frames avg "
+                      << times.totalMs / times.count << "ms, GPU " << gpuMs << "ms, "
+                      << stats.meshletsCulled * 100.0 / stats.meshlets << "% of meshlets culled, "
+                      << stats.trianglesCulled * 100.0 / stats.triangles << "% of triangles saved";
+            if (occlusion)
+            {
+                float buildMs = hiz->stats.samples ? hiz->stats.totalMs / hiz->stats.samples : 0.0f;
+                std::cout << ", " << stats.occluded / stats.frames << " occluded and " << stats.recovered / stats.frames
+                          << " recovered per frame, pyramid " << buildMs << "ms, saves " << offGpuMs - gpuMs + buildMs
+                          << "ms for a net " << offGpuMs - gpuMs << "ms";
+            }
+            std::cout << std::endl;
+
+            offGpuMs = gpuMs;
+        }
+    }
+
+    MVP = savedMVP;
+    gViewMatrix = savedView;
+    gProjectionMatrix = savedProjection;
+    drs->targetMs = targetMs;
+
+    meshlet_print_stats(culler);
+    hiz_print_stats(hiz);
+    VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+    meshlet_culler_shutdown(culler);
+}
+
+// A large ground plane under a growing number of point lights, lit through
+// the cluster lists and by looping over every light. The light lists of the
+// last frame are checked against lighting_assign_cpu().
+static void benchmark_lighting()
+{
+    const uint32_t warmupFrames = 30, frameCount = 60;
+    const uint32_t naiveMaxLights = 1024; // Past that a frame takes seconds
+    const uint32_t groundQuads = 256;
+    const float groundSize = 40.0f;
+
+    std::vector<VertexColor> vertices;
+    std::vector<uint32_t> indices;
+    for (uint32_t z = 0; z <= groundQuads; z++)
+    {
+        for (uint32_t x = 0; x <= groundQuads; x++)
+        {
+            glm::vec3 p((x / (float)groundQuads - 0.5f) * groundSize, -0.5f, -(z / (float)groundQuads) * groundSize);
+            vertices.push_back({p, glm::vec3(0.8f)});
+        }
+    }
+    for (uint32_t z = 0; z < groundQuads; z++)
+    {
+        for (uint32_t x = 0; x < groundQuads; x++)
+        {
+            uint32_t a = z * (groundQuads + 1) + x;
+            uint32_t b = a + groundQuads + 1;
+            uint32_t quad[] = {a, a + 1, b, a + 1, b + 1, b};
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    GeometryArena *arena = &vkcontext.geometry;
+    uint32_t groundMesh = geometry_add_mesh(arena, vertices.data(), vertices.size(), indices.data(), indices.size());
+    if (groundMesh == INVALID_IDX)
+    {
+        std::cout << "Lighting: ground doesn't fit, skipped" << std::endl;
+        return;
+    }
+    geometry_update(arena);
+
+    ClusteredLighting *lighting = &vkcontext.lighting;
+    DynamicResolution *drs = &vkcontext.resolution;
+    float targetMs = drs->targetMs;
+    drs->targetMs = 1000.0f;
+
+    // The ground is seen from both sides, whatever its winding
+    PipelineState savedState = vkcontext.pipelineState;
+    vkcontext.pipelineState = {VERTEX_FORMAT_POSITION_COLOR, VK_CULL_MODE_NONE, VK_FALSE, VK_FALSE, VK_TRUE};
+
+    glm::mat4 savedMVP = MVP, savedView = gViewMatrix, savedProjection = gProjectionMatrix;
+    gProjectionMatrix = glm::perspective(glm::radians(45.0f), (float)SCREEN_WIDTH / SCREEN_HEIGHT, 0.1f, 50.0f);
+    gViewMatrix = glm::lookAt(glm::vec3(0.0f, 3.0f, 2.0f), glm::vec3(0.0f, -0.5f, -15.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    MVP = gProjectionMatrix * gViewMatrix;
+    lighting->ambient = 0.1f;
+
+    uint32_t lightCounts[] = {16, 64, 256, 1024, 4096, 10000};
+    for (uint32_t lightCount : lightCounts)
+    {
+        srand(lightCount);
+        std::vector<PointLight> lights(lightCount);
+        for (PointLight &light : lights)
+        {
+            float x = (rand() / (float)RAND_MAX - 0.5f) * groundSize;
+            float z = -(rand() / (float)RAND_MAX) * groundSize;
+            light.position = glm::vec3(x, rand() / (float)RAND_MAX - 0.3f, z);
+            light.radius = 0.4f + rand() / (float)RAND_MAX * 0.8f;
+            light.color = glm::vec3(rand() % 256, rand() % 256, rand() % 256) / 255.0f;
+            light.intensity = 1.0f;
+        }
+        lighting_set_lights(lighting, lights.data(), lightCount);
+
+        // The CPU reference on its own, transform and assignment
+        std::vector<PointLight> viewLights(lightCount);
+        std::vector<ClusterBounds> clusters;
+        std::vector<uint32_t> counts(LIGHTING_CLUSTER_COUNT);
+        std::vector<uint32_t> clusterIndices(LIGHTING_CLUSTER_COUNT * LIGHTING_MAX_CLUSTER_LIGHTS);
+        lighting_build_clusters(gProjectionMatrix, clusters);
+        auto start = std::chrono::high_resolution_clock::now();
+        lighting_to_view(gViewMatrix, lights.data(), lightCount, viewLights.data());
+        lighting_assign_cpu(clusters.data(), viewLights.data(), lightCount, counts.data(), clusterIndices.data());
+        double cpuMs = benchmark_ms(start);
+
+        float clusteredGpuMs = 0.0f;
+        for (uint32_t pass = 0; pass < 2; pass++)
+        {
+            bool clustered = pass == 0;
+            if (!clustered && lightCount > naiveMaxLights)
+            {
+                break;
+            }
+            lighting->clustered = clustered;
+
+            FrameTimes times = {};
+            for (uint32_t i = 0; i < warmupFrames; i++)
+            {
+                benchmark_frame(&times);
+            }
+
+            times = {};
+            lighting->stats = {};
+            for (uint32_t i = 0; i < frameCount; i++)
+            {
+                lighting->checkRequested = i == frameCount - 1;
+                benchmark_frame(&times);
+            }
+            float gpuMs = benchmark_avg_gpu_ms(drs, frameCount);
+
+            std::cout << "Lighting: " << lightCount << " lights " << (clustered ? "clustered" : "naive")
+                      << " frames avg " << times.totalMs / times.count << "ms, GPU " << gpuMs << "ms";
+            if (clustered)
+            {
+                // Results of the last frame
+                sync_wait(&vkcontext.graphicsSync, vkcontext.frameValue);
+                lighting_check(lighting);
+                lighting->checkPending = false;
+
+                LightingStats &stats = lighting->stats;
+                float assignMs = stats.samples ? stats.assignMs / stats.samples : 0.0f;
+                std::cout << ", assign " << assignMs << "ms (CPU reference " << cpuMs << "ms), avg "
+                          << stats.avgClusterLights << " max " << stats.maxClusterLights << " lights per cluster, "
+                          << stats.overflowClusters << " clusters overflowed, " << stats.checkMismatches
+                          << " differ from the CPU";
+                clusteredGpuMs = gpuMs;
+            }
+            else
+            {
+                std::cout << ", clustered is " << gpuMs / clusteredGpuMs << "x faster";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    lighting_set_lights(lighting, 0, 0);
+    lighting->clustered = true;
+    lighting->ambient = LIGHTING_AMBIENT;
+    lighting->stats = {};
+    vkcontext.pipelineState = savedState;
+    MVP = savedMVP;
+    gViewMatrix = savedView;
+    gProjectionMatrix = savedProjection;
+    drs->targetMs = targetMs;
+
+    geometry_remove_mesh(arena, groundMesh, vkcontext.frameValue);
+    VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+    geometry_collect(arena, &vkcontext.graphicsSync);
+    geometry_update(arena);
+}
+
+// A fountain of 1M and 2M particles, the passes recorded in front of the
+// Render Pass and on the async compute queue. A burst fills the buffer and
+// the rate replaces the particles dying, so the count stays near the target
+// once the burst died out. The frames are capped by FIFO presents, the time
+// the graphics queue saves shows the overlap.
+static void benchmark_particles()
+{
+    const uint32_t warmupFrames = 300, frameCount = 120;
+
+    ParticleSystem *particles = &vkcontext.particles;
+    if (!vk_init_particle_system())
+    {
+        std::cout << "Particles: failed to create the particle system, skipped" << std::endl;
+        VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+        particle_system_shutdown(particles);
+        return;
+    }
+
+    if (!particles->asyncSupported)
+    {
+        std::cout << "Particles: no Compute Family without graphics, only the graphics queue" << std::endl;
+    }
+
+    DynamicResolution *drs = &vkcontext.resolution;
+    float targetMs = drs->targetMs;
+    drs->targetMs = 1000.0f;
+
+    glm::mat4 savedMVP = MVP, savedView = gViewMatrix, savedProjection = gProjectionMatrix;
+    gProjectionMatrix = glm::perspective(glm::radians(45.0f), (float)SCREEN_WIDTH / SCREEN_HEIGHT, 0.1f, 100.0f);
+    gViewMatrix = glm::lookAt(glm::vec3(0.0f, 1.5f, 8.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    MVP = gProjectionMatrix * gViewMatrix;
+    particles->emitter = glm::vec3(0.0f);
+
+    uint32_t targetCounts[] = {1 << 20, 2000000};
+    for (uint32_t targetCount : targetCounts)
+    {
+        float serialGpuMs = 0.0f;
+        for (uint32_t async = 0; async < 2; async++)
+        {
+            if (async && !particles->asyncSupported)
+            {
+                break;
+            }
+            particles->async = async;
+            particles->emitRate = targetCount / PARTICLE_LIFETIME;
+            particles->burst = targetCount > particles->particleCount ? targetCount - particles->particleCount : 0;
+
+            FrameTimes times = {};
+            for (uint32_t i = 0; i < warmupFrames; i++)
+            {
+                benchmark_frame(&times);
+            }
+
+            times = {};
+            particles->stats = {};
+            uint64_t totalParticles = 0;
+            for (uint32_t i = 0; i < frameCount; i++)
+            {
+                benchmark_frame(&times);
+                totalParticles += particles->particleCount;
+            }
+
+            ParticleStats &stats = particles->stats;
+            float gpuMs = benchmark_avg_gpu_ms(drs, frameCount);
+            std::cout << "Particles: " << totalParticles / frameCount << " alive " << (async ? "async compute" : "graphics queue")
+                      << " frames avg " << times.totalMs / times.count << "ms, graphics GPU " << gpuMs << "ms";
+            if (stats.samples)
+            {
+                std::cout << ", passes " << stats.computeMs / stats.samples << "ms, "
+                          << stats.simulated / (stats.computeMs / 1000.0) / 1e6 << "M particles/s";
+            }
+            if (async)
+            {
+                std::cout << ", the graphics queue saves " << serialGpuMs - gpuMs << "ms";
+            }
+            std::cout << ", " << stats.dropped << " dropped" << std::endl;
+
+            serialGpuMs = gpuMs;
+        }
+    }
+
+    MVP = savedMVP;
+    gViewMatrix = savedView;
+    gProjectionMatrix = savedProjection;
+    drs->targetMs = targetMs;
+
+    particle_print_stats(particles);
+    VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+    particle_system_shutdown(particles);
+}
+
+// A ground with a grid of boxes under the sun. The camera stands still,
+// moves forward with and without caching and the sun turns. Standing still
+// every cascade stays cached, moving only the cascades the camera leaves
+// are fitted and rendered again, a turning sun renders all of them.
+static void benchmark_shadows()
+{
+    const uint32_t warmupFrames = 30, frameCount = 120;
+    const uint32_t boxRows = 24;
+    const float groundSize = 48.0f, boxSpacing = 2.0f;
+
+    std::vector<VertexColor> meshVertices;
+    std::vector<uint32_t> meshIndices;
+    {
+        glm::vec3 corners[] = {{-0.5f, -0.5f, 0.0f}, {0.5f, -0.5f, 0.0f}, {-0.5f, -0.5f, -1.0f}, {0.5f, -0.5f, -1.0f}};
+        for (glm::vec3 corner : corners)
+        {
+            meshVertices.push_back({corner * glm::vec3(groundSize, 1.0f, groundSize), glm::vec3(0.8f)});
+        }
+        uint32_t ground[] = {0, 1, 2, 1, 3, 2};
+        meshIndices.insert(meshIndices.end(), ground, ground + 6);
+
+        const VertexColor *box = (const VertexColor *)vertices.data();
+        uint32_t boxVertexCount = vertices.size() * sizeof(GLfloat) / sizeof(VertexColor);
+        for (uint32_t z = 0; z < boxRows; z++)
+        {
+            for (uint32_t x = 0; x < boxRows; x++)
+            {
+                glm::vec3 offset(((float)x - boxRows * 0.5f) * boxSpacing, 0.0f, -(float)z * boxSpacing - 1.0f);
+                float height = 1.0f + (x * 7 + z * 3) % 4;
+                uint32_t firstVertex = meshVertices.size();
+                for (uint32_t i = 0; i < boxVertexCount; i++)
+                {
+                    glm::vec3 p = box[i].position;
+                    p.y = (p.y + 0.5f) * height - 0.5f;
+                    meshVertices.push_back({p + offset, box[i].color});
+                }
+                for (uint32_t index : indices)
+                {
+                    meshIndices.push_back(firstVertex + index);
+                }
+            }
+        }
+    }
+
+    GeometryArena *arena = &vkcontext.geometry;
+    uint32_t sceneMesh = geometry_add_mesh(arena, meshVertices.data(), meshVertices.size(), meshIndices.data(), meshIndices.size());
+    if (sceneMesh == INVALID_IDX)
+    {
+        std::cout << "Shadows: scene doesn't fit, skipped" << std::endl;
+        return;
+    }
+    geometry_update(arena);
+
+    ShadowMaps *shadows = &vkcontext.shadows;
+    DynamicResolution *drs = &vkcontext.resolution;
+    float targetMs = drs->targetMs;
+    drs->targetMs = 1000.0f;
+
+    PipelineState savedState = vkcontext.pipelineState;
+    vkcontext.pipelineState = {VERTEX_FORMAT_POSITION_COLOR, VK_CULL_MODE_NONE, VK_FALSE, VK_FALSE, VK_TRUE};
+
+    glm::mat4 savedMVP = MVP, savedView = gViewMatrix, savedProjection = gProjectionMatrix;
+    glm::vec3 savedDirection = shadows->lightDirection;
+    gProjectionMatrix = glm::perspective(glm::radians(45.0f), (float)SCREEN_WIDTH / SCREEN_HEIGHT, 0.1f, 50.0f);
+
+    struct Case
+    {
+        const char *name;
+        float cameraSpeed; // Units per frame toward -z
+        float sunSpeed;    // Radians per frame
+        bool caching;
+    };
+    Case cases[] = {
+        {"still camera", 0.0f, 0.0f, true},
+        {"moving camera", 0.05f, 0.0f, true},
+        {"moving camera without caching", 0.05f, 0.0f, false},
+        {"turning sun", 0.0f, 0.01f, true},
+    };
+
+    for (Case &c : cases)
+    {
+        shadows->caching = c.caching;
+
+        FrameTimes times = {};
+        for (uint32_t i = 0; i < warmupFrames + frameCount; i++)
+        {
+            if (i == warmupFrames)
+            {
+                times = {};
+                shadows->stats = {};
+            }
+
+            glm::vec3 eye(0.0f, 3.0f, 2.0f - i * c.cameraSpeed);
+            gViewMatrix = glm::lookAt(eye, eye + glm::vec3(0.0f, -0.2f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            MVP = gProjectionMatrix * gViewMatrix;
+
+            float angle = i * c.sunSpeed;
+            shadows->lightDirection = glm::vec3(glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(savedDirection, 0.0f));
+
+            benchmark_frame(&times);
+        }
+
+        std::cout << "Shadows: " << c.name << " frames avg " << times.totalMs / times.count << "ms, GPU "
+                  << benchmark_avg_gpu_ms(drs, frameCount) << "ms" << std::endl;
+        sync_wait(&vkcontext.graphicsSync, vkcontext.frameValue);
+        shadow_print_stats(shadows);
+    }
+
+    shadows->caching = true;
+    shadows->lightDirection = savedDirection;
+    shadows->stats = {};
+    vkcontext.pipelineState = savedState;
+    MVP = savedMVP;
+    gViewMatrix = savedView;
+    gProjectionMatrix = savedProjection;
+    drs->targetMs = targetMs;
+
+    geometry_remove_mesh(arena, sceneMesh, vkcontext.frameValue);
+    VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+    geometry_collect(arena, &vkcontext.graphicsSync);
+    geometry_update(arena);
+}
+
+// Few large triangles and many small ones, on the calling thread only and
+// on all workers. Both have to give the same image.
+static void benchmark_software()
+{
+    const uint32_t frameCount = 20;
+
+    std::vector<VertexColor> sphereVertices;
+    std::vector<uint32_t> sphereIndices;
+    meshlet_sphere(384, 768, sphereVertices, sphereIndices);
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCREEN_WIDTH / SCREEN_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 2.5f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    struct Case
+    {
+        const char *name;
+        const VertexColor *vertices;
+        const uint32_t *indices;
+        uint32_t indexCount;
+        glm::mat4 mvp;
+    };
+    Case cases[] = {
+        {"cube", (const VertexColor *)vertices.data(), indices.data(), (uint32_t)indices.size(),
+         projection * glm::lookAt(glm::vec3(0.0f, 0.0f, 1.5f), glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f)) *
+             glm::rotate(0.5f, glm::vec3(1.0f, 1.0f, 0.0f))},
+        {"sphere", sphereVertices.data(), sphereIndices.data(), (uint32_t)sphereIndices.size(), projection * view},
+    };
+
+    for (Case &c : cases)
+    {
+        std::vector<uint32_t> images[2];
+        uint32_t maxThreads[] = {0, SOFT_MAX_THREADS};
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            SoftRasterizer rast = {};
+            if (!soft_init(&rast, SCREEN_WIDTH, SCREEN_HEIGHT, maxThreads[i]))
+            {
+                return;
+            }
+
+            for (uint32_t frame = 0; frame < frameCount; frame++)
+            {
+                soft_clear(&rast, glm::vec4(0.2f, 0.2f, 0.2f, 1.0f));
+                soft_draw(&rast, c.mvp, c.vertices, c.indices, c.indexCount, SOFT_CULL_FRONT, true);
+                soft_flush(&rast);
+            }
+
+            std::cout << c.name << ": ";
+            soft_print_stats(&rast);
+            images[i] = rast.color;
+            soft_shutdown(&rast);
+        }
+
+        std::cout << "Software Rasterizer: " << c.name << " images "
+                  << (images[0] == images[1] ? "identical" : "DIFFERENT") << " across thread counts" << std::endl;
+    }
+}
+
+// 1000 roots with 10 children with 10 children each. Every case changes the
+// same locals each frame and uploads the result into a mapped buffer, the
+// baseline recomputes and uploads everything like a flat list would.
+static void benchmark_scene()
+{
+    const uint32_t rootCount = 1000, fanout = 10;
+    const uint32_t frameCount = 200;
+
+    SceneGraph scene = {};
+    std::vector<uint32_t> roots, leaves;
+    for (uint32_t r = 0; r < rootCount; r++)
+    {
+        uint32_t root = scene_add_node(&scene, SCENE_NO_PARENT, glm::translate(glm::vec3(r * 2.0f, 0.0f, 0.0f)));
+        roots.push_back(root);
+        for (uint32_t c = 0; c < fanout; c++)
+        {
+            uint32_t child = scene_add_node(&scene, root, glm::translate(glm::vec3(0.0f, c * 1.0f, 0.0f)));
+            for (uint32_t l = 0; l < fanout; l++)
+            {
+                leaves.push_back(scene_add_node(&scene, child, glm::translate(glm::vec3(0.0f, 0.0f, l * 0.5f))));
+            }
+        }
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    scene_update(&scene);
+    double sortMs = benchmark_ms(start);
+
+    uint32_t nodeCount = scene.worlds.size();
+    Buffer buffer = vk_allocate_buffer(
+        vkcontext.device, vkcontext.gpu, nodeCount * sizeof(glm::mat4),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        "Benchmark World Matrices");
+    scene_copy_changed(&scene, buffer.data);
+
+    std::cout << "Scene: " << nodeCount << " nodes, sorted and computed in " << sortMs << "ms" << std::endl;
+
+    // Flat baseline
+    {
+        std::vector<glm::mat4> worlds(nodeCount);
+        start = std::chrono::high_resolution_clock::now();
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            for (uint32_t idx = 0; idx < nodeCount; idx++)
+            {
+                uint32_t parent = scene.parents[idx];
+                worlds[idx] = parent == SCENE_NO_PARENT ? scene.locals[idx] : worlds[parent] * scene.locals[idx];
+            }
+            memcpy(buffer.data, worlds.data(), nodeCount * sizeof(glm::mat4));
+        }
+        double ms = benchmark_ms(start) / frameCount;
+        std::cout << "Scene: recompute all " << ms * 1000.0 << "us, " << nodeCount * sizeof(glm::mat4) / 1024
+                  << "KB uploaded per frame" << std::endl;
+    }
+
+    struct Case
+    {
+        const char *name;
+        std::vector<uint32_t> handles;
+    };
+    Case cases[] = {
+        {"static", {}},
+        {"1 leaf", {leaves[leaves.size() / 2]}},
+        {"1% of leaves", {}},
+        {"1 root", {roots[rootCount / 2]}},
+        {"all roots", roots},
+    };
+    for (uint32_t i = 0; i < leaves.size(); i += 100)
+    {
+        cases[2].handles.push_back(leaves[i]);
+    }
+
+    for (Case &c : cases)
+    {
+        uint64_t bytes = 0;
+        uint32_t ranges = 0;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            for (uint32_t handle : c.handles)
+            {
+                glm::mat4 local = scene.locals[scene_node_idx(&scene, handle)];
+                scene_set_local(&scene, handle, glm::rotate(local, 0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+            }
+            scene_update(&scene);
+            bytes += scene_copy_changed(&scene, buffer.data);
+            ranges += scene.changedRanges.size();
+        }
+        double ms = benchmark_ms(start) / frameCount;
+
+        std::cout << "Scene: " << c.name << " " << ms * 1000.0 << "us, " << scene.changedCount << " nodes in "
+                  << ranges / frameCount << " ranges, " << bytes / frameCount / 1024.0 << "KB uploaded per frame" << std::endl;
+    }
+
+    vk_free_buffer(vkcontext.device, &buffer);
+}
+
+void run_vulkan_benchmarks()
+{
+    benchmark_dispatch();
+    benchmark_geometry();
+    benchmark_streaming();
+    benchmark_textures();
+    benchmark_resolution();
+    benchmark_voxels();
+    benchmark_meshlets();
+    benchmark_occlusion();
+    benchmark_lighting();
+    benchmark_particles();
+    benchmark_shadows();
+    benchmark_software();
+    benchmark_scene();
+}
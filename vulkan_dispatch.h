@@ -0,0 +1,119 @@
+#pragma once
+
+// The functions exported by vulkan-1.dll are trampolines, every call first
+// looks up the dispatch table of the instance or device in the loader.
+// Resolving the entry points with vkGetInstanceProcAddr/vkGetDeviceProcAddr
+// calls straight into the driver (or the first enabled layer) instead.
+//
+// The members are named like the Vulkan functions, so vkCmdDraw(...) becomes
+// vkcontext.vk.vkCmdDraw(...). Functions the driver doesn't expose stay null.
+
+#define VK_INSTANCE_FUNCTIONS(X)                  \
+    X(vkEnumeratePhysicalDevices)                 \
+    X(vkEnumerateDeviceExtensionProperties)       \
+    X(vkGetPhysicalDeviceProperties)              \
+    X(vkGetPhysicalDeviceFeatures)                \
+    X(vkGetPhysicalDeviceFeatures2)               \
+    X(vkGetPhysicalDeviceMemoryProperties)        \
+    X(vkGetPhysicalDeviceQueueFamilyProperties)   \
+    X(vkGetPhysicalDeviceFormatProperties)        \
+    X(vkGetPhysicalDeviceSurfaceSupportKHR)       \
+    X(vkGetPhysicalDeviceSurfaceFormatsKHR)       \
+    X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR)  \
+    X(vkCreateDevice)                             \
+    X(vkGetDeviceProcAddr)
+
+#define VK_DEVICE_FUNCTIONS(X)        \
+    X(vkGetDeviceQueue)               \
+    X(vkDeviceWaitIdle)               \
+    X(vkQueueSubmit)                  \
+    X(vkQueuePresentKHR)              \
+    X(vkCreateSwapchainKHR)           \
+    X(vkGetSwapchainImagesKHR)        \
+    X(vkAcquireNextImageKHR)          \
+    X(vkCreateImageView)              \
+    X(vkDestroyImageView)             \
+    X(vkCreateRenderPass)             \
+    X(vkDestroyRenderPass)            \
+    X(vkCreateFramebuffer)            \
+    X(vkDestroyFramebuffer)           \
+    X(vkCreateCommandPool)            \
+    X(vkDestroyCommandPool)           \
+    X(vkAllocateCommandBuffers)       \
+    X(vkFreeCommandBuffers)           \
+    X(vkCreateSemaphore)              \
+    X(vkDestroySemaphore)             \
+    X(vkGetSemaphoreCounterValue)     \
+    X(vkWaitSemaphores)               \
+    X(vkCreateFence)                  \
+    X(vkDestroyFence)                 \
+    X(vkWaitForFences)                \
+    X(vkResetFences)                  \
+    X(vkGetFenceStatus)               \
+    X(vkCreateDescriptorSetLayout)    \
+    X(vkCreatePipelineLayout)         \
+    X(vkCreateDescriptorPool)         \
+    X(vkAllocateDescriptorSets)       \
+    X(vkUpdateDescriptorSets)         \
+    X(vkResetCommandBuffer)           \
+    X(vkBeginCommandBuffer)           \
+    X(vkEndCommandBuffer)             \
+    X(vkCmdBeginRenderPass)           \
+    X(vkCmdEndRenderPass)             \
+    X(vkCmdSetViewport)               \
+    X(vkCmdSetScissor)                \
+    X(vkCmdBindPipeline)              \
+    X(vkCmdBindVertexBuffers)         \
+    X(vkCmdBindIndexBuffer)           \
+    X(vkCmdBindDescriptorSets)        \
+    X(vkCmdPushConstants)             \
+    X(vkCmdDraw)                      \
+    X(vkCmdDrawIndexed)               \
+    X(vkCmdDrawIndirect)              \
+    X(vkCmdDrawIndexedIndirect)       \
+    X(vkCmdDispatch)                  \
+    X(vkCmdDispatchIndirect)          \
+    X(vkCmdCopyBuffer)                \
+    X(vkCmdFillBuffer)                \
+    X(vkCmdCopyBufferToImage)         \
+    X(vkCmdCopyImage)                 \
+    X(vkCmdBlitImage)                 \
+    X(vkCreateQueryPool)              \
+    X(vkDestroyQueryPool)             \
+    X(vkCmdResetQueryPool)            \
+    X(vkCmdWriteTimestamp)            \
+    X(vkGetQueryPoolResults)          \
+    X(vkCmdPipelineBarrier)
+
+struct VkDispatch
+{
+#define X(name) PFN_##name name;
+    VK_INSTANCE_FUNCTIONS(X)
+    VK_DEVICE_FUNCTIONS(X)
+#undef X
+};
+
+static void vk_load_instance_functions(VkInstance instance, VkDispatch *vk)
+{
+#define X(name) vk->name = (PFN_##name)vkGetInstanceProcAddr(instance, #name);
+    VK_INSTANCE_FUNCTIONS(X)
+#undef X
+}
+
+static bool vk_load_device_functions(VkDevice device, VkDispatch *vk)
+{
+#define X(name) vk->name = (PFN_##name)vk->vkGetDeviceProcAddr(device, #name);
+    VK_DEVICE_FUNCTIONS(X)
+#undef X
+
+    // The Timeline Semaphore functions are missing before 1.2,
+    // but what the frame loop calls unconditionally has to be there
+    if (!vk->vkQueueSubmit || !vk->vkQueuePresentKHR || !vk->vkAcquireNextImageKHR ||
+        !vk->vkBeginCommandBuffer || !vk->vkCmdDrawIndexed)
+    {
+        std::cerr << "Failed to load Device Functions" << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,729 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <map>
+
+// One vertex and one index buffer shared by all static meshes. Meshes are
+// sub-allocated at offsets and drawn together with a single bind and one
+// vkCmdDrawIndexedIndirect, every mesh is a command using firstIndex and
+// vertexOffset into the shared buffers.
+//
+// The buffers are Device Local, nothing writes them from the CPU. Meshes
+// get there through a staging buffer, either on the Transfer Queue by the
+// Streamer or in the frame by geometry_record_uploads().
+
+#define GEOMETRY_MAX_VERTICES (1 << 18)
+#define GEOMETRY_MAX_INDICES (1 << 20)
+#define GEOMETRY_MAX_DRAWS 16384
+
+// First fit allocator over element ranges, free neighbours get merged
+struct RangeAllocator
+{
+    uint32_t capacity;
+    std::map<uint32_t, uint32_t> freeRanges; // offset -> count
+};
+
+static void range_init(RangeAllocator *allocator, uint32_t capacity)
+{
+    allocator->capacity = capacity;
+    allocator->freeRanges.clear();
+    allocator->freeRanges[0] = capacity;
+}
+
+static uint32_t range_alloc(RangeAllocator *allocator, uint32_t count)
+{
+    for (auto it = allocator->freeRanges.begin(); it != allocator->freeRanges.end(); it++)
+    {
+        if (it->second >= count)
+        {
+            uint32_t offset = it->first;
+            uint32_t remaining = it->second - count;
+
+            allocator->freeRanges.erase(it);
+            if (remaining)
+            {
+                allocator->freeRanges[offset + count] = remaining;
+            }
+
+            return offset;
+        }
+    }
+
+    return INVALID_IDX;
+}
+
+static void range_free(RangeAllocator *allocator, uint32_t offset, uint32_t count)
+{
+    auto it = allocator->freeRanges.emplace(offset, count).first;
+
+    // Merge with the following range
+    auto next = std::next(it);
+    if (next != allocator->freeRanges.end() && it->first + it->second == next->first)
+    {
+        it->second += next->second;
+        allocator->freeRanges.erase(next);
+    }
+
+    // Merge with the previous range
+    if (it != allocator->freeRanges.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second == it->first)
+        {
+            prev->second += it->second;
+            allocator->freeRanges.erase(it);
+        }
+    }
+}
+
+static uint32_t range_largest_free(RangeAllocator *allocator)
+{
+    uint32_t largest = 0;
+    for (auto &it : allocator->freeRanges)
+    {
+        largest = it.second > largest ? it.second : largest;
+    }
+    return largest;
+}
+
+struct GeometryMesh
+{
+    uint32_t vertexOffset;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    bool alive;
+
+    // Reserved, the data is still being uploaded
+    bool pending;
+
+    // Removed while pending, freed once the upload completed
+    bool removed;
+
+    // Into GeometryArena::uploads, INVALID_IDX once the copy is recorded
+    uint32_t uploadIdx;
+
+    // Model space, see geometry_mesh_bounds()
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+// Data of geometry_add_mesh() that wasn't copied to the GPU yet
+struct GeometryUpload
+{
+    uint32_t meshId; // INVALID_IDX if the mesh was removed before the copy
+    uint32_t vertexStart;
+    uint32_t indexStart;
+};
+
+// A staging buffer is only free once the copies out of it completed
+struct GeometryStaging
+{
+    Buffer buffer;
+    uint64_t retireValue;
+};
+
+// A removed mesh can still be read by frames in flight
+struct RetiredMesh
+{
+    uint32_t meshIdx;
+    uint64_t retireValue;
+};
+
+struct GeometryArena
+{
+    VkDevice device;
+    VkPhysicalDevice gpu;
+
+    Buffer vertexBuffer;
+    Buffer indexBuffer;
+    Buffer indirectBuffer;
+
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+
+    std::vector<GeometryMesh> meshes;
+    std::vector<uint32_t> freeMeshIds;
+    std::vector<RetiredMesh> retired;
+
+    std::vector<GeometryUpload> uploads;
+    std::vector<VertexColor> uploadVertices;
+    std::vector<uint32_t> uploadIndices;
+    std::vector<GeometryStaging> staging;
+
+    // Mirror of the buffers on the CPU, only kept if asked for, e.g. for the
+    // trace capture that can't read the Device Local buffers
+    std::vector<VertexColor> hostVertices;
+    std::vector<uint32_t> hostIndices;
+
+    uint32_t maxDraws;
+    uint32_t drawCount;
+    uint32_t pendingCount;
+    bool dirty;
+    uint32_t version; // Goes up whenever the draws were rebuilt
+
+    // Of the drawn meshes, min above max while there are none
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    // Without the multiDrawIndirect feature drawCount has to be 1
+    bool multiDraw;
+};
+
+static void geometry_init(
+    GeometryArena *arena,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    uint32_t vertexCapacity,
+    uint32_t indexCapacity,
+    uint32_t maxDraws,
+    bool multiDraw,
+    const uint32_t *queueFamilies,
+    uint32_t queueFamilyCount,
+    bool hostCopy = false)
+{
+    arena->device = device;
+    arena->gpu = gpu;
+
+    // Transfer Source for geometry_defragment()
+    arena->vertexBuffer = vk_allocate_buffer(
+        device, gpu, vertexCapacity * sizeof(VertexColor),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        "Geometry Vertices", queueFamilies, queueFamilyCount);
+
+    arena->indexBuffer = vk_allocate_buffer(
+        device, gpu, indexCapacity * sizeof(uint32_t),
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        "Geometry Indices", queueFamilies, queueFamilyCount);
+
+    if (hostCopy)
+    {
+        arena->hostVertices.resize(vertexCapacity);
+        arena->hostIndices.resize(indexCapacity);
+    }
+
+    arena->indirectBuffer = vk_allocate_buffer(
+        device, gpu, maxDraws * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Geometry Indirect Draws");
+
+    range_init(&arena->vertexRanges, vertexCapacity);
+    range_init(&arena->indexRanges, indexCapacity);
+    arena->maxDraws = maxDraws;
+    arena->multiDraw = multiDraw;
+}
+
+// Allocates space for a mesh that is written later, e.g. by a copy on the
+// transfer queue. It isn't drawn until geometry_commit_mesh().
+// Returns the mesh id, INVALID_IDX if the arena is full
+static uint32_t geometry_reserve_mesh(GeometryArena *arena, uint32_t vertexCount, uint32_t indexCount)
+{
+    uint32_t vertexOffset = range_alloc(&arena->vertexRanges, vertexCount);
+    uint32_t firstIndex = range_alloc(&arena->indexRanges, indexCount);
+    if (vertexOffset == INVALID_IDX || firstIndex == INVALID_IDX)
+    {
+        if (vertexOffset != INVALID_IDX)
+        {
+            range_free(&arena->vertexRanges, vertexOffset, vertexCount);
+        }
+        if (firstIndex != INVALID_IDX)
+        {
+            range_free(&arena->indexRanges, firstIndex, indexCount);
+        }
+
+        std::cerr << "Geometry Arena full, try geometry_defragment()" << std::endl;
+        return INVALID_IDX;
+    }
+
+    GeometryMesh mesh = {vertexOffset, vertexCount, firstIndex, indexCount, false, true, false, INVALID_IDX};
+
+    uint32_t meshId;
+    if (arena->freeMeshIds.size())
+    {
+        meshId = arena->freeMeshIds.back();
+        arena->freeMeshIds.pop_back();
+        arena->meshes[meshId] = mesh;
+    }
+    else
+    {
+        meshId = arena->meshes.size();
+        arena->meshes.push_back(mesh);
+    }
+
+    arena->pendingCount++;
+    return meshId;
+}
+
+static void geometry_free_mesh(GeometryArena *arena, uint32_t meshId)
+{
+    GeometryMesh &mesh = arena->meshes[meshId];
+    range_free(&arena->vertexRanges, mesh.vertexOffset, mesh.vertexCount);
+    range_free(&arena->indexRanges, mesh.firstIndex, mesh.indexCount);
+    arena->freeMeshIds.push_back(meshId);
+}
+
+// Only keeps the data if the arena has a host copy
+static void geometry_write_host(
+    GeometryArena *arena,
+    uint32_t meshId,
+    const VertexColor *vertices,
+    const uint32_t *indices)
+{
+    if (arena->hostVertices.empty())
+    {
+        return;
+    }
+
+    GeometryMesh &mesh = arena->meshes[meshId];
+    memcpy(arena->hostVertices.data() + mesh.vertexOffset, vertices, mesh.vertexCount * sizeof(VertexColor));
+    memcpy(arena->hostIndices.data() + mesh.firstIndex, indices, mesh.indexCount * sizeof(uint32_t));
+}
+
+static void geometry_mesh_bounds(GeometryArena *arena, uint32_t meshId, const VertexColor *vertices)
+{
+    GeometryMesh &mesh = arena->meshes[meshId];
+    mesh.boundsMin = glm::vec3(FLT_MAX);
+    mesh.boundsMax = glm::vec3(-FLT_MAX);
+    for (uint32_t i = 0; i < mesh.vertexCount; i++)
+    {
+        mesh.boundsMin = glm::min(mesh.boundsMin, vertices[i].position);
+        mesh.boundsMax = glm::max(mesh.boundsMax, vertices[i].position);
+    }
+}
+
+// Call once the upload completed. A mesh removed in the meantime is freed
+// instead, nothing writes its ranges anymore.
+static void geometry_commit_mesh(GeometryArena *arena, uint32_t meshId)
+{
+    GeometryMesh &mesh = arena->meshes[meshId];
+    if (mesh.pending)
+    {
+        mesh.pending = false;
+        arena->pendingCount--;
+
+        if (mesh.removed)
+        {
+            mesh.removed = false;
+            geometry_free_mesh(arena, meshId);
+            return;
+        }
+
+        mesh.alive = true;
+        arena->dirty = true;
+    }
+}
+
+// The data is staged on the CPU and copied by geometry_record_uploads(),
+// which has to come before any draw of the arena in the frame. Returns the
+// mesh id, INVALID_IDX if the arena is full.
+static uint32_t geometry_add_mesh(
+    GeometryArena *arena,
+    const VertexColor *vertices,
+    uint32_t vertexCount,
+    const uint32_t *indices,
+    uint32_t indexCount)
+{
+    uint32_t meshId = geometry_reserve_mesh(arena, vertexCount, indexCount);
+    if (meshId == INVALID_IDX)
+    {
+        return INVALID_IDX;
+    }
+
+    GeometryUpload upload = {meshId, (uint32_t)arena->uploadVertices.size(), (uint32_t)arena->uploadIndices.size()};
+    arena->uploadVertices.insert(arena->uploadVertices.end(), vertices, vertices + vertexCount);
+    arena->uploadIndices.insert(arena->uploadIndices.end(), indices, indices + indexCount);
+    arena->meshes[meshId].uploadIdx = arena->uploads.size();
+    arena->uploads.push_back(upload);
+
+    geometry_write_host(arena, meshId, vertices, indices);
+    geometry_mesh_bounds(arena, meshId, vertices);
+
+    // The copy is recorded in front of the first frame that draws it
+    geometry_commit_mesh(arena, meshId);
+    return meshId;
+}
+
+// The ranges are released by geometry_collect() once retireValue completed.
+// A mesh that is still uploading is freed by geometry_commit_mesh().
+static void geometry_remove_mesh(GeometryArena *arena, uint32_t meshId, uint64_t retireValue)
+{
+    if (meshId >= arena->meshes.size())
+    {
+        return;
+    }
+
+    GeometryMesh &mesh = arena->meshes[meshId];
+    if (mesh.pending)
+    {
+        mesh.removed = true;
+        return;
+    }
+
+    if (!mesh.alive)
+    {
+        return;
+    }
+
+    // Never copied, the range could be handed out again before the copy
+    if (mesh.uploadIdx != INVALID_IDX)
+    {
+        arena->uploads[mesh.uploadIdx].meshId = INVALID_IDX;
+        mesh.uploadIdx = INVALID_IDX;
+    }
+
+    mesh.alive = false;
+    arena->retired.push_back({meshId, retireValue});
+    arena->dirty = true;
+}
+
+// Records the copies of geometry_add_mesh() into cmd, outside of a Render
+// Pass. cmd has to be submitted with the next value of sync, the staging
+// buffer is freed once that completed.
+static void geometry_record_uploads(GeometryArena *arena, const VkDispatch *vk, VkCommandBuffer cmd, SyncQueue *sync)
+{
+    for (uint32_t i = 0; i < arena->staging.size();)
+    {
+        if (!sync_is_complete(sync, arena->staging[i].retireValue))
+        {
+            i++;
+            continue;
+        }
+
+        vk_free_buffer(arena->device, &arena->staging[i].buffer);
+        arena->staging[i] = arena->staging.back();
+        arena->staging.pop_back();
+    }
+
+    if (arena->uploads.empty())
+    {
+        return;
+    }
+
+    // Vertices first, the Indices follow in the same staging buffer
+    uint32_t vertexBytes = arena->uploadVertices.size() * sizeof(VertexColor);
+    uint32_t indexBytes = arena->uploadIndices.size() * sizeof(uint32_t);
+
+    std::vector<VkBufferCopy> vertexCopies, indexCopies;
+    for (GeometryUpload &upload : arena->uploads)
+    {
+        if (upload.meshId == INVALID_IDX)
+        {
+            continue;
+        }
+
+        GeometryMesh &mesh = arena->meshes[upload.meshId];
+        mesh.uploadIdx = INVALID_IDX;
+
+        if (mesh.vertexCount)
+        {
+            VkBufferCopy vertexCopy = {};
+            vertexCopy.srcOffset = upload.vertexStart * sizeof(VertexColor);
+            vertexCopy.dstOffset = mesh.vertexOffset * sizeof(VertexColor);
+            vertexCopy.size = mesh.vertexCount * sizeof(VertexColor);
+            vertexCopies.push_back(vertexCopy);
+        }
+
+        if (mesh.indexCount)
+        {
+            VkBufferCopy indexCopy = {};
+            indexCopy.srcOffset = vertexBytes + upload.indexStart * sizeof(uint32_t);
+            indexCopy.dstOffset = mesh.firstIndex * sizeof(uint32_t);
+            indexCopy.size = mesh.indexCount * sizeof(uint32_t);
+            indexCopies.push_back(indexCopy);
+        }
+    }
+
+    if (vertexCopies.size() || indexCopies.size())
+    {
+        GeometryStaging staging = {};
+        staging.buffer = vk_allocate_buffer(
+            arena->device, arena->gpu, vertexBytes + indexBytes,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            "Geometry Staging");
+        staging.retireValue = sync->nextValue;
+
+        memcpy(staging.buffer.data, arena->uploadVertices.data(), vertexBytes);
+        memcpy((char *)staging.buffer.data + vertexBytes, arena->uploadIndices.data(), indexBytes);
+
+        if (vertexCopies.size())
+        {
+            vk->vkCmdCopyBuffer(cmd, staging.buffer.buffer, arena->vertexBuffer.buffer,
+                                vertexCopies.size(), vertexCopies.data());
+        }
+        if (indexCopies.size())
+        {
+            vk->vkCmdCopyBuffer(cmd, staging.buffer.buffer, arena->indexBuffer.buffer,
+                                indexCopies.size(), indexCopies.data());
+        }
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 1, &barrier, 0, 0, 0, 0);
+
+        arena->staging.push_back(staging);
+    }
+
+    arena->uploads.clear();
+    arena->uploadVertices.clear();
+    arena->uploadIndices.clear();
+}
+
+static void geometry_collect(GeometryArena *arena, SyncQueue *sync)
+{
+    for (uint32_t i = 0; i < arena->retired.size();)
+    {
+        RetiredMesh retired = arena->retired[i];
+        if (!sync_is_complete(sync, retired.retireValue))
+        {
+            i++;
+            continue;
+        }
+
+        geometry_free_mesh(arena, retired.meshIdx);
+
+        arena->retired[i] = arena->retired.back();
+        arena->retired.pop_back();
+    }
+}
+
+// Moves all meshes to the front of the buffers with copies recorded into cmd,
+// outside of a Render Pass, submitted with the next value of sync. The meshes
+// go through a scratch buffer, a copy within one buffer can't overlap.
+// Returns false if retired meshes are still waiting on the GPU or uploads of
+// the Streamer are in flight.
+static bool geometry_defragment(GeometryArena *arena, const VkDispatch *vk, VkCommandBuffer cmd, SyncQueue *sync)
+{
+    geometry_collect(arena, sync);
+    if (arena->retired.size() || arena->pendingCount)
+    {
+        return false;
+    }
+
+    // Staged meshes are moved like the others
+    geometry_record_uploads(arena, vk, cmd, sync);
+
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < arena->meshes.size(); i++)
+    {
+        if (arena->meshes[i].alive)
+        {
+            order.push_back(i);
+        }
+    }
+
+    // Moving down in offset order never overwrites a mesh of the host copy
+    // that wasn't moved yet
+    std::sort(order.begin(), order.end(), [arena](uint32_t a, uint32_t b)
+              { return arena->meshes[a].vertexOffset < arena->meshes[b].vertexOffset; });
+
+    std::vector<VkBufferCopy> vertexCopies;
+    uint32_t vertexOffset = 0;
+    for (uint32_t meshIdx : order)
+    {
+        GeometryMesh &mesh = arena->meshes[meshIdx];
+        if (mesh.vertexCount)
+        {
+            VkBufferCopy copy = {};
+            copy.srcOffset = mesh.vertexOffset * sizeof(VertexColor);
+            copy.dstOffset = vertexOffset * sizeof(VertexColor);
+            copy.size = mesh.vertexCount * sizeof(VertexColor);
+            vertexCopies.push_back(copy);
+        }
+
+        if (arena->hostVertices.size())
+        {
+            VertexColor *vertices = arena->hostVertices.data();
+            memmove(vertices + vertexOffset, vertices + mesh.vertexOffset, mesh.vertexCount * sizeof(VertexColor));
+        }
+
+        mesh.vertexOffset = vertexOffset;
+        vertexOffset += mesh.vertexCount;
+    }
+
+    std::sort(order.begin(), order.end(), [arena](uint32_t a, uint32_t b)
+              { return arena->meshes[a].firstIndex < arena->meshes[b].firstIndex; });
+
+    // Indices are relative to vertexOffset, so they are copied as they are.
+    // They follow the vertices in the scratch buffer.
+    uint32_t vertexBytes = vertexOffset * sizeof(VertexColor);
+    std::vector<VkBufferCopy> indexCopies;
+    uint32_t firstIndex = 0;
+    for (uint32_t meshIdx : order)
+    {
+        GeometryMesh &mesh = arena->meshes[meshIdx];
+        if (mesh.indexCount)
+        {
+            VkBufferCopy copy = {};
+            copy.srcOffset = mesh.firstIndex * sizeof(uint32_t);
+            copy.dstOffset = vertexBytes + firstIndex * sizeof(uint32_t);
+            copy.size = mesh.indexCount * sizeof(uint32_t);
+            indexCopies.push_back(copy);
+        }
+
+        if (arena->hostIndices.size())
+        {
+            uint32_t *indices = arena->hostIndices.data();
+            memmove(indices + firstIndex, indices + mesh.firstIndex, mesh.indexCount * sizeof(uint32_t));
+        }
+
+        mesh.firstIndex = firstIndex;
+        firstIndex += mesh.indexCount;
+    }
+
+    uint32_t indexBytes = firstIndex * sizeof(uint32_t);
+    if (vertexBytes || indexBytes)
+    {
+        GeometryStaging scratch = {};
+        scratch.buffer = vk_allocate_buffer(
+            arena->device, arena->gpu, vertexBytes + indexBytes,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "Geometry Defragment");
+        scratch.retireValue = sync->nextValue;
+
+        // Earlier frames may still read the arena
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, 0, 0, 0);
+
+        if (vertexCopies.size())
+        {
+            vk->vkCmdCopyBuffer(cmd, arena->vertexBuffer.buffer, scratch.buffer.buffer,
+                                vertexCopies.size(), vertexCopies.data());
+        }
+        if (indexCopies.size())
+        {
+            vk->vkCmdCopyBuffer(cmd, arena->indexBuffer.buffer, scratch.buffer.buffer,
+                                indexCopies.size(), indexCopies.data());
+        }
+
+        vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 1, &barrier, 0, 0, 0, 0);
+
+        if (vertexBytes)
+        {
+            VkBufferCopy copy = {};
+            copy.size = vertexBytes;
+            vk->vkCmdCopyBuffer(cmd, scratch.buffer.buffer, arena->vertexBuffer.buffer, 1, &copy);
+        }
+        if (indexBytes)
+        {
+            VkBufferCopy copy = {};
+            copy.srcOffset = vertexBytes;
+            copy.size = indexBytes;
+            vk->vkCmdCopyBuffer(cmd, scratch.buffer.buffer, arena->indexBuffer.buffer, 1, &copy);
+        }
+
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+        vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                 0, 1, &barrier, 0, 0, 0, 0);
+
+        arena->staging.push_back(scratch);
+    }
+
+    range_init(&arena->vertexRanges, arena->vertexRanges.capacity);
+    range_init(&arena->indexRanges, arena->indexRanges.capacity);
+    range_alloc(&arena->vertexRanges, vertexOffset);
+    range_alloc(&arena->indexRanges, firstIndex);
+
+    arena->dirty = true;
+    return true;
+}
+
+// Free vertex space outside of the largest free block, 0 is unfragmented
+static float geometry_fragmentation(GeometryArena *arena)
+{
+    uint32_t freeVertices = 0;
+    for (auto &it : arena->vertexRanges.freeRanges)
+    {
+        freeVertices += it.second;
+    }
+
+    return freeVertices ? 1.0f - (float)range_largest_free(&arena->vertexRanges) / freeVertices : 0.0f;
+}
+
+// Rewrites the indirect commands if meshes changed. Call after the frame that
+// last read the indirect buffer completed.
+static void geometry_update(GeometryArena *arena)
+{
+    if (!arena->dirty)
+    {
+        return;
+    }
+
+    VkDrawIndexedIndirectCommand *commands = (VkDrawIndexedIndirectCommand *)arena->indirectBuffer.data;
+    arena->drawCount = 0;
+    arena->boundsMin = glm::vec3(FLT_MAX);
+    arena->boundsMax = glm::vec3(-FLT_MAX);
+
+    for (GeometryMesh &mesh : arena->meshes)
+    {
+        if (!mesh.alive || arena->drawCount >= arena->maxDraws)
+        {
+            continue;
+        }
+
+        VkDrawIndexedIndirectCommand &command = commands[arena->drawCount++];
+        command.indexCount = mesh.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = mesh.firstIndex;
+        command.vertexOffset = mesh.vertexOffset;
+        command.firstInstance = 0;
+
+        arena->boundsMin = glm::min(arena->boundsMin, mesh.boundsMin);
+        arena->boundsMax = glm::max(arena->boundsMax, mesh.boundsMax);
+    }
+
+    arena->dirty = false;
+    arena->version++;
+}
+
+static void geometry_draw(GeometryArena *arena, const VkDispatch *vk, VkCommandBuffer cmd)
+{
+    if (!arena->drawCount)
+    {
+        return;
+    }
+
+    VkDeviceSize offsets[] = {0};
+    vk->vkCmdBindVertexBuffers(cmd, 0, 1, &arena->vertexBuffer.buffer, offsets);
+    vk->vkCmdBindIndexBuffer(cmd, arena->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    if (arena->multiDraw)
+    {
+        vk->vkCmdDrawIndexedIndirect(cmd, arena->indirectBuffer.buffer, 0, arena->drawCount,
+                                     sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+        for (uint32_t i = 0; i < arena->drawCount; i++)
+        {
+            vk->vkCmdDrawIndexedIndirect(cmd, arena->indirectBuffer.buffer, i * sizeof(VkDrawIndexedIndirectCommand),
+                                         1, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+}
+
+static void geometry_destroy(GeometryArena *arena, VkDevice device)
+{
+    for (GeometryStaging &staging : arena->staging)
+    {
+        vk_free_buffer(device, &staging.buffer);
+    }
+    arena->staging.clear();
+
+    vk_free_buffer(device, &arena->vertexBuffer);
+    vk_free_buffer(device, &arena->indexBuffer);
+    vk_free_buffer(device, &arena->indirectBuffer);
+}
@@ -0,0 +1,473 @@
+#pragma once
+
+// Hierarchical depth (Hi-Z) pyramid for occlusion culling. A compute shader
+// reduces the depth buffer into a mip chain where every texel holds the
+// farthest depth of the pixels it covers, so one or four reads tell if a
+// screen rectangle is hidden behind what was already drawn.
+//
+// Level 0 is the largest power of two below the screen size and always
+// covers the whole render area, whatever scale Dynamic Resolution picked.
+// The image stays in VK_IMAGE_LAYOUT_GENERAL, written as storage image and
+// read through a sampler.
+
+#define HIZ_MAX_LEVELS 16
+#define HIZ_GROUP_SIZE 8 // local_size_x and _y of hiz_build.comp
+
+// Push Constants of hiz_build.comp
+struct HiZBuildConstants
+{
+    uint32_t sourceWidth;
+    uint32_t sourceHeight;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct HiZStats
+{
+    uint64_t builds;
+    uint64_t samples; // Builds with a GPU time
+    double totalMs;
+    float maxMs;
+};
+
+struct HiZPyramid
+{
+    VkDevice device;
+    const VkDispatch *vk;
+
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view; // All levels, what the culling reads
+    VkImageView levelViews[HIZ_MAX_LEVELS];
+    VkSampler sampler;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+
+    // Set i reads level i - 1, or the depth buffer for i = 0, and writes level i
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descPool;
+    VkDescriptorSet descSets[HIZ_MAX_LEVELS];
+    VkPipelineLayout pipeLayout;
+    VkPipeline pipeline;
+
+    bool layoutReady; // In VK_IMAGE_LAYOUT_GENERAL
+    bool valid; // Holds the depth of a previous frame
+
+    // Start and end of the last build
+    VkQueryPool queryPool;
+    float timestampPeriod;
+    uint64_t timestampMask;
+    bool queriesWritten;
+    float lastMs;
+
+    HiZStats stats;
+};
+
+static uint32_t hiz_previous_pow2(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result * 2 <= value)
+    {
+        result *= 2;
+    }
+    return result;
+}
+
+// depthView has to be sampleable, the depth image is created with
+// VK_IMAGE_USAGE_SAMPLED_BIT for this
+static bool hiz_init(
+    HiZPyramid *hiz,
+    const VkDispatch *vk,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    VkImageView depthView,
+    uint32_t depthWidth,
+    uint32_t depthHeight,
+    uint32_t timestampValidBits,
+    const char *buildShaderPath)
+{
+    hiz->device = device;
+    hiz->vk = vk;
+    hiz->width = hiz_previous_pow2(depthWidth);
+    hiz->height = hiz_previous_pow2(depthHeight);
+    hiz->levelCount = 1;
+    while ((hiz->width >> hiz->levelCount) || (hiz->height >> hiz->levelCount))
+    {
+        hiz->levelCount++;
+    }
+    hiz->levelCount = hiz->levelCount < HIZ_MAX_LEVELS ? hiz->levelCount : HIZ_MAX_LEVELS;
+
+    // Pyramid Image, R32F storage images are supported everywhere
+    {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = VK_FORMAT_R32_SFLOAT;
+        imageInfo.extent = {hiz->width, hiz->height, 1};
+        imageInfo.mipLevels = hiz->levelCount;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VK_CHECK_FATAL(vkCreateImage(device, &imageInfo, 0, &hiz->image));
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, hiz->image, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = vk_get_memory_type_index(gpu, memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (vkAllocateMemory(device, &allocInfo, 0, &hiz->memory) != VK_SUCCESS)
+        {
+            memory_track_failure(allocInfo.allocationSize, allocInfo.memoryTypeIndex, "Hi-Z Pyramid");
+            vkDestroyImage(device, hiz->image, 0);
+            *hiz = {};
+            return false;
+        }
+        memory_track_alloc(hiz->memory, MEMORY_RESOURCE_IMAGE, allocInfo.allocationSize,
+                           allocInfo.memoryTypeIndex, imageInfo.usage, "Hi-Z Pyramid");
+        VK_CHECK_FATAL(vkBindImageMemory(device, hiz->image, hiz->memory, 0));
+
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = hiz->image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = VK_FORMAT_R32_SFLOAT;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = hiz->levelCount;
+        viewInfo.subresourceRange.layerCount = 1;
+        VK_CHECK_FATAL(vk->vkCreateImageView(device, &viewInfo, 0, &hiz->view));
+
+        viewInfo.subresourceRange.levelCount = 1;
+        for (uint32_t level = 0; level < hiz->levelCount; level++)
+        {
+            viewInfo.subresourceRange.baseMipLevel = level;
+            VK_CHECK_FATAL(vk->vkCreateImageView(device, &viewInfo, 0, &hiz->levelViews[level]));
+        }
+
+        // Only read with texelFetch, which ignores the filter
+        VkSamplerCreateInfo samplerInfo = {};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+        VK_CHECK_FATAL(vkCreateSampler(device, &samplerInfo, 0, &hiz->sampler));
+    }
+
+    // Descriptors, one set per level
+    {
+        VkDescriptorSetLayoutBinding layoutBindings[] = {
+            layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 0),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1)};
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = ArraySize(layoutBindings);
+        layoutInfo.pBindings = layoutBindings;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorSetLayout(device, &layoutInfo, 0, &hiz->setLayout));
+
+        VkDescriptorPoolSize poolSizes[] = {
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, hiz->levelCount},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, hiz->levelCount}};
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = hiz->levelCount;
+        poolInfo.poolSizeCount = ArraySize(poolSizes);
+        poolInfo.pPoolSizes = poolSizes;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorPool(device, &poolInfo, 0, &hiz->descPool));
+
+        VkDescriptorSetLayout setLayouts[HIZ_MAX_LEVELS];
+        for (uint32_t level = 0; level < hiz->levelCount; level++)
+        {
+            setLayouts[level] = hiz->setLayout;
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.pSetLayouts = setLayouts;
+        allocInfo.descriptorSetCount = hiz->levelCount;
+        allocInfo.descriptorPool = hiz->descPool;
+        VK_CHECK_FATAL(vk->vkAllocateDescriptorSets(device, &allocInfo, hiz->descSets));
+
+        for (uint32_t level = 0; level < hiz->levelCount; level++)
+        {
+            // The depth buffer is moved to SHADER_READ_ONLY_OPTIMAL for the build
+            VkDescriptorImageInfo sourceInfo = {};
+            sourceInfo.sampler = hiz->sampler;
+            sourceInfo.imageView = level ? hiz->levelViews[level - 1] : depthView;
+            sourceInfo.imageLayout = level ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+            VkDescriptorImageInfo destinationInfo = {};
+            destinationInfo.imageView = hiz->levelViews[level];
+            destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            VkWriteDescriptorSet writes[2] = {};
+            for (uint32_t i = 0; i < 2; i++)
+            {
+                writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[i].dstSet = hiz->descSets[level];
+                writes[i].dstBinding = i;
+                writes[i].descriptorCount = 1;
+            }
+            writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[0].pImageInfo = &sourceInfo;
+            writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[1].pImageInfo = &destinationInfo;
+            vk->vkUpdateDescriptorSets(device, ArraySize(writes), writes, 0, 0);
+        }
+    }
+
+    // Compute Pipeline
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstant.size = sizeof(HiZBuildConstants);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &hiz->setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(vk->vkCreatePipelineLayout(device, &layoutInfo, 0, &hiz->pipeLayout));
+
+        std::vector<char> code = read_file(buildShaderPath);
+        if (code.empty())
+        {
+            return false;
+        }
+
+        VkShaderModuleCreateInfo shaderInfo = {};
+        shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderInfo.pCode = (uint32_t *)code.data();
+        shaderInfo.codeSize = code.size();
+
+        VkShaderModule shader;
+        VK_CHECK_FATAL(vkCreateShaderModule(device, &shaderInfo, 0, &shader));
+
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shader;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = hiz->pipeLayout;
+
+        VkResult result = vkCreateComputePipelines(device, 0, 1, &pipelineInfo, 0, &hiz->pipeline);
+        vkDestroyShaderModule(device, shader, 0);
+
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "Failed to create the Hi-Z Pipeline" << std::endl;
+            return false;
+        }
+    }
+
+    // Timestamps, only for the stats
+    if (timestampValidBits)
+    {
+        VkPhysicalDeviceProperties gpuProps;
+        vk->vkGetPhysicalDeviceProperties(gpu, &gpuProps);
+        hiz->timestampPeriod = gpuProps.limits.timestampPeriod;
+        hiz->timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+
+        VkQueryPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = 2;
+        VK_CHECK_FATAL(vk->vkCreateQueryPool(device, &poolInfo, 0, &hiz->queryPool));
+    }
+
+    return true;
+}
+
+// Call after the last frame was waited on, reads the GPU time of its build
+static void hiz_update(HiZPyramid *hiz)
+{
+    if (!hiz->queryPool || !hiz->queriesWritten)
+    {
+        return;
+    }
+    hiz->queriesWritten = false;
+
+    uint64_t timestamps[2];
+    if (hiz->vk->vkGetQueryPoolResults(hiz->device, hiz->queryPool, 0, 2, sizeof(timestamps), timestamps,
+                                       sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    {
+        return;
+    }
+
+    hiz->lastMs = (float)(((timestamps[1] - timestamps[0]) & hiz->timestampMask) * hiz->timestampPeriod / 1e6);
+    hiz->stats.samples++;
+    hiz->stats.totalMs += hiz->lastMs;
+    hiz->stats.maxMs = hiz->lastMs > hiz->stats.maxMs ? hiz->lastMs : hiz->stats.maxMs;
+}
+
+// Before anything binds the pyramid, it has to be in GENERAL even when it
+// isn't read yet
+static void hiz_prepare(HiZPyramid *hiz, VkCommandBuffer cmd)
+{
+    if (hiz->layoutReady)
+    {
+        return;
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = hiz->image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    hiz->vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                  0, 0, 0, 0, 0, 1, &barrier);
+
+    hiz->layoutReady = true;
+}
+
+// After the Render Pass, which left the depth buffer in
+// DEPTH_STENCIL_ATTACHMENT_OPTIMAL with the depth of width x height pixels.
+// Leaves it in the same layout for a following pass and the pyramid ready
+// to be read by compute shaders.
+static void hiz_build(HiZPyramid *hiz, VkCommandBuffer cmd, VkImage depthImage, uint32_t width, uint32_t height)
+{
+    const VkDispatch *vk = hiz->vk;
+
+    if (hiz->queryPool)
+    {
+        vk->vkCmdResetQueryPool(cmd, hiz->queryPool, 0, 2);
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, hiz->queryPool, 0);
+    }
+
+    VkImageMemoryBarrier barriers[2] = {};
+    for (VkImageMemoryBarrier &barrier : barriers)
+    {
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.layerCount = 1;
+    }
+
+    // Depth writes done before the reads
+    barriers[0].image = depthImage;
+    barriers[0].subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    // Culling reads of the last pyramid done before it's overwritten, the
+    // contents are replaced entirely
+    barriers[1].image = hiz->image;
+    barriers[1].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barriers[1].oldLayout = hiz->layoutReady ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 2, barriers);
+
+    vk->vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hiz->pipeline);
+
+    VkMemoryBarrier levelBarrier = {};
+    levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    HiZBuildConstants constants = {width, height, hiz->width, hiz->height};
+    for (uint32_t level = 0; level < hiz->levelCount; level++)
+    {
+        vk->vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hiz->pipeLayout, 0, 1, &hiz->descSets[level], 0, 0);
+        vk->vkCmdPushConstants(cmd, hiz->pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+        vk->vkCmdDispatch(cmd, (constants.width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+                          (constants.height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+        // The next level reads this one, after the last the culling does
+        vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &levelBarrier, 0, 0, 0, 0);
+
+        constants.sourceWidth = constants.width;
+        constants.sourceHeight = constants.height;
+        constants.width = constants.width > 1 ? constants.width / 2 : 1;
+        constants.height = constants.height > 1 ? constants.height / 2 : 1;
+    }
+
+    // Back to a depth attachment for the next pass
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                             0, 0, 0, 0, 0, 1, barriers);
+
+    if (hiz->queryPool)
+    {
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, hiz->queryPool, 1);
+        hiz->queriesWritten = true;
+    }
+
+    hiz->layoutReady = true;
+    hiz->valid = true;
+    hiz->stats.builds++;
+}
+
+static void hiz_print_stats(HiZPyramid *hiz)
+{
+    if (!hiz->stats.builds)
+    {
+        return;
+    }
+
+    std::cout << "Hi-Z: " << hiz->width << "x" << hiz->height << " with " << hiz->levelCount << " levels, "
+              << hiz->stats.builds << " builds";
+    if (hiz->stats.samples)
+    {
+        std::cout << ", avg GPU " << hiz->stats.totalMs / hiz->stats.samples << "ms, max " << hiz->stats.maxMs << "ms";
+    }
+    std::cout << std::endl;
+}
+
+// Needs an idle device
+static void hiz_shutdown(HiZPyramid *hiz)
+{
+    if (!hiz->device)
+    {
+        return;
+    }
+
+    const VkDispatch *vk = hiz->vk;
+    if (hiz->queryPool)
+    {
+        vk->vkDestroyQueryPool(hiz->device, hiz->queryPool, 0);
+    }
+
+    vkDestroyPipeline(hiz->device, hiz->pipeline, 0);
+    vkDestroyPipelineLayout(hiz->device, hiz->pipeLayout, 0);
+    vkDestroyDescriptorPool(hiz->device, hiz->descPool, 0);
+    vkDestroyDescriptorSetLayout(hiz->device, hiz->setLayout, 0);
+    vkDestroySampler(hiz->device, hiz->sampler, 0);
+    for (uint32_t level = 0; level < hiz->levelCount; level++)
+    {
+        vk->vkDestroyImageView(hiz->device, hiz->levelViews[level], 0);
+    }
+    vk->vkDestroyImageView(hiz->device, hiz->view, 0);
+
+    memory_track_free(hiz->memory);
+    vkDestroyImage(hiz->device, hiz->image, 0);
+    vkFreeMemory(hiz->device, hiz->memory, 0);
+
+    *hiz = {};
+}
@@ -0,0 +1,635 @@
+#pragma once
+#include <chrono>
+#include <cmath>
+
+// Clustered forward lighting. The view frustum is split into a grid of
+// clusters, LIGHTING_CLUSTERS_X x _Y tiles on screen and LIGHTING_CLUSTERS_Z
+// slices in depth, spaced exponentially so near and far clusters have
+// similar proportions. A compute shader moves the point lights into view
+// space and lists the ones touching each cluster, the fragment shader then
+// only loops over the list of the cluster it falls into.
+//
+// Every cluster has a fixed slot of LIGHTING_MAX_CLUSTER_LIGHTS indices in
+// the index buffer, lights past that are dropped and counted as overflow.
+// lighting_assign_cpu() is the reference the compute results are checked
+// against, see benchmark_lighting().
+
+#define LIGHTING_CLUSTERS_X 16
+#define LIGHTING_CLUSTERS_Y 16
+#define LIGHTING_CLUSTERS_Z 24
+#define LIGHTING_CLUSTER_COUNT (LIGHTING_CLUSTERS_X * LIGHTING_CLUSTERS_Y * LIGHTING_CLUSTERS_Z)
+#define LIGHTING_MAX_CLUSTER_LIGHTS 256
+#define LIGHTING_MAX_LIGHTS (1 << 14)
+#define LIGHTING_GROUP_SIZE 64 // local_size_x of lighting_cluster.comp
+#define LIGHTING_AMBIENT 0.4f  // The sun of vulkan_shadows.h adds the rest
+
+// Laid out like the std430 struct in the shaders
+struct PointLight
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// View space box around a cluster
+struct ClusterBounds
+{
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// Push Constant of lighting_cluster.comp
+enum LightingPass
+{
+    LIGHTING_PASS_TRANSFORM,
+    LIGHTING_PASS_ASSIGN,
+};
+
+// Uniform Buffer of lighting_cluster.comp and color.frag, std140
+struct LightingData
+{
+    glm::mat4 view;        // World to view space, for the transform pass
+    glm::uvec4 gridSize;   // Clusters in x, y and z, max lights per cluster
+    glm::vec4 depthSlices; // Near, far, slice scale and bias
+    glm::vec2 renderSize;  // Render area in pixels
+    float ambient;
+    uint32_t lightCount;
+    uint32_t clustered; // 0 loops over all lights, the naive baseline
+    uint32_t padding[3];
+};
+
+struct LightingStats
+{
+    uint64_t frames;
+    uint64_t samples; // Frames with a GPU time
+    double assignMs;
+    uint32_t checks;
+    uint32_t checkMismatches; // Clusters that differ from the CPU reference
+    uint32_t maxClusterLights;
+    float avgClusterLights;
+    uint32_t overflowClusters;
+};
+
+struct ClusteredLighting
+{
+    VkDevice device;
+    const VkDispatch *vk;
+
+    std::vector<PointLight> lights; // World space
+    glm::mat4 projection;           // The clusters were built for
+    std::vector<ClusterBounds> clusters;
+    float ambient;
+    bool clustered;
+
+    Buffer worldLightBuffer; // Written by the CPU
+    Buffer viewLightBuffer;  // What the fragment shader reads
+    Buffer clusterBuffer;
+    Buffer countBuffer;
+    Buffer indexBuffer;
+    Buffer dataBuffer;
+    bool lightsDirty;
+
+    // Copies of the compute results for lighting_check()
+    Buffer readbackViewLights;
+    Buffer readbackCounts;
+    Buffer readbackIndices;
+    bool checkRequested;
+    bool checkPending;
+
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descPool;
+    VkDescriptorSet descSet;
+    VkPipelineLayout pipeLayout;
+    VkPipeline pipeline;
+
+    VkQueryPool queryPool;
+    float timestampPeriod;
+    uint64_t timestampMask;
+    bool queriesWritten;
+    float lastAssignMs;
+
+    LightingStats stats;
+};
+
+// Near and far plane of a glm::perspective() matrix
+static void lighting_depth_range(const glm::mat4 &projection, float *nearZ, float *farZ)
+{
+    *nearZ = projection[3][2] / (projection[2][2] - 1.0f);
+    *farZ = projection[3][2] / (projection[2][2] + 1.0f);
+}
+
+// Depth slice of a view space depth is log(depth) * scale + bias
+static glm::vec4 lighting_depth_slices(const glm::mat4 &projection)
+{
+    float nearZ, farZ;
+    lighting_depth_range(projection, &nearZ, &farZ);
+    float scale = LIGHTING_CLUSTERS_Z / logf(farZ / nearZ);
+    return glm::vec4(nearZ, farZ, scale, -logf(nearZ) * scale);
+}
+
+// Clusters in x, y then z order. The corners of a tile are unprojected at
+// the near and far depth of its slice, the same mapping from the render
+// area to NDC the fragment shader uses.
+static void lighting_build_clusters(const glm::mat4 &projection, std::vector<ClusterBounds> &clusters)
+{
+    float nearZ, farZ;
+    lighting_depth_range(projection, &nearZ, &farZ);
+
+    clusters.resize(LIGHTING_CLUSTER_COUNT);
+    for (uint32_t z = 0; z < LIGHTING_CLUSTERS_Z; z++)
+    {
+        float depths[2] = {
+            nearZ * powf(farZ / nearZ, (float)z / LIGHTING_CLUSTERS_Z),
+            nearZ * powf(farZ / nearZ, (float)(z + 1) / LIGHTING_CLUSTERS_Z)};
+
+        for (uint32_t y = 0; y < LIGHTING_CLUSTERS_Y; y++)
+        {
+            for (uint32_t x = 0; x < LIGHTING_CLUSTERS_X; x++)
+            {
+                glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+                for (uint32_t corner = 0; corner < 8; corner++)
+                {
+                    float ndcX = ((x + (corner & 1)) * 2.0f / LIGHTING_CLUSTERS_X) - 1.0f;
+                    float ndcY = ((y + ((corner >> 1) & 1)) * 2.0f / LIGHTING_CLUSTERS_Y) - 1.0f;
+                    float depth = depths[corner >> 2];
+
+                    glm::vec3 p(ndcX * depth / projection[0][0], ndcY * depth / projection[1][1], -depth);
+                    min = glm::min(min, p);
+                    max = glm::max(max, p);
+                }
+
+                ClusterBounds &bounds = clusters[(z * LIGHTING_CLUSTERS_Y + y) * LIGHTING_CLUSTERS_X + x];
+                bounds.min = glm::vec4(min, 0.0f);
+                bounds.max = glm::vec4(max, 0.0f);
+            }
+        }
+    }
+}
+
+static void lighting_to_view(const glm::mat4 &view, const PointLight *lights, uint32_t lightCount, PointLight *viewLights)
+{
+    for (uint32_t i = 0; i < lightCount; i++)
+    {
+        viewLights[i] = lights[i];
+        viewLights[i].position = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+    }
+}
+
+// CPU reference of the assign pass, lights in the same order with the same
+// limit. Returns the clusters that overflowed.
+static uint32_t lighting_assign_cpu(
+    const ClusterBounds *clusters,
+    const PointLight *viewLights,
+    uint32_t lightCount,
+    uint32_t *counts,
+    uint32_t *indices)
+{
+    uint32_t overflowed = 0;
+    for (uint32_t cluster = 0; cluster < LIGHTING_CLUSTER_COUNT; cluster++)
+    {
+        glm::vec3 min(clusters[cluster].min), max(clusters[cluster].max);
+        uint32_t *clusterIndices = indices + cluster * LIGHTING_MAX_CLUSTER_LIGHTS;
+
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < lightCount; i++)
+        {
+            // Closest point of the box inside the sphere
+            glm::vec3 d = glm::clamp(viewLights[i].position, min, max) - viewLights[i].position;
+            if (glm::dot(d, d) <= viewLights[i].radius * viewLights[i].radius)
+            {
+                if (count < LIGHTING_MAX_CLUSTER_LIGHTS)
+                {
+                    clusterIndices[count] = i;
+                }
+                count++;
+            }
+        }
+
+        overflowed += count > LIGHTING_MAX_CLUSTER_LIGHTS;
+        counts[cluster] = count < LIGHTING_MAX_CLUSTER_LIGHTS ? count : LIGHTING_MAX_CLUSTER_LIGHTS;
+    }
+
+    return overflowed;
+}
+
+static bool lighting_init(
+    ClusteredLighting *lighting,
+    const VkDispatch *vk,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    uint32_t timestampValidBits,
+    const char *clusterShaderPath)
+{
+    lighting->device = device;
+    lighting->vk = vk;
+    lighting->ambient = LIGHTING_AMBIENT;
+    lighting->clustered = true;
+
+    const VkMemoryPropertyFlags hostMemory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    const VkBufferUsageFlags gpuUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    // Everything the fragment shader reads for every light is device local
+    lighting->worldLightBuffer = vk_allocate_buffer(
+        device, gpu, LIGHTING_MAX_LIGHTS * sizeof(PointLight),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostMemory, "World Lights");
+    lighting->viewLightBuffer = vk_allocate_buffer(
+        device, gpu, LIGHTING_MAX_LIGHTS * sizeof(PointLight),
+        gpuUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "View Lights");
+    lighting->clusterBuffer = vk_allocate_buffer(
+        device, gpu, LIGHTING_CLUSTER_COUNT * sizeof(ClusterBounds),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostMemory, "Cluster Bounds");
+    lighting->countBuffer = vk_allocate_buffer(
+        device, gpu, LIGHTING_CLUSTER_COUNT * sizeof(uint32_t),
+        gpuUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "Cluster Light Counts");
+    lighting->indexBuffer = vk_allocate_buffer(
+        device, gpu, LIGHTING_CLUSTER_COUNT * LIGHTING_MAX_CLUSTER_LIGHTS * sizeof(uint32_t),
+        gpuUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "Cluster Light Indices");
+    lighting->dataBuffer = vk_allocate_buffer(
+        device, gpu, sizeof(LightingData),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, hostMemory, "Lighting Data");
+
+    lighting->readbackViewLights = vk_allocate_buffer(
+        device, gpu, lighting->viewLightBuffer.size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostMemory, "Lighting Readback");
+    lighting->readbackCounts = vk_allocate_buffer(
+        device, gpu, lighting->countBuffer.size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostMemory, "Lighting Readback");
+    lighting->readbackIndices = vk_allocate_buffer(
+        device, gpu, lighting->indexBuffer.size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT, hostMemory, "Lighting Readback");
+
+    if (!lighting->worldLightBuffer.data || !lighting->dataBuffer.data || !lighting->clusterBuffer.data ||
+        !lighting->readbackIndices.data)
+    {
+        std::cerr << "Failed to allocate the Lighting Buffers" << std::endl;
+        return false;
+    }
+
+    // No lights until lighting_update(), the fragment shader only adds the ambient term
+    LightingData *data = (LightingData *)lighting->dataBuffer.data;
+    *data = {};
+    data->gridSize = glm::uvec4(LIGHTING_CLUSTERS_X, LIGHTING_CLUSTERS_Y, LIGHTING_CLUSTERS_Z, LIGHTING_MAX_CLUSTER_LIGHTS);
+    data->ambient = lighting->ambient;
+
+    // Descriptors
+    {
+        VkDescriptorSetLayoutBinding layoutBindings[] = {
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 0),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 2),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 3),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 4),
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 5)};
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = ArraySize(layoutBindings);
+        layoutInfo.pBindings = layoutBindings;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorSetLayout(device, &layoutInfo, 0, &lighting->setLayout));
+
+        VkDescriptorPoolSize poolSizes[] = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}};
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = ArraySize(poolSizes);
+        poolInfo.pPoolSizes = poolSizes;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorPool(device, &poolInfo, 0, &lighting->descPool));
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.pSetLayouts = &lighting->setLayout;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.descriptorPool = lighting->descPool;
+        VK_CHECK_FATAL(vk->vkAllocateDescriptorSets(device, &allocInfo, &lighting->descSet));
+
+        Buffer *buffers[] = {&lighting->worldLightBuffer, &lighting->viewLightBuffer, &lighting->clusterBuffer,
+                             &lighting->countBuffer, &lighting->indexBuffer, &lighting->dataBuffer};
+        VkDescriptorBufferInfo bufferInfos[6] = {};
+        VkWriteDescriptorSet writes[6] = {};
+        for (uint32_t i = 0; i < 6; i++)
+        {
+            bufferInfos[i].buffer = buffers[i]->buffer;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].descriptorType = i == 5 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].descriptorCount = 1;
+            writes[i].dstBinding = i;
+            writes[i].pBufferInfo = &bufferInfos[i];
+            writes[i].dstSet = lighting->descSet;
+        }
+        vk->vkUpdateDescriptorSets(device, ArraySize(writes), writes, 0, 0);
+    }
+
+    // Compute Pipeline
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstant.size = sizeof(uint32_t);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &lighting->setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(vk->vkCreatePipelineLayout(device, &layoutInfo, 0, &lighting->pipeLayout));
+
+        std::vector<char> code = read_file(clusterShaderPath);
+        if (code.empty())
+        {
+            return false;
+        }
+
+        VkShaderModuleCreateInfo shaderInfo = {};
+        shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderInfo.pCode = (uint32_t *)code.data();
+        shaderInfo.codeSize = code.size();
+
+        VkShaderModule shader;
+        VK_CHECK_FATAL(vkCreateShaderModule(device, &shaderInfo, 0, &shader));
+
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shader;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = lighting->pipeLayout;
+
+        VkResult result = vkCreateComputePipelines(device, 0, 1, &pipelineInfo, 0, &lighting->pipeline);
+        vkDestroyShaderModule(device, shader, 0);
+
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "Failed to create the Light Cluster Pipeline" << std::endl;
+            return false;
+        }
+    }
+
+    // Timestamps, only for the stats
+    if (timestampValidBits)
+    {
+        VkPhysicalDeviceProperties gpuProps;
+        vk->vkGetPhysicalDeviceProperties(gpu, &gpuProps);
+        lighting->timestampPeriod = gpuProps.limits.timestampPeriod;
+        lighting->timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+
+        VkQueryPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = 2;
+        VK_CHECK_FATAL(vk->vkCreateQueryPool(device, &poolInfo, 0, &lighting->queryPool));
+    }
+
+    return true;
+}
+
+// Bindings firstBinding to firstBinding + 3 of a set the fragment shader
+// reads: view space lights, light counts and indices per cluster and the
+// Lighting Data
+static void lighting_write_descriptors(ClusteredLighting *lighting, VkDescriptorSet descSet, uint32_t firstBinding)
+{
+    Buffer *buffers[] = {&lighting->viewLightBuffer, &lighting->countBuffer, &lighting->indexBuffer, &lighting->dataBuffer};
+    VkDescriptorBufferInfo bufferInfos[4] = {};
+    VkWriteDescriptorSet writes[4] = {};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bufferInfos[i].buffer = buffers[i]->buffer;
+        bufferInfos[i].range = VK_WHOLE_SIZE;
+
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].descriptorType = i == 3 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].dstBinding = firstBinding + i;
+        writes[i].pBufferInfo = &bufferInfos[i];
+        writes[i].dstSet = descSet;
+    }
+    lighting->vk->vkUpdateDescriptorSets(lighting->device, ArraySize(writes), writes, 0, 0);
+}
+
+// Replaces all lights, only allowed while no submitted frame reads them
+static void lighting_set_lights(ClusteredLighting *lighting, const PointLight *lights, uint32_t lightCount)
+{
+    if (lightCount > LIGHTING_MAX_LIGHTS)
+    {
+        std::cerr << "Too many Lights, increase LIGHTING_MAX_LIGHTS" << std::endl;
+        lightCount = LIGHTING_MAX_LIGHTS;
+    }
+
+    lighting->lights.assign(lights, lights + lightCount);
+    lighting->lightsDirty = true;
+}
+
+// Compares the results of the last checked frame with the CPU reference on
+// the same view space lights
+static void lighting_check(ClusteredLighting *lighting)
+{
+    LightingStats &stats = lighting->stats;
+    uint32_t lightCount = lighting->lights.size();
+
+    std::vector<uint32_t> counts(LIGHTING_CLUSTER_COUNT);
+    std::vector<uint32_t> indices(LIGHTING_CLUSTER_COUNT * LIGHTING_MAX_CLUSTER_LIGHTS);
+    stats.overflowClusters = lighting_assign_cpu(lighting->clusters.data(), (PointLight *)lighting->readbackViewLights.data,
+                                                 lightCount, counts.data(), indices.data());
+
+    const uint32_t *gpuCounts = (uint32_t *)lighting->readbackCounts.data;
+    const uint32_t *gpuIndices = (uint32_t *)lighting->readbackIndices.data;
+
+    uint64_t totalLights = 0;
+    stats.maxClusterLights = 0;
+    stats.checks++;
+    for (uint32_t cluster = 0; cluster < LIGHTING_CLUSTER_COUNT; cluster++)
+    {
+        uint32_t offset = cluster * LIGHTING_MAX_CLUSTER_LIGHTS;
+        stats.checkMismatches += gpuCounts[cluster] != counts[cluster] ||
+                                 memcmp(&gpuIndices[offset], &indices[offset], counts[cluster] * sizeof(uint32_t));
+
+        totalLights += counts[cluster];
+        stats.maxClusterLights = counts[cluster] > stats.maxClusterLights ? counts[cluster] : stats.maxClusterLights;
+    }
+    stats.avgClusterLights = (float)totalLights / LIGHTING_CLUSTER_COUNT;
+}
+
+// Call after the last frame was waited on. Reads its GPU time and check
+// results, rebuilds the clusters if the projection changed and uploads the
+// lights and parameters of this frame.
+static void lighting_update(
+    ClusteredLighting *lighting,
+    const glm::mat4 &view,
+    const glm::mat4 &projection,
+    uint32_t width,
+    uint32_t height)
+{
+    if (lighting->queriesWritten)
+    {
+        uint64_t timestamps[2];
+        if (lighting->vk->vkGetQueryPoolResults(lighting->device, lighting->queryPool, 0, 2, sizeof(timestamps), timestamps,
+                                                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        {
+            lighting->lastAssignMs = (float)(((timestamps[1] - timestamps[0]) & lighting->timestampMask) *
+                                             lighting->timestampPeriod / 1e6);
+            lighting->stats.samples++;
+            lighting->stats.assignMs += lighting->lastAssignMs;
+        }
+        lighting->queriesWritten = false;
+    }
+
+    if (lighting->checkPending)
+    {
+        lighting_check(lighting);
+        lighting->checkPending = false;
+    }
+
+    if (lighting->clusters.empty() || projection != lighting->projection)
+    {
+        lighting->projection = projection;
+        lighting_build_clusters(projection, lighting->clusters);
+        memcpy(lighting->clusterBuffer.data, lighting->clusters.data(), LIGHTING_CLUSTER_COUNT * sizeof(ClusterBounds));
+    }
+
+    if (lighting->lightsDirty)
+    {
+        memcpy(lighting->worldLightBuffer.data, lighting->lights.data(), lighting->lights.size() * sizeof(PointLight));
+        lighting->lightsDirty = false;
+    }
+
+    LightingData *data = (LightingData *)lighting->dataBuffer.data;
+    data->view = view;
+    data->depthSlices = lighting_depth_slices(projection);
+    data->renderSize = glm::vec2(width, height);
+    data->ambient = lighting->ambient;
+    data->lightCount = lighting->lights.size();
+    data->clustered = lighting->clustered;
+}
+
+static void lighting_dispatch(ClusteredLighting *lighting, VkCommandBuffer cmd, LightingPass pass, uint32_t threadCount)
+{
+    const VkDispatch *vk = lighting->vk;
+    uint32_t pushPass = pass;
+
+    vk->vkCmdPushConstants(cmd, lighting->pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushPass), &pushPass);
+    vk->vkCmdDispatch(cmd, (threadCount + LIGHTING_GROUP_SIZE - 1) / LIGHTING_GROUP_SIZE, 1, 1);
+
+    // The assign pass reads the view space lights, drawing reads everything
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 1, &barrier, 0, 0, 0, 0);
+}
+
+// Before the Render Pass, after lighting_update()
+static void lighting_assign(ClusteredLighting *lighting, VkCommandBuffer cmd)
+{
+    const VkDispatch *vk = lighting->vk;
+    uint32_t lightCount = lighting->lights.size();
+    if (!lightCount)
+    {
+        return;
+    }
+
+    lighting->stats.frames++;
+    if (lighting->queryPool)
+    {
+        vk->vkCmdResetQueryPool(cmd, lighting->queryPool, 0, 2);
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, lighting->queryPool, 0);
+    }
+
+    vk->vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lighting->pipeline);
+    vk->vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lighting->pipeLayout, 0, 1, &lighting->descSet, 0, 0);
+    lighting_dispatch(lighting, cmd, LIGHTING_PASS_TRANSFORM, lightCount);
+
+    // The naive baseline loops over all lights, no lists needed
+    if (lighting->clustered)
+    {
+        lighting_dispatch(lighting, cmd, LIGHTING_PASS_ASSIGN, LIGHTING_CLUSTER_COUNT);
+    }
+
+    if (lighting->queryPool)
+    {
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, lighting->queryPool, 1);
+        lighting->queriesWritten = true;
+    }
+
+    // Results for lighting_check() once the frame is done
+    if (lighting->checkRequested && lighting->clustered)
+    {
+        VkBufferCopy copy = {};
+        copy.size = lightCount * sizeof(PointLight);
+        vk->vkCmdCopyBuffer(cmd, lighting->viewLightBuffer.buffer, lighting->readbackViewLights.buffer, 1, &copy);
+        copy.size = lighting->countBuffer.size;
+        vk->vkCmdCopyBuffer(cmd, lighting->countBuffer.buffer, lighting->readbackCounts.buffer, 1, &copy);
+        copy.size = lighting->indexBuffer.size;
+        vk->vkCmdCopyBuffer(cmd, lighting->indexBuffer.buffer, lighting->readbackIndices.buffer, 1, &copy);
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                 0, 1, &barrier, 0, 0, 0, 0);
+
+        lighting->checkRequested = false;
+        lighting->checkPending = true;
+    }
+}
+
+static void lighting_print_stats(ClusteredLighting *lighting)
+{
+    LightingStats &stats = lighting->stats;
+    if (!stats.frames)
+    {
+        return;
+    }
+
+    std::cout << "Lighting: " << lighting->lights.size() << " lights in " << LIGHTING_CLUSTER_COUNT << " clusters";
+    if (stats.samples)
+    {
+        std::cout << ", assign avg GPU " << stats.assignMs / stats.samples << "ms";
+    }
+    if (stats.checks)
+    {
+        std::cout << ", last check avg " << stats.avgClusterLights << " max " << stats.maxClusterLights
+                  << " lights per cluster, " << stats.overflowClusters << " overflowed, " << stats.checkMismatches
+                  << " clusters differ from the CPU in " << stats.checks << " checks";
+    }
+    std::cout << std::endl;
+}
+
+// Needs an idle device
+static void lighting_shutdown(ClusteredLighting *lighting)
+{
+    if (!lighting->device)
+    {
+        return;
+    }
+
+    VkDevice device = lighting->device;
+    if (lighting->queryPool)
+    {
+        lighting->vk->vkDestroyQueryPool(device, lighting->queryPool, 0);
+    }
+
+    vkDestroyPipeline(device, lighting->pipeline, 0);
+    vkDestroyPipelineLayout(device, lighting->pipeLayout, 0);
+    vkDestroyDescriptorPool(device, lighting->descPool, 0);
+    vkDestroyDescriptorSetLayout(device, lighting->setLayout, 0);
+    vk_free_buffer(device, &lighting->worldLightBuffer);
+    vk_free_buffer(device, &lighting->viewLightBuffer);
+    vk_free_buffer(device, &lighting->clusterBuffer);
+    vk_free_buffer(device, &lighting->countBuffer);
+    vk_free_buffer(device, &lighting->indexBuffer);
+    vk_free_buffer(device, &lighting->dataBuffer);
+    vk_free_buffer(device, &lighting->readbackViewLights);
+    vk_free_buffer(device, &lighting->readbackCounts);
+    vk_free_buffer(device, &lighting->readbackIndices);
+
+    *lighting = {};
+}
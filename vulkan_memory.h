@@ -0,0 +1,255 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Records every device memory allocation of buffers and images together with
+// an owner tag. Snapshots can be diffed to find growth, the per heap budget
+// comes from VK_EXT_memory_budget where the device supports it.
+
+#define MEMORY_DUMP_INTERVAL_SEC 30.0
+#define MEMORY_PRESSURE_PERCENT 90
+
+enum MemoryResourceType
+{
+    MEMORY_RESOURCE_BUFFER,
+    MEMORY_RESOURCE_IMAGE,
+};
+
+struct MemoryAllocation
+{
+    MemoryResourceType type;
+    VkDeviceSize size;
+    uint32_t memoryTypeIdx;
+    uint32_t heapIdx;
+    VkFlags usage; // VkBufferUsageFlags or VkImageUsageFlags
+    const char *tag;
+};
+
+struct MemoryHeapStats
+{
+    VkDeviceSize size;
+    VkDeviceSize trackedBytes;
+    uint32_t allocationCount;
+
+    // Zero without VK_EXT_memory_budget
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+};
+
+struct MemorySnapshot
+{
+    double time; // Seconds since memory_tracker_init()
+    uint32_t heapCount;
+    MemoryHeapStats heaps[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize totalBytes;
+    uint32_t allocationCount;
+    uint32_t failedCount;
+    std::map<std::string, VkDeviceSize> bytesPerTag;
+};
+
+struct MemoryDiff
+{
+    double seconds;
+    int64_t totalBytes;
+    int32_t allocationCount;
+    int64_t heapBytes[VK_MAX_MEMORY_HEAPS];
+    std::map<std::string, int64_t> bytesPerTag;
+};
+
+struct MemoryTracker
+{
+    VkPhysicalDevice gpu;
+    VkPhysicalDeviceMemoryProperties memProps;
+    bool budgetSupport;
+
+    std::chrono::high_resolution_clock::time_point startTime;
+    double lastDumpTime;
+
+    // Allocations can come from worker threads
+    std::mutex mutex;
+    std::unordered_map<VkDeviceMemory, MemoryAllocation> allocations;
+    uint32_t failedCount;
+};
+
+static MemoryTracker gMemoryTracker;
+
+static void memory_tracker_init(VkPhysicalDevice gpu, bool budgetSupport)
+{
+    gMemoryTracker.gpu = gpu;
+    gMemoryTracker.budgetSupport = budgetSupport;
+    gMemoryTracker.startTime = std::chrono::high_resolution_clock::now();
+    vkGetPhysicalDeviceMemoryProperties(gpu, &gMemoryTracker.memProps);
+}
+
+static void memory_track_alloc(
+    VkDeviceMemory memory,
+    MemoryResourceType type,
+    VkDeviceSize size,
+    uint32_t memoryTypeIdx,
+    VkFlags usage,
+    const char *tag)
+{
+    MemoryAllocation allocation = {};
+    allocation.type = type;
+    allocation.size = size;
+    allocation.memoryTypeIdx = memoryTypeIdx;
+    allocation.heapIdx = gMemoryTracker.memProps.memoryTypes[memoryTypeIdx].heapIndex;
+    allocation.usage = usage;
+    allocation.tag = tag;
+
+    std::lock_guard<std::mutex> lock(gMemoryTracker.mutex);
+    gMemoryTracker.allocations[memory] = allocation;
+}
+
+static void memory_track_failure(VkDeviceSize size, uint32_t memoryTypeIdx, const char *tag)
+{
+    std::cerr << "Failed to allocate " << size << " bytes of Memory Type " << memoryTypeIdx
+              << " for: " << tag << std::endl;
+
+    std::lock_guard<std::mutex> lock(gMemoryTracker.mutex);
+    gMemoryTracker.failedCount++;
+}
+
+static void memory_track_free(VkDeviceMemory memory)
+{
+    std::lock_guard<std::mutex> lock(gMemoryTracker.mutex);
+    gMemoryTracker.allocations.erase(memory);
+}
+
+static MemorySnapshot memory_snapshot()
+{
+    MemorySnapshot snapshot = {};
+    snapshot.time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - gMemoryTracker.startTime).count();
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {};
+    budgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    // Budget and usage change over time, so they are queried every snapshot
+    if (gMemoryTracker.budgetSupport)
+    {
+        VkPhysicalDeviceMemoryProperties2 memProps = {};
+        memProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        memProps.pNext = &budgetProps;
+        vkGetPhysicalDeviceMemoryProperties2(gMemoryTracker.gpu, &memProps);
+    }
+
+    snapshot.heapCount = gMemoryTracker.memProps.memoryHeapCount;
+    for (uint32_t i = 0; i < snapshot.heapCount; i++)
+    {
+        snapshot.heaps[i].size = gMemoryTracker.memProps.memoryHeaps[i].size;
+        snapshot.heaps[i].budget = budgetProps.heapBudget[i];
+        snapshot.heaps[i].usage = budgetProps.heapUsage[i];
+    }
+
+    std::lock_guard<std::mutex> lock(gMemoryTracker.mutex);
+    for (auto &it : gMemoryTracker.allocations)
+    {
+        const MemoryAllocation &allocation = it.second;
+        snapshot.heaps[allocation.heapIdx].trackedBytes += allocation.size;
+        snapshot.heaps[allocation.heapIdx].allocationCount++;
+        snapshot.totalBytes += allocation.size;
+        snapshot.allocationCount++;
+        snapshot.bytesPerTag[allocation.tag] += allocation.size;
+    }
+    snapshot.failedCount = gMemoryTracker.failedCount;
+
+    return snapshot;
+}
+
+static MemoryDiff memory_diff(const MemorySnapshot &before, const MemorySnapshot &after)
+{
+    MemoryDiff diff = {};
+    diff.seconds = after.time - before.time;
+    diff.totalBytes = (int64_t)after.totalBytes - (int64_t)before.totalBytes;
+    diff.allocationCount = (int32_t)after.allocationCount - (int32_t)before.allocationCount;
+
+    for (uint32_t i = 0; i < after.heapCount; i++)
+    {
+        diff.heapBytes[i] = (int64_t)after.heaps[i].trackedBytes - (int64_t)before.heaps[i].trackedBytes;
+    }
+
+    // Tags only present in one of the two still show up
+    for (auto &it : after.bytesPerTag)
+    {
+        diff.bytesPerTag[it.first] += (int64_t)it.second;
+    }
+    for (auto &it : before.bytesPerTag)
+    {
+        diff.bytesPerTag[it.first] -= (int64_t)it.second;
+    }
+
+    return diff;
+}
+
+static void memory_print_snapshot(const MemorySnapshot &snapshot)
+{
+    std::cout << "GPU Memory at " << snapshot.time << "s: " << snapshot.totalBytes / 1024 << "KB in "
+              << snapshot.allocationCount << " allocations, " << snapshot.failedCount << " failed" << std::endl;
+
+    for (uint32_t i = 0; i < snapshot.heapCount; i++)
+    {
+        const MemoryHeapStats &heap = snapshot.heaps[i];
+        std::cout << "  Heap " << i << ": " << heap.trackedBytes / 1024 << "KB tracked in "
+                  << heap.allocationCount << " allocations, size " << heap.size / (1024 * 1024) << "MB";
+        if (heap.budget)
+        {
+            std::cout << ", usage " << heap.usage / (1024 * 1024) << "MB of "
+                      << heap.budget / (1024 * 1024) << "MB budget";
+        }
+        std::cout << std::endl;
+    }
+
+    for (auto &it : snapshot.bytesPerTag)
+    {
+        std::cout << "  " << it.first << ": " << it.second / 1024 << "KB" << std::endl;
+    }
+}
+
+static void memory_print_diff(const MemoryDiff &diff)
+{
+    std::cout << "GPU Memory over " << diff.seconds << "s: " << diff.totalBytes << " bytes, "
+              << diff.allocationCount << " allocations" << std::endl;
+
+    for (auto &it : diff.bytesPerTag)
+    {
+        if (it.second)
+        {
+            std::cout << "  " << it.first << ": " << it.second << " bytes" << std::endl;
+        }
+    }
+}
+
+// Call once per frame, dumps the stats every MEMORY_DUMP_INTERVAL_SEC together
+// with the change since the last dump and warns about heap pressure
+static void memory_update()
+{
+    static MemorySnapshot lastDump;
+
+    double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - gMemoryTracker.startTime).count();
+    if (time - gMemoryTracker.lastDumpTime < MEMORY_DUMP_INTERVAL_SEC)
+    {
+        return;
+    }
+    gMemoryTracker.lastDumpTime = time;
+
+    MemorySnapshot snapshot = memory_snapshot();
+    memory_print_snapshot(snapshot);
+    if (lastDump.time > 0.0)
+    {
+        memory_print_diff(memory_diff(lastDump, snapshot));
+    }
+
+    for (uint32_t i = 0; i < snapshot.heapCount; i++)
+    {
+        const MemoryHeapStats &heap = snapshot.heaps[i];
+        if (heap.budget && heap.usage * 100 > heap.budget * MEMORY_PRESSURE_PERCENT)
+        {
+            std::cerr << "Heap " << i << " is above " << MEMORY_PRESSURE_PERCENT << "% of its budget" << std::endl;
+        }
+    }
+
+    lastDump = snapshot;
+}
@@ -0,0 +1,757 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+// Splits meshes into clusters (meshlets) of at most MESHLET_MAX_VERTICES
+// vertices and MESHLET_MAX_TRIANGLES triangles, each with a bounding sphere and
+// a cone around its triangle normals. Clusters that are off screen or face
+// away from the camera are culled before drawing, either on the CPU or in a
+// compute shader. Every cluster is one indexed indirect draw into a Geometry
+// Arena of their own.
+//
+// The compute cull can also test clusters against a Hi-Z pyramid in two
+// phases: the early phase tests against the pyramid of the last frame and
+// draws what passes, the pyramid is rebuilt from that and the late phase
+// retests what the early phase rejected, so nothing that just came into view
+// is missing for a frame.
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_MAX_COUNT (1 << 16)
+#define MESHLET_ARENA_VERTICES (1 << 19)
+#define MESHLET_ARENA_INDICES (1 << 22)
+#define MESHLET_ARENA_MESHES 256 // Whole meshes, drawn as such by the shadow cascades
+#define MESHLET_CULL_GROUP_SIZE 64 // local_size_x of meshlet_cull.comp
+
+struct Meshlet
+{
+    uint32_t vertexOffset;   // Into MeshletMesh::vertices
+    uint32_t triangleOffset; // Into MeshletMesh::triangles, 3 per triangle
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+};
+
+// Laid out like the std430 struct in meshlet_cull.comp
+struct MeshletBounds
+{
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    float coneCutoff; // Sine of the cone angle, 1 if the cone can't cull
+};
+
+// Vertex indices of the mesh per meshlet and triangles as local 8 bit
+// indices into them, which is what a mesh shader would read
+struct MeshletMesh
+{
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshletBounds> bounds;
+    std::vector<uint32_t> vertices;
+    std::vector<uint8_t> triangles;
+};
+
+static MeshletBounds meshlet_compute_bounds(const MeshletMesh &mesh, const Meshlet &meshlet, const VertexColor *vertices)
+{
+    MeshletBounds bounds = {};
+
+    // Sphere around the center of the bounding box
+    glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+    {
+        glm::vec3 p = vertices[mesh.vertices[meshlet.vertexOffset + i]].position;
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+    bounds.center = (min + max) * 0.5f;
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+    {
+        glm::vec3 p = vertices[mesh.vertices[meshlet.vertexOffset + i]].position;
+        bounds.radius = glm::max(bounds.radius, glm::length(p - bounds.center));
+    }
+
+    // Area weighted average normal as the axis, the widest normal gives the angle
+    std::vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+    {
+        const uint8_t *tri = &mesh.triangles[meshlet.triangleOffset + t * 3];
+        glm::vec3 a = vertices[mesh.vertices[meshlet.vertexOffset + tri[0]]].position;
+        glm::vec3 b = vertices[mesh.vertices[meshlet.vertexOffset + tri[1]]].position;
+        glm::vec3 c = vertices[mesh.vertices[meshlet.vertexOffset + tri[2]]].position;
+
+        glm::vec3 n = glm::cross(b - a, c - a);
+        if (glm::length(n) > 0.0f)
+        {
+            axis += n;
+            normals.push_back(glm::normalize(n));
+        }
+    }
+
+    bounds.coneCutoff = 1.0f;
+    if (glm::length(axis) > 0.0f)
+    {
+        bounds.coneAxis = glm::normalize(axis);
+
+        float minDot = 1.0f;
+        for (glm::vec3 &n : normals)
+        {
+            minDot = glm::min(minDot, glm::dot(n, bounds.coneAxis));
+        }
+
+        // Wider than a hemisphere, some triangle always faces the camera
+        if (minDot > 0.0f)
+        {
+            bounds.coneCutoff = sqrtf(1.0f - minDot * minDot);
+        }
+    }
+
+    return bounds;
+}
+
+// UV sphere with the quads in 7x7 blocks, 8x8 vertices fill a meshlet
+static void meshlet_sphere(uint32_t rings, uint32_t segments, std::vector<VertexColor> &vertices, std::vector<uint32_t> &indices)
+{
+    const uint32_t block = 7;
+
+    for (uint32_t i = 0; i <= rings; i++)
+    {
+        for (uint32_t j = 0; j <= segments; j++)
+        {
+            float theta = glm::pi<float>() * i / rings;
+            float phi = glm::two_pi<float>() * j / segments;
+            glm::vec3 p(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            vertices.push_back({p, p * 0.5f + 0.5f});
+        }
+    }
+
+    for (uint32_t bi = 0; bi < rings; bi += block)
+    {
+        for (uint32_t bj = 0; bj < segments; bj += block)
+        {
+            for (uint32_t i = bi; i < bi + block && i < rings; i++)
+            {
+                for (uint32_t j = bj; j < bj + block && j < segments; j++)
+                {
+                    uint32_t a = i * (segments + 1) + j;
+                    uint32_t b = a + segments + 1;
+
+                    // Counter clockwise from the outside
+                    uint32_t quad[] = {a, a + 1, b, a + 1, b + 1, b};
+                    indices.insert(indices.end(), quad, quad + 6);
+                }
+            }
+        }
+    }
+}
+
+// Walks the triangles in order and starts a new meshlet when the next one
+// doesn't fit. Meshes with good vertex locality give full meshlets.
+static void meshlet_build(
+    const VertexColor *vertices,
+    uint32_t vertexCount,
+    const uint32_t *indices,
+    uint32_t indexCount,
+    MeshletMesh *mesh)
+{
+    *mesh = {};
+
+    // Local index of every vertex in the current meshlet, 0xFF if not in it
+    std::vector<uint8_t> localIdx(vertexCount, 0xFF);
+    Meshlet meshlet = {};
+
+    auto finish = [&]()
+    {
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        {
+            localIdx[mesh->vertices[meshlet.vertexOffset + i]] = 0xFF;
+        }
+
+        mesh->meshlets.push_back(meshlet);
+        mesh->bounds.push_back(meshlet_compute_bounds(*mesh, meshlet, vertices));
+
+        meshlet = {};
+        meshlet.vertexOffset = mesh->vertices.size();
+        meshlet.triangleOffset = mesh->triangles.size();
+    };
+
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        uint32_t tri[3] = {indices[i], indices[i + 1], indices[i + 2]};
+
+        uint32_t newVertices = 0;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+            newVertices += localIdx[tri[k]] == 0xFF && !repeated;
+        }
+
+        if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES)
+        {
+            finish();
+        }
+
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            if (localIdx[tri[k]] == 0xFF)
+            {
+                localIdx[tri[k]] = meshlet.vertexCount++;
+                mesh->vertices.push_back(tri[k]);
+            }
+            mesh->triangles.push_back(localIdx[tri[k]]);
+        }
+        meshlet.triangleCount++;
+    }
+
+    if (meshlet.triangleCount)
+    {
+        finish();
+    }
+}
+
+enum MeshletCullMode
+{
+    MESHLET_CULL_NONE,
+    MESHLET_CULL_CPU,
+    MESHLET_CULL_GPU,
+};
+
+// Push Constant of meshlet_cull.comp
+enum MeshletCullPhase
+{
+    MESHLET_PHASE_NO_OCCLUSION,
+    MESHLET_PHASE_EARLY,
+    MESHLET_PHASE_LATE,
+};
+
+// Uniform Buffer of meshlet_cull.comp, std140
+struct MeshletCullData
+{
+    glm::mat4 viewProj;
+    glm::vec4 planes[6];
+    glm::vec4 cameraPos;
+    glm::vec2 pyramidSize;
+    uint32_t meshletCount;
+    uint32_t pyramidValid;
+};
+
+struct MeshletStats
+{
+    uint64_t frames;
+    uint64_t meshlets;
+    uint64_t meshletsCulled;
+    uint64_t frustumCulled; // CPU only, the compute shader only counts what is left
+    uint64_t backfaceCulled;
+    uint64_t triangles;
+    uint64_t trianglesCulled;
+    uint64_t occluded;  // Rejected by the early phase
+    uint64_t recovered; // Of those, drawn by the late phase
+    double cpuCullMs;
+};
+
+struct MeshletCuller
+{
+    VkDevice device;
+    const VkDispatch *vk;
+    GeometryArena arena;
+    MeshletCullMode mode;
+    bool meshShaderSupport; // Detected only, the clusters are drawn with indirect draws
+
+    // One draw per meshlet, all of them. What gets drawn is in commandBuffer.
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    std::vector<MeshletBounds> bounds;
+    uint32_t triangleCount;
+
+    Buffer boundsBuffer;
+    Buffer commandBuffer;
+    Buffer statsBuffer; // Visible meshlets and triangles, occluded and recovered meshlets of the last compute cull
+    Buffer cullDataBuffer;
+    uint32_t drawCount;
+    bool commandsUploaded; // The CPU path overwrites them with the visible ones
+    bool statsPending;
+
+    // Occlusion culling, compute only. The late draws go into a second pass.
+    HiZPyramid *hiz;
+    bool occlusion;
+    bool latePending; // meshlet_cull_late() still has to run this frame
+    Buffer occludedBuffer; // Per meshlet, written by the early phase
+    Buffer lateCommandBuffer;
+    uint32_t lateDrawCount;
+
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descPool;
+    VkDescriptorSet descSet;
+    VkPipelineLayout pipeLayout;
+    VkPipeline pipeline;
+
+    MeshletStats stats;
+};
+
+static bool meshlet_culler_init(
+    MeshletCuller *culler,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    const VkDispatch *vk,
+    bool multiDraw,
+    bool meshShaderSupport,
+    HiZPyramid *hiz,
+    const char *cullShaderPath)
+{
+    culler->device = device;
+    culler->vk = vk;
+    culler->meshShaderSupport = meshShaderSupport;
+    culler->mode = MESHLET_CULL_GPU;
+    culler->hiz = hiz;
+    culler->occlusion = true;
+
+    geometry_init(&culler->arena, device, gpu, MESHLET_ARENA_VERTICES, MESHLET_ARENA_INDICES,
+                  MESHLET_ARENA_MESHES, multiDraw, 0, 0);
+
+    culler->boundsBuffer = vk_allocate_buffer(
+        device, gpu, MESHLET_MAX_COUNT * sizeof(MeshletBounds),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Meshlet Bounds");
+    culler->commandBuffer = vk_allocate_buffer(
+        device, gpu, MESHLET_MAX_COUNT * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Meshlet Draws");
+    culler->statsBuffer = vk_allocate_buffer(
+        device, gpu, 4 * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Meshlet Stats");
+    culler->cullDataBuffer = vk_allocate_buffer(
+        device, gpu, sizeof(MeshletCullData),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Meshlet Cull Data");
+    culler->occludedBuffer = vk_allocate_buffer(
+        device, gpu, MESHLET_MAX_COUNT * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Meshlet Occlusion");
+    culler->lateCommandBuffer = vk_allocate_buffer(
+        device, gpu, MESHLET_MAX_COUNT * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Meshlet Late Draws");
+
+    // Descriptors
+    {
+        VkDescriptorSetLayoutBinding layoutBindings[] = {
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 0),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 2),
+            layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 3),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 4),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 5),
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 6)};
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = ArraySize(layoutBindings);
+        layoutInfo.pBindings = layoutBindings;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorSetLayout(device, &layoutInfo, 0, &culler->setLayout));
+
+        VkDescriptorPoolSize poolSizes[] = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}};
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = ArraySize(poolSizes);
+        poolInfo.pPoolSizes = poolSizes;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorPool(device, &poolInfo, 0, &culler->descPool));
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.pSetLayouts = &culler->setLayout;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.descriptorPool = culler->descPool;
+        VK_CHECK_FATAL(vk->vkAllocateDescriptorSets(device, &allocInfo, &culler->descSet));
+
+        // Binding 3 is the pyramid, the rest are buffers
+        Buffer *buffers[] = {&culler->boundsBuffer, &culler->commandBuffer, &culler->statsBuffer, 0,
+                             &culler->occludedBuffer, &culler->lateCommandBuffer, &culler->cullDataBuffer};
+        VkDescriptorBufferInfo bufferInfos[7] = {};
+        VkWriteDescriptorSet writes[7] = {};
+        for (uint32_t i = 0; i < 7; i++)
+        {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].descriptorCount = 1;
+            writes[i].dstBinding = i;
+            writes[i].dstSet = culler->descSet;
+
+            if (buffers[i])
+            {
+                bufferInfos[i].buffer = buffers[i]->buffer;
+                bufferInfos[i].range = VK_WHOLE_SIZE;
+                writes[i].pBufferInfo = &bufferInfos[i];
+            }
+        }
+        writes[6].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        VkDescriptorImageInfo pyramidInfo = {};
+        pyramidInfo.sampler = hiz->sampler;
+        pyramidInfo.imageView = hiz->view;
+        pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        writes[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[3].pImageInfo = &pyramidInfo;
+
+        vk->vkUpdateDescriptorSets(device, ArraySize(writes), writes, 0, 0);
+    }
+
+    // Compute Pipeline
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstant.size = sizeof(uint32_t);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &culler->setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(vk->vkCreatePipelineLayout(device, &layoutInfo, 0, &culler->pipeLayout));
+
+        std::vector<char> code = read_file(cullShaderPath);
+        if (code.empty())
+        {
+            return false;
+        }
+
+        VkShaderModuleCreateInfo shaderInfo = {};
+        shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderInfo.pCode = (uint32_t *)code.data();
+        shaderInfo.codeSize = code.size();
+
+        VkShaderModule shader;
+        VK_CHECK_FATAL(vkCreateShaderModule(device, &shaderInfo, 0, &shader));
+
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shader;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = culler->pipeLayout;
+
+        VkResult result = vkCreateComputePipelines(device, 0, 1, &pipelineInfo, 0, &culler->pipeline);
+        vkDestroyShaderModule(device, shader, 0);
+
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "Failed to create the Meshlet Cull Pipeline" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Adds the mesh to the arena with its indices in meshlet order, returns the
+// arena mesh id or INVALID_IDX if it doesn't fit
+static uint32_t meshlet_add_mesh(MeshletCuller *culler, const MeshletMesh &mesh, const VertexColor *vertices, uint32_t vertexCount)
+{
+    if (culler->commands.size() + mesh.meshlets.size() > MESHLET_MAX_COUNT)
+    {
+        std::cerr << "Too many Meshlets, increase MESHLET_MAX_COUNT" << std::endl;
+        return INVALID_IDX;
+    }
+
+    std::vector<uint32_t> indices;
+    indices.reserve(mesh.triangles.size());
+    for (const Meshlet &meshlet : mesh.meshlets)
+    {
+        for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+        {
+            indices.push_back(mesh.vertices[meshlet.vertexOffset + mesh.triangles[meshlet.triangleOffset + i]]);
+        }
+    }
+
+    // The camera passes draw the clusters, the arena draw list of whole meshes
+    // is left to the shadow cascades
+    uint32_t meshId = geometry_add_mesh(&culler->arena, vertices, vertexCount, indices.data(), indices.size());
+    if (meshId == INVALID_IDX)
+    {
+        return INVALID_IDX;
+    }
+
+    GeometryMesh &arenaMesh = culler->arena.meshes[meshId];
+    uint32_t firstIndex = arenaMesh.firstIndex;
+    for (uint32_t i = 0; i < mesh.meshlets.size(); i++)
+    {
+        const Meshlet &meshlet = mesh.meshlets[i];
+
+        VkDrawIndexedIndirectCommand command = {};
+        command.indexCount = meshlet.triangleCount * 3;
+        command.instanceCount = 1;
+        command.firstIndex = firstIndex;
+        command.vertexOffset = arenaMesh.vertexOffset;
+        culler->commands.push_back(command);
+        culler->bounds.push_back(mesh.bounds[i]);
+
+        firstIndex += command.indexCount;
+        culler->triangleCount += meshlet.triangleCount;
+    }
+
+    memcpy(culler->boundsBuffer.data, culler->bounds.data(), culler->bounds.size() * sizeof(MeshletBounds));
+    culler->commandsUploaded = false;
+    return meshId;
+}
+
+// Clip space planes of the MVP, pointing inwards and normalized
+static void meshlet_frustum_planes(const glm::mat4 &mvp, glm::vec4 planes[6])
+{
+    glm::mat4 m = glm::transpose(mvp);
+    planes[0] = m[3] + m[0];
+    planes[1] = m[3] - m[0];
+    planes[2] = m[3] + m[1];
+    planes[3] = m[3] - m[1];
+    planes[4] = m[3] + m[2];
+    planes[5] = m[3] - m[2];
+
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+// The camera is the point the projection maps to w = 0 at the center of
+// the screen, so this works in the space of the mesh without the view matrix
+static glm::vec3 meshlet_camera_position(const glm::mat4 &mvp)
+{
+    glm::vec4 camera = glm::inverse(mvp) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+    return glm::vec3(camera) / camera.w;
+}
+
+static bool meshlet_backfacing(const MeshletBounds &bounds, glm::vec3 cameraPos)
+{
+    glm::vec3 toCenter = bounds.center - cameraPos;
+    return glm::dot(toCenter, bounds.coneAxis) >= bounds.coneCutoff * glm::length(toCenter) + bounds.radius;
+}
+
+static bool meshlet_outside(const MeshletBounds &bounds, const glm::vec4 planes[6])
+{
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        if (glm::dot(glm::vec3(planes[i]), bounds.center) + planes[i].w < -bounds.radius)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void meshlet_dispatch(MeshletCuller *culler, VkCommandBuffer cmd, MeshletCullPhase phase)
+{
+    const VkDispatch *vk = culler->vk;
+    uint32_t meshletCount = culler->commands.size();
+    uint32_t pushPhase = phase;
+
+    vk->vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, culler->pipeline);
+    vk->vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, culler->pipeLayout, 0, 1, &culler->descSet, 0, 0);
+    vk->vkCmdPushConstants(cmd, culler->pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushPhase), &pushPhase);
+    vk->vkCmdDispatch(cmd, (meshletCount + MESHLET_CULL_GROUP_SIZE - 1) / MESHLET_CULL_GROUP_SIZE, 1, 1);
+
+    // The late phase reads the occlusion flags of the early one
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT |
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, 0, 0, 0);
+}
+
+// Before the Render Pass, after the wait on the last frame. With occlusion
+// culling this is the early phase and meshlet_cull_late() has to follow.
+static void meshlet_cull(MeshletCuller *culler, VkCommandBuffer cmd, const glm::mat4 &mvp)
+{
+    uint32_t meshletCount = culler->commands.size();
+    MeshletStats &stats = culler->stats;
+
+    // Results of the last compute cull
+    if (culler->statsPending)
+    {
+        uint32_t *visible = (uint32_t *)culler->statsBuffer.data;
+        stats.meshletsCulled += meshletCount - visible[0];
+        stats.trianglesCulled += culler->triangleCount - visible[1];
+        stats.occluded += visible[2];
+        stats.recovered += visible[3];
+        culler->statsPending = false;
+    }
+    culler->latePending = false;
+    culler->lateDrawCount = 0;
+
+    stats.frames++;
+    stats.meshlets += meshletCount;
+    stats.triangles += culler->triangleCount;
+
+    glm::vec4 planes[6];
+    meshlet_frustum_planes(mvp, planes);
+    glm::vec3 cameraPos = meshlet_camera_position(mvp);
+
+    if (culler->mode == MESHLET_CULL_CPU)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        VkDrawIndexedIndirectCommand *draws = (VkDrawIndexedIndirectCommand *)culler->commandBuffer.data;
+        uint32_t drawCount = 0;
+        for (uint32_t i = 0; i < meshletCount; i++)
+        {
+            const MeshletBounds &bounds = culler->bounds[i];
+            if (meshlet_outside(bounds, planes))
+            {
+                stats.frustumCulled++;
+            }
+            else if (meshlet_backfacing(bounds, cameraPos))
+            {
+                stats.backfaceCulled++;
+            }
+            else
+            {
+                draws[drawCount++] = culler->commands[i];
+                continue;
+            }
+
+            stats.meshletsCulled++;
+            stats.trianglesCulled += culler->commands[i].indexCount / 3;
+        }
+
+        culler->drawCount = drawCount;
+        culler->commandsUploaded = false;
+        stats.cpuCullMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return;
+    }
+
+    if (!culler->commandsUploaded)
+    {
+        memcpy(culler->commandBuffer.data, culler->commands.data(), meshletCount * sizeof(VkDrawIndexedIndirectCommand));
+        memcpy(culler->lateCommandBuffer.data, culler->commands.data(), meshletCount * sizeof(VkDrawIndexedIndirectCommand));
+        culler->commandsUploaded = true;
+    }
+    culler->drawCount = meshletCount;
+
+    if (culler->mode == MESHLET_CULL_NONE || !meshletCount)
+    {
+        return;
+    }
+
+    // Culled meshlets keep their draw with instanceCount 0, so nothing has to be compacted
+    memset(culler->statsBuffer.data, 0, 4 * sizeof(uint32_t));
+
+    HiZPyramid *hiz = culler->hiz;
+    MeshletCullData *data = (MeshletCullData *)culler->cullDataBuffer.data;
+    data->viewProj = mvp;
+    memcpy(data->planes, planes, sizeof(planes));
+    data->cameraPos = glm::vec4(cameraPos, 1.0f);
+    data->pyramidSize = glm::vec2(hiz->width, hiz->height);
+    data->meshletCount = meshletCount;
+    data->pyramidValid = hiz->valid;
+
+    hiz_prepare(hiz, cmd);
+    meshlet_dispatch(culler, cmd, culler->occlusion ? MESHLET_PHASE_EARLY : MESHLET_PHASE_NO_OCCLUSION);
+
+    culler->latePending = culler->occlusion;
+    culler->statsPending = true;
+}
+
+// After hiz_build() from the depth of the early draws, outside of the
+// Render Pass. Returns false if there is no late phase this frame.
+static bool meshlet_cull_late(MeshletCuller *culler, VkCommandBuffer cmd)
+{
+    if (!culler->latePending)
+    {
+        return false;
+    }
+
+    meshlet_dispatch(culler, cmd, MESHLET_PHASE_LATE);
+    culler->lateDrawCount = culler->commands.size();
+    culler->latePending = false;
+    return true;
+}
+
+static void meshlet_draw_commands(MeshletCuller *culler, const VkDispatch *vk, VkCommandBuffer cmd,
+                                  Buffer *commandBuffer, uint32_t drawCount)
+{
+    if (!drawCount)
+    {
+        return;
+    }
+
+    VkDeviceSize offset = 0;
+    vk->vkCmdBindVertexBuffers(cmd, 0, 1, &culler->arena.vertexBuffer.buffer, &offset);
+    vk->vkCmdBindIndexBuffer(cmd, culler->arena.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    if (culler->arena.multiDraw)
+    {
+        vk->vkCmdDrawIndexedIndirect(cmd, commandBuffer->buffer, 0, drawCount,
+                                     sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+        for (uint32_t i = 0; i < drawCount; i++)
+        {
+            vk->vkCmdDrawIndexedIndirect(cmd, commandBuffer->buffer, i * sizeof(VkDrawIndexedIndirectCommand),
+                                         1, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+}
+
+// Inside the Render Pass, with a pipeline bound
+static void meshlet_draw(MeshletCuller *culler, const VkDispatch *vk, VkCommandBuffer cmd)
+{
+    meshlet_draw_commands(culler, vk, cmd, &culler->commandBuffer, culler->drawCount);
+}
+
+// What the late phase recovered, inside a second Render Pass that keeps
+// the color and depth of the first
+static void meshlet_draw_late(MeshletCuller *culler, const VkDispatch *vk, VkCommandBuffer cmd)
+{
+    meshlet_draw_commands(culler, vk, cmd, &culler->lateCommandBuffer, culler->lateDrawCount);
+}
+
+static void meshlet_print_stats(MeshletCuller *culler)
+{
+    MeshletStats &stats = culler->stats;
+    if (!stats.frames)
+    {
+        return;
+    }
+
+    std::cout << "Meshlets: " << culler->commands.size() << " clusters, "
+              << stats.meshletsCulled * 100.0 / (stats.meshlets ? stats.meshlets : 1) << "% culled ("
+              << stats.frustumCulled << " frustum, " << stats.backfaceCulled << " backface on the CPU), "
+              << stats.trianglesCulled * 100.0 / (stats.triangles ? stats.triangles : 1) << "% of triangles saved, "
+              << stats.occluded << " occluded in the early phase, " << stats.recovered << " recovered late, "
+              << "mesh shaders " << (culler->meshShaderSupport ? "available" : "not supported") << std::endl;
+}
+
+static void meshlet_culler_shutdown(MeshletCuller *culler)
+{
+    if (!culler->device)
+    {
+        return;
+    }
+
+    vkDestroyPipeline(culler->device, culler->pipeline, 0);
+    vkDestroyPipelineLayout(culler->device, culler->pipeLayout, 0);
+    vkDestroyDescriptorPool(culler->device, culler->descPool, 0);
+    vkDestroyDescriptorSetLayout(culler->device, culler->setLayout, 0);
+    vk_free_buffer(culler->device, &culler->boundsBuffer);
+    vk_free_buffer(culler->device, &culler->commandBuffer);
+    vk_free_buffer(culler->device, &culler->statsBuffer);
+    vk_free_buffer(culler->device, &culler->cullDataBuffer);
+    vk_free_buffer(culler->device, &culler->occludedBuffer);
+    vk_free_buffer(culler->device, &culler->lateCommandBuffer);
+    geometry_destroy(&culler->arena, culler->device);
+
+    *culler = {};
+}
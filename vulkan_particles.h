@@ -0,0 +1,720 @@
+#pragma once
+#include <cmath>
+
+// GPU particles, simulated by compute shaders and drawn as instanced quads
+// straight from the particle buffer. There are two particle buffers. Every
+// frame the simulate pass reads the particles of one, integrates them and
+// appends the ones still alive to the other, the emit pass appends the new
+// particles behind them. The appends are the compaction, dead particles just
+// aren't written, so the particles of a buffer are always packed at its start
+// and their count is the instance count of the indirect draw.
+//
+// The compute passes only read the buffer of the last frame, which is also
+// the one the frame before draws. With a compute queue of its own family the
+// passes run there, next to the rendering of the current frame, and the next
+// frame waits on the compute timeline before drawing their result. Without
+// one, or with async off, the passes are recorded in front of the Render
+// Pass and the frame draws its own result.
+
+#define PARTICLE_MAX_COUNT (1 << 21)
+#define PARTICLE_GROUP_SIZE 256 // local_size_x of particles.comp
+#define PARTICLE_TIME_STEP (1.0f / 60.0f)
+#define PARTICLE_LIFETIME 3.0f // Average, particles live from half of it to 1.5x
+#define PARTICLE_SIZE 0.02f    // Half the side of a quad
+
+// Laid out like the std430 struct in the shaders
+struct Particle
+{
+    glm::vec3 position;
+    float life; // Seconds left
+    glm::vec3 velocity;
+    float lifetime;
+};
+
+// One per particle buffer, also the indirect arguments of the draw and of
+// the simulate pass of the next frame
+struct ParticleCounters
+{
+    VkDrawIndirectCommand draw; // instanceCount is the particle count
+    VkDispatchIndirectCommand simulate;
+    uint32_t dropped; // Emitted while the buffer was full
+};
+
+// Push Constant of particles.comp
+enum ParticlePass
+{
+    PARTICLE_PASS_SIMULATE,
+    PARTICLE_PASS_EMIT,
+    PARTICLE_PASS_FINISH,
+};
+
+// Uniform Buffer of particles.comp, std140
+struct ParticleData
+{
+    glm::vec4 emitter; // Position and radius
+    glm::vec4 gravity; // w is the height of the ground
+    float timeStep;
+    float drag;
+    float lifetime;
+    uint32_t emitCount;
+    uint32_t seed;
+    uint32_t capacity;
+    uint32_t padding[2];
+};
+
+// Push Constants of particle.vert
+struct ParticleDrawConstants
+{
+    glm::mat4 viewProj;
+    glm::vec4 right; // w is the size of a particle
+    glm::vec4 up;
+};
+
+struct ParticleStats
+{
+    uint64_t frames;
+    uint64_t asyncFrames;
+    uint64_t samples; // Frames with a GPU time
+    double computeMs;
+    uint64_t simulated; // Particles read by the simulate pass of the timed frames
+    uint64_t dropped;
+};
+
+struct ParticleSystem
+{
+    VkDevice device;
+    const VkDispatch *vk;
+    SyncQueue *computeSync;
+    bool asyncSupported; // The compute queue is of another family than graphics
+    bool async;
+
+    Buffer particleBuffers[2];
+    Buffer counterBuffer; // ParticleCounters of both particle buffers
+    Buffer dataBuffer;
+    uint32_t current;    // Particle buffer with the newest particles, the next passes read it
+    uint32_t drawBuffer; // Particle buffer the frame draws
+
+    float emitRate; // Particles per second
+    uint32_t burst; // Emitted once on top of the rate
+    float emitCarry;
+    glm::vec3 emitter;
+    uint32_t frame;
+
+    // Only used with async compute
+    VkCommandPool computePool;
+    VkCommandBuffer computeCmd;
+    SyncBatch computeBatch;
+    uint64_t computeValue;  // Timeline Value of the last compute submission
+    uint64_t drawWaitValue; // What the draw of this frame waits on, 0 for nothing
+
+    VkDescriptorSetLayout computeSetLayout;
+    VkDescriptorSetLayout drawSetLayout;
+    VkDescriptorPool descPool;
+    VkDescriptorSet computeSets[2]; // By the particle buffer the passes read
+    VkDescriptorSet drawSets[2];
+    VkPipelineLayout computeLayout;
+    VkPipelineLayout drawLayout;
+    VkPipeline computePipeline;
+    VkPipeline drawPipeline;
+
+    VkQueryPool queryPool;
+    float timestampPeriod;
+    uint64_t timestampMask;
+    bool queriesWritten;
+    uint32_t pendingSimulated; // Read by the passes of the timed frame
+    float lastComputeMs;
+
+    uint32_t particleCount; // Of the last completed passes
+    ParticleStats stats;
+};
+
+static bool particle_load_shader(VkDevice device, const char *path, VkShaderModule *shader)
+{
+    std::vector<char> code = read_file(path);
+    if (code.empty())
+    {
+        return false;
+    }
+
+    VkShaderModuleCreateInfo shaderInfo = {};
+    shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderInfo.pCode = (uint32_t *)code.data();
+    shaderInfo.codeSize = code.size();
+
+    VK_CHECK_FATAL(vkCreateShaderModule(device, &shaderInfo, 0, shader));
+    return true;
+}
+
+// The compute passes run on computeSync if it is of another family than the
+// graphics queue, timestampValidBits has to hold for both queues
+static bool particle_system_init(
+    ParticleSystem *particles,
+    const VkDispatch *vk,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    VkRenderPass renderPass,
+    SyncQueue *computeSync,
+    uint32_t graphicsIdx,
+    uint32_t computeIdx,
+    uint32_t timestampValidBits,
+    const char *computeShaderPath,
+    const char *vertexShaderPath,
+    const char *fragmentShaderPath)
+{
+    particles->device = device;
+    particles->vk = vk;
+    particles->computeSync = computeSync;
+    particles->asyncSupported = computeIdx != graphicsIdx;
+    particles->async = particles->asyncSupported;
+    particles->drawBuffer = 0;
+
+    // Both queues use the buffers, no ownership transfers
+    uint32_t queueFamilies[] = {graphicsIdx, computeIdx};
+    uint32_t queueFamilyCount = particles->asyncSupported ? 2 : 1;
+
+    const VkMemoryPropertyFlags hostMemory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        particles->particleBuffers[i] = vk_allocate_buffer(
+            device, gpu, PARTICLE_MAX_COUNT * sizeof(Particle),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            "Particles", queueFamilies, queueFamilyCount);
+    }
+
+    // Small, the CPU reads the counts back for the stats
+    particles->counterBuffer = vk_allocate_buffer(
+        device, gpu, 2 * sizeof(ParticleCounters),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        hostMemory, "Particle Counters", queueFamilies, queueFamilyCount);
+    particles->dataBuffer = vk_allocate_buffer(
+        device, gpu, sizeof(ParticleData),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, hostMemory, "Particle Data", queueFamilies, queueFamilyCount);
+
+    if (!particles->particleBuffers[0].memory || !particles->particleBuffers[1].memory ||
+        !particles->counterBuffer.data || !particles->dataBuffer.data)
+    {
+        std::cerr << "Failed to allocate the Particle Buffers" << std::endl;
+        return false;
+    }
+
+    // Both buffers start empty, the draws are quads
+    ParticleCounters *counters = (ParticleCounters *)particles->counterBuffer.data;
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        counters[i] = {};
+        counters[i].draw.vertexCount = 6;
+        counters[i].simulate.y = 1;
+        counters[i].simulate.z = 1;
+    }
+
+    // Descriptors, one set per direction between the buffers
+    {
+        VkDescriptorSetLayoutBinding computeBindings[] = {
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 0),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 2),
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 3)};
+        VkDescriptorSetLayoutBinding drawBinding =
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1, 0);
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = ArraySize(computeBindings);
+        layoutInfo.pBindings = computeBindings;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorSetLayout(device, &layoutInfo, 0, &particles->computeSetLayout));
+
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &drawBinding;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorSetLayout(device, &layoutInfo, 0, &particles->drawSetLayout));
+
+        VkDescriptorPoolSize poolSizes[] = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2}};
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = 4;
+        poolInfo.poolSizeCount = ArraySize(poolSizes);
+        poolInfo.pPoolSizes = poolSizes;
+        VK_CHECK_FATAL(vk->vkCreateDescriptorPool(device, &poolInfo, 0, &particles->descPool));
+
+        VkDescriptorSetLayout setLayouts[] = {particles->computeSetLayout, particles->computeSetLayout,
+                                              particles->drawSetLayout, particles->drawSetLayout};
+        VkDescriptorSet sets[4];
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.pSetLayouts = setLayouts;
+        allocInfo.descriptorSetCount = ArraySize(setLayouts);
+        allocInfo.descriptorPool = particles->descPool;
+        VK_CHECK_FATAL(vk->vkAllocateDescriptorSets(device, &allocInfo, sets));
+
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            particles->computeSets[i] = sets[i];
+            particles->drawSets[i] = sets[2 + i];
+
+            // Read from buffer i, written to the other one
+            Buffer *buffers[] = {&particles->particleBuffers[i], &particles->particleBuffers[1 - i],
+                                 &particles->counterBuffer, &particles->dataBuffer, &particles->particleBuffers[i]};
+            VkDescriptorBufferInfo bufferInfos[5] = {};
+            VkWriteDescriptorSet writes[5] = {};
+            for (uint32_t j = 0; j < 5; j++)
+            {
+                bufferInfos[j].buffer = buffers[j]->buffer;
+                bufferInfos[j].range = VK_WHOLE_SIZE;
+
+                writes[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[j].descriptorType = j == 3 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[j].descriptorCount = 1;
+                writes[j].dstBinding = j;
+                writes[j].pBufferInfo = &bufferInfos[j];
+                writes[j].dstSet = particles->computeSets[i];
+            }
+            writes[4].dstBinding = 0;
+            writes[4].dstSet = particles->drawSets[i];
+            vk->vkUpdateDescriptorSets(device, ArraySize(writes), writes, 0, 0);
+        }
+    }
+
+    // Compute Pipeline
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstant.size = 2 * sizeof(uint32_t);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &particles->computeSetLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(vk->vkCreatePipelineLayout(device, &layoutInfo, 0, &particles->computeLayout));
+
+        VkShaderModule shader;
+        if (!particle_load_shader(device, computeShaderPath, &shader))
+        {
+            return false;
+        }
+
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shader;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = particles->computeLayout;
+
+        VkResult result = vkCreateComputePipelines(device, 0, 1, &pipelineInfo, 0, &particles->computePipeline);
+        vkDestroyShaderModule(device, shader, 0);
+
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "Failed to create the Particle Compute Pipeline" << std::endl;
+            return false;
+        }
+    }
+
+    // Draw Pipeline, additive quads that test against the depth of the scene
+    // but don't write it
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstant.size = sizeof(ParticleDrawConstants);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &particles->drawSetLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(vk->vkCreatePipelineLayout(device, &layoutInfo, 0, &particles->drawLayout));
+
+        VkShaderModule vertexShader, fragmentShader;
+        if (!particle_load_shader(device, vertexShaderPath, &vertexShader))
+        {
+            return false;
+        }
+        if (!particle_load_shader(device, fragmentShaderPath, &fragmentShader))
+        {
+            vkDestroyShaderModule(device, vertexShader, 0);
+            return false;
+        }
+
+        VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderStages[0].module = vertexShader;
+        shaderStages[0].pName = "main";
+        shaderStages[1] = shaderStages[0];
+        shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderStages[1].module = fragmentShader;
+
+        // The quads come from the vertex index
+        VkPipelineVertexInputStateCreateInfo vertexInputState = {};
+        vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+        rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizationState.cullMode = VK_CULL_MODE_NONE;
+        rasterizationState.lineWidth = 1.0f;
+
+        VkPipelineMultisampleStateCreateInfo multisampleState = {};
+        multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+        depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencilState.depthTestEnable = VK_TRUE;
+        depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS;
+
+        VkPipelineColorBlendAttachmentState colorAttachment = {};
+        colorAttachment.blendEnable = VK_TRUE;
+        colorAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+        colorAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        colorAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+        colorAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                         VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+        VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+        colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlendState.attachmentCount = 1;
+        colorBlendState.pAttachments = &colorAttachment;
+
+        VkDynamicState dynamicStates[]{
+            VK_DYNAMIC_STATE_VIEWPORT,
+            VK_DYNAMIC_STATE_SCISSOR};
+
+        VkPipelineDynamicStateCreateInfo dynamicState = {};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.pDynamicStates = dynamicStates;
+        dynamicState.dynamicStateCount = ArraySize(dynamicStates);
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.pVertexInputState = &vertexInputState;
+        pipelineInfo.pColorBlendState = &colorBlendState;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizationState;
+        pipelineInfo.pMultisampleState = &multisampleState;
+        pipelineInfo.pDepthStencilState = &depthStencilState;
+        pipelineInfo.stageCount = ArraySize(shaderStages);
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = particles->drawLayout;
+        pipelineInfo.pStages = shaderStages;
+
+        VkResult result = vkCreateGraphicsPipelines(device, 0, 1, &pipelineInfo, 0, &particles->drawPipeline);
+        vkDestroyShaderModule(device, vertexShader, 0);
+        vkDestroyShaderModule(device, fragmentShader, 0);
+
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "Failed to create the Particle Draw Pipeline" << std::endl;
+            return false;
+        }
+    }
+
+    // Async compute records into its own Command Buffer
+    if (particles->asyncSupported)
+    {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = computeIdx;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VK_CHECK_FATAL(vk->vkCreateCommandPool(device, &poolInfo, 0, &particles->computePool));
+
+        VkCommandBufferAllocateInfo allocInfo = cmd_alloc_info(particles->computePool);
+        VK_CHECK_FATAL(vk->vkAllocateCommandBuffers(device, &allocInfo, &particles->computeCmd));
+    }
+
+    // Timestamps, only for the stats
+    if (timestampValidBits)
+    {
+        VkPhysicalDeviceProperties gpuProps;
+        vk->vkGetPhysicalDeviceProperties(gpu, &gpuProps);
+        particles->timestampPeriod = gpuProps.limits.timestampPeriod;
+        particles->timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+
+        VkQueryPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = 2;
+        VK_CHECK_FATAL(vk->vkCreateQueryPool(device, &poolInfo, 0, &particles->queryPool));
+    }
+
+    return true;
+}
+
+static void particle_barrier(const VkDispatch *vk, VkCommandBuffer cmd, VkPipelineStageFlags srcStage,
+                             VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vk->vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 1, &barrier, 0, 0, 0, 0);
+}
+
+static void particle_push_pass(ParticleSystem *particles, VkCommandBuffer cmd, ParticlePass pass, uint32_t source)
+{
+    uint32_t constants[] = {(uint32_t)pass, source};
+    particles->vk->vkCmdPushConstants(cmd, particles->computeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                      sizeof(constants), constants);
+}
+
+// Simulate, emit and finish from the current buffer into the other one, on
+// either queue. Only reads what the last passes wrote.
+static void particle_record_passes(ParticleSystem *particles, VkCommandBuffer cmd, uint32_t emitCount, bool graphicsQueue)
+{
+    const VkDispatch *vk = particles->vk;
+    uint32_t source = particles->current;
+    uint32_t target = 1 - source;
+    VkDeviceSize sourceOffset = source * sizeof(ParticleCounters);
+    VkDeviceSize targetOffset = target * sizeof(ParticleCounters);
+
+    if (particles->queryPool)
+    {
+        vk->vkCmdResetQueryPool(cmd, particles->queryPool, 0, 2);
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, particles->queryPool, 0);
+    }
+
+    // The target starts empty, the source counts come from the last finish pass
+    vk->vkCmdFillBuffer(cmd, particles->counterBuffer.buffer, targetOffset + offsetof(ParticleCounters, draw.instanceCount),
+                        sizeof(uint32_t), 0);
+    vk->vkCmdFillBuffer(cmd, particles->counterBuffer.buffer, targetOffset + offsetof(ParticleCounters, dropped),
+                        sizeof(uint32_t), 0);
+    particle_barrier(vk, cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    vk->vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, particles->computePipeline);
+    vk->vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, particles->computeLayout,
+                                0, 1, &particles->computeSets[source], 0, 0);
+
+    // Survivors first, new particles are appended behind them
+    particle_push_pass(particles, cmd, PARTICLE_PASS_SIMULATE, source);
+    vk->vkCmdDispatchIndirect(cmd, particles->counterBuffer.buffer, sourceOffset + offsetof(ParticleCounters, simulate));
+    particle_barrier(vk, cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    if (emitCount)
+    {
+        particle_push_pass(particles, cmd, PARTICLE_PASS_EMIT, source);
+        vk->vkCmdDispatch(cmd, (emitCount + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE, 1, 1);
+        particle_barrier(vk, cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    }
+
+    // Clamps the count and writes the dispatch of the next simulate pass
+    particle_push_pass(particles, cmd, PARTICLE_PASS_FINISH, source);
+    vk->vkCmdDispatch(cmd, 1, 1, 1);
+
+    if (particles->queryPool)
+    {
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, particles->queryPool, 1);
+        particles->queriesWritten = true;
+    }
+
+    // The CPU reads the counts. The draw either follows on this queue or
+    // waits on the compute timeline, a compute queue has no vertex stage.
+    VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_HOST_BIT;
+    VkAccessFlags dstAccess = VK_ACCESS_HOST_READ_BIT;
+    if (graphicsQueue)
+    {
+        dstStages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+        dstAccess |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    }
+    particle_barrier(vk, cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                     dstStages, dstAccess);
+}
+
+// Call after the last frame was waited on, before recording. Reads the
+// results of the last passes, with async compute the passes of this frame
+// are submitted here already.
+static void particle_update(ParticleSystem *particles)
+{
+    if (!particles->device)
+    {
+        return;
+    }
+
+    // The last passes are done before the Command Buffer and the Data are reused
+    sync_wait(particles->computeSync, particles->computeValue);
+
+    ParticleStats &stats = particles->stats;
+    if (particles->queriesWritten)
+    {
+        uint64_t timestamps[2];
+        if (particles->vk->vkGetQueryPoolResults(particles->device, particles->queryPool, 0, 2, sizeof(timestamps),
+                                                 timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        {
+            particles->lastComputeMs = (float)(((timestamps[1] - timestamps[0]) & particles->timestampMask) *
+                                               particles->timestampPeriod / 1e6);
+            stats.samples++;
+            stats.computeMs += particles->lastComputeMs;
+            stats.simulated += particles->pendingSimulated;
+        }
+        particles->queriesWritten = false;
+    }
+
+    ParticleCounters *counters = (ParticleCounters *)particles->counterBuffer.data;
+    particles->particleCount = counters[particles->current].draw.instanceCount;
+    stats.dropped += counters[particles->current].dropped;
+    counters[particles->current].dropped = 0;
+
+    uint32_t capacity = PARTICLE_MAX_COUNT;
+    float emit = particles->emitRate * PARTICLE_TIME_STEP + particles->emitCarry;
+    uint32_t emitCount = (uint32_t)emit + particles->burst;
+    particles->emitCarry = emit - floorf(emit);
+    particles->burst = 0;
+    emitCount = emitCount < capacity ? emitCount : capacity;
+
+    ParticleData *data = (ParticleData *)particles->dataBuffer.data;
+    data->emitter = glm::vec4(particles->emitter, 0.2f);
+    data->gravity = glm::vec4(0.0f, -9.81f, 0.0f, particles->emitter.y - 0.5f);
+    data->timeStep = PARTICLE_TIME_STEP;
+    data->drag = 0.1f;
+    data->lifetime = PARTICLE_LIFETIME;
+    data->emitCount = emitCount;
+    data->seed = particles->frame++;
+    data->capacity = capacity;
+
+    particles->pendingSimulated = particles->particleCount;
+    stats.frames++;
+
+    if (!particles->async || !particles->asyncSupported)
+    {
+        // particle_simulate() records the passes, the frame draws their result
+        particles->drawBuffer = 1 - particles->current;
+        particles->drawWaitValue = 0;
+        return;
+    }
+
+    // The frame draws what the last passes wrote, while these passes write
+    // the other buffer for the next frame
+    particles->drawBuffer = particles->current;
+    particles->drawWaitValue = particles->computeValue;
+    stats.asyncFrames++;
+
+    const VkDispatch *vk = particles->vk;
+    VkCommandBuffer cmd = particles->computeCmd;
+    vk->vkResetCommandBuffer(cmd, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vk->vkBeginCommandBuffer(cmd, &beginInfo));
+    particle_record_passes(particles, cmd, emitCount, false);
+    VK_CHECK(vk->vkEndCommandBuffer(cmd));
+
+    SyncSubmit *submit = sync_batch_add(particles->computeSync, &particles->computeBatch);
+    sync_submit_add_cmd(submit, cmd);
+    particles->computeValue = sync_flush(particles->computeSync, &particles->computeBatch);
+    particles->current = 1 - particles->current;
+}
+
+// Outside of the Render Pass, records the passes unless they went to the
+// compute queue already
+static void particle_simulate(ParticleSystem *particles, VkCommandBuffer cmd)
+{
+    if (!particles->device || (particles->async && particles->asyncSupported))
+    {
+        return;
+    }
+
+    ParticleData *data = (ParticleData *)particles->dataBuffer.data;
+    particle_record_passes(particles, cmd, data->emitCount, true);
+    particles->current = 1 - particles->current;
+}
+
+// Inside the Render Pass, after the opaque geometry
+static void particle_draw(ParticleSystem *particles, VkCommandBuffer cmd, const glm::mat4 &view, const glm::mat4 &projection)
+{
+    if (!particles->device)
+    {
+        return;
+    }
+
+    const VkDispatch *vk = particles->vk;
+
+    // Quads face the camera, its axes are the rows of the view matrix
+    ParticleDrawConstants constants = {};
+    constants.viewProj = projection * view;
+    constants.right = glm::vec4(view[0][0], view[1][0], view[2][0], PARTICLE_SIZE);
+    constants.up = glm::vec4(view[0][1], view[1][1], view[2][1], 0.0f);
+
+    vk->vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, particles->drawPipeline);
+    vk->vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, particles->drawLayout,
+                                0, 1, &particles->drawSets[particles->drawBuffer], 0, 0);
+    vk->vkCmdPushConstants(cmd, particles->drawLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+    vk->vkCmdDrawIndirect(cmd, particles->counterBuffer.buffer,
+                          particles->drawBuffer * sizeof(ParticleCounters) + offsetof(ParticleCounters, draw), 1, 0);
+}
+
+static void particle_print_stats(ParticleSystem *particles)
+{
+    ParticleStats &stats = particles->stats;
+    if (!stats.frames)
+    {
+        return;
+    }
+
+    std::cout << "Particles: " << particles->particleCount << " alive, " << stats.asyncFrames << " of " << stats.frames
+              << " frames on the " << (particles->asyncSupported ? "async compute queue" : "graphics queue only");
+    if (stats.samples)
+    {
+        double computeMs = stats.computeMs / stats.samples;
+        std::cout << ", passes avg GPU " << computeMs << "ms, "
+                  << stats.simulated / (stats.computeMs / 1000.0) / 1e6 << "M particles/s";
+    }
+    std::cout << ", " << stats.dropped << " dropped" << std::endl;
+}
+
+// Needs an idle device
+static void particle_system_shutdown(ParticleSystem *particles)
+{
+    if (!particles->device)
+    {
+        return;
+    }
+
+    VkDevice device = particles->device;
+    const VkDispatch *vk = particles->vk;
+    if (particles->queryPool)
+    {
+        vk->vkDestroyQueryPool(device, particles->queryPool, 0);
+    }
+    if (particles->computePool)
+    {
+        vk->vkDestroyCommandPool(device, particles->computePool, 0);
+    }
+
+    vkDestroyPipeline(device, particles->computePipeline, 0);
+    vkDestroyPipeline(device, particles->drawPipeline, 0);
+    vkDestroyPipelineLayout(device, particles->computeLayout, 0);
+    vkDestroyPipelineLayout(device, particles->drawLayout, 0);
+    vkDestroyDescriptorPool(device, particles->descPool, 0);
+    vkDestroyDescriptorSetLayout(device, particles->computeSetLayout, 0);
+    vkDestroyDescriptorSetLayout(device, particles->drawSetLayout, 0);
+    vk_free_buffer(device, &particles->particleBuffers[0]);
+    vk_free_buffer(device, &particles->particleBuffers[1]);
+    vk_free_buffer(device, &particles->counterBuffer);
+    vk_free_buffer(device, &particles->dataBuffer);
+
+    *particles = {};
+}
@@ -0,0 +1,590 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Graphics pipelines keyed by a hash of their state. Variants are created on
+// worker threads through one shared VkPipelineCache, compile time branches in
+// the shaders are selected through specialization constants.
+
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+#define PIPELINE_MAX_WORKERS 4
+
+enum VertexFormat
+{
+    VERTEX_FORMAT_POSITION_COLOR,
+};
+
+// Only 32 bit fields, the struct is hashed as raw bytes
+struct PipelineState
+{
+    uint32_t vertexFormat;
+    VkCullModeFlags cullMode;
+    VkBool32 depthTest;
+
+    // Specialization Constants, see shaders_vulkan/
+    VkBool32 instanced;      // constant_id = 0
+    VkBool32 shadeBackFaces; // constant_id = 1
+};
+
+static uint64_t pipeline_state_hash(const PipelineState &state)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    const uint8_t *bytes = (const uint8_t *)&state;
+    for (uint32_t i = 0; i < sizeof(PipelineState); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static bool vk_create_pipeline(
+    VkDevice device,
+    VkPipelineCache pipelineCache,
+    VkRenderPass renderPass,
+    VkPipelineLayout pipeLayout,
+    const PipelineState &state,
+    const std::vector<char> &vertexCode,
+    const std::vector<char> &fragmentCode,
+    VkPipeline *pipeline)
+{
+    // Bindings
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = 0; // Index
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    // Attributes
+    VkVertexInputAttributeDescription attributeDescriptions[2] = {};
+    uint32_t attributeCount = 0;
+
+    switch (state.vertexFormat)
+    {
+    case VERTEX_FORMAT_POSITION_COLOR:
+    {
+        bindingDescription.stride = sizeof(VertexColor);
+
+        VkVertexInputAttributeDescription posDescription = {};
+        posDescription.binding = 0;
+        posDescription.location = 0;
+        posDescription.offset = offsetof(VertexColor, position);
+        posDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+
+        VkVertexInputAttributeDescription colorDescription = {};
+        colorDescription.binding = 0;
+        colorDescription.location = 1;
+        colorDescription.offset = offsetof(VertexColor, color);
+        colorDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+
+        attributeDescriptions[attributeCount++] = posDescription;
+        attributeDescriptions[attributeCount++] = colorDescription;
+        break;
+    }
+
+    default:
+        std::cerr << "Unknown Vertex Format: " << state.vertexFormat << std::endl;
+        return false;
+    }
+
+    VkPipelineVertexInputStateCreateInfo vertexInputState = {};
+    vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputState.pVertexAttributeDescriptions = attributeDescriptions;
+    vertexInputState.vertexAttributeDescriptionCount = attributeCount;
+    vertexInputState.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputState.vertexBindingDescriptionCount = 1;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+    colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlendState.pAttachments = &colorBlendAttachment;
+    colorBlendState.attachmentCount = 1;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkViewport viewport = {};
+    viewport.maxDepth = 1.0;
+
+    VkRect2D scissor = {};
+
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.pViewports = &viewport;
+    viewportState.viewportCount = 1;
+    viewportState.pScissors = &scissor;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+    rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizationState.cullMode = state.cullMode;
+    rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizationState.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisampleState = {};
+    multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // Ignored if the Render Pass has no depth attachment
+    VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+    depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencilState.depthTestEnable = state.depthTest;
+    depthStencilState.depthWriteEnable = state.depthTest;
+    depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencilState.maxDepthBounds = 1.0f;
+
+    VkShaderModule vertexShader, fragmentShader;
+
+    // Vertex Shader
+    {
+        uint32_t lengthInBytes = vertexCode.size();
+
+        VkShaderModuleCreateInfo shaderInfo = {};
+        shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderInfo.pCode = (uint32_t *)vertexCode.data();
+        shaderInfo.codeSize = lengthInBytes;
+        VK_CHECK_FATAL(vkCreateShaderModule(device, &shaderInfo, 0, &vertexShader));
+    }
+
+    // Fragment Shader
+    {
+        uint32_t lengthInBytes = fragmentCode.size();
+
+        VkShaderModuleCreateInfo shaderInfo = {};
+        shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderInfo.pCode = (uint32_t *)fragmentCode.data();
+        shaderInfo.codeSize = lengthInBytes;
+        if (vkCreateShaderModule(device, &shaderInfo, 0, &fragmentShader) != VK_SUCCESS)
+        {
+            vkDestroyShaderModule(device, vertexShader, 0);
+            return false;
+        }
+    }
+
+    // Entries for constants a stage doesn't declare are ignored,
+    // so both stages share one Specialization Info
+    VkSpecializationMapEntry specEntries[] = {
+        {0, offsetof(PipelineState, instanced), sizeof(VkBool32)},
+        {1, offsetof(PipelineState, shadeBackFaces), sizeof(VkBool32)}};
+
+    VkSpecializationInfo specInfo = {};
+    specInfo.mapEntryCount = ArraySize(specEntries);
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = sizeof(PipelineState);
+    specInfo.pData = &state;
+
+    VkPipelineShaderStageCreateInfo vertStage = {};
+    vertStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertStage.pName = "main";
+    vertStage.module = vertexShader;
+    vertStage.pSpecializationInfo = &specInfo;
+
+    VkPipelineShaderStageCreateInfo fragStage = {};
+    fragStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragStage.pName = "main";
+    fragStage.module = fragmentShader;
+    fragStage.pSpecializationInfo = &specInfo;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2]{
+        vertStage,
+        fragStage};
+
+    VkDynamicState dynamicStates[]{
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR};
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.pDynamicStates = dynamicStates;
+    dynamicState.dynamicStateCount = ArraySize(dynamicStates);
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.pVertexInputState = &vertexInputState;
+    pipelineInfo.pColorBlendState = &colorBlendState;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizationState;
+    pipelineInfo.pMultisampleState = &multisampleState;
+    pipelineInfo.pDepthStencilState = &depthStencilState;
+    pipelineInfo.stageCount = ArraySize(shaderStages);
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = pipeLayout;
+    pipelineInfo.pStages = shaderStages;
+
+    // The Pipeline Cache is internally synchronized, so all workers can share it
+    VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, 0, pipeline);
+
+    // The modules are only needed during creation, also on failure
+    vkDestroyShaderModule(device, vertexShader, 0);
+    vkDestroyShaderModule(device, fragmentShader, 0);
+
+    VK_CHECK_FATAL(result);
+
+    return true;
+}
+
+struct PipelineVariant
+{
+    PipelineState state;
+    VkPipeline pipeline;
+
+    // A rebuilt pipeline waiting for the next frame boundary
+    VkPipeline pendingPipeline;
+    bool queued;
+    bool failed;
+};
+
+struct PipelineLibraryStats
+{
+    uint32_t created;
+    uint32_t failed;
+    uint32_t fallbacks;
+    uint32_t waits;
+    double totalCreateMs;
+    double maxCreateMs;
+    double totalWaitMs;
+};
+
+struct PipelineLibrary
+{
+    VkDevice device;
+    VkRenderPass renderPass;
+    VkPipelineLayout pipeLayout;
+    VkPipelineCache cache;
+
+    // Used whenever a requested variant isn't ready yet
+    uint64_t fallbackKey;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable variantDone;
+    bool running;
+
+    // Everything below is guarded by the mutex
+    std::vector<char> vertexCode;
+    std::vector<char> fragmentCode;
+    std::deque<uint64_t> queue;
+    std::unordered_map<uint64_t, PipelineVariant> variants;
+    PipelineLibraryStats stats;
+};
+
+static void pipeline_library_worker(PipelineLibrary *lib)
+{
+    std::unique_lock<std::mutex> lock(lib->mutex);
+
+    while (true)
+    {
+        lib->workAvailable.wait(lock, [lib]
+                                { return !lib->running || !lib->queue.empty(); });
+        if (!lib->running)
+        {
+            return;
+        }
+
+        uint64_t key = lib->queue.front();
+        lib->queue.pop_front();
+
+        // Copies, the shaders can get swapped by a hot reload while we compile
+        PipelineState state = lib->variants[key].state;
+        std::vector<char> vertexCode = lib->vertexCode;
+        std::vector<char> fragmentCode = lib->fragmentCode;
+        lib->variants[key].queued = false;
+
+        lock.unlock();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        bool success = vk_create_pipeline(lib->device, lib->cache, lib->renderPass, lib->pipeLayout,
+                                          state, vertexCode, fragmentCode, &pipeline);
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::high_resolution_clock::now() - start)
+                        .count();
+
+        lock.lock();
+
+        PipelineVariant &variant = lib->variants[key];
+        if (!success)
+        {
+            // Keep whatever we had before
+            std::cerr << "Failed to create Pipeline Variant: " << key << std::endl;
+            variant.failed = !variant.pipeline;
+            lib->stats.failed++;
+        }
+        else if (!variant.pipeline)
+        {
+            // Nobody could have used it yet
+            variant.pipeline = pipeline;
+        }
+        else
+        {
+            if (variant.pendingPipeline)
+            {
+                vkDestroyPipeline(lib->device, variant.pendingPipeline, 0);
+            }
+            variant.pendingPipeline = pipeline;
+        }
+
+        if (success)
+        {
+            lib->stats.created++;
+            lib->stats.totalCreateMs += ms;
+            lib->stats.maxCreateMs = ms > lib->stats.maxCreateMs ? ms : lib->stats.maxCreateMs;
+        }
+
+        lib->variantDone.notify_all();
+    }
+}
+
+// Needs lib->mutex
+static PipelineVariant &pipeline_library_enqueue(PipelineLibrary *lib, const PipelineState &state, bool urgent)
+{
+    uint64_t key = pipeline_state_hash(state);
+
+    PipelineVariant &variant = lib->variants[key];
+    variant.state = state;
+
+    if (!variant.queued)
+    {
+        variant.queued = true;
+        variant.failed = false;
+        if (urgent)
+        {
+            lib->queue.push_front(key);
+        }
+        else
+        {
+            lib->queue.push_back(key);
+        }
+        lib->workAvailable.notify_one();
+    }
+
+    return variant;
+}
+
+static bool pipeline_library_init(
+    PipelineLibrary *lib,
+    VkDevice device,
+    VkRenderPass renderPass,
+    VkPipelineLayout pipeLayout,
+    std::vector<char> vertexCode,
+    std::vector<char> fragmentCode,
+    const PipelineState &fallbackState)
+{
+    lib->device = device;
+    lib->renderPass = renderPass;
+    lib->pipeLayout = pipeLayout;
+    lib->vertexCode = std::move(vertexCode);
+    lib->fragmentCode = std::move(fragmentCode);
+
+    // Pipeline Cache, seeded from the last run if there is one
+    {
+        std::vector<char> cacheData;
+        std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+        if (file.is_open())
+        {
+            cacheData.resize((size_t)file.tellg());
+            file.seekg(0);
+            file.read(cacheData.data(), cacheData.size());
+        }
+
+        // The driver validates the header and ignores data of other devices
+        VkPipelineCacheCreateInfo cacheInfo = {};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = cacheData.size();
+        cacheInfo.pInitialData = cacheData.data();
+        VK_CHECK_FATAL(vkCreatePipelineCache(device, &cacheInfo, 0, &lib->cache));
+    }
+
+    // The fallback has to exist before the first frame
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        PipelineVariant variant = {};
+        variant.state = fallbackState;
+        if (!vk_create_pipeline(device, lib->cache, renderPass, pipeLayout, fallbackState,
+                                lib->vertexCode, lib->fragmentCode, &variant.pipeline))
+        {
+            return false;
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::high_resolution_clock::now() - start)
+                        .count();
+        lib->stats.created++;
+        lib->stats.totalCreateMs += ms;
+        lib->stats.maxCreateMs = ms;
+
+        lib->fallbackKey = pipeline_state_hash(fallbackState);
+        lib->variants[lib->fallbackKey] = variant;
+    }
+
+    uint32_t workerCount = std::thread::hardware_concurrency();
+    workerCount = workerCount > 1 ? workerCount - 1 : 1;
+    workerCount = workerCount > PIPELINE_MAX_WORKERS ? PIPELINE_MAX_WORKERS : workerCount;
+
+    lib->running = true;
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        lib->workers.push_back(std::thread(pipeline_library_worker, lib));
+    }
+
+    return true;
+}
+
+// Starts creating variants in the background, e.g. during loading
+static void pipeline_library_prewarm(PipelineLibrary *lib, const PipelineState *states, uint32_t count)
+{
+    std::lock_guard<std::mutex> lock(lib->mutex);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        PipelineVariant &variant = lib->variants[pipeline_state_hash(states[i])];
+        if (!variant.pipeline)
+        {
+            pipeline_library_enqueue(lib, states[i], false);
+        }
+    }
+}
+
+// Returns the variant for state. If it isn't created yet it gets moved to the
+// front of the queue, then we either wait for it or use the fallback pipeline.
+static VkPipeline pipeline_library_get(PipelineLibrary *lib, const PipelineState &state, bool waitIfMissing)
+{
+    uint64_t key = pipeline_state_hash(state);
+
+    std::unique_lock<std::mutex> lock(lib->mutex);
+
+    auto it = lib->variants.find(key);
+    if (it != lib->variants.end() && it->second.pipeline)
+    {
+        return it->second.pipeline;
+    }
+
+    // Don't retry failed variants every frame, only after a reload
+    if (it == lib->variants.end() || !it->second.failed)
+    {
+        PipelineVariant &variant = pipeline_library_enqueue(lib, state, true);
+
+        if (waitIfMissing)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+
+            lib->variantDone.wait(lock, [&variant]
+                                  { return variant.pipeline || variant.failed; });
+
+            lib->stats.waits++;
+            lib->stats.totalWaitMs += std::chrono::duration<double, std::milli>(
+                                          std::chrono::high_resolution_clock::now() - start)
+                                          .count();
+
+            if (variant.pipeline)
+            {
+                return variant.pipeline;
+            }
+        }
+    }
+
+    lib->stats.fallbacks++;
+    return lib->variants[lib->fallbackKey].pipeline;
+}
+
+// Rebuilds every known variant with new SPIR-V, the results get picked up
+// by pipeline_library_swap()
+static void pipeline_library_rebuild(PipelineLibrary *lib, std::vector<char> vertexCode, std::vector<char> fragmentCode)
+{
+    std::lock_guard<std::mutex> lock(lib->mutex);
+
+    lib->vertexCode = std::move(vertexCode);
+    lib->fragmentCode = std::move(fragmentCode);
+
+    for (auto &it : lib->variants)
+    {
+        pipeline_library_enqueue(lib, it.second.state, it.first == lib->fallbackKey);
+    }
+}
+
+// Call at a frame boundary, after the fence of the last frame that used any
+// of the pipelines has been waited on
+static void pipeline_library_swap(PipelineLibrary *lib)
+{
+    // Never block the render loop, if a worker holds the lock try next frame
+    std::unique_lock<std::mutex> lock(lib->mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return;
+    }
+
+    for (auto &it : lib->variants)
+    {
+        PipelineVariant &variant = it.second;
+        if (variant.pendingPipeline)
+        {
+            // No longer in flight, so it can go right away
+            vkDestroyPipeline(lib->device, variant.pipeline, 0);
+            variant.pipeline = variant.pendingPipeline;
+            variant.pendingPipeline = VK_NULL_HANDLE;
+        }
+    }
+}
+
+static void pipeline_library_print_stats(PipelineLibrary *lib)
+{
+    std::lock_guard<std::mutex> lock(lib->mutex);
+
+    PipelineLibraryStats &stats = lib->stats;
+    std::cout << "Pipelines: " << lib->variants.size() << " variants, "
+              << stats.created << " created, " << stats.failed << " failed, "
+              << "avg " << (stats.created ? stats.totalCreateMs / stats.created : 0.0) << "ms, "
+              << "max " << stats.maxCreateMs << "ms, "
+              << stats.fallbacks << " fallbacks, "
+              << stats.waits << " waits (" << stats.totalWaitMs << "ms)" << std::endl;
+}
+
+static void pipeline_library_shutdown(PipelineLibrary *lib)
+{
+    {
+        std::lock_guard<std::mutex> lock(lib->mutex);
+        lib->running = false;
+    }
+    lib->workAvailable.notify_all();
+
+    for (std::thread &worker : lib->workers)
+    {
+        worker.join();
+    }
+    lib->workers.clear();
+
+    // Save the Pipeline Cache for the next run
+    {
+        size_t size = 0;
+        VK_CHECK(vkGetPipelineCacheData(lib->device, lib->cache, &size, 0));
+
+        std::vector<char> cacheData(size);
+        VK_CHECK(vkGetPipelineCacheData(lib->device, lib->cache, &size, cacheData.data()));
+
+        std::ofstream file(PIPELINE_CACHE_PATH, std::ios::binary);
+        file.write(cacheData.data(), size);
+    }
+
+    for (auto &it : lib->variants)
+    {
+        vkDestroyPipeline(lib->device, it.second.pipeline, 0);
+        vkDestroyPipeline(lib->device, it.second.pendingPipeline, 0);
+    }
+    lib->variants.clear();
+
+    vkDestroyPipelineCache(lib->device, lib->cache, 0);
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include <filesystem>
 #include <fstream>
 
 #define VK_CHECK_FATAL(result)                                     \
@@ -18,6 +19,14 @@
 #define ArraySize(arr) sizeof((arr)) / sizeof((arr[0]))
 #define INVALID_IDX UINT32_MAX
 
+// Optional parts of the scene for init_vulkan(), main() takes them from the command line
+#define RENDER_VOXELS (1 << 0)   // Voxel terrain behind the cube, "--voxels"
+#define RENDER_MESHLETS (1 << 1) // Dense sphere next to the cube drawn as culled meshlets, "--meshlets"
+#define RENDER_PARTICLES (1 << 2) // GPU particle fountain beside the cube, "--particles"
+
+#include "vulkan_memory.h"
+#include "vulkan_startup.h"
+
 static uint32_t vk_get_memory_type_index(
     VkPhysicalDevice gpu,
     VkMemoryRequirements memRequirements,
@@ -57,12 +66,29 @@ struct Buffer
     void *data;
 };
 
+// Binding 0 of the global set, see modelViewProj.vert. The model matrix
+// comes from the scene buffer at binding 1, by the node index push constant.
+struct GlobalUBO
+{
+    glm::mat4 viewProj;
+    glm::mat4 view; // The fragment shader lights in view space
+};
+
+// Push Constant of the scene draws
+struct DrawConstants
+{
+    uint32_t nodeIndex;
+};
+
 static Buffer vk_allocate_buffer(
     VkDevice device,
     VkPhysicalDevice gpu,
     uint32_t size,
     VkBufferUsageFlags bufferUsage,
-    VkMemoryPropertyFlags memProps)
+    VkMemoryPropertyFlags memProps,
+    const char *tag,
+    const uint32_t *queueFamilies = 0,
+    uint32_t queueFamilyCount = 0)
 {
     Buffer buffer = {};
     buffer.size = size;
@@ -71,6 +97,14 @@ static Buffer vk_allocate_buffer(
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.usage = bufferUsage;
     bufferInfo.size = size;
+
+    // Used by more than one Queue Family, saves the ownership transfers
+    if (queueFamilyCount > 1)
+    {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = queueFamilyCount;
+        bufferInfo.pQueueFamilyIndices = queueFamilies;
+    }
     VK_CHECK(vkCreateBuffer(device, &bufferInfo, 0, &buffer.buffer));
 
     VkMemoryRequirements memRequirements;
@@ -81,7 +115,15 @@ static Buffer vk_allocate_buffer(
     allocInfo.allocationSize = memRequirements.size;
     allocInfo.memoryTypeIndex = vk_get_memory_type_index(gpu, memRequirements, memProps);
 
-    VK_CHECK(vkAllocateMemory(device, &allocInfo, 0, &buffer.memory));
+    if (vkAllocateMemory(device, &allocInfo, 0, &buffer.memory) != VK_SUCCESS)
+    {
+        memory_track_failure(allocInfo.allocationSize, allocInfo.memoryTypeIndex, tag);
+        vkDestroyBuffer(device, buffer.buffer, 0);
+        buffer.buffer = VK_NULL_HANDLE;
+        return buffer;
+    }
+    memory_track_alloc(buffer.memory, MEMORY_RESOURCE_BUFFER, allocInfo.allocationSize,
+                       allocInfo.memoryTypeIndex, bufferUsage, tag);
 
     // Only map memory we can actually write to from the CPU
     if (memProps & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
@@ -94,6 +136,15 @@ static Buffer vk_allocate_buffer(
     return buffer;
 }
 
+static void vk_free_buffer(VkDevice device, Buffer *buffer)
+{
+    memory_track_free(buffer->memory);
+
+    vkDestroyBuffer(device, buffer->buffer, 0);
+    vkFreeMemory(device, buffer->memory, 0);
+    *buffer = {};
+}
+
 void vk_copy_to_buffer(Buffer *buffer, const void *data, uint32_t size)
 {
     if (buffer->size >= size)
@@ -124,13 +175,16 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL vk_debug_callback(
     return false;
 }
 
+// Empty if the file can't be opened, the startup stages run it on tasks
+// where an exception would terminate the process
 static std::vector<char> read_file(const std::string &filename)
 {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
     if (!file.is_open())
     {
-        throw std::runtime_error("failed to open file!");
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return {};
     }
     size_t fileSize = (size_t)file.tellg();
     std::vector<char> buffer(fileSize);
@@ -143,15 +197,19 @@ static std::vector<char> read_file(const std::string &filename)
     return buffer;
 }
 
-static void compile_shader(const char *input, const char *output)
+// glslc does not write the output on a failed compile, so the last good
+// SPIR-V stays on disk and can still be used
+static bool compile_shader(const char *input, const char *output)
 {
     char command[500] = {};
     sprintf(command, "shaders_vulkan\\glslc.exe %s -o %s", input, output);
     if (system(command))
     {
         std::cerr << "Failed to compile Shader: " << input << std::endl;
-        __debugbreak();
+        return false;
     }
+
+    return true;
 }
 
 static VkCommandBufferAllocateInfo cmd_alloc_info(VkCommandPool pool)
@@ -188,8 +246,25 @@ static VkDescriptorSetLayoutBinding layout_binding(
     return binding;
 }
 
+#include "vulkan_dispatch.h"
+#include "vulkan_pipeline_library.h"
+#include "vulkan_sync.h"
+#include "vulkan_shader_reload.h"
+#include "vulkan_geometry.h"
+#include "vulkan_streaming.h"
+#include "vulkan_texture.h"
+#include "vulkan_resolution.h"
+#include "vulkan_lighting.h"
+#include "vulkan_shadows.h"
+#include "vulkan_trace.h"
+#include "vulkan_voxel.h"
+#include "vulkan_hiz.h"
+#include "vulkan_meshlet.h"
+#include "vulkan_particles.h"
+
 struct VkContext
 {
+    VkDispatch vk;
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
     VkSurfaceKHR surface;
@@ -197,8 +272,11 @@ struct VkContext
     VkPhysicalDevice gpu;
     VkDevice device;
     VkQueue graphicsQueue;
+    VkQueue transferQueue;
+    VkQueue computeQueue; // The Graphics Queue without a separate Compute Family
     VkSwapchainKHR swapchain;
     VkRenderPass renderPass;
+    VkRenderPass renderPassLoad; // Continues after the first, for the late occlusion culling draws
     VkCommandPool commandPool;
     VkCommandBuffer cmd;
 
@@ -206,51 +284,229 @@ struct VkContext
     VkDescriptorSetLayout setLayout;
     VkDescriptorSet descSet;
     VkPipelineLayout pipeLayout;
-    VkPipeline pipeline;
+    PipelineLibrary pipelines;
+    PipelineState pipelineState;
+    PipelineState depthState; // Depth tested, the voxel and meshlet arenas
+    ShaderReloader shaderReload;
 
     // Buffers
     Buffer globalUBO;
-    Buffer vertexBuffer;
-    Buffer indexBuffer;
+    Buffer sceneBuffer; // World matrices of gScene by node index, binding 1
+    uint32_t sceneCapacity;
+    GeometryArena geometry;
+    uint32_t cubeMesh;
+    Streamer streamer;
+    TextureManager textures;
+    uint32_t cubeTexture;
+    VkSampler cubeSampler;
+    VoxelWorld voxels; // Empty until voxel_world_init()
+    uint32_t voxelNode; // Child of gWorldNode, places the voxel chunks
+    MeshletCuller meshlets; // Empty until vk_init_meshlet_culler()
+    uint32_t meshletNode; // Child of gWorldNode, places the meshlet arena
+    ParticleSystem particles; // Empty until vk_init_particle_system()
 
     // Sync Objects
     VkSemaphore aquireSemaphore;
     VkSemaphore submitSemaphore;
-    VkFence imgAvailableFence;
+    SyncQueue graphicsSync;
+    SyncQueue transferSync;
+    SyncQueue computeSync;
+    SyncBatch frameBatch;
+    uint64_t frameValue; // Timeline Value of the last submitted frame
 
     uint32_t scImgCount;
     // TODO: Suballocation from Main Memory
     VkImage scImages[5];
     VkImageView scImgViews[5];
-    VkFramebuffer framebuffers[5];
+
+    // The scene renders into the Dynamic Resolution target, not the Swapchain
+    DynamicResolution resolution;
+    VkFramebuffer framebuffer;
+
+    // Full size like the target, the render area picks the scaled part
+    VkImage depthImage;
+    VkDeviceMemory depthMemory;
+    VkImageView depthView;
+    HiZPyramid hiz; // Built from the depth buffer for occlusion culling, empty until vk_init_meshlet_culler()
+
+    ClusteredLighting lighting;
+    ShadowMaps shadows;
+
+    // Frame capture for replay_trace(), only when started
+    TraceWriter trace;
 
     int graphicsIdx;
+    int transferIdx;
+    int computeIdx;
+    bool timelineSupport;
+    bool multiDrawSupport;
+    bool meshShaderSupport;
 };
 
 static VkContext vkcontext;
 
-bool init_vulkan(GLFWwindow *glfwWindow)
+// Points the descriptor at the resident image of the cube texture, only
+// allowed while no submitted frame uses the descriptor set
+static void vk_write_texture_descriptor()
 {
-    // Compile both Shaders
-    compile_shader("shaders_vulkan/modelViewProj.vert",
-                   "shaders_vulkan/modelViewProj.vert.spv");
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = vkcontext.cubeSampler;
+    imageInfo.imageView = texture_view(&vkcontext.textures, vkcontext.cubeTexture);
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet textureWrite = {};
+    textureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    textureWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    textureWrite.descriptorCount = 1;
+    textureWrite.dstBinding = 2;
+    textureWrite.pImageInfo = &imageInfo;
+    textureWrite.dstSet = vkcontext.descSet;
+
+    vkcontext.vk.vkUpdateDescriptorSets(vkcontext.device, 1, &textureWrite, 0, 0);
+}
 
-    compile_shader("shaders_vulkan/color.frag",
-                   "shaders_vulkan/color.frag.spv");
+// Binding 1 holds the world matrices of all nodes, modelViewProj.vert reads
+// them by the node index of the draw. Only the ranges changed by
+// scene_update() are copied. Called after the wait on the last frame, so a
+// full buffer can be replaced right away.
+static void vk_upload_scene(SceneGraph *scene)
+{
+    uint32_t nodeCount = scene->worlds.size();
+    if (nodeCount > vkcontext.sceneCapacity)
+    {
+        uint32_t capacity = vkcontext.sceneCapacity ? vkcontext.sceneCapacity : 1;
+        while (capacity < nodeCount)
+        {
+            capacity *= 2;
+        }
+
+        if (vkcontext.sceneBuffer.buffer)
+        {
+            vk_free_buffer(vkcontext.device, &vkcontext.sceneBuffer);
+        }
+        vkcontext.sceneBuffer = vk_allocate_buffer(
+            vkcontext.device,
+            vkcontext.gpu,
+            capacity * sizeof(glm::mat4),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            "Scene World Matrices");
+        vkcontext.sceneCapacity = capacity;
+
+        VkDescriptorBufferInfo bufferInfo = {};
+        bufferInfo.buffer = vkcontext.sceneBuffer.buffer;
+        bufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet sceneWrite = {};
+        sceneWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        sceneWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        sceneWrite.descriptorCount = 1;
+        sceneWrite.dstBinding = 1;
+        sceneWrite.pBufferInfo = &bufferInfo;
+        sceneWrite.dstSet = vkcontext.descSet;
+        vkcontext.vk.vkUpdateDescriptorSets(vkcontext.device, 1, &sceneWrite, 0, 0);
+
+        // The new buffer has none of them yet
+        vk_copy_to_buffer(&vkcontext.sceneBuffer, scene->worlds.data(), nodeCount * sizeof(glm::mat4));
+        return;
+    }
+
+    scene_copy_changed(scene, vkcontext.sceneBuffer.data);
+}
+
+// SPIR-V written before the last edit of its source was built for another
+// interface, it can't stand in for a failed compile
+static bool vk_spirv_current(const char *input, const char *output)
+{
+    std::error_code error;
+    std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(input, error);
+    if (error)
+    {
+        return false;
+    }
+
+    std::filesystem::file_time_type spirvTime = std::filesystem::last_write_time(output, error);
+    return !error && spirvTime >= sourceTime;
+}
+
+// Every Shader in its own thread, glslc runs as a separate process anyway. A
+// failed compile keeps the last good SPIR-V if it is newer than the source,
+// a shader without any fails.
+static bool vk_compile_shaders()
+{
+    const char *shaders[][2] = {
+        {"shaders_vulkan/modelViewProj.vert", "shaders_vulkan/modelViewProj.vert.spv"},
+        {"shaders_vulkan/color.frag", "shaders_vulkan/color.frag.spv"},
+        {"shaders_vulkan/meshlet_cull.comp", "shaders_vulkan/meshlet_cull.comp.spv"},
+        {"shaders_vulkan/hiz_build.comp", "shaders_vulkan/hiz_build.comp.spv"},
+        {"shaders_vulkan/lighting_cluster.comp", "shaders_vulkan/lighting_cluster.comp.spv"},
+        {"shaders_vulkan/particles.comp", "shaders_vulkan/particles.comp.spv"},
+        {"shaders_vulkan/particle.vert", "shaders_vulkan/particle.vert.spv"},
+        {"shaders_vulkan/particle.frag", "shaders_vulkan/particle.frag.spv"},
+        {"shaders_vulkan/shadow.vert", "shaders_vulkan/shadow.vert.spv"}};
+
+    bool compiled[ArraySize(shaders)] = {};
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < ArraySize(shaders); i++)
+    {
+        threads.push_back(std::thread([&compiled, &shaders, i]()
+                                      { compiled[i] = compile_shader(shaders[i][0], shaders[i][1]); }));
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    bool success = true;
+    for (uint32_t i = 0; i < ArraySize(shaders); i++)
+    {
+        if (!compiled[i] && !vk_spirv_current(shaders[i][0], shaders[i][1]))
+        {
+            std::cerr << "No current SPIR-V for Shader: " << shaders[i][0] << std::endl;
+            success = false;
+        }
+    }
+
+    return success;
+}
 
+static bool vk_init_instance(bool validation)
+{
     // Instance
     {
         VkApplicationInfo appInfo = {};
         appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        appInfo.apiVersion = VK_API_VERSION_1_2;
 
         // GLFW Extensions for Vulkan
         uint32_t glfwExtensionCount = 0;
         const char **glfwExtensions;
         glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-        char *layers[]{
+        // Validation is optional and has to be installed, without it we run as is
+        const char *layers[] = {
             "VK_LAYER_KHRONOS_validation"};
+        uint32_t layerCount = 0;
+        if (validation)
+        {
+            uint32_t availableCount = 0;
+            VK_CHECK_FATAL(vkEnumerateInstanceLayerProperties(&availableCount, 0));
+            std::vector<VkLayerProperties> availableLayers(availableCount);
+            VK_CHECK_FATAL(vkEnumerateInstanceLayerProperties(&availableCount, availableLayers.data()));
+
+            for (VkLayerProperties &props : availableLayers)
+            {
+                if (!strcmp(props.layerName, layers[0]))
+                {
+                    layerCount = 1;
+                }
+            }
+
+            if (!layerCount)
+            {
+                std::cerr << "Validation Layers aren't installed, running without them" << std::endl;
+            }
+        }
 
         VkInstanceCreateInfo info = {};
         info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -258,9 +514,11 @@ bool init_vulkan(GLFWwindow *glfwWindow)
         info.enabledExtensionCount = glfwExtensionCount;
         info.ppEnabledExtensionNames = glfwExtensions;
         info.ppEnabledLayerNames = layers;
-        info.enabledLayerCount = ArraySize(layers);
+        info.enabledLayerCount = layerCount;
 
         VK_CHECK_FATAL(vkCreateInstance(&info, 0, &vkcontext.instance));
+
+        vk_load_instance_functions(vkcontext.instance, &vkcontext.vk);
     }
 
     // Debug Utils
@@ -284,6 +542,11 @@ bool init_vulkan(GLFWwindow *glfwWindow)
         // }
     }
 
+    return true;
+}
+
+static bool vk_init_surface(GLFWwindow *glfwWindow)
+{
     // Surface
     {
         if (glfwCreateWindowSurface(vkcontext.instance, glfwWindow, nullptr, &vkcontext.surface) != VK_SUCCESS)
@@ -293,14 +556,19 @@ bool init_vulkan(GLFWwindow *glfwWindow)
         }
     }
 
+    return true;
+}
+
+static bool vk_init_device()
+{
     // Choose GPU
     {
         vkcontext.graphicsIdx = -1;
 
         uint32_t gpuCount = 0;
         VkPhysicalDevice gpus[10];
-        VK_CHECK_FATAL(vkEnumeratePhysicalDevices(vkcontext.instance, &gpuCount, 0));
-        VK_CHECK_FATAL(vkEnumeratePhysicalDevices(vkcontext.instance, &gpuCount, gpus));
+        VK_CHECK_FATAL(vkcontext.vk.vkEnumeratePhysicalDevices(vkcontext.instance, &gpuCount, 0));
+        VK_CHECK_FATAL(vkcontext.vk.vkEnumeratePhysicalDevices(vkcontext.instance, &gpuCount, gpus));
 
         for (uint32_t i = 0; i < gpuCount; i++)
         {
@@ -308,15 +576,15 @@ bool init_vulkan(GLFWwindow *glfwWindow)
 
             uint32_t queueFamilyCount = 0;
             VkQueueFamilyProperties queueProps[10];
-            vkGetPhysicalDeviceQueueFamilyProperties(gpu, &queueFamilyCount, 0);
-            vkGetPhysicalDeviceQueueFamilyProperties(gpu, &queueFamilyCount, queueProps);
+            vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(gpu, &queueFamilyCount, 0);
+            vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(gpu, &queueFamilyCount, queueProps);
 
             for (uint32_t j = 0; j < queueFamilyCount; j++)
             {
                 if (queueProps[j].queueFlags & VK_QUEUE_GRAPHICS_BIT)
                 {
                     VkBool32 surfaceSupport = VK_FALSE;
-                    VK_CHECK_FATAL(vkGetPhysicalDeviceSurfaceSupportKHR(gpu, j, vkcontext.surface, &surfaceSupport));
+                    VK_CHECK_FATAL(vkcontext.vk.vkGetPhysicalDeviceSurfaceSupportKHR(gpu, j, vkcontext.surface, &surfaceSupport));
 
                     if (surfaceSupport)
                     {
@@ -338,34 +606,155 @@ bool init_vulkan(GLFWwindow *glfwWindow)
     {
         float queuePriority = 1.0f;
 
-        VkDeviceQueueCreateInfo queueInfo = {};
-        queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueInfo.queueFamilyIndex = vkcontext.graphicsIdx;
-        queueInfo.queueCount = 1;
-        queueInfo.pQueuePriorities = &queuePriority;
+        // Multi Draw Indirect is optional, without it every mesh is its own indirect draw
+        VkPhysicalDeviceFeatures gpuFeatures;
+        vkcontext.vk.vkGetPhysicalDeviceFeatures(vkcontext.gpu, &gpuFeatures);
+
+        VkPhysicalDeviceFeatures enabledFeatures = {};
+        enabledFeatures.multiDrawIndirect = gpuFeatures.multiDrawIndirect;
+        vkcontext.multiDrawSupport = gpuFeatures.multiDrawIndirect;
+
+        // Without BC support texture_load() rejects compressed files
+        enabledFeatures.textureCompressionBC = gpuFeatures.textureCompressionBC;
+        enabledFeatures.samplerAnisotropy = gpuFeatures.samplerAnisotropy;
+
+        // Timeline Semaphores are core in 1.2, otherwise we fall back to Fences
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        {
+            VkPhysicalDeviceProperties gpuProps;
+            vkcontext.vk.vkGetPhysicalDeviceProperties(vkcontext.gpu, &gpuProps);
+
+            if (gpuProps.apiVersion >= VK_API_VERSION_1_2)
+            {
+                VkPhysicalDeviceFeatures2 features = {};
+                features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+                features.pNext = &timelineFeatures;
+                vkcontext.vk.vkGetPhysicalDeviceFeatures2(vkcontext.gpu, &features);
+            }
+
+            vkcontext.timelineSupport = timelineFeatures.timelineSemaphore;
+        }
+
+        // Uploads go to a dedicated Transfer Family if there is one, those are
+        // usually the DMA engines. Otherwise they share the Graphics Queue.
+        // Async compute likewise wants a Compute Family without graphics.
+        vkcontext.transferIdx = vkcontext.graphicsIdx;
+        vkcontext.computeIdx = vkcontext.graphicsIdx;
+        {
+            uint32_t queueFamilyCount = 0;
+            VkQueueFamilyProperties queueProps[10];
+            vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, 0);
+            vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, queueProps);
+
+            for (uint32_t i = 0; i < queueFamilyCount; i++)
+            {
+                if ((queueProps[i].queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+                    !(queueProps[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+                {
+                    vkcontext.transferIdx = i;
+                    break;
+                }
+            }
+
+            for (uint32_t i = 0; i < queueFamilyCount; i++)
+            {
+                if ((queueProps[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueProps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+                {
+                    vkcontext.computeIdx = i;
+                    break;
+                }
+            }
+        }
+
+        VkDeviceQueueCreateInfo queueInfos[3] = {};
+        uint32_t queueInfoCount = 1;
+        queueInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfos[0].queueFamilyIndex = vkcontext.graphicsIdx;
+        queueInfos[0].queueCount = 1;
+        queueInfos[0].pQueuePriorities = &queuePriority;
+
+        if (vkcontext.transferIdx != vkcontext.graphicsIdx)
+        {
+            queueInfos[1] = queueInfos[0];
+            queueInfos[1].queueFamilyIndex = vkcontext.transferIdx;
+            queueInfoCount++;
+        }
+
+        if (vkcontext.computeIdx != vkcontext.graphicsIdx)
+        {
+            queueInfos[queueInfoCount] = queueInfos[0];
+            queueInfos[queueInfoCount].queueFamilyIndex = vkcontext.computeIdx;
+            queueInfoCount++;
+        }
+
+        // Optional Extensions
+        bool budgetSupport = false;
+        {
+            uint32_t extensionCount = 0;
+            VK_CHECK_FATAL(vkcontext.vk.vkEnumerateDeviceExtensionProperties(vkcontext.gpu, 0, &extensionCount, 0));
+            std::vector<VkExtensionProperties> extensionProps(extensionCount);
+            VK_CHECK_FATAL(vkcontext.vk.vkEnumerateDeviceExtensionProperties(vkcontext.gpu, 0, &extensionCount, extensionProps.data()));
 
-        char *extensions[] = {
+            for (VkExtensionProperties &props : extensionProps)
+            {
+                if (!strcmp(props.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+                {
+                    budgetSupport = true;
+                }
+
+                // Only reported, meshlets are drawn with indirect draws either way
+                if (!strcmp(props.extensionName, VK_EXT_MESH_SHADER_EXTENSION_NAME))
+                {
+                    vkcontext.meshShaderSupport = true;
+                }
+            }
+        }
+
+        const char *extensions[2] = {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+        uint32_t extensionCount = 1;
+
+        if (budgetSupport)
+        {
+            extensions[extensionCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+        }
 
         VkDeviceCreateInfo deviceInfo = {};
         deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        deviceInfo.pQueueCreateInfos = &queueInfo;
-        deviceInfo.queueCreateInfoCount = 1;
+        deviceInfo.pQueueCreateInfos = queueInfos;
+        deviceInfo.queueCreateInfoCount = queueInfoCount;
         deviceInfo.ppEnabledExtensionNames = extensions;
-        deviceInfo.enabledExtensionCount = ArraySize(extensions);
+        deviceInfo.enabledExtensionCount = extensionCount;
+        deviceInfo.pEnabledFeatures = &enabledFeatures;
+        deviceInfo.pNext = vkcontext.timelineSupport ? &timelineFeatures : 0;
 
-        VK_CHECK_FATAL(vkCreateDevice(vkcontext.gpu, &deviceInfo, 0, &vkcontext.device));
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateDevice(vkcontext.gpu, &deviceInfo, 0, &vkcontext.device));
+
+        if (!vk_load_device_functions(vkcontext.device, &vkcontext.vk))
+        {
+            return false;
+        }
 
         // Get Graphics Queue
-        vkGetDeviceQueue(vkcontext.device, vkcontext.graphicsIdx, 0, &vkcontext.graphicsQueue);
+        vkcontext.vk.vkGetDeviceQueue(vkcontext.device, vkcontext.graphicsIdx, 0, &vkcontext.graphicsQueue);
+        vkcontext.vk.vkGetDeviceQueue(vkcontext.device, vkcontext.transferIdx, 0, &vkcontext.transferQueue);
+        vkcontext.vk.vkGetDeviceQueue(vkcontext.device, vkcontext.computeIdx, 0, &vkcontext.computeQueue);
+
+        memory_tracker_init(vkcontext.gpu, budgetSupport);
     }
 
-    // Swapchain
+    return true;
+}
+
+static bool vk_init_render_pass()
+{
+    // Surface Format, the Swapchain and the Render Target use it
     {
         uint32_t formatCount = 0;
         VkSurfaceFormatKHR surfaceFormats[10];
-        VK_CHECK_FATAL(vkGetPhysicalDeviceSurfaceFormatsKHR(vkcontext.gpu, vkcontext.surface, &formatCount, 0));
-        VK_CHECK_FATAL(vkGetPhysicalDeviceSurfaceFormatsKHR(vkcontext.gpu, vkcontext.surface, &formatCount, surfaceFormats));
+        VK_CHECK_FATAL(vkcontext.vk.vkGetPhysicalDeviceSurfaceFormatsKHR(vkcontext.gpu, vkcontext.surface, &formatCount, 0));
+        VK_CHECK_FATAL(vkcontext.vk.vkGetPhysicalDeviceSurfaceFormatsKHR(vkcontext.gpu, vkcontext.surface, &formatCount, surfaceFormats));
 
         for (uint32_t i = 0; i < formatCount; i++)
         {
@@ -377,15 +766,172 @@ bool init_vulkan(GLFWwindow *glfwWindow)
                 break;
             }
         }
+    }
+
+    // Render Pass
+    {
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = vkcontext.surfaceFormat.format;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL; // Blitted to the Swapchain
+
+        VkAttachmentDescription depthAttachment = {};
+        depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // The Hi-Z pyramid is built from it
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentDescription attachments[] = {
+            colorAttachment,
+            depthAttachment};
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0; // This is an index into the attachments array
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentRef = {};
+        depthAttachmentRef.attachment = 1;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpassDesc = {};
+        subpassDesc.colorAttachmentCount = 1;
+        subpassDesc.pColorAttachments = &colorAttachmentRef;
+        subpassDesc.pDepthStencilAttachment = &depthAttachmentRef;
+
+        // Color writes of an earlier pass are done before the second one
+        // loads them, both need it to stay compatible
+        VkSubpassDependency dependency = {};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        VkRenderPassCreateInfo rpInfo = {};
+        rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        rpInfo.pAttachments = attachments;
+        rpInfo.attachmentCount = ArraySize(attachments);
+        rpInfo.subpassCount = 1;
+        rpInfo.pSubpasses = &subpassDesc;
+        rpInfo.dependencyCount = 1;
+        rpInfo.pDependencies = &dependency;
+
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateRenderPass(vkcontext.device, &rpInfo, 0, &vkcontext.renderPass));
+
+        // Same attachments with the contents of the first pass, compatible
+        // with its Frame Buffer and Pipelines
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateRenderPass(vkcontext.device, &rpInfo, 0, &vkcontext.renderPassLoad));
+    }
+
+    return true;
+}
+
+// Everything the Pipelines need besides the Render Pass
+static bool vk_init_layouts()
+{
+    // Create Descriptor Set Layouts
+    {
+        VkDescriptorSetLayoutBinding layoutBindings[] = {
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1, 0),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1, 1),
+            layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 2),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 3),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 4),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 5),
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 6),
+            layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 7),
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 8)};
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = ArraySize(layoutBindings);
+        layoutInfo.pBindings = layoutBindings;
+
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateDescriptorSetLayout(vkcontext.device, &layoutInfo, 0, &vkcontext.setLayout));
+    }
+
+    // Create Pipeline Layout
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstant.size = sizeof(DrawConstants);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &vkcontext.setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(vkcontext.vk.vkCreatePipelineLayout(vkcontext.device, &layoutInfo, 0, &vkcontext.pipeLayout));
+    }
+
+    return true;
+}
+
+// The slowest part of the startup, runs as a task next to the main thread
+static bool vk_init_pipelines()
+{
+    // Create the Pipeline Library
+    {
+        vkcontext.pipelineState.vertexFormat = VERTEX_FORMAT_POSITION_COLOR;
+        vkcontext.pipelineState.cullMode = VK_CULL_MODE_FRONT_BIT;
+
+        // Voxel chunks and meshlets overlap each other and the rest of the
+        // scene, unlike the cube
+        vkcontext.depthState = vkcontext.pipelineState;
+        vkcontext.depthState.depthTest = VK_TRUE;
+
+        std::vector<char> vertexCode = read_file("shaders_vulkan/modelViewProj.vert.spv");
+        std::vector<char> fragmentCode = read_file("shaders_vulkan/color.frag.spv");
+        if (vertexCode.empty() || fragmentCode.empty())
+        {
+            return false;
+        }
+
+        // Only the pipeline we draw with is created here, the rest on the workers
+        if (!pipeline_library_init(&vkcontext.pipelines, vkcontext.device, vkcontext.renderPass, vkcontext.pipeLayout,
+                                   std::move(vertexCode), std::move(fragmentCode), vkcontext.pipelineState))
+        {
+            return false;
+        }
 
+        PipelineState variants[] = {
+            {VERTEX_FORMAT_POSITION_COLOR, VK_CULL_MODE_BACK_BIT, VK_FALSE, VK_FALSE, VK_FALSE},
+            {VERTEX_FORMAT_POSITION_COLOR, VK_CULL_MODE_NONE, VK_FALSE, VK_FALSE, VK_TRUE},
+            {VERTEX_FORMAT_POSITION_COLOR, VK_CULL_MODE_BACK_BIT, VK_TRUE, VK_FALSE, VK_FALSE},
+            {VERTEX_FORMAT_POSITION_COLOR, VK_CULL_MODE_BACK_BIT, VK_TRUE, VK_TRUE, VK_FALSE},
+            vkcontext.depthState};
+
+        pipeline_library_prewarm(&vkcontext.pipelines, variants, ArraySize(variants));
+    }
+
+    return true;
+}
+
+static bool vk_init_swapchain()
+{
+    // Swapchain
+    {
         VkSurfaceCapabilitiesKHR surfaceCaps = {};
-        VK_CHECK_FATAL(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vkcontext.gpu, vkcontext.surface, &surfaceCaps));
+        VK_CHECK_FATAL(vkcontext.vk.vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vkcontext.gpu, vkcontext.surface, &surfaceCaps));
         uint32_t imgCount = surfaceCaps.minImageCount + 1;
         imgCount = imgCount > surfaceCaps.maxImageCount ? imgCount - 1 : imgCount;
 
         VkSwapchainCreateInfoKHR scInfo = {};
         scInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-        scInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        scInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
         scInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         scInfo.surface = vkcontext.surface;
         scInfo.imageFormat = vkcontext.surfaceFormat.format;
@@ -395,10 +941,10 @@ bool init_vulkan(GLFWwindow *glfwWindow)
         scInfo.minImageCount = imgCount;
         scInfo.imageArrayLayers = 1;
 
-        VK_CHECK_FATAL(vkCreateSwapchainKHR(vkcontext.device, &scInfo, 0, &vkcontext.swapchain));
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateSwapchainKHR(vkcontext.device, &scInfo, 0, &vkcontext.swapchain));
 
-        VK_CHECK_FATAL(vkGetSwapchainImagesKHR(vkcontext.device, vkcontext.swapchain, &vkcontext.scImgCount, 0));
-        VK_CHECK_FATAL(vkGetSwapchainImagesKHR(vkcontext.device, vkcontext.swapchain, &vkcontext.scImgCount, vkcontext.scImages));
+        VK_CHECK_FATAL(vkcontext.vk.vkGetSwapchainImagesKHR(vkcontext.device, vkcontext.swapchain, &vkcontext.scImgCount, 0));
+        VK_CHECK_FATAL(vkcontext.vk.vkGetSwapchainImagesKHR(vkcontext.device, vkcontext.swapchain, &vkcontext.scImgCount, vkcontext.scImages));
 
         VkImageViewCreateInfo viewInfo = {};
         viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -410,275 +956,217 @@ bool init_vulkan(GLFWwindow *glfwWindow)
         for (uint32_t i = 0; i < vkcontext.scImgCount; i++)
         {
             viewInfo.image = vkcontext.scImages[i];
-            VK_CHECK_FATAL(vkCreateImageView(vkcontext.device, &viewInfo, 0, &vkcontext.scImgViews[i]));
+            VK_CHECK_FATAL(vkcontext.vk.vkCreateImageView(vkcontext.device, &viewInfo, 0, &vkcontext.scImgViews[i]));
         }
     }
 
-    // Render Pass
-    {
-        VkAttachmentDescription colorAttachment = {};
-        colorAttachment.format = vkcontext.surfaceFormat.format;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-        VkAttachmentDescription attachments[] = {
-            colorAttachment};
-
-        VkAttachmentReference colorAttachmentRef = {};
-        colorAttachmentRef.attachment = 0; // This is an index into the attachments array
-        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    return true;
+}
 
-        VkSubpassDescription subpassDesc = {};
-        subpassDesc.colorAttachmentCount = 1;
-        subpassDesc.pColorAttachments = &colorAttachmentRef;
+static bool vk_init_targets()
+{
+    // Dynamic Resolution
+    {
+        uint32_t queueFamilyCount = 0;
+        VkQueueFamilyProperties queueProps[10];
+        vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, 0);
+        vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, queueProps);
+
+        if (!drs_init(&vkcontext.resolution, &vkcontext.vk, vkcontext.device, vkcontext.gpu,
+                      vkcontext.surfaceFormat.format, SCREEN_WIDTH, SCREEN_HEIGHT,
+                      queueProps[vkcontext.graphicsIdx].timestampValidBits))
+        {
+            return false;
+        }
+    }
 
-        VkRenderPassCreateInfo rpInfo = {};
-        rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        rpInfo.pAttachments = attachments;
-        rpInfo.attachmentCount = ArraySize(attachments);
-        rpInfo.subpassCount = 1;
-        rpInfo.pSubpasses = &subpassDesc;
+    // Depth Buffer, D32 is supported as depth attachment everywhere
+    {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = VK_FORMAT_D32_SFLOAT;
+        imageInfo.extent = {SCREEN_WIDTH, SCREEN_HEIGHT, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VK_CHECK_FATAL(vkCreateImage(vkcontext.device, &imageInfo, 0, &vkcontext.depthImage));
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(vkcontext.device, vkcontext.depthImage, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = vk_get_memory_type_index(vkcontext.gpu, memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (vkAllocateMemory(vkcontext.device, &allocInfo, 0, &vkcontext.depthMemory) != VK_SUCCESS)
+        {
+            memory_track_failure(allocInfo.allocationSize, allocInfo.memoryTypeIndex, "Depth Buffer");
+            return false;
+        }
+        memory_track_alloc(vkcontext.depthMemory, MEMORY_RESOURCE_IMAGE, allocInfo.allocationSize,
+                           allocInfo.memoryTypeIndex, imageInfo.usage, "Depth Buffer");
+        VK_CHECK_FATAL(vkBindImageMemory(vkcontext.device, vkcontext.depthImage, vkcontext.depthMemory, 0));
 
-        VK_CHECK_FATAL(vkCreateRenderPass(vkcontext.device, &rpInfo, 0, &vkcontext.renderPass));
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = vkcontext.depthImage;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = VK_FORMAT_D32_SFLOAT;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateImageView(vkcontext.device, &viewInfo, 0, &vkcontext.depthView));
     }
 
-    // Frame Buffers
+    // Frame Buffer, always full size, the render area picks the scaled part
     {
+        VkImageView fbAttachments[] = {
+            vkcontext.resolution.targetView,
+            vkcontext.depthView};
+
         VkFramebufferCreateInfo fbInfo = {};
         fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         fbInfo.renderPass = vkcontext.renderPass;
         fbInfo.width = SCREEN_WIDTH;
         fbInfo.height = SCREEN_HEIGHT;
         fbInfo.layers = 1;
-        fbInfo.attachmentCount = 1;
+        fbInfo.attachmentCount = ArraySize(fbAttachments);
+        fbInfo.pAttachments = fbAttachments;
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateFramebuffer(vkcontext.device, &fbInfo, 0, &vkcontext.framebuffer));
+    }
 
-        for (uint32_t i = 0; i < vkcontext.scImgCount; i++)
+    return true;
+}
+
+// Runs as a task next to the main thread
+static bool vk_init_compute()
+{
+    // Clustered Lighting and Shadow Maps, both time their passes
+    {
+        uint32_t queueFamilyCount = 0;
+        VkQueueFamilyProperties queueProps[10];
+        vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, 0);
+        vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, queueProps);
+
+        if (!lighting_init(&vkcontext.lighting, &vkcontext.vk, vkcontext.device, vkcontext.gpu,
+                           queueProps[vkcontext.graphicsIdx].timestampValidBits,
+                           "shaders_vulkan/lighting_cluster.comp.spv"))
         {
-            //HERE: Instead of using swapchain Image Views, prolly use other Image Views
-            fbInfo.pAttachments = &vkcontext.scImgViews[i];
-            VK_CHECK_FATAL(vkCreateFramebuffer(vkcontext.device, &fbInfo, 0, &vkcontext.framebuffers[i]));
+            return false;
+        }
+
+        if (!shadow_init(&vkcontext.shadows, &vkcontext.vk, vkcontext.device, vkcontext.gpu,
+                         queueProps[vkcontext.graphicsIdx].timestampValidBits, "shaders_vulkan/shadow.vert.spv"))
+        {
+            return false;
         }
     }
 
+    return true;
+}
+
+static bool vk_init_commands()
+{
     // Command Pool
     {
         VkCommandPoolCreateInfo poolInfo = {};
         poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         poolInfo.queueFamilyIndex = vkcontext.graphicsIdx;
         poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        VK_CHECK_FATAL(vkCreateCommandPool(vkcontext.device, &poolInfo, 0, &vkcontext.commandPool));
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateCommandPool(vkcontext.device, &poolInfo, 0, &vkcontext.commandPool));
     }
 
     // Command Buffer
     {
         VkCommandBufferAllocateInfo allocInfo = cmd_alloc_info(vkcontext.commandPool);
-        VK_CHECK_FATAL(vkAllocateCommandBuffers(vkcontext.device, &allocInfo, &vkcontext.cmd));
+        VK_CHECK_FATAL(vkcontext.vk.vkAllocateCommandBuffers(vkcontext.device, &allocInfo, &vkcontext.cmd));
     }
 
     // Sync Objects
     {
         VkSemaphoreCreateInfo semaInfo = {};
         semaInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        VK_CHECK_FATAL(vkCreateSemaphore(vkcontext.device, &semaInfo, 0, &vkcontext.aquireSemaphore));
-        VK_CHECK_FATAL(vkCreateSemaphore(vkcontext.device, &semaInfo, 0, &vkcontext.submitSemaphore));
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateSemaphore(vkcontext.device, &semaInfo, 0, &vkcontext.aquireSemaphore));
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateSemaphore(vkcontext.device, &semaInfo, 0, &vkcontext.submitSemaphore));
 
-        VkFenceCreateInfo fenceInfo = fence_info(VK_FENCE_CREATE_SIGNALED_BIT);
-        VK_CHECK_FATAL(vkCreateFence(vkcontext.device, &fenceInfo, 0, &vkcontext.imgAvailableFence));
+        if (!sync_queue_init(&vkcontext.graphicsSync, &vkcontext.vk, vkcontext.device, vkcontext.graphicsQueue, vkcontext.timelineSupport) ||
+            !sync_queue_init(&vkcontext.transferSync, &vkcontext.vk, vkcontext.device, vkcontext.transferQueue, vkcontext.timelineSupport) ||
+            !sync_queue_init(&vkcontext.computeSync, &vkcontext.vk, vkcontext.device, vkcontext.computeQueue, vkcontext.timelineSupport))
+        {
+            return false;
+        }
     }
 
-    // Create Descriptor Set Layouts
-    {
-        VkDescriptorSetLayoutBinding layoutBindings[] = {
-            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1, 0),
-            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1, 1)};
-
-        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = ArraySize(layoutBindings);
-        layoutInfo.pBindings = layoutBindings;
-
-        VK_CHECK_FATAL(vkCreateDescriptorSetLayout(vkcontext.device, &layoutInfo, 0, &vkcontext.setLayout));
-    }
+    return true;
+}
 
-    //HERE: This will need to be duplicated, line 506 - 655
-    // This could be a function create_pipeline(bool frontFaceCulling, ...)
-    // Create Pipeline Layout
+static bool vk_init_textures()
+{
+    // Textures
     {
-        VkPushConstantRange pushConstant = {};
-
-        VkPipelineLayoutCreateInfo layoutInfo = {};
-        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        layoutInfo.setLayoutCount = 1;
-        layoutInfo.pSetLayouts = &vkcontext.setLayout;
-        VK_CHECK_FATAL(vkCreatePipelineLayout(vkcontext.device, &layoutInfo, 0, &vkcontext.pipeLayout));
-    }
-
-    // Create a Pipeline
-    {
-        // Bindings
-        VkVertexInputBindingDescription bindingDescription = {};
-        bindingDescription.binding = 0; // Index
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        bindingDescription.stride = sizeof(VertexColor);
-
-        // Attributes
-        VkVertexInputAttributeDescription posDescription = {};
-        posDescription.binding = 0;
-        posDescription.location = 0;
-        posDescription.offset = offsetof(VertexColor, position);
-        posDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-
-        VkVertexInputAttributeDescription colorDescription = {};
-        colorDescription.binding = 0;
-        colorDescription.location = 1;
-        colorDescription.offset = offsetof(VertexColor, color);
-        colorDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-
-        VkVertexInputAttributeDescription attributeDescriptions[2] = {
-            posDescription,
-            colorDescription};
-
-        VkPipelineVertexInputStateCreateInfo vertexInputState = {};
-        vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputState.pVertexAttributeDescriptions = attributeDescriptions;
-        vertexInputState.vertexAttributeDescriptionCount = ArraySize(attributeDescriptions);
-        vertexInputState.pVertexBindingDescriptions = &bindingDescription;
-        vertexInputState.vertexBindingDescriptionCount = 1;
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
-
-        VkPipelineColorBlendStateCreateInfo colorBlendState = {};
-        colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlendState.pAttachments = &colorBlendAttachment;
-        colorBlendState.attachmentCount = 1;
-
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-        VkViewport viewport = {};
-        viewport.maxDepth = 1.0;
-
-        VkRect2D scissor = {};
-
-        VkPipelineViewportStateCreateInfo viewportState = {};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.pViewports = &viewport;
-        viewportState.viewportCount = 1;
-        viewportState.pScissors = &scissor;
-        viewportState.scissorCount = 1;
-
-        VkPipelineRasterizationStateCreateInfo rasterizationState = {};
-        rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizationState.cullMode = VK_CULL_MODE_FRONT_BIT;
-        rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-        rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizationState.lineWidth = 1.0f;
-
-        VkPipelineMultisampleStateCreateInfo multisampleState = {};
-        multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-        VkShaderModule vertexShader, fragmentShader;
-
-        // Vertex Shader
-        std::vector<char> vertexCode = read_file("shaders_vulkan/modelViewProj.vert.spv");
+        VkPhysicalDeviceFeatures gpuFeatures;
+        VkPhysicalDeviceProperties gpuProps;
+        vkcontext.vk.vkGetPhysicalDeviceFeatures(vkcontext.gpu, &gpuFeatures);
+        vkcontext.vk.vkGetPhysicalDeviceProperties(vkcontext.gpu, &gpuProps);
+        float maxAnisotropy = gpuFeatures.samplerAnisotropy ? gpuProps.limits.maxSamplerAnisotropy : 0.0f;
+
+        if (!texture_manager_init(&vkcontext.textures, vkcontext.device, vkcontext.gpu, &vkcontext.vk,
+                                  &vkcontext.transferSync, &vkcontext.graphicsSync,
+                                  vkcontext.graphicsIdx, vkcontext.transferIdx, maxAnisotropy))
         {
-            uint32_t lengthInBytes = vertexCode.size();
-
-            VkShaderModuleCreateInfo shaderInfo = {};
-            shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            shaderInfo.pCode = (uint32_t *)vertexCode.data();
-            shaderInfo.codeSize = lengthInBytes;
-            VK_CHECK_FATAL(vkCreateShaderModule(vkcontext.device, &shaderInfo, 0, &vertexShader));
+            return false;
         }
 
-        // Fragment Shader
-        std::vector<char> fragmentCode = read_file("shaders_vulkan/color.frag.spv");
+        // Optional, the cube keeps its vertex colors without it
+        vkcontext.cubeTexture = INVALID_IDX;
+        if (std::filesystem::exists("textures/cube.ktx2"))
         {
-            uint32_t lengthInBytes = fragmentCode.size();
-
-            VkShaderModuleCreateInfo shaderInfo = {};
-            shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            shaderInfo.pCode = (uint32_t *)fragmentCode.data();
-            shaderInfo.codeSize = lengthInBytes;
-            VK_CHECK_FATAL(vkCreateShaderModule(vkcontext.device, &shaderInfo, 0, &fragmentShader));
+            vkcontext.cubeTexture = texture_load(&vkcontext.textures, "textures/cube.ktx2");
         }
 
-        VkPipelineShaderStageCreateInfo vertStage = {};
-        vertStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertStage.pName = "main";
-        vertStage.module = vertexShader;
-
-        VkPipelineShaderStageCreateInfo fragStage = {};
-        fragStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragStage.pName = "main";
-        fragStage.module = fragmentShader;
-
-        VkPipelineShaderStageCreateInfo shaderStages[2]{
-            vertStage,
-            fragStage};
-
-        VkDynamicState dynamicStates[]{
-            VK_DYNAMIC_STATE_VIEWPORT,
-            VK_DYNAMIC_STATE_SCISSOR};
-
-        VkPipelineDynamicStateCreateInfo dynamicState = {};
-        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-        dynamicState.pDynamicStates = dynamicStates;
-        dynamicState.dynamicStateCount = ArraySize(dynamicStates);
-
-        VkGraphicsPipelineCreateInfo pipelineInfo = {};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.renderPass = vkcontext.renderPass;
-        pipelineInfo.pVertexInputState = &vertexInputState;
-        pipelineInfo.pColorBlendState = &colorBlendState;
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizationState;
-        pipelineInfo.pMultisampleState = &multisampleState;
-        pipelineInfo.stageCount = ArraySize(shaderStages);
-        pipelineInfo.pDynamicState = &dynamicState;
-        pipelineInfo.layout = vkcontext.pipeLayout;
-        pipelineInfo.pStages = shaderStages;
-
-        VK_CHECK_FATAL(vkCreateGraphicsPipelines(vkcontext.device, 0, 1, &pipelineInfo, 0, &vkcontext.pipeline));
-
-        vkDestroyShaderModule(vkcontext.device, vertexShader, 0);
-        vkDestroyShaderModule(vkcontext.device, fragmentShader, 0);
+        vkcontext.cubeSampler = sampler_cache_get(
+            &vkcontext.textures.samplers,
+            {VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_TRUE});
     }
 
+    return true;
+}
+
+// Needs the Textures and the Lighting Buffers
+static bool vk_init_descriptors()
+{
     // Create Global Uniform Buffer Object
     {
         vkcontext.globalUBO = vk_allocate_buffer(
             vkcontext.device,
             vkcontext.gpu,
-            sizeof(glm::mat4),
+            sizeof(GlobalUBO),
             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            "Global UBO");
 
-        vk_copy_to_buffer(&vkcontext.globalUBO, &MVP, sizeof(glm::mat4));
+        GlobalUBO globals = {gProjectionMatrix * gViewMatrix, gViewMatrix};
+        vk_copy_to_buffer(&vkcontext.globalUBO, &globals, sizeof(GlobalUBO));
     }
 
     // Create Descriptor Pool
     {
         VkDescriptorPoolSize poolSizes[] = {
-            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2}};
 
         VkDescriptorPoolCreateInfo poolInfo = {};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolInfo.maxSets = 2;
         poolInfo.poolSizeCount = ArraySize(poolSizes);
         poolInfo.pPoolSizes = poolSizes;
-        VK_CHECK_FATAL(vkCreateDescriptorPool(vkcontext.device, &poolInfo, 0, &vkcontext.descPool));
+        VK_CHECK_FATAL(vkcontext.vk.vkCreateDescriptorPool(vkcontext.device, &poolInfo, 0, &vkcontext.descPool));
     }
 
     //HERE: This would need to match the shaders used in the different pieplines, so two Sets
@@ -690,13 +1178,13 @@ bool init_vulkan(GLFWwindow *glfwWindow)
         allocInfo.pSetLayouts = &vkcontext.setLayout;
         allocInfo.descriptorSetCount = 1;
         allocInfo.descriptorPool = vkcontext.descPool;
-        VK_CHECK_FATAL(vkAllocateDescriptorSets(vkcontext.device, &allocInfo, &vkcontext.descSet));
+        VK_CHECK_FATAL(vkcontext.vk.vkAllocateDescriptorSets(vkcontext.device, &allocInfo, &vkcontext.descSet));
 
         // Update Descriptor Set
         {
             VkDescriptorBufferInfo bufferInfo = {};
             bufferInfo.buffer = vkcontext.globalUBO.buffer;
-            bufferInfo.range = sizeof(glm::mat4);
+            bufferInfo.range = sizeof(GlobalUBO);
 
             VkWriteDescriptorSet globalUBOWrite = {};
             globalUBOWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -709,126 +1197,472 @@ bool init_vulkan(GLFWwindow *glfwWindow)
             VkWriteDescriptorSet writes[] = {
                 globalUBOWrite};
 
-            vkUpdateDescriptorSets(vkcontext.device, ArraySize(writes), writes, 0, 0);
+            vkcontext.vk.vkUpdateDescriptorSets(vkcontext.device, ArraySize(writes), writes, 0, 0);
+            vk_write_texture_descriptor();
+            lighting_write_descriptors(&vkcontext.lighting, vkcontext.descSet, 3);
+            shadow_write_descriptors(&vkcontext.shadows, vkcontext.descSet, 7);
         }
     }
 
-    // Create Vertex Buffer
-    {
-        vkcontext.vertexBuffer = vk_allocate_buffer(
-            vkcontext.device,
-            vkcontext.gpu,
-            sizeof(float) * vertices.size(),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    return true;
+}
 
-        // Copy Vertices to the buffer
+static bool vk_init_geometry()
+{
+    // Geometry Arena, the Cube is just the first static mesh
+    {
+        // Streamed meshes are copied in on the Transfer Queue
+        uint32_t queueFamilies[] = {(uint32_t)vkcontext.graphicsIdx, (uint32_t)vkcontext.transferIdx};
+        uint32_t queueFamilyCount = vkcontext.transferIdx != vkcontext.graphicsIdx ? 2 : 1;
+
+        geometry_init(&vkcontext.geometry, vkcontext.device, vkcontext.gpu,
+                      GEOMETRY_MAX_VERTICES, GEOMETRY_MAX_INDICES, GEOMETRY_MAX_DRAWS,
+                      vkcontext.multiDrawSupport, queueFamilies, queueFamilyCount, true);
+
+        vkcontext.cubeMesh = geometry_add_mesh(
+            &vkcontext.geometry,
+            (const VertexColor *)vertices.data(),
+            static_cast<uint32_t>(vertices.size() * sizeof(GLfloat) / sizeof(VertexColor)),
+            indices.data(),
+            static_cast<uint32_t>(indices.size()));
+
+        if (vkcontext.cubeMesh == INVALID_IDX)
         {
-            vk_copy_to_buffer(&vkcontext.vertexBuffer, vertices.data(), sizeof(GLfloat) * vertices.size());
+            return false;
         }
     }
 
-    // Create Index Buffer
+    // Asset Streaming
     {
-        vkcontext.indexBuffer = vk_allocate_buffer(
-            vkcontext.device,
-            vkcontext.gpu,
-            sizeof(GLuint) * indices.size(),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        if (!stream_init(&vkcontext.streamer, vkcontext.device, vkcontext.gpu, &vkcontext.vk,
+                         &vkcontext.geometry, &vkcontext.transferSync, vkcontext.transferIdx))
+        {
+            return false;
+        }
+    }
+
+    // Static arenas, identity unless their part of the scene places them
+    vkcontext.voxelNode = scene_add_node(&gScene, gWorldNode, glm::mat4(1.0f));
+    vkcontext.meshletNode = scene_add_node(&gScene, gWorldNode, glm::mat4(1.0f));
+
+    return true;
+}
+
+// RENDER_VOXELS, the chunks are meshed by the workers over the first frames
+static bool vk_init_voxels()
+{
+    const uint32_t sizeX = 8, sizeY = 3, sizeZ = 8;
+    const float extent = 3.5f; // Of the terrain in x and z, in world units
+
+    voxel_world_init(&vkcontext.voxels, vkcontext.device, vkcontext.gpu, &vkcontext.graphicsSync,
+                     sizeX, sizeY, sizeZ, vkcontext.multiDrawSupport);
+    voxel_generate_terrain(&vkcontext.voxels);
+
+    // Voxels are unit cubes with y up, the camera has x up and looks down -z.
+    // The terrain ends behind the cube, which is drawn over it, and before
+    // the far plane.
+    float scale = extent / (sizeX * VOXEL_CHUNK_SIZE);
+    glm::mat4 local = glm::translate(glm::vec3(-1.5f, 0.0f, -2.8f)) *
+                      glm::rotate(-glm::half_pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f)) *
+                      glm::scale(glm::vec3(scale)) *
+                      glm::translate(glm::vec3(sizeX * VOXEL_CHUNK_SIZE * -0.5f, 0.0f, sizeZ * VOXEL_CHUNK_SIZE * -0.5f));
+    scene_set_local(&gScene, vkcontext.voxelNode, local);
 
-        // Copy Vertices to the buffer
+    return true;
+}
+
+// Meshlets of RENDER_MESHLETS and the benchmarks, empty until meshes are
+// added. Only the culler reads the Hi-Z pyramid, it is created with the
+// first one from the Depth Buffer.
+static bool vk_init_meshlet_culler()
+{
+    if (!vkcontext.hiz.device)
+    {
+        uint32_t queueFamilyCount = 0;
+        VkQueueFamilyProperties queueProps[10];
+        vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, 0);
+        vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, queueProps);
+
+        if (!hiz_init(&vkcontext.hiz, &vkcontext.vk, vkcontext.device, vkcontext.gpu, vkcontext.depthView,
+                      SCREEN_WIDTH, SCREEN_HEIGHT, queueProps[vkcontext.graphicsIdx].timestampValidBits,
+                      "shaders_vulkan/hiz_build.comp.spv"))
         {
-            vk_copy_to_buffer(&vkcontext.indexBuffer, indices.data(), sizeof(GLuint) * indices.size());
+            // Nothing used it yet, the next culler tries again
+            hiz_shutdown(&vkcontext.hiz);
+            return false;
         }
     }
 
+    return meshlet_culler_init(&vkcontext.meshlets, vkcontext.device, vkcontext.gpu, &vkcontext.vk,
+                               vkcontext.multiDrawSupport, vkcontext.meshShaderSupport, &vkcontext.hiz,
+                               "shaders_vulkan/meshlet_cull.comp.spv");
+}
+
+// RENDER_MESHLETS, culled in compute against the Hi-Z pyramid
+static bool vk_init_meshlets()
+{
+    std::vector<VertexColor> vertices;
+    std::vector<uint32_t> indices;
+    meshlet_sphere(128, 256, vertices, indices);
+
+    MeshletMesh mesh;
+    meshlet_build(vertices.data(), vertices.size(), indices.data(), indices.size(), &mesh);
+
+    if (!vk_init_meshlet_culler() ||
+        meshlet_add_mesh(&vkcontext.meshlets, mesh, vertices.data(), vertices.size()) == INVALID_IDX)
+    {
+        return false;
+    }
+
+    // Right of the cube, the camera has x up and -y to the right
+    glm::mat4 local = glm::translate(glm::vec3(0.0f, -1.6f, -1.0f)) * glm::scale(glm::vec3(0.6f));
+    scene_set_local(&gScene, vkcontext.meshletNode, local);
+
+    return true;
+}
+
+// Particles of RENDER_PARTICLES and the benchmark. The passes go to the
+// Compute Queue if it is of another family, so the timestamps have to
+// hold on both queues.
+static bool vk_init_particle_system()
+{
+    uint32_t queueFamilyCount = 0;
+    VkQueueFamilyProperties queueProps[10];
+    vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, 0);
+    vkcontext.vk.vkGetPhysicalDeviceQueueFamilyProperties(vkcontext.gpu, &queueFamilyCount, queueProps);
+    uint32_t graphicsBits = queueProps[vkcontext.graphicsIdx].timestampValidBits;
+    uint32_t computeBits = queueProps[vkcontext.computeIdx].timestampValidBits;
+
+    return particle_system_init(&vkcontext.particles, &vkcontext.vk, vkcontext.device, vkcontext.gpu,
+                                vkcontext.renderPass, &vkcontext.computeSync, vkcontext.graphicsIdx,
+                                vkcontext.computeIdx, graphicsBits < computeBits ? graphicsBits : computeBits,
+                                "shaders_vulkan/particles.comp.spv", "shaders_vulkan/particle.vert.spv",
+                                "shaders_vulkan/particle.frag.spv");
+}
+
+// RENDER_PARTICLES, simulated on the Compute Queue next to the frames
+static bool vk_init_particles()
+{
+    if (!vk_init_particle_system())
+    {
+        return false;
+    }
+
+    // Gravity pulls along -y, which is to the right on screen. The ground
+    // is half a unit below the emitter, clear of the cube.
+    vkcontext.particles.emitter = glm::vec3(0.5f, 1.6f, 0.0f);
+    vkcontext.particles.emitRate = 20000.0f;
+
+    return true;
+}
+
+// Stages in dependency order, see vulkan_startup.h. Shaders compile and the
+// Pipelines and compute passes are created on tasks while the main thread
+// goes on with the Swapchain and the other resources.
+bool init_vulkan(GLFWwindow *glfwWindow, bool validation, uint32_t renderFlags)
+{
+    std::shared_future<bool> shaders = startup_launch("Compile Shaders", vk_compile_shaders).share();
+
+    if (!startup_run("Instance", [validation]() { return vk_init_instance(validation); }) ||
+        !startup_run("Surface", [glfwWindow]() { return vk_init_surface(glfwWindow); }) ||
+        !startup_run("Device", vk_init_device) ||
+        !startup_run("Render Pass", vk_init_render_pass) ||
+        !startup_run("Layouts", vk_init_layouts))
+    {
+        return false;
+    }
+
+    std::future<bool> pipelines = startup_launch("Pipelines", vk_init_pipelines, shaders);
+
+    if (!startup_run("Swapchain", vk_init_swapchain) ||
+        !startup_run("Render Targets", vk_init_targets))
+    {
+        return false;
+    }
+
+    std::future<bool> compute = startup_launch("Compute Passes", vk_init_compute, shaders);
+
+    bool commandsReady = startup_run("Commands", vk_init_commands) && startup_run("Textures", vk_init_textures);
+    if (!compute.get() || !commandsReady ||
+        !startup_run("Descriptors", vk_init_descriptors) ||
+        !startup_run("Geometry", vk_init_geometry) ||
+        !pipelines.get())
+    {
+        return false;
+    }
+
+    if (((renderFlags & RENDER_VOXELS) && !startup_run("Voxels", vk_init_voxels)) ||
+        ((renderFlags & RENDER_MESHLETS) && !startup_run("Meshlets", vk_init_meshlets)) ||
+        ((renderFlags & RENDER_PARTICLES) && !startup_run("Particles", vk_init_particles)))
+    {
+        return false;
+    }
+
+    // Shader Hot Reload
+    {
+        shader_reload_start(&vkcontext.shaderReload, &vkcontext.pipelines,
+                            {"shaders_vulkan/modelViewProj.vert", "shaders_vulkan/modelViewProj.vert.spv"},
+                            {"shaders_vulkan/color.frag", "shaders_vulkan/color.frag.spv"});
+    }
+
     return true;
 }
 
 void render_scene_vulkan()
 {
     uint32_t imgIdx;
+    uint32_t startupStage = startup_frame_begin();
+
+    // We wait on the GPU to be done with the last frame, then the
+    // Command Buffer and the UBO can be reused
+    sync_wait(&vkcontext.graphicsSync, vkcontext.frameValue);
+
+    // Measured GPU time of the last frame decides the resolution of this one
+    drs_update(&vkcontext.resolution, &vkcontext.vk, vkcontext.device);
+    hiz_update(&vkcontext.hiz);
+    lighting_update(&vkcontext.lighting, gViewMatrix, gProjectionMatrix,
+                    vkcontext.resolution.width, vkcontext.resolution.height);
+
+    // With async compute this submits the particle passes of this frame
+    particle_update(&vkcontext.particles);
+
+    // Frame boundary, nothing references the current pipelines anymore
+    pipeline_library_swap(&vkcontext.pipelines);
+
+    memory_update();
+
+    vk_upload_scene(&gScene);
+
+    // Removed meshes are free once their last frame completed, the
+    // indirect buffer isn't read by the GPU anymore either
+    geometry_collect(&vkcontext.geometry, &vkcontext.graphicsSync);
+    stream_update(&vkcontext.streamer);
+    geometry_update(&vkcontext.geometry);
+    geometry_update(&vkcontext.meshlets.arena);
+    voxel_update(&vkcontext.voxels, vkcontext.frameValue);
+
+    // The geometry arena moves with the cube, the voxel chunks and meshlet
+    // meshes stay put and only touch the cascades they reach when they change
+    {
+        ShadowCaster casters[3] = {{&vkcontext.geometry, scene_world(&gScene, gCubeNode)}};
+        uint32_t casterCount = 1;
+        if (vkcontext.voxels.running)
+        {
+            casters[casterCount++] = {&vkcontext.voxels.arena, scene_world(&gScene, vkcontext.voxelNode)};
+        }
+        if (vkcontext.meshlets.device)
+        {
+            casters[casterCount++] = {&vkcontext.meshlets.arena, scene_world(&gScene, vkcontext.meshletNode)};
+        }
+        shadow_update(&vkcontext.shadows, gViewMatrix, gProjectionMatrix, casters, casterCount);
+    }
+
+    // Mip residency of the cube texture, from the size of the cube on screen
+    if (vkcontext.cubeTexture != INVALID_IDX)
+    {
+        glm::vec4 left = MVP * glm::vec4(-0.5f, 0.0f, 0.0f, 1.0f);
+        glm::vec4 right = MVP * glm::vec4(0.5f, 0.0f, 0.0f, 1.0f);
+        float pixels = 0.0f;
+        if (left.w > 0.0f && right.w > 0.0f)
+        {
+            pixels = glm::length(glm::vec2(left) / left.w - glm::vec2(right) / right.w) * 0.5f * SCREEN_WIDTH;
+        }
+        texture_request(&vkcontext.textures, vkcontext.cubeTexture, pixels);
+    }
+
+    if (texture_update(&vkcontext.textures))
+    {
+        vk_write_texture_descriptor();
+    }
 
-    // We wait on the GPU to be done with the work
-    VK_CHECK(vkWaitForFences(vkcontext.device, 1, &vkcontext.imgAvailableFence, VK_TRUE, UINT64_MAX));
-    VK_CHECK(vkResetFences(vkcontext.device, 1, &vkcontext.imgAvailableFence));
+    // Clear Color to Yellow
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color = {0.2f, 0.2f, 0.2f, 1};
+    clearValues[1].depthStencil = {1.0f, 0};
 
-    // Copy Data to buffers
+    // Copy Data to buffers, the world matrices went out with vk_upload_scene()
+    GlobalUBO globals = {gProjectionMatrix * gViewMatrix, gViewMatrix};
     {
-        vk_copy_to_buffer(&vkcontext.globalUBO, &MVP, sizeof(glm::mat4));
+        vk_copy_to_buffer(&vkcontext.globalUBO, &globals, sizeof(GlobalUBO));
     }
 
+    trace_frame_begin(&vkcontext.trace, vkcontext.resolution.width, vkcontext.resolution.height, clearValues[0].color);
+    trace_geometry(&vkcontext.trace, &vkcontext.geometry);
+    trace_ubo(&vkcontext.trace, 0, &globals, sizeof(GlobalUBO));
+
     // This waits on the timeout until the image is ready, if timeout reached -> VK_TIMEOUT
-    VK_CHECK(vkAcquireNextImageKHR(vkcontext.device, vkcontext.swapchain, UINT64_MAX, vkcontext.aquireSemaphore, 0, &imgIdx));
+    VK_CHECK(vkcontext.vk.vkAcquireNextImageKHR(vkcontext.device, vkcontext.swapchain, UINT64_MAX, vkcontext.aquireSemaphore, 0, &imgIdx));
 
     VkCommandBuffer cmd = vkcontext.cmd;
-    vkResetCommandBuffer(cmd, 0);
+    vkcontext.vk.vkResetCommandBuffer(cmd, 0);
 
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+    VK_CHECK(vkcontext.vk.vkBeginCommandBuffer(cmd, &beginInfo));
 
-    // Clear Color to Yellow
-    VkClearValue clearValue = {};
-    clearValue.color = {0.2f, 0.2f, 0.2f, 1};
+    // Meshes added since the last frame, before anything draws the arenas
+    geometry_record_uploads(&vkcontext.geometry, &vkcontext.vk, cmd, &vkcontext.graphicsSync);
+    if (vkcontext.voxels.running)
+    {
+        geometry_record_uploads(&vkcontext.voxels.arena, &vkcontext.vk, cmd, &vkcontext.graphicsSync);
+    }
+    if (vkcontext.meshlets.device)
+    {
+        geometry_record_uploads(&vkcontext.meshlets.arena, &vkcontext.vk, cmd, &vkcontext.graphicsSync);
+    }
+
+    drs_begin(&vkcontext.resolution, &vkcontext.vk, cmd);
+
+    // Light lists for the fragment shader, before any draw
+    lighting_assign(&vkcontext.lighting, cmd);
+
+    // Particle passes, unless they run on the compute queue
+    particle_simulate(&vkcontext.particles, cmd);
+
+    // Cascades that aren't cached, before the scene samples them
+    shadow_render(&vkcontext.shadows, cmd);
+
+    // Outside of the Render Pass, the compute cull writes the draws of this frame
+    if (vkcontext.meshlets.device)
+    {
+        meshlet_cull(&vkcontext.meshlets, cmd, gProjectionMatrix * gViewMatrix * scene_world(&gScene, vkcontext.meshletNode));
+    }
 
     VkRenderPassBeginInfo rpBeginInfo = {};
     rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    rpBeginInfo.renderArea.extent = {SCREEN_WIDTH, SCREEN_HEIGHT};
-    rpBeginInfo.clearValueCount = 1;
-    rpBeginInfo.pClearValues = &clearValue;
+    rpBeginInfo.renderArea.extent = {vkcontext.resolution.width, vkcontext.resolution.height};
+    rpBeginInfo.clearValueCount = ArraySize(clearValues);
+    rpBeginInfo.pClearValues = clearValues;
     rpBeginInfo.renderPass = vkcontext.renderPass;
-    rpBeginInfo.framebuffer = vkcontext.framebuffers[imgIdx];
-    vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    rpBeginInfo.framebuffer = vkcontext.framebuffer;
+    vkcontext.vk.vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
     VkViewport viewport = {};
     viewport.maxDepth = 1.0f;
-    viewport.width = SCREEN_WIDTH;
-    viewport.height = SCREEN_HEIGHT;
+    viewport.width = vkcontext.resolution.width;
+    viewport.height = vkcontext.resolution.height;
 
     VkRect2D scissor = {};
-    scissor.extent.width = SCREEN_WIDTH;
-    scissor.extent.height = SCREEN_HEIGHT;
+    scissor.extent.width = vkcontext.resolution.width;
+    scissor.extent.height = vkcontext.resolution.height;
 
-    vkCmdSetViewport(cmd, 0, 1, &viewport);
-    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    vkcontext.vk.vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkcontext.vk.vkCmdSetScissor(cmd, 0, 1, &scissor);
 
     //HERE: You would bind frontFacePipeline -> vkCmdDrawIndexed
     //HERE: You would bind backFacePipeline -> vkCmdDrawIndexed
     //HERE: You would bind different Descriptor -> bind finalPipeline -> vkCmdDrawIndexed
     // Render Loop
     {
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vkcontext.pipeline);
+        vkcontext.vk.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vkcontext.pipeLayout,
+                                0, 1, &vkcontext.descSet, 0, 0);
 
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(cmd, 0, 1, &vkcontext.vertexBuffer.buffer, offsets);
-        vkCmdBindIndexBuffer(cmd, vkcontext.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+        // The depth tested arenas first, the cube doesn't test depth and
+        // goes over them
+        VkPipeline depthPipeline = pipeline_library_get(&vkcontext.pipelines, vkcontext.depthState, false);
+        DrawConstants draw = {};
 
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vkcontext.pipeLayout,
-                                0, 1, &vkcontext.descSet, 0, 0);
+        // Voxel chunks, one more indirect draw
+        if (vkcontext.voxels.running)
+        {
+            draw.nodeIndex = scene_node_idx(&gScene, vkcontext.voxelNode);
+            vkcontext.vk.vkCmdPushConstants(cmd, vkcontext.pipeLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(draw), &draw);
+            vkcontext.vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPipeline);
+            geometry_draw(&vkcontext.voxels.arena, &vkcontext.vk, cmd);
+        }
+
+        // Meshlets that survived culling, one draw each
+        if (vkcontext.meshlets.device)
+        {
+            draw.nodeIndex = scene_node_idx(&gScene, vkcontext.meshletNode);
+            vkcontext.vk.vkCmdPushConstants(cmd, vkcontext.pipeLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(draw), &draw);
+            vkcontext.vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPipeline);
+            meshlet_draw(&vkcontext.meshlets, &vkcontext.vk, cmd);
+        }
 
-        vkCmdDrawIndexed(cmd, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+        VkPipeline pipeline = pipeline_library_get(&vkcontext.pipelines, vkcontext.pipelineState, false);
+        vkcontext.vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+        // The geometry arena is placed by the node of the cube
+        draw.nodeIndex = scene_node_idx(&gScene, gCubeNode);
+        vkcontext.vk.vkCmdPushConstants(cmd, vkcontext.pipeLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(draw), &draw);
+
+        // All static meshes in one go
+        geometry_draw(&vkcontext.geometry, &vkcontext.vk, cmd);
+
+        trace_pipeline(&vkcontext.trace, vkcontext.pipelineState);
+        trace_draw_geometry(&vkcontext.trace, scene_world(&gScene, gCubeNode));
+
+        // Blended over everything opaque
+        particle_draw(&vkcontext.particles, cmd, gViewMatrix, gProjectionMatrix);
+    }
+
+    vkcontext.vk.vkCmdEndRenderPass(cmd);
+
+    // Occlusion culling, the depth of the early draws becomes the pyramid
+    // for the late phase and for the early phase of the next frame
+    if (vkcontext.meshlets.latePending)
+    {
+        hiz_build(&vkcontext.hiz, cmd, vkcontext.depthImage, vkcontext.resolution.width, vkcontext.resolution.height);
+        meshlet_cull_late(&vkcontext.meshlets, cmd);
+
+        rpBeginInfo.renderPass = vkcontext.renderPassLoad;
+        rpBeginInfo.clearValueCount = 0;
+        rpBeginInfo.pClearValues = 0;
+        vkcontext.vk.vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkcontext.vk.vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkcontext.vk.vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        VkPipeline meshletPipeline = pipeline_library_get(&vkcontext.pipelines, vkcontext.depthState, false);
+        vkcontext.vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipeline);
+        vkcontext.vk.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vkcontext.pipeLayout,
+                                             0, 1, &vkcontext.descSet, 0, 0);
+
+        // The compute passes in between bound other layouts
+        DrawConstants draw = {scene_node_idx(&gScene, vkcontext.meshletNode)};
+        vkcontext.vk.vkCmdPushConstants(cmd, vkcontext.pipeLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(draw), &draw);
+        meshlet_draw_late(&vkcontext.meshlets, &vkcontext.vk, cmd);
+
+        vkcontext.vk.vkCmdEndRenderPass(cmd);
     }
 
-    vkCmdEndRenderPass(cmd);
+    // Upscale into the Swapchain Image
+    drs_end(&vkcontext.resolution, &vkcontext.vk, cmd, vkcontext.scImages[imgIdx]);
+
+    VK_CHECK(vkcontext.vk.vkEndCommandBuffer(cmd));
+
+    // Other work of this frame was added to the batch already, it all goes
+    // out with one vkQueueSubmit and the frame signals the highest value
+    {
+        SyncSubmit *submit = sync_batch_add(&vkcontext.graphicsSync, &vkcontext.frameBatch);
+        sync_submit_add_cmd(submit, cmd);
+        sync_submit_wait_binary(submit, vkcontext.aquireSemaphore, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        sync_submit_signal_binary(submit, vkcontext.submitSemaphore);
+
+        // Already complete, the copies of streamed meshes just have to be visible
+        if (vkcontext.streamer.acquireValue)
+        {
+            sync_submit_wait_queue(submit, &vkcontext.transferSync, vkcontext.streamer.acquireValue,
+                                   VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+        }
+        if (vkcontext.textures.acquireValue)
+        {
+            sync_submit_wait_queue(submit, &vkcontext.transferSync, vkcontext.textures.acquireValue,
+                                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        }
 
-    VK_CHECK(vkEndCommandBuffer(cmd));
+        // Particles of the last async compute passes
+        if (vkcontext.particles.drawWaitValue)
+        {
+            sync_submit_wait_queue(submit, &vkcontext.computeSync, vkcontext.particles.drawWaitValue,
+                                   VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+        }
 
-    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        vkcontext.frameValue = sync_flush(&vkcontext.graphicsSync, &vkcontext.frameBatch);
+    }
 
-    // This call will signal the Fence when the GPU Work is done
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmd;
-    submitInfo.pWaitDstStageMask = &waitStage;
-    submitInfo.pSignalSemaphores = &vkcontext.submitSemaphore;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &vkcontext.aquireSemaphore;
-    submitInfo.waitSemaphoreCount = 1;
-    VK_CHECK(vkQueueSubmit(vkcontext.graphicsQueue, 1, &submitInfo, vkcontext.imgAvailableFence));
+    trace_frame_end(&vkcontext.trace);
 
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -837,5 +1671,61 @@ void render_scene_vulkan()
     presentInfo.pImageIndices = &imgIdx;
     presentInfo.pWaitSemaphores = &vkcontext.submitSemaphore;
     presentInfo.waitSemaphoreCount = 1;
-    vkQueuePresentKHR(vkcontext.graphicsQueue, &presentInfo);
-}
\ No newline at end of file
+    vkcontext.vk.vkQueuePresentKHR(vkcontext.graphicsQueue, &presentInfo);
+
+    // The first time through, this ends the startup trace
+    startup_frame_end(startupStage);
+}
+
+// Records every frame from now on until shutdown_vulkan(), see vulkan_trace.h
+bool capture_vulkan_trace(const char *path)
+{
+    std::lock_guard<std::mutex> lock(vkcontext.pipelines.mutex);
+    return trace_begin(&vkcontext.trace, path, vkcontext.surfaceFormat.format,
+                       vkcontext.resolution.maxWidth, vkcontext.resolution.maxHeight,
+                       vkcontext.pipelines.vertexCode, vkcontext.pipelines.fragmentCode);
+}
+
+void shutdown_vulkan()
+{
+    shader_reload_stop(&vkcontext.shaderReload);
+    trace_end(&vkcontext.trace);
+
+    VK_CHECK(vkcontext.vk.vkDeviceWaitIdle(vkcontext.device));
+
+    pipeline_library_print_stats(&vkcontext.pipelines);
+    memory_print_snapshot(memory_snapshot());
+    stream_print_stats(&vkcontext.streamer);
+    texture_print_stats(&vkcontext.textures);
+    drs_print_stats(&vkcontext.resolution);
+    voxel_print_stats(&vkcontext.voxels);
+    meshlet_print_stats(&vkcontext.meshlets);
+    hiz_print_stats(&vkcontext.hiz);
+    lighting_print_stats(&vkcontext.lighting);
+    shadow_print_stats(&vkcontext.shadows);
+    particle_print_stats(&vkcontext.particles);
+    pipeline_library_shutdown(&vkcontext.pipelines);
+    stream_shutdown(&vkcontext.streamer);
+    texture_manager_shutdown(&vkcontext.textures);
+
+    // The Frame Buffer uses the Depth Buffer and the Dynamic Resolution target
+    vkcontext.vk.vkDestroyFramebuffer(vkcontext.device, vkcontext.framebuffer, 0);
+    vkcontext.vk.vkDestroyRenderPass(vkcontext.device, vkcontext.renderPassLoad, 0);
+    vkcontext.vk.vkDestroyImageView(vkcontext.device, vkcontext.depthView, 0);
+    memory_track_free(vkcontext.depthMemory);
+    vkDestroyImage(vkcontext.device, vkcontext.depthImage, 0);
+    vkFreeMemory(vkcontext.device, vkcontext.depthMemory, 0);
+    drs_shutdown(&vkcontext.resolution, &vkcontext.vk, vkcontext.device);
+    voxel_world_shutdown(&vkcontext.voxels);
+    meshlet_culler_shutdown(&vkcontext.meshlets);
+    hiz_shutdown(&vkcontext.hiz);
+    lighting_shutdown(&vkcontext.lighting);
+    shadow_shutdown(&vkcontext.shadows);
+    particle_system_shutdown(&vkcontext.particles);
+    geometry_destroy(&vkcontext.geometry, vkcontext.device);
+    sync_queue_destroy(&vkcontext.graphicsSync);
+    sync_queue_destroy(&vkcontext.transferSync);
+    sync_queue_destroy(&vkcontext.computeSync);
+}
+
+#include "vulkan_benchmarks.h"
@@ -0,0 +1,325 @@
+#pragma once
+#include <cmath>
+
+// Dynamic resolution. The scene renders into an internal target at a scale
+// of the screen size, a blit then upscales it into the swapchain image. The
+// scale follows the GPU time of the last frame, measured with timestamps,
+// against a target budget. The target is allocated at full size and only the
+// top left part of it is used, so changing the scale costs nothing.
+
+#define DRS_TARGET_MS 16.0f
+#define DRS_MIN_SCALE 0.5f
+#define DRS_MAX_SCALE 1.0f
+#define DRS_HEADROOM 0.9f     // Aim below the budget, GPU times are noisy
+#define DRS_SMOOTHING 0.1f    // Weight of a new measurement
+#define DRS_HYSTERESIS 0.02f  // Smaller changes are ignored
+#define DRS_MAX_STEP 0.05f    // Per frame
+#define DRS_GRANULARITY 8     // Pixels
+#define DRS_HISTORY 512
+
+struct DrsSample
+{
+    float gpuMs;
+    float scale;
+};
+
+struct DynamicResolution
+{
+    // Without timestamps the scale stays at 1
+    bool enabled;
+    float targetMs;
+    float scale;
+    float smoothedMs;
+
+    // Size of the part of the target the scene renders into
+    uint32_t width;
+    uint32_t height;
+    uint32_t maxWidth;
+    uint32_t maxHeight;
+
+    VkImage target;
+    VkDeviceMemory targetMemory;
+    VkImageView targetView;
+    bool blitSupport; // Otherwise copied 1:1 at full scale
+
+    VkQueryPool queryPool;
+    float timestampPeriod; // Nanoseconds per tick
+    uint64_t timestampMask;
+    bool queriesWritten;
+
+    // Ring buffer, newest at historyIdx - 1
+    DrsSample history[DRS_HISTORY];
+    uint32_t historyIdx;
+    uint32_t historyCount;
+};
+
+static void drs_apply_scale(DynamicResolution *drs, float scale)
+{
+    drs->scale = scale;
+
+    // Round to the granularity, odd sizes make the upscale shimmer
+    uint32_t width = (uint32_t)(drs->maxWidth * scale) / DRS_GRANULARITY * DRS_GRANULARITY;
+    uint32_t height = (uint32_t)(drs->maxHeight * scale) / DRS_GRANULARITY * DRS_GRANULARITY;
+    drs->width = width ? width : DRS_GRANULARITY;
+    drs->height = height ? height : DRS_GRANULARITY;
+    drs->width = drs->width > drs->maxWidth ? drs->maxWidth : drs->width;
+    drs->height = drs->height > drs->maxHeight ? drs->maxHeight : drs->height;
+}
+
+static bool drs_init(
+    DynamicResolution *drs,
+    const VkDispatch *vk,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    VkFormat format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t timestampValidBits)
+{
+    drs->maxWidth = width;
+    drs->maxHeight = height;
+    drs->targetMs = DRS_TARGET_MS;
+    drs_apply_scale(drs, 1.0f);
+
+    VkFormatProperties formatProps;
+    vk->vkGetPhysicalDeviceFormatProperties(gpu, format, &formatProps);
+    VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    drs->blitSupport = (formatProps.optimalTilingFeatures & blitFeatures) == blitFeatures;
+
+    // Render Target
+    {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = format;
+        imageInfo.extent = {width, height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VK_CHECK_FATAL(vkCreateImage(device, &imageInfo, 0, &drs->target));
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, drs->target, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = vk_get_memory_type_index(gpu, memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (vkAllocateMemory(device, &allocInfo, 0, &drs->targetMemory) != VK_SUCCESS)
+        {
+            memory_track_failure(allocInfo.allocationSize, allocInfo.memoryTypeIndex, "Render Target");
+            return false;
+        }
+        memory_track_alloc(drs->targetMemory, MEMORY_RESOURCE_IMAGE, allocInfo.allocationSize,
+                           allocInfo.memoryTypeIndex, imageInfo.usage, "Render Target");
+        VK_CHECK_FATAL(vkBindImageMemory(device, drs->target, drs->targetMemory, 0));
+
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = drs->target;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        VK_CHECK_FATAL(vk->vkCreateImageView(device, &viewInfo, 0, &drs->targetView));
+    }
+
+    // Timestamps
+    if (timestampValidBits && drs->blitSupport)
+    {
+        VkPhysicalDeviceProperties gpuProps;
+        vk->vkGetPhysicalDeviceProperties(gpu, &gpuProps);
+        drs->timestampPeriod = gpuProps.limits.timestampPeriod;
+        drs->timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+
+        VkQueryPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = 2;
+        VK_CHECK_FATAL(vk->vkCreateQueryPool(device, &poolInfo, 0, &drs->queryPool));
+
+        drs->enabled = true;
+    }
+    else
+    {
+        std::cerr << "Dynamic Resolution disabled, no GPU Timestamps or Blits" << std::endl;
+    }
+
+    return true;
+}
+
+static void drs_record_sample(DynamicResolution *drs, float gpuMs)
+{
+    drs->history[drs->historyIdx] = {gpuMs, drs->scale};
+    drs->historyIdx = (drs->historyIdx + 1) % DRS_HISTORY;
+    drs->historyCount = drs->historyCount < DRS_HISTORY ? drs->historyCount + 1 : DRS_HISTORY;
+}
+
+// i = 0 is the newest sample, i < historyCount
+static DrsSample drs_history_sample(DynamicResolution *drs, uint32_t i)
+{
+    return drs->history[(drs->historyIdx + DRS_HISTORY - 1 - i) % DRS_HISTORY];
+}
+
+// Call after the last frame was waited on, reads its GPU time and picks the
+// scale of the next frame
+static void drs_update(DynamicResolution *drs, const VkDispatch *vk, VkDevice device)
+{
+    if (!drs->enabled || !drs->queriesWritten)
+    {
+        return;
+    }
+
+    uint64_t timestamps[2];
+    if (vk->vkGetQueryPoolResults(device, drs->queryPool, 0, 2, sizeof(timestamps), timestamps,
+                                  sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    {
+        return;
+    }
+
+    float gpuMs = (float)(((timestamps[1] - timestamps[0]) & drs->timestampMask) * drs->timestampPeriod / 1e6);
+    drs_record_sample(drs, gpuMs);
+
+    // React to spikes right away, but only scale back up slowly
+    drs->smoothedMs = drs->smoothedMs ? drs->smoothedMs + (gpuMs - drs->smoothedMs) * DRS_SMOOTHING : gpuMs;
+    float frameMs = gpuMs > drs->smoothedMs ? gpuMs : drs->smoothedMs;
+
+    // GPU time grows with the pixel count, so with the square of the scale
+    float scale = drs->scale * sqrtf(drs->targetMs * DRS_HEADROOM / (frameMs > 0.01f ? frameMs : 0.01f));
+    scale = scale > drs->scale + DRS_MAX_STEP ? drs->scale + DRS_MAX_STEP : scale;
+    scale = scale < drs->scale - DRS_MAX_STEP ? drs->scale - DRS_MAX_STEP : scale;
+    scale = scale < DRS_MIN_SCALE ? DRS_MIN_SCALE : scale;
+    scale = scale > DRS_MAX_SCALE ? DRS_MAX_SCALE : scale;
+
+    if (fabsf(scale - drs->scale) >= DRS_HYSTERESIS ||
+        (scale != drs->scale && (scale == DRS_MIN_SCALE || scale == DRS_MAX_SCALE)))
+    {
+        drs_apply_scale(drs, scale);
+    }
+}
+
+// Before the render pass
+static void drs_begin(DynamicResolution *drs, const VkDispatch *vk, VkCommandBuffer cmd)
+{
+    if (drs->enabled)
+    {
+        vk->vkCmdResetQueryPool(cmd, drs->queryPool, 0, 2);
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, drs->queryPool, 0);
+    }
+}
+
+// After the render pass, which left the target in TRANSFER_SRC_OPTIMAL.
+// Scales the used part of the target up into the swapchain image and leaves
+// that ready to present.
+static void drs_end(DynamicResolution *drs, const VkDispatch *vk, VkCommandBuffer cmd, VkImage swapchainImage)
+{
+    VkImageMemoryBarrier barriers[2] = {};
+    for (VkImageMemoryBarrier &barrier : barriers)
+    {
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.layerCount = 1;
+    }
+
+    // Rendering has to be done before the blit reads the target
+    barriers[0].image = drs->target;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    // The contents of the last present are overwritten anyway
+    barriers[1].image = swapchainImage;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 2, barriers);
+
+    if (drs->blitSupport)
+    {
+        VkImageBlit blit = {};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.layerCount = 1;
+        blit.srcOffsets[1] = {(int32_t)drs->width, (int32_t)drs->height, 1};
+        blit.dstSubresource = blit.srcSubresource;
+        blit.dstOffsets[1] = {(int32_t)drs->maxWidth, (int32_t)drs->maxHeight, 1};
+
+        vk->vkCmdBlitImage(cmd, drs->target, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1, &blit, VK_FILTER_LINEAR);
+    }
+    else
+    {
+        VkImageCopy copy = {};
+        copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy.srcSubresource.layerCount = 1;
+        copy.dstSubresource = copy.srcSubresource;
+        copy.extent = {drs->maxWidth, drs->maxHeight, 1};
+
+        vk->vkCmdCopyImage(cmd, drs->target, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+    }
+
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = 0;
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, 0, 0, 0, 1, &barriers[1]);
+
+    if (drs->enabled)
+    {
+        vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, drs->queryPool, 1);
+        drs->queriesWritten = true;
+    }
+}
+
+static void drs_print_stats(DynamicResolution *drs)
+{
+    if (!drs->historyCount)
+    {
+        std::cout << "Dynamic Resolution: no samples" << std::endl;
+        return;
+    }
+
+    float totalMs = 0.0f, totalScale = 0.0f, minScale = DRS_MAX_SCALE;
+    uint32_t overBudget = 0;
+    for (uint32_t i = 0; i < drs->historyCount; i++)
+    {
+        DrsSample sample = drs_history_sample(drs, i);
+        totalMs += sample.gpuMs;
+        totalScale += sample.scale;
+        minScale = sample.scale < minScale ? sample.scale : minScale;
+        overBudget += sample.gpuMs > drs->targetMs;
+    }
+
+    std::cout << "Dynamic Resolution: scale " << drs->scale << " (" << drs->width << "x" << drs->height << "), "
+              << "last " << drs->historyCount << " frames: avg GPU " << totalMs / drs->historyCount << "ms of "
+              << drs->targetMs << "ms, avg scale " << totalScale / drs->historyCount << ", min scale " << minScale
+              << ", " << overBudget << " over budget" << std::endl;
+}
+
+// Needs an idle device
+static void drs_shutdown(DynamicResolution *drs, const VkDispatch *vk, VkDevice device)
+{
+    if (drs->queryPool)
+    {
+        vk->vkDestroyQueryPool(device, drs->queryPool, 0);
+    }
+
+    memory_track_free(drs->targetMemory);
+    vk->vkDestroyImageView(device, drs->targetView, 0);
+    vkDestroyImage(device, drs->target, 0);
+    vkFreeMemory(device, drs->targetMemory, 0);
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+// Watches the GLSL sources of the pipelines, recompiles them on a background
+// thread and hands the new SPIR-V to the Pipeline Library, which rebuilds the
+// variants on its workers. The render loop only ever picks up finished
+// pipelines, it never waits on glslc.
+
+#define SHADER_RELOAD_POLL_MS 250
+
+struct WatchedShader
+{
+    const char *glslPath;
+    const char *spvPath;
+    std::filesystem::file_time_type lastWrite;   // Of the source the SPIR-V was compiled from
+    std::filesystem::file_time_type failedWrite; // Of the source that last failed to compile
+};
+
+struct ShaderReloader
+{
+    PipelineLibrary *library;
+    WatchedShader vertShader;
+    WatchedShader fragShader;
+
+    std::thread thread;
+    std::atomic<bool> running;
+
+    std::atomic<uint32_t> reloadCount;
+    std::atomic<uint32_t> failedCount;
+};
+
+static std::filesystem::file_time_type shader_last_write(const char *path)
+{
+    std::error_code err;
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, err);
+
+    // Editors sometimes delete and rewrite the file, just try again next poll
+    return err ? std::filesystem::file_time_type::min() : time;
+}
+
+enum ShaderReloadResult
+{
+    SHADER_RELOAD_UNCHANGED,
+    SHADER_RELOAD_COMPILED,
+    SHADER_RELOAD_FAILED,
+};
+
+// Compiles the shader if its source changed. Only a successful compile
+// counts as seen, a failed one is tried again once the source changes.
+static ShaderReloadResult shader_reload_compile(WatchedShader *shader)
+{
+    std::filesystem::file_time_type time = shader_last_write(shader->glslPath);
+    if (time == std::filesystem::file_time_type::min() || time == shader->lastWrite || time == shader->failedWrite)
+    {
+        return SHADER_RELOAD_UNCHANGED;
+    }
+
+    if (!compile_shader(shader->glslPath, shader->spvPath))
+    {
+        shader->failedWrite = time;
+        return SHADER_RELOAD_FAILED;
+    }
+
+    shader->lastWrite = time;
+    return SHADER_RELOAD_COMPILED;
+}
+
+static void shader_reload_thread(ShaderReloader *reloader)
+{
+    while (reloader->running)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SHADER_RELOAD_POLL_MS));
+
+        // Each shader on its own, a failed compile leaves its previous
+        // SPIR-V untouched and doesn't hold back the other one
+        ShaderReloadResult results[] = {shader_reload_compile(&reloader->vertShader),
+                                        shader_reload_compile(&reloader->fragShader)};
+
+        bool compiled = false;
+        for (ShaderReloadResult result : results)
+        {
+            reloader->failedCount += result == SHADER_RELOAD_FAILED;
+            compiled |= result == SHADER_RELOAD_COMPILED;
+        }
+        if (!compiled)
+        {
+            continue;
+        }
+
+        std::vector<char> vertexCode = read_file(reloader->vertShader.spvPath);
+        std::vector<char> fragmentCode = read_file(reloader->fragShader.spvPath);
+        if (vertexCode.empty() || fragmentCode.empty())
+        {
+            reloader->failedCount++;
+            continue;
+        }
+
+        // Failed variants keep their previous pipeline, see pipeline_library_worker()
+        pipeline_library_rebuild(reloader->library, std::move(vertexCode), std::move(fragmentCode));
+        reloader->reloadCount++;
+    }
+}
+
+static void shader_reload_start(
+    ShaderReloader *reloader,
+    PipelineLibrary *library,
+    WatchedShader vertShader,
+    WatchedShader fragShader)
+{
+    reloader->library = library;
+    reloader->vertShader = vertShader;
+    reloader->fragShader = fragShader;
+    reloader->vertShader.lastWrite = shader_last_write(vertShader.glslPath);
+    reloader->fragShader.lastWrite = shader_last_write(fragShader.glslPath);
+    reloader->vertShader.failedWrite = std::filesystem::file_time_type::min();
+    reloader->fragShader.failedWrite = std::filesystem::file_time_type::min();
+
+    reloader->running = true;
+    reloader->thread = std::thread(shader_reload_thread, reloader);
+}
+
+static void shader_reload_stop(ShaderReloader *reloader)
+{
+    reloader->running = false;
+    if (reloader->thread.joinable())
+    {
+        reloader->thread.join();
+    }
+}
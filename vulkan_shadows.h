@@ -0,0 +1,780 @@
+#pragma once
+#include <cfloat>
+#include <cmath>
+
+// Cascaded shadow maps of a directional light, the sun. The view frustum up
+// to SHADOW_MAX_DISTANCE is split into cascades, each one an orthographic
+// depth map of the casters seen from the sun. All cascades are tiles of one
+// depth atlas, the fragment shader picks the cascade by view depth.
+//
+// A cascade is fitted to the bounding sphere of its frustum slice, so its
+// size doesn't change when the camera turns, and its center is snapped to
+// whole texels of the light space so the shadow edges don't shimmer when
+// the camera moves. The sphere gets SHADOW_CACHE_MARGIN of extra radius and
+// the cascade only moves once its slice leaves it. Until then the cascade
+// keeps its depth map and is only rendered again when the light or one of
+// the casters inside its light space box changed, which the content key of
+// every cascade tracks. A caster outside the box leaves the key alone.
+
+#define SHADOW_CASCADE_COUNT 4
+#define SHADOW_CASCADE_SIZE 1024 // Texels of one cascade in x and y
+#define SHADOW_ATLAS_TILES 2     // Cascades per row of the atlas
+#define SHADOW_ATLAS_SIZE (SHADOW_CASCADE_SIZE * SHADOW_ATLAS_TILES)
+#define SHADOW_MAX_DISTANCE 50.0f   // Cascades end here or at the far plane
+#define SHADOW_SPLIT_LAMBDA 0.75f   // Blend of logarithmic and uniform splits
+#define SHADOW_CACHE_MARGIN 0.25f   // Extra radius a cascade has for the camera to move in
+#define SHADOW_CASTER_DISTANCE 10.0f // How far toward the sun casters outside a cascade are kept
+#define SHADOW_DEPTH_BIAS 1.25f
+#define SHADOW_SLOPE_BIAS 1.75f
+
+// Drawn into the cascades it reaches with the transform it has in the
+// scene. Moving casters change their model every frame, static ones like
+// the voxel chunks only change their arena version.
+struct ShadowCaster
+{
+    GeometryArena *arena;
+    glm::mat4 model;
+};
+
+// Uniform Buffer of color.frag, std140
+struct ShadowData
+{
+    glm::mat4 cascades[SHADOW_CASCADE_COUNT];  // View space to atlas uv and depth
+    glm::vec4 tileRects[SHADOW_CASCADE_COUNT]; // Atlas uv a cascade may sample, min and max
+    glm::vec4 splits;                          // Far view depth of every cascade
+    glm::vec4 sunDirection;                    // View space, toward the sun
+    glm::vec4 sunColor;
+    uint32_t cascadeCount; // 0 without shadows, the sun still lights
+    float texelSize;       // Of the atlas, for the filter taps
+    uint32_t padding[2];
+};
+
+struct ShadowCascade
+{
+    glm::vec3 center;     // Light space, snapped to whole texels
+    float radius;         // Half the extent of the projection
+    glm::mat4 projection; // Light space to the clip space of the cascade
+    uint64_t contentKey;  // Casters and light the depth map holds
+    bool valid;
+    bool render; // In this frame
+};
+
+struct ShadowCascadeStats
+{
+    uint64_t renders;
+    uint64_t hits; // Frames the cached depth map was used as it was
+    uint64_t refits;
+    uint64_t samples; // Renders with a GPU time
+    double renderMs;
+};
+
+struct ShadowStats
+{
+    uint64_t frames;
+    ShadowCascadeStats cascades[SHADOW_CASCADE_COUNT];
+};
+
+struct ShadowMaps
+{
+    VkDevice device;
+    const VkDispatch *vk;
+
+    glm::vec3 lightDirection; // World space, the way the light travels
+    glm::vec3 sunColor;
+    uint32_t cascadeCount; // 0 disables the shadows
+    bool caching;          // Off renders every cascade every frame, the naive baseline
+
+    std::vector<ShadowCaster> casters;
+    ShadowCascade cascades[SHADOW_CASCADE_COUNT];
+    glm::vec3 fittedDirection; // The light space was built for
+    glm::mat4 lightView;
+
+    VkImage atlas;
+    VkDeviceMemory atlasMemory;
+    VkImageView atlasView;
+    VkSampler sampler;
+    VkRenderPass renderPass;
+    VkFramebuffer framebuffer;
+    bool layoutReady;
+    Buffer dataBuffer;
+
+    VkPipelineLayout pipeLayout;
+    VkPipeline pipeline;
+
+    VkQueryPool queryPool;
+    float timestampPeriod;
+    uint64_t timestampMask;
+    bool queriesWritten[SHADOW_CASCADE_COUNT];
+
+    ShadowStats stats;
+};
+
+static bool shadow_init(
+    ShadowMaps *shadows,
+    const VkDispatch *vk,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    uint32_t timestampValidBits,
+    const char *vertexShaderPath)
+{
+    shadows->device = device;
+    shadows->vk = vk;
+    shadows->lightDirection = glm::normalize(glm::vec3(-0.5f, -0.3f, -1.0f));
+    shadows->sunColor = glm::vec3(0.8f, 0.75f, 0.65f);
+    shadows->cascadeCount = SHADOW_CASCADE_COUNT;
+    shadows->caching = true;
+
+    // Atlas, sampled with depth compare by color.frag
+    {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = VK_FORMAT_D32_SFLOAT;
+        imageInfo.extent = {SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VK_CHECK_FATAL(vkCreateImage(device, &imageInfo, 0, &shadows->atlas));
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, shadows->atlas, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = vk_get_memory_type_index(gpu, memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (vkAllocateMemory(device, &allocInfo, 0, &shadows->atlasMemory) != VK_SUCCESS)
+        {
+            memory_track_failure(allocInfo.allocationSize, allocInfo.memoryTypeIndex, "Shadow Atlas");
+            vkDestroyImage(device, shadows->atlas, 0);
+            *shadows = {};
+            return false;
+        }
+        memory_track_alloc(shadows->atlasMemory, MEMORY_RESOURCE_IMAGE, allocInfo.allocationSize,
+                           allocInfo.memoryTypeIndex, imageInfo.usage, "Shadow Atlas");
+        VK_CHECK_FATAL(vkBindImageMemory(device, shadows->atlas, shadows->atlasMemory, 0));
+
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = shadows->atlas;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = VK_FORMAT_D32_SFLOAT;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        VK_CHECK_FATAL(vk->vkCreateImageView(device, &viewInfo, 0, &shadows->atlasView));
+
+        // Linear filtering of depth formats is optional, it gives 2x2 PCF
+        // on top of the taps of the shader
+        VkFormatProperties formatProps;
+        vk->vkGetPhysicalDeviceFormatProperties(gpu, VK_FORMAT_D32_SFLOAT, &formatProps);
+        VkFilter filter = formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+                              ? VK_FILTER_LINEAR
+                              : VK_FILTER_NEAREST;
+
+        VkSamplerCreateInfo samplerInfo = {};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = filter;
+        samplerInfo.minFilter = filter;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.compareEnable = VK_TRUE;
+        samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+        VK_CHECK_FATAL(vkCreateSampler(device, &samplerInfo, 0, &shadows->sampler));
+    }
+
+    // Render Pass, a cascade clears and renders only its tile. Between the
+    // passes the atlas stays readable for the fragment shader.
+    {
+        VkAttachmentDescription depthAttachment = {};
+        depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // Only the render area
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentRef = {};
+        depthAttachmentRef.attachment = 0;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpassDesc = {};
+        subpassDesc.pDepthStencilAttachment = &depthAttachmentRef;
+
+        // Reads of the last frame and writes of the cascade before are done
+        // first, the scene samples the cascade after
+        VkSubpassDependency dependencies[2] = {};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        VkRenderPassCreateInfo rpInfo = {};
+        rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        rpInfo.pAttachments = &depthAttachment;
+        rpInfo.attachmentCount = 1;
+        rpInfo.subpassCount = 1;
+        rpInfo.pSubpasses = &subpassDesc;
+        rpInfo.dependencyCount = ArraySize(dependencies);
+        rpInfo.pDependencies = dependencies;
+        VK_CHECK_FATAL(vk->vkCreateRenderPass(device, &rpInfo, 0, &shadows->renderPass));
+
+        VkFramebufferCreateInfo fbInfo = {};
+        fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        fbInfo.renderPass = shadows->renderPass;
+        fbInfo.pAttachments = &shadows->atlasView;
+        fbInfo.attachmentCount = 1;
+        fbInfo.width = SHADOW_ATLAS_SIZE;
+        fbInfo.height = SHADOW_ATLAS_SIZE;
+        fbInfo.layers = 1;
+        VK_CHECK_FATAL(vk->vkCreateFramebuffer(device, &fbInfo, 0, &shadows->framebuffer));
+    }
+
+    shadows->dataBuffer = vk_allocate_buffer(
+        device, gpu, sizeof(ShadowData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, "Shadow Data");
+    if (!shadows->dataBuffer.data)
+    {
+        std::cerr << "Failed to allocate the Shadow Data" << std::endl;
+        return false;
+    }
+
+    // No cascades until shadow_update(), the sun lights everything and its
+    // direction counts as view space
+    ShadowData *data = (ShadowData *)shadows->dataBuffer.data;
+    *data = {};
+    data->sunDirection = glm::vec4(-shadows->lightDirection, 0.0f);
+    data->sunColor = glm::vec4(shadows->sunColor, 0.0f);
+
+    // Depth only Pipeline, positions of the scene vertices and no fragment shader
+    {
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstant.size = sizeof(glm::mat4);
+
+        VkPipelineLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(vk->vkCreatePipelineLayout(device, &layoutInfo, 0, &shadows->pipeLayout));
+
+        std::vector<char> code = read_file(vertexShaderPath);
+        if (code.empty())
+        {
+            return false;
+        }
+
+        VkShaderModuleCreateInfo shaderInfo = {};
+        shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderInfo.pCode = (uint32_t *)code.data();
+        shaderInfo.codeSize = code.size();
+
+        VkShaderModule shader;
+        VK_CHECK_FATAL(vkCreateShaderModule(device, &shaderInfo, 0, &shader));
+
+        VkPipelineShaderStageCreateInfo shaderStage = {};
+        shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderStage.module = shader;
+        shaderStage.pName = "main";
+
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(VertexColor);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        VkVertexInputAttributeDescription posDescription = {};
+        posDescription.binding = 0;
+        posDescription.location = 0;
+        posDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+        posDescription.offset = offsetof(VertexColor, position);
+
+        VkPipelineVertexInputStateCreateInfo vertexInputState = {};
+        vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputState.vertexBindingDescriptionCount = 1;
+        vertexInputState.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputState.vertexAttributeDescriptionCount = 1;
+        vertexInputState.pVertexAttributeDescriptions = &posDescription;
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        // The scene has both windings, casters are never culled
+        VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+        rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizationState.cullMode = VK_CULL_MODE_NONE;
+        rasterizationState.depthBiasEnable = VK_TRUE;
+        rasterizationState.depthBiasConstantFactor = SHADOW_DEPTH_BIAS;
+        rasterizationState.depthBiasSlopeFactor = SHADOW_SLOPE_BIAS;
+        rasterizationState.lineWidth = 1.0f;
+
+        VkPipelineMultisampleStateCreateInfo multisampleState = {};
+        multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+        depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencilState.depthTestEnable = VK_TRUE;
+        depthStencilState.depthWriteEnable = VK_TRUE;
+        depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS;
+
+        VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+        colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+        VkDynamicState dynamicStates[]{
+            VK_DYNAMIC_STATE_VIEWPORT,
+            VK_DYNAMIC_STATE_SCISSOR};
+
+        VkPipelineDynamicStateCreateInfo dynamicState = {};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.pDynamicStates = dynamicStates;
+        dynamicState.dynamicStateCount = ArraySize(dynamicStates);
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.renderPass = shadows->renderPass;
+        pipelineInfo.pVertexInputState = &vertexInputState;
+        pipelineInfo.pColorBlendState = &colorBlendState;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizationState;
+        pipelineInfo.pMultisampleState = &multisampleState;
+        pipelineInfo.pDepthStencilState = &depthStencilState;
+        pipelineInfo.stageCount = 1;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = shadows->pipeLayout;
+        pipelineInfo.pStages = &shaderStage;
+
+        VkResult result = vkCreateGraphicsPipelines(device, 0, 1, &pipelineInfo, 0, &shadows->pipeline);
+        vkDestroyShaderModule(device, shader, 0);
+
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "Failed to create the Shadow Pipeline" << std::endl;
+            return false;
+        }
+    }
+
+    // Timestamps around every cascade, only for the stats
+    if (timestampValidBits)
+    {
+        VkPhysicalDeviceProperties gpuProps;
+        vk->vkGetPhysicalDeviceProperties(gpu, &gpuProps);
+        shadows->timestampPeriod = gpuProps.limits.timestampPeriod;
+        shadows->timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+
+        VkQueryPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = 2 * SHADOW_CASCADE_COUNT;
+        VK_CHECK_FATAL(vk->vkCreateQueryPool(device, &poolInfo, 0, &shadows->queryPool));
+    }
+
+    return true;
+}
+
+// Bindings firstBinding and firstBinding + 1 of a set the fragment shader
+// reads: the atlas with its compare sampler and the Shadow Data
+static void shadow_write_descriptors(ShadowMaps *shadows, VkDescriptorSet descSet, uint32_t firstBinding)
+{
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = shadows->sampler;
+    imageInfo.imageView = shadows->atlasView;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = shadows->dataBuffer.buffer;
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet writes[2] = {};
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[0].descriptorCount = 1;
+    writes[0].dstBinding = firstBinding;
+    writes[0].pImageInfo = &imageInfo;
+    writes[0].dstSet = descSet;
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writes[1].descriptorCount = 1;
+    writes[1].dstBinding = firstBinding + 1;
+    writes[1].pBufferInfo = &bufferInfo;
+    writes[1].dstSet = descSet;
+    shadows->vk->vkUpdateDescriptorSets(shadows->device, ArraySize(writes), writes, 0, 0);
+}
+
+// FNV-1a, the content key of the cascades
+static uint64_t shadow_hash(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Far view depth of every cascade, practical splits between near and the
+// shadow distance
+static void shadow_splits(const glm::mat4 &projection, uint32_t cascadeCount, float *splits)
+{
+    float nearZ, farZ;
+    lighting_depth_range(projection, &nearZ, &farZ);
+    farZ = farZ < SHADOW_MAX_DISTANCE ? farZ : SHADOW_MAX_DISTANCE;
+
+    for (uint32_t i = 0; i < cascadeCount; i++)
+    {
+        float t = (float)(i + 1) / cascadeCount;
+        float logSplit = nearZ * powf(farZ / nearZ, t);
+        float uniformSplit = nearZ + (farZ - nearZ) * t;
+        splits[i] = SHADOW_SPLIT_LAMBDA * logSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+    }
+}
+
+// Bounding sphere of the frustum slice between two view depths. The center
+// lies on the view axis, so the sphere only depends on the depths and the
+// field of view, never on the camera rotation. The radius is rounded up to
+// keep float noise from changing it.
+static void shadow_slice_sphere(const glm::mat4 &projection, float nearZ, float farZ, float *centerZ, float *radius)
+{
+    float tanX = 1.0f / projection[0][0], tanY = 1.0f / projection[1][1];
+    float k = tanX * tanX + tanY * tanY;
+
+    // Same distance to the corners of both ends, unless that is past the far end
+    float c = (nearZ + farZ) * (1.0f + k) * 0.5f;
+    c = c < farZ ? c : farZ;
+
+    float nearDist = nearZ * nearZ * k + (nearZ - c) * (nearZ - c);
+    float farDist = farZ * farZ * k + (farZ - c) * (farZ - c);
+    *centerZ = c;
+    *radius = ceilf(sqrtf(nearDist > farDist ? nearDist : farDist) * 16.0f) / 16.0f;
+}
+
+// Moves a cascade only once its slice left it. A moved cascade gets the
+// margin around the slice again and snaps to whole texels of its size.
+// Returns true if the cascade moved.
+static bool shadow_fit_cascade(ShadowCascade *cascade, glm::vec3 center, float radius)
+{
+    float maxRadius = radius * (1.0f + 2.0f * SHADOW_CACHE_MARGIN);
+    if (cascade->radius > 0.0f && glm::length(center - cascade->center) + radius <= cascade->radius &&
+        cascade->radius <= maxRadius)
+    {
+        return false;
+    }
+
+    cascade->radius = radius * (1.0f + SHADOW_CACHE_MARGIN);
+    float texel = 2.0f * cascade->radius / SHADOW_CASCADE_SIZE;
+    cascade->center = glm::vec3(floorf(center.x / texel) * texel, floorf(center.y / texel) * texel, center.z);
+
+    // Light space looks down -z, casters toward the sun have a larger z
+    glm::vec3 c = cascade->center;
+    float r = cascade->radius;
+    cascade->projection = glm::orthoRH_ZO(c.x - r, c.x + r, c.y - r, c.y + r,
+                                          -c.z - r - SHADOW_CASTER_DISTANCE, -c.z + r);
+    return true;
+}
+
+// Bounds of the caster arena in light space against the box the cascade
+// renders, which reaches SHADOW_CASTER_DISTANCE further toward the sun
+static bool shadow_caster_in_cascade(const glm::mat4 &lightView, const ShadowCascade &cascade, const ShadowCaster &caster)
+{
+    glm::vec3 boundsMin = caster.arena->boundsMin, boundsMax = caster.arena->boundsMax;
+    if (boundsMin.x > boundsMax.x)
+    {
+        return false;
+    }
+
+    glm::mat4 toLight = lightView * caster.model;
+    glm::vec3 lo = glm::vec3(FLT_MAX), hi = glm::vec3(-FLT_MAX);
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        glm::vec3 corner = glm::vec3(i & 1 ? boundsMax.x : boundsMin.x,
+                                     i & 2 ? boundsMax.y : boundsMin.y,
+                                     i & 4 ? boundsMax.z : boundsMin.z);
+        glm::vec3 p = glm::vec3(toLight * glm::vec4(corner, 1.0f));
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+
+    glm::vec3 c = cascade.center;
+    float r = cascade.radius;
+    return hi.x >= c.x - r && lo.x <= c.x + r &&
+           hi.y >= c.y - r && lo.y <= c.y + r &&
+           hi.z >= c.z - r && lo.z <= c.z + r + SHADOW_CASTER_DISTANCE;
+}
+
+// Call after the last frame was waited on and the caster arenas were
+// updated. Reads the GPU times of the last frame, fits the cascades to the
+// camera and decides which ones shadow_render() renders again.
+static void shadow_update(
+    ShadowMaps *shadows,
+    const glm::mat4 &view,
+    const glm::mat4 &projection,
+    const ShadowCaster *casters,
+    uint32_t casterCount)
+{
+    ShadowStats &stats = shadows->stats;
+    for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+    {
+        if (!shadows->queriesWritten[i])
+        {
+            continue;
+        }
+
+        uint64_t timestamps[2];
+        if (shadows->vk->vkGetQueryPoolResults(shadows->device, shadows->queryPool, 2 * i, 2, sizeof(timestamps), timestamps,
+                                               sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        {
+            stats.cascades[i].samples++;
+            stats.cascades[i].renderMs += ((timestamps[1] - timestamps[0]) & shadows->timestampMask) *
+                                          shadows->timestampPeriod / 1e6;
+        }
+        shadows->queriesWritten[i] = false;
+    }
+
+    ShadowData *data = (ShadowData *)shadows->dataBuffer.data;
+    uint32_t cascadeCount = shadows->cascadeCount < SHADOW_CASCADE_COUNT ? shadows->cascadeCount : SHADOW_CASCADE_COUNT;
+    glm::vec3 lightDirection = glm::normalize(shadows->lightDirection);
+
+    data->sunDirection = glm::vec4(-glm::normalize(glm::mat3(view) * lightDirection), 0.0f);
+    data->sunColor = glm::vec4(shadows->sunColor, 0.0f);
+    data->cascadeCount = cascadeCount;
+    data->texelSize = 1.0f / SHADOW_ATLAS_SIZE;
+    shadows->casters.assign(casters, casters + casterCount);
+    for (ShadowCascade &cascade : shadows->cascades)
+    {
+        cascade.render = false;
+    }
+    if (!cascadeCount)
+    {
+        return;
+    }
+    stats.frames++;
+
+    // A new light space, every cascade has to move
+    if (lightDirection != shadows->fittedDirection)
+    {
+        glm::vec3 up = fabsf(lightDirection.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        shadows->lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+        shadows->fittedDirection = lightDirection;
+        for (ShadowCascade &cascade : shadows->cascades)
+        {
+            cascade.radius = 0.0f;
+        }
+    }
+
+    float splits[SHADOW_CASCADE_COUNT];
+    shadow_splits(projection, cascadeCount, splits);
+
+    float nearZ, farZ;
+    lighting_depth_range(projection, &nearZ, &farZ);
+    glm::mat4 invView = glm::inverse(view);
+
+    for (uint32_t i = 0; i < cascadeCount; i++)
+    {
+        ShadowCascade &cascade = shadows->cascades[i];
+
+        float centerZ, radius;
+        shadow_slice_sphere(projection, i ? splits[i - 1] : nearZ, splits[i], &centerZ, &radius);
+        glm::vec3 center = glm::vec3(shadows->lightView * invView * glm::vec4(0.0f, 0.0f, -centerZ, 1.0f));
+
+        bool moved = shadow_fit_cascade(&cascade, center, radius);
+        stats.cascades[i].refits += moved;
+
+        // Everything the depth map depends on besides its projection. Arenas
+        // only change their version when meshes were added, removed or moved.
+        uint64_t contentKey = shadow_hash(14695981039346656037ull, &lightDirection, sizeof(lightDirection));
+        for (uint32_t j = 0; j < casterCount; j++)
+        {
+            if (!shadow_caster_in_cascade(shadows->lightView, cascade, casters[j]))
+            {
+                continue;
+            }
+            contentKey = shadow_hash(contentKey, &casters[j].arena, sizeof(casters[j].arena));
+            contentKey = shadow_hash(contentKey, &casters[j].arena->version, sizeof(casters[j].arena->version));
+            contentKey = shadow_hash(contentKey, &casters[j].model, sizeof(casters[j].model));
+        }
+
+        cascade.render = !shadows->caching || moved || !cascade.valid || cascade.contentKey != contentKey;
+        cascade.contentKey = contentKey;
+        stats.cascades[i].hits += !cascade.render;
+
+        // View space to the tile of the cascade, uv = ndc * 0.5 + 0.5 like the scene
+        glm::vec2 tile = glm::vec2(i % SHADOW_ATLAS_TILES, i / SHADOW_ATLAS_TILES) / (float)SHADOW_ATLAS_TILES;
+        float tileScale = 0.5f / SHADOW_ATLAS_TILES;
+        glm::mat4 toTile = glm::translate(glm::vec3(tile + tileScale, 0.0f)) * glm::scale(glm::vec3(tileScale, tileScale, 1.0f));
+
+        float halfTexel = 0.5f / SHADOW_ATLAS_SIZE;
+        data->cascades[i] = toTile * cascade.projection * shadows->lightView * invView;
+        data->tileRects[i] = glm::vec4(tile + halfTexel, tile + 1.0f / SHADOW_ATLAS_TILES - halfTexel);
+        data->splits[i] = splits[i];
+    }
+}
+
+// Before the Render Pass of the scene, after shadow_update(). Renders the
+// cascades that aren't cached, every cascade is its own pass on its tile.
+static void shadow_render(ShadowMaps *shadows, VkCommandBuffer cmd)
+{
+    const VkDispatch *vk = shadows->vk;
+
+    // The Render Pass starts and ends readable, the first time the atlas
+    // has no layout yet
+    if (!shadows->layoutReady)
+    {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.image = shadows->atlas;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.layerCount = 1;
+        vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                 0, 0, 0, 0, 0, 1, &barrier);
+        shadows->layoutReady = true;
+    }
+
+    VkClearValue clearValue = {};
+    clearValue.depthStencil = {1.0f, 0};
+
+    for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+    {
+        ShadowCascade &cascade = shadows->cascades[i];
+        if (!cascade.render)
+        {
+            continue;
+        }
+
+        if (shadows->queryPool)
+        {
+            vk->vkCmdResetQueryPool(cmd, shadows->queryPool, 2 * i, 2);
+            vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, shadows->queryPool, 2 * i);
+        }
+
+        VkRect2D tile = {};
+        tile.offset = {(int32_t)(i % SHADOW_ATLAS_TILES * SHADOW_CASCADE_SIZE), (int32_t)(i / SHADOW_ATLAS_TILES * SHADOW_CASCADE_SIZE)};
+        tile.extent = {SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE};
+
+        VkRenderPassBeginInfo rpBeginInfo = {};
+        rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        rpBeginInfo.renderArea = tile;
+        rpBeginInfo.clearValueCount = 1;
+        rpBeginInfo.pClearValues = &clearValue;
+        rpBeginInfo.renderPass = shadows->renderPass;
+        rpBeginInfo.framebuffer = shadows->framebuffer;
+        vk->vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        VkViewport viewport = {};
+        viewport.x = tile.offset.x;
+        viewport.y = tile.offset.y;
+        viewport.width = SHADOW_CASCADE_SIZE;
+        viewport.height = SHADOW_CASCADE_SIZE;
+        viewport.maxDepth = 1.0f;
+        vk->vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vk->vkCmdSetScissor(cmd, 0, 1, &tile);
+
+        vk->vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadows->pipeline);
+        for (ShadowCaster &caster : shadows->casters)
+        {
+            // Not part of the content key either
+            if (!shadow_caster_in_cascade(shadows->lightView, cascade, caster))
+            {
+                continue;
+            }
+
+            glm::mat4 lightMVP = cascade.projection * shadows->lightView * caster.model;
+            vk->vkCmdPushConstants(cmd, shadows->pipeLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(lightMVP), &lightMVP);
+            geometry_draw(caster.arena, vk, cmd);
+        }
+
+        vk->vkCmdEndRenderPass(cmd);
+
+        if (shadows->queryPool)
+        {
+            vk->vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, shadows->queryPool, 2 * i + 1);
+            shadows->queriesWritten[i] = true;
+        }
+
+        cascade.valid = true;
+        shadows->stats.cascades[i].renders++;
+    }
+}
+
+static void shadow_print_stats(ShadowMaps *shadows)
+{
+    ShadowStats &stats = shadows->stats;
+    if (!stats.frames)
+    {
+        return;
+    }
+
+    std::cout << "Shadows: " << shadows->cascadeCount << " cascades of " << SHADOW_CASCADE_SIZE << "x" << SHADOW_CASCADE_SIZE
+              << " in a " << SHADOW_ATLAS_SIZE << "x" << SHADOW_ATLAS_SIZE << " atlas, " << stats.frames << " frames, caching "
+              << (shadows->caching ? "on" : "off") << std::endl;
+    for (uint32_t i = 0; i < shadows->cascadeCount && i < SHADOW_CASCADE_COUNT; i++)
+    {
+        ShadowCascadeStats &cascade = stats.cascades[i];
+        std::cout << "    Cascade " << i << ": " << cascade.renders << " renders, " << cascade.hits << " cached ("
+                  << 100.0 * cascade.hits / stats.frames << "% hit rate), " << cascade.refits << " refits";
+        if (cascade.samples)
+        {
+            std::cout << ", render avg GPU " << cascade.renderMs / cascade.samples << "ms";
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Needs an idle device
+static void shadow_shutdown(ShadowMaps *shadows)
+{
+    if (!shadows->device)
+    {
+        return;
+    }
+
+    VkDevice device = shadows->device;
+    const VkDispatch *vk = shadows->vk;
+    if (shadows->queryPool)
+    {
+        vk->vkDestroyQueryPool(device, shadows->queryPool, 0);
+    }
+
+    vkDestroyPipeline(device, shadows->pipeline, 0);
+    vkDestroyPipelineLayout(device, shadows->pipeLayout, 0);
+    vk->vkDestroyFramebuffer(device, shadows->framebuffer, 0);
+    vkDestroyRenderPass(device, shadows->renderPass, 0);
+    vkDestroySampler(device, shadows->sampler, 0);
+    vk->vkDestroyImageView(device, shadows->atlasView, 0);
+    vk_free_buffer(device, &shadows->dataBuffer);
+
+    memory_track_free(shadows->atlasMemory);
+    vkDestroyImage(device, shadows->atlas, 0);
+    vkFreeMemory(device, shadows->atlasMemory, 0);
+
+    *shadows = {};
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Timeline of the startup up to the first presented frame. init_vulkan() is
+// split into stages, some of them run as tasks next to the main thread. Every
+// stage records when it started and ended relative to startup_begin(), the
+// trace is printed once the first frame was presented.
+
+#define STARTUP_NO_STAGE UINT32_MAX
+
+struct StartupStage
+{
+    const char *name;
+    std::thread::id thread;
+    double startMs;
+    double endMs;
+};
+
+struct StartupTrace
+{
+    std::chrono::high_resolution_clock::time_point startTime;
+    bool running; // From startup_begin() until the first frame
+
+    // Tasks record their stages too
+    std::mutex mutex;
+    std::vector<StartupStage> stages;
+    std::thread::id mainThread;
+};
+
+static StartupTrace gStartupTrace;
+
+static double startup_ms()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - gStartupTrace.startTime).count();
+}
+
+// As early as possible in main()
+static void startup_begin()
+{
+    gStartupTrace.startTime = std::chrono::high_resolution_clock::now();
+    gStartupTrace.mainThread = std::this_thread::get_id();
+    gStartupTrace.running = true;
+}
+
+static uint32_t startup_stage_begin(const char *name)
+{
+    std::lock_guard<std::mutex> lock(gStartupTrace.mutex);
+    if (!gStartupTrace.running)
+    {
+        return STARTUP_NO_STAGE;
+    }
+
+    gStartupTrace.stages.push_back({name, std::this_thread::get_id(), startup_ms(), 0.0});
+    return gStartupTrace.stages.size() - 1;
+}
+
+static void startup_stage_end(uint32_t stage)
+{
+    if (stage == STARTUP_NO_STAGE)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(gStartupTrace.mutex);
+    gStartupTrace.stages[stage].endMs = startup_ms();
+}
+
+// Runs one stage of the startup on the calling thread
+template <typename Stage>
+static bool startup_run(const char *name, Stage stage)
+{
+    uint32_t idx = startup_stage_begin(name);
+    bool result = stage();
+    startup_stage_end(idx);
+    return result;
+}
+
+// Runs a stage on its own thread, the future has its result. A stage that
+// depends on others waits for them first, that wait isn't part of its time.
+template <typename Stage>
+static std::future<bool> startup_launch(const char *name, Stage stage, std::shared_future<bool> dependency = {})
+{
+    auto task = [name, stage, dependency]()
+    {
+        if (dependency.valid() && !dependency.get())
+        {
+            return false;
+        }
+        return startup_run(name, stage);
+    };
+    return std::async(std::launch::async, task);
+}
+
+// Stages in the order they started. Their summed time against the time to
+// the first frame shows how much ran in parallel.
+static void startup_print()
+{
+    std::lock_guard<std::mutex> lock(gStartupTrace.mutex);
+
+    double endMs = 0.0, stageMs = 0.0;
+    std::vector<std::thread::id> threads = {gStartupTrace.mainThread};
+    for (StartupStage &stage : gStartupTrace.stages)
+    {
+        endMs = stage.endMs > endMs ? stage.endMs : endMs;
+        stageMs += stage.endMs - stage.startMs;
+        if (std::find(threads.begin(), threads.end(), stage.thread) == threads.end())
+        {
+            threads.push_back(stage.thread);
+        }
+    }
+
+    std::cout << "Startup: first frame after " << endMs << "ms, stages took " << stageMs << "ms in total on "
+              << threads.size() << " threads" << std::endl;
+    for (StartupStage &stage : gStartupTrace.stages)
+    {
+        uint32_t thread = std::find(threads.begin(), threads.end(), stage.thread) - threads.begin();
+        std::cout << "    " << stage.name << ": " << stage.startMs << "ms - " << stage.endMs << "ms, took "
+                  << stage.endMs - stage.startMs << "ms on " << (thread ? "task " + std::to_string(thread) : "main")
+                  << std::endl;
+    }
+}
+
+// Around the first frame, ends the trace once it was presented
+static uint32_t startup_frame_begin()
+{
+    return startup_stage_begin("First Frame");
+}
+
+static void startup_frame_end(uint32_t stage)
+{
+    if (stage == STARTUP_NO_STAGE)
+    {
+        return;
+    }
+
+    startup_stage_end(stage);
+    {
+        std::lock_guard<std::mutex> lock(gStartupTrace.mutex);
+        gStartupTrace.running = false;
+    }
+    startup_print();
+}
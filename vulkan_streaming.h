@@ -0,0 +1,557 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Loads meshes without blocking the render loop. Files are read by a pool of
+// I/O threads, decoded into staging buffers by workers and copied into the
+// Geometry Arena on the transfer queue. Every asset signals its own
+// completion, a mesh gets drawn from the first frame after its copy finished.
+
+#define STREAM_IO_THREADS 2
+#define STREAM_MAX_DECODE_THREADS 4
+#define STREAM_UPLOAD_SLOTS 4
+#define STREAM_UPLOAD_BUDGET (16 * 1024 * 1024) // Bytes per frame
+
+enum StreamState
+{
+    STREAM_STATE_QUEUED,
+    STREAM_STATE_READING,
+    STREAM_STATE_DECODING,
+    STREAM_STATE_WAITING_UPLOAD,
+    STREAM_STATE_UPLOADING,
+    STREAM_STATE_READY,
+    STREAM_STATE_FAILED,
+};
+
+struct StreamAsset
+{
+    std::string path;
+    std::atomic<uint32_t> state;
+
+    // Filled in by the I/O and decode threads
+    std::vector<char> fileData;
+    Buffer staging; // Vertices, followed by the Indices
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    double readMs;
+    double decodeMs;
+
+    // INVALID_IDX until the asset is ready
+    uint32_t meshId;
+};
+
+// One transfer submission, reused once its value completed
+struct StreamUpload
+{
+    VkCommandBuffer cmd;
+    uint64_t value; // 0 means free
+    std::vector<StreamAsset *> assets;
+};
+
+struct StreamStats
+{
+    uint32_t assetsReady;
+    uint32_t assetsFailed;
+    uint64_t bytesRead;
+    uint64_t bytesUploaded;
+    double totalReadMs;
+    double totalDecodeMs;
+};
+
+struct Streamer
+{
+    VkDevice device;
+    VkPhysicalDevice gpu;
+    const VkDispatch *vk;
+    GeometryArena *arena;
+    SyncQueue *transferSync;
+    VkCommandPool commandPool;
+    StreamUpload uploads[STREAM_UPLOAD_SLOTS];
+    SyncBatch batch;
+
+    // Transfer value of the newest committed meshes, the frame waits on it
+    uint64_t acquireValue;
+
+    std::vector<std::thread> ioThreads;
+    std::vector<std::thread> decodeThreads;
+    std::mutex mutex;
+    std::condition_variable readAvailable;
+    std::condition_variable decodeAvailable;
+    bool running;
+
+    // Everything below is guarded by the mutex, a deque never moves its elements
+    std::deque<StreamAsset> assets;
+    std::deque<StreamAsset *> readQueue;
+    std::deque<StreamAsset *> decodeQueue;
+    std::deque<StreamAsset *> uploadQueue;
+    StreamStats stats;
+};
+
+static double stream_ms(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Unlike read_file() this runs on worker threads, so it reports errors instead of throwing
+static bool stream_read_file(const char *path, std::vector<char> &data)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open Asset: " << path << std::endl;
+        return false;
+    }
+
+    data.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(data.data(), data.size());
+
+    // The decoder relies on the terminator
+    data.push_back(0);
+    return true;
+}
+
+// Wavefront OBJ with optional vertex colors ("v x y z r g b"), polygons are
+// triangulated as fans. Everything besides v and f is skipped.
+static bool stream_decode_obj(
+    const char *text,
+    std::vector<VertexColor> &vertices,
+    std::vector<uint32_t> &indices)
+{
+    const char *c = text;
+    while (*c)
+    {
+        if (c[0] == 'v' && c[1] == ' ')
+        {
+            char *end = (char *)c + 1;
+            float values[6] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+            for (uint32_t i = 0; i < 6 && *end != '\n' && *end != '\r' && *end; i++)
+            {
+                values[i] = strtof(end, &end);
+            }
+
+            vertices.push_back({{values[0], values[1], values[2]}, {values[3], values[4], values[5]}});
+            c = end;
+        }
+        else if (c[0] == 'f' && c[1] == ' ')
+        {
+            char *end = (char *)c + 1;
+            uint32_t polygon[32];
+            uint32_t cornerCount = 0;
+            while (*end && *end != '\n' && *end != '\r')
+            {
+                char *start = end;
+                long idx = strtol(start, &end, 10);
+                if (end == start)
+                {
+                    end++;
+                    continue;
+                }
+
+                // Skip texture coordinate and normal indices
+                while (*end == '/' || (*end >= '0' && *end <= '9') || *end == '-')
+                {
+                    end++;
+                }
+
+                // Negative indices are relative to the end
+                idx = idx < 0 ? (long)vertices.size() + idx : idx - 1;
+                if (idx < 0 || idx >= (long)vertices.size() || cornerCount >= ArraySize(polygon))
+                {
+                    return false;
+                }
+                polygon[cornerCount++] = (uint32_t)idx;
+            }
+
+            for (uint32_t i = 2; i < cornerCount; i++)
+            {
+                indices.push_back(polygon[0]);
+                indices.push_back(polygon[i - 1]);
+                indices.push_back(polygon[i]);
+            }
+            c = end;
+        }
+
+        // Next line
+        while (*c && *c != '\n')
+        {
+            c++;
+        }
+        if (*c)
+        {
+            c++;
+        }
+    }
+
+    return vertices.size() && indices.size();
+}
+
+static void stream_io_thread(Streamer *streamer)
+{
+    std::unique_lock<std::mutex> lock(streamer->mutex);
+
+    while (true)
+    {
+        streamer->readAvailable.wait(lock, [streamer]
+                                     { return !streamer->running || !streamer->readQueue.empty(); });
+        if (!streamer->running)
+        {
+            return;
+        }
+
+        StreamAsset *asset = streamer->readQueue.front();
+        streamer->readQueue.pop_front();
+        asset->state = STREAM_STATE_READING;
+
+        lock.unlock();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        bool success = stream_read_file(asset->path.c_str(), asset->fileData);
+        asset->readMs = stream_ms(start);
+
+        lock.lock();
+
+        if (!success)
+        {
+            asset->state = STREAM_STATE_FAILED;
+            streamer->stats.assetsFailed++;
+            continue;
+        }
+
+        streamer->stats.bytesRead += asset->fileData.size() - 1;
+        streamer->stats.totalReadMs += asset->readMs;
+
+        asset->state = STREAM_STATE_DECODING;
+        streamer->decodeQueue.push_back(asset);
+        streamer->decodeAvailable.notify_one();
+    }
+}
+
+static void stream_decode_thread(Streamer *streamer)
+{
+    std::unique_lock<std::mutex> lock(streamer->mutex);
+
+    while (true)
+    {
+        streamer->decodeAvailable.wait(lock, [streamer]
+                                       { return !streamer->running || !streamer->decodeQueue.empty(); });
+        if (!streamer->running)
+        {
+            return;
+        }
+
+        StreamAsset *asset = streamer->decodeQueue.front();
+        streamer->decodeQueue.pop_front();
+
+        lock.unlock();
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<VertexColor> vertices;
+        std::vector<uint32_t> indices;
+        bool success = stream_decode_obj(asset->fileData.data(), vertices, indices);
+        asset->fileData = std::vector<char>();
+
+        if (success)
+        {
+            uint32_t vertexBytes = vertices.size() * sizeof(VertexColor);
+            uint32_t indexBytes = indices.size() * sizeof(uint32_t);
+
+            // Device level creation functions are thread safe
+            asset->staging = vk_allocate_buffer(
+                streamer->device, streamer->gpu, vertexBytes + indexBytes,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                "Stream Staging");
+
+            success = asset->staging.data != 0;
+            if (success)
+            {
+                memcpy(asset->staging.data, vertices.data(), vertexBytes);
+                memcpy((char *)asset->staging.data + vertexBytes, indices.data(), indexBytes);
+                asset->vertexCount = vertices.size();
+                asset->indexCount = indices.size();
+            }
+        }
+        else
+        {
+            std::cerr << "Failed to decode Asset: " << asset->path << std::endl;
+        }
+
+        asset->decodeMs = stream_ms(start);
+
+        lock.lock();
+
+        if (!success)
+        {
+            asset->state = STREAM_STATE_FAILED;
+            streamer->stats.assetsFailed++;
+            continue;
+        }
+
+        streamer->stats.totalDecodeMs += asset->decodeMs;
+
+        asset->state = STREAM_STATE_WAITING_UPLOAD;
+        streamer->uploadQueue.push_back(asset);
+    }
+}
+
+static bool stream_init(
+    Streamer *streamer,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    const VkDispatch *vk,
+    GeometryArena *arena,
+    SyncQueue *transferSync,
+    uint32_t transferIdx)
+{
+    streamer->device = device;
+    streamer->gpu = gpu;
+    streamer->vk = vk;
+    streamer->arena = arena;
+    streamer->transferSync = transferSync;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = transferIdx;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VK_CHECK_FATAL(vk->vkCreateCommandPool(device, &poolInfo, 0, &streamer->commandPool));
+
+    for (uint32_t i = 0; i < STREAM_UPLOAD_SLOTS; i++)
+    {
+        VkCommandBufferAllocateInfo allocInfo = cmd_alloc_info(streamer->commandPool);
+        VK_CHECK_FATAL(vk->vkAllocateCommandBuffers(device, &allocInfo, &streamer->uploads[i].cmd));
+    }
+
+    // Reading mostly waits on the disk, decoding is what needs the cores
+    uint32_t decodeCount = std::thread::hardware_concurrency();
+    decodeCount = decodeCount > 2 ? decodeCount - 2 : 1;
+    decodeCount = decodeCount > STREAM_MAX_DECODE_THREADS ? STREAM_MAX_DECODE_THREADS : decodeCount;
+
+    streamer->running = true;
+    for (uint32_t i = 0; i < STREAM_IO_THREADS; i++)
+    {
+        streamer->ioThreads.push_back(std::thread(stream_io_thread, streamer));
+    }
+    for (uint32_t i = 0; i < decodeCount; i++)
+    {
+        streamer->decodeThreads.push_back(std::thread(stream_decode_thread, streamer));
+    }
+
+    return true;
+}
+
+// Returns the asset id, poll stream_state() for completion
+static uint32_t stream_mesh(Streamer *streamer, const char *path)
+{
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+
+    streamer->assets.emplace_back();
+    StreamAsset *asset = &streamer->assets.back();
+    asset->path = path;
+    asset->state = STREAM_STATE_QUEUED;
+    asset->meshId = INVALID_IDX;
+
+    streamer->readQueue.push_back(asset);
+    streamer->readAvailable.notify_one();
+
+    return streamer->assets.size() - 1;
+}
+
+static StreamState stream_state(Streamer *streamer, uint32_t assetId)
+{
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+    return (StreamState)streamer->assets[assetId].state.load();
+}
+
+// The id in the Geometry Arena, INVALID_IDX until the asset is ready
+static uint32_t stream_mesh_id(Streamer *streamer, uint32_t assetId)
+{
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+    StreamAsset &asset = streamer->assets[assetId];
+    return asset.state == STREAM_STATE_READY ? asset.meshId : INVALID_IDX;
+}
+
+// Call once per frame on the render thread, before geometry_update(). Commits
+// finished uploads to the Geometry Arena and submits new ones up to
+// STREAM_UPLOAD_BUDGET bytes.
+static void stream_update(Streamer *streamer)
+{
+    const VkDispatch *vk = streamer->vk;
+
+    // Finished Uploads
+    for (uint32_t i = 0; i < STREAM_UPLOAD_SLOTS; i++)
+    {
+        StreamUpload &upload = streamer->uploads[i];
+        if (!upload.value || !sync_is_complete(streamer->transferSync, upload.value))
+        {
+            continue;
+        }
+
+        for (StreamAsset *asset : upload.assets)
+        {
+            geometry_commit_mesh(streamer->arena, asset->meshId);
+            vk_free_buffer(streamer->device, &asset->staging);
+            asset->state = STREAM_STATE_READY;
+        }
+
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+        streamer->stats.assetsReady += upload.assets.size();
+
+        streamer->acquireValue = upload.value > streamer->acquireValue ? upload.value : streamer->acquireValue;
+        upload.value = 0;
+        upload.assets.clear();
+    }
+
+    StreamUpload *upload = 0;
+    for (uint32_t i = 0; i < STREAM_UPLOAD_SLOTS; i++)
+    {
+        if (!streamer->uploads[i].value)
+        {
+            upload = &streamer->uploads[i];
+            break;
+        }
+    }
+
+    if (!upload)
+    {
+        return;
+    }
+
+    // Take what fits into the budget, but at least one asset
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+
+        uint64_t bytes = 0;
+        while (!streamer->uploadQueue.empty() &&
+               (!upload->assets.size() || bytes + streamer->uploadQueue.front()->staging.size <= STREAM_UPLOAD_BUDGET))
+        {
+            StreamAsset *asset = streamer->uploadQueue.front();
+            streamer->uploadQueue.pop_front();
+
+            bytes += asset->staging.size;
+            upload->assets.push_back(asset);
+        }
+
+        if (!upload->assets.size())
+        {
+            return;
+        }
+    }
+
+    VkCommandBuffer cmd = upload->cmd;
+    vk->vkResetCommandBuffer(cmd, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vk->vkBeginCommandBuffer(cmd, &beginInfo));
+
+    uint64_t bytesUploaded = 0;
+    uint32_t failedCount = 0;
+    for (uint32_t i = 0; i < upload->assets.size();)
+    {
+        StreamAsset *asset = upload->assets[i];
+
+        asset->meshId = geometry_reserve_mesh(streamer->arena, asset->vertexCount, asset->indexCount);
+        if (asset->meshId == INVALID_IDX)
+        {
+            vk_free_buffer(streamer->device, &asset->staging);
+            asset->state = STREAM_STATE_FAILED;
+            failedCount++;
+
+            upload->assets[i] = upload->assets.back();
+            upload->assets.pop_back();
+            continue;
+        }
+
+        GeometryMesh &mesh = streamer->arena->meshes[asset->meshId];
+        uint32_t vertexBytes = asset->vertexCount * sizeof(VertexColor);
+        geometry_write_host(streamer->arena, asset->meshId, (const VertexColor *)asset->staging.data,
+                            (const uint32_t *)((const char *)asset->staging.data + vertexBytes));
+        geometry_mesh_bounds(streamer->arena, asset->meshId, (const VertexColor *)asset->staging.data);
+
+        VkBufferCopy vertexCopy = {};
+        vertexCopy.size = vertexBytes;
+        vertexCopy.dstOffset = mesh.vertexOffset * sizeof(VertexColor);
+        vk->vkCmdCopyBuffer(cmd, asset->staging.buffer, streamer->arena->vertexBuffer.buffer, 1, &vertexCopy);
+
+        VkBufferCopy indexCopy = {};
+        indexCopy.srcOffset = vertexBytes;
+        indexCopy.size = asset->indexCount * sizeof(uint32_t);
+        indexCopy.dstOffset = mesh.firstIndex * sizeof(uint32_t);
+        vk->vkCmdCopyBuffer(cmd, asset->staging.buffer, streamer->arena->indexBuffer.buffer, 1, &indexCopy);
+
+        asset->state = STREAM_STATE_UPLOADING;
+        bytesUploaded += vertexCopy.size + indexCopy.size;
+        i++;
+    }
+
+    VK_CHECK(vk->vkEndCommandBuffer(cmd));
+
+    if (upload->assets.size())
+    {
+        SyncSubmit *submit = sync_batch_add(streamer->transferSync, &streamer->batch);
+        sync_submit_add_cmd(submit, cmd);
+        upload->value = sync_flush(streamer->transferSync, &streamer->batch);
+    }
+
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+    streamer->stats.bytesUploaded += bytesUploaded;
+    streamer->stats.assetsFailed += failedCount;
+}
+
+// True once every requested asset is ready or failed
+static bool stream_idle(Streamer *streamer)
+{
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+    return streamer->stats.assetsReady + streamer->stats.assetsFailed == streamer->assets.size();
+}
+
+static void stream_print_stats(Streamer *streamer)
+{
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+
+    StreamStats &stats = streamer->stats;
+    std::cout << "Streaming: " << streamer->assets.size() << " assets, " << stats.assetsReady << " ready, "
+              << stats.assetsFailed << " failed, " << stats.bytesRead / 1024 << "KB read, "
+              << stats.bytesUploaded / 1024 << "KB uploaded, "
+              << "read " << stats.totalReadMs << "ms, decode " << stats.totalDecodeMs << "ms" << std::endl;
+}
+
+// Needs an idle device, uploads still in flight are dropped
+static void stream_shutdown(Streamer *streamer)
+{
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+        streamer->running = false;
+    }
+    streamer->readAvailable.notify_all();
+    streamer->decodeAvailable.notify_all();
+
+    for (std::thread &thread : streamer->ioThreads)
+    {
+        thread.join();
+    }
+    for (std::thread &thread : streamer->decodeThreads)
+    {
+        thread.join();
+    }
+    streamer->ioThreads.clear();
+    streamer->decodeThreads.clear();
+
+    for (StreamAsset &asset : streamer->assets)
+    {
+        if (asset.staging.buffer)
+        {
+            vk_free_buffer(streamer->device, &asset.staging);
+        }
+    }
+
+    streamer->vk->vkDestroyCommandPool(streamer->device, streamer->commandPool, 0);
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+// Queue synchronization built on timeline semaphores. Every queue owns one
+// timeline with a monotonically increasing value, each submission signals
+// the next value. Checking if a resource can be reused is then a comparison
+// against the completed value instead of a fence wait.
+//
+// Devices without timeline semaphores fall back to a ring of fences, one per
+// vkQueueSubmit, each tagged with the last value of its batch.
+
+#define SYNC_FENCE_COUNT 8
+#define SYNC_MAX_BATCH 8
+#define SYNC_MAX_CMDS 4
+#define SYNC_MAX_WAITS 4
+#define SYNC_MAX_SIGNALS 4
+
+struct SyncQueue
+{
+    const VkDispatch *vk;
+    VkDevice device;
+    VkQueue queue;
+    bool useTimeline;
+
+    VkSemaphore timeline;
+    uint64_t nextValue;      // Signaled by the next submission
+    uint64_t completedValue; // Cached, refreshed on demand
+
+    // Fence fallback
+    VkFence fences[SYNC_FENCE_COUNT];
+    uint64_t fenceValues[SYNC_FENCE_COUNT]; // 0 means unused
+    uint32_t fenceIdx;
+};
+
+struct SyncSubmit
+{
+    VkCommandBuffer cmds[SYNC_MAX_CMDS];
+    uint32_t cmdCount;
+
+    // Binary Semaphores or Timelines of other queues
+    SyncQueue *waitQueues[SYNC_MAX_WAITS];
+    VkSemaphore waitSemaphores[SYNC_MAX_WAITS];
+    uint64_t waitValues[SYNC_MAX_WAITS];
+    VkPipelineStageFlags waitStages[SYNC_MAX_WAITS];
+    uint32_t waitCount;
+
+    // Binary Semaphores only, e.g. for present
+    VkSemaphore signalSemaphores[SYNC_MAX_SIGNALS];
+    uint32_t signalCount;
+
+    // Filled in by sync_flush()
+    uint64_t value;
+};
+
+// Submissions collected over a frame and handed to one vkQueueSubmit
+struct SyncBatch
+{
+    SyncSubmit submits[SYNC_MAX_BATCH];
+    uint32_t count;
+};
+
+static bool sync_queue_init(SyncQueue *sync, const VkDispatch *vk, VkDevice device, VkQueue queue, bool useTimeline)
+{
+    *sync = {};
+    sync->vk = vk;
+    sync->device = device;
+    sync->queue = queue;
+    sync->useTimeline = useTimeline;
+    sync->nextValue = 1;
+
+    if (useTimeline)
+    {
+        VkSemaphoreTypeCreateInfo typeInfo = {};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaInfo = {};
+        semaInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaInfo.pNext = &typeInfo;
+        VK_CHECK_FATAL(sync->vk->vkCreateSemaphore(device, &semaInfo, 0, &sync->timeline));
+    }
+    else
+    {
+        VkFenceCreateInfo fenceInfo = fence_info();
+        for (uint32_t i = 0; i < SYNC_FENCE_COUNT; i++)
+        {
+            VK_CHECK_FATAL(sync->vk->vkCreateFence(device, &fenceInfo, 0, &sync->fences[i]));
+        }
+    }
+
+    return true;
+}
+
+static uint64_t sync_completed_value(SyncQueue *sync)
+{
+    if (sync->useTimeline)
+    {
+        VK_CHECK(sync->vk->vkGetSemaphoreCounterValue(sync->device, sync->timeline, &sync->completedValue));
+    }
+    else
+    {
+        for (uint32_t i = 0; i < SYNC_FENCE_COUNT; i++)
+        {
+            uint64_t value = sync->fenceValues[i];
+            if (value > sync->completedValue && sync->vk->vkGetFenceStatus(sync->device, sync->fences[i]) == VK_SUCCESS)
+            {
+                sync->completedValue = value;
+            }
+        }
+    }
+
+    return sync->completedValue;
+}
+
+// Cheap enough to call per resource, only asks the driver if the cached value is behind
+static bool sync_is_complete(SyncQueue *sync, uint64_t value)
+{
+    return value <= sync->completedValue || value <= sync_completed_value(sync);
+}
+
+static void sync_wait(SyncQueue *sync, uint64_t value)
+{
+    if (sync_is_complete(sync, value))
+    {
+        return;
+    }
+
+    if (sync->useTimeline)
+    {
+        VkSemaphoreWaitInfo waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &sync->timeline;
+        waitInfo.pValues = &value;
+        VK_CHECK(sync->vk->vkWaitSemaphores(sync->device, &waitInfo, UINT64_MAX));
+    }
+    else
+    {
+        // Oldest fence that covers the value, values grow with the ring index.
+        // Without one the value wasn't submitted yet, there is nothing to wait on.
+        bool waited = false;
+        for (uint32_t i = 0; i < SYNC_FENCE_COUNT; i++)
+        {
+            uint32_t idx = (sync->fenceIdx + i) % SYNC_FENCE_COUNT;
+            if (sync->fenceValues[idx] >= value)
+            {
+                VK_CHECK(sync->vk->vkWaitForFences(sync->device, 1, &sync->fences[idx], VK_TRUE, UINT64_MAX));
+                waited = true;
+                break;
+            }
+        }
+        if (!waited)
+        {
+            return;
+        }
+    }
+
+    sync->completedValue = value > sync->completedValue ? value : sync->completedValue;
+}
+
+static uint64_t sync_flush(SyncQueue *sync, SyncBatch *batch);
+
+// A full batch is submitted to the queue right away, the values stay in order
+static SyncSubmit *sync_batch_add(SyncQueue *sync, SyncBatch *batch)
+{
+    if (batch->count >= SYNC_MAX_BATCH)
+    {
+        sync_flush(sync, batch);
+    }
+
+    SyncSubmit *submit = &batch->submits[batch->count++];
+    *submit = {};
+    return submit;
+}
+
+static void sync_submit_add_cmd(SyncSubmit *submit, VkCommandBuffer cmd)
+{
+    if (submit->cmdCount < SYNC_MAX_CMDS)
+    {
+        submit->cmds[submit->cmdCount++] = cmd;
+    }
+}
+
+static void sync_submit_wait_binary(SyncSubmit *submit, VkSemaphore semaphore, VkPipelineStageFlags stage)
+{
+    if (submit->waitCount < SYNC_MAX_WAITS)
+    {
+        submit->waitQueues[submit->waitCount] = 0;
+        submit->waitSemaphores[submit->waitCount] = semaphore;
+        submit->waitValues[submit->waitCount] = 0; // Ignored for binary Semaphores
+        submit->waitStages[submit->waitCount] = stage;
+        submit->waitCount++;
+    }
+}
+
+// Makes the submission wait on work of another queue, e.g. an upload on the transfer queue
+static void sync_submit_wait_queue(SyncSubmit *submit, SyncQueue *other, uint64_t value, VkPipelineStageFlags stage)
+{
+    if (submit->waitCount < SYNC_MAX_WAITS)
+    {
+        submit->waitQueues[submit->waitCount] = other;
+        submit->waitSemaphores[submit->waitCount] = other->timeline;
+        submit->waitValues[submit->waitCount] = value;
+        submit->waitStages[submit->waitCount] = stage;
+        submit->waitCount++;
+    }
+}
+
+static void sync_submit_signal_binary(SyncSubmit *submit, VkSemaphore semaphore)
+{
+    if (submit->signalCount < SYNC_MAX_SIGNALS - 1)
+    {
+        submit->signalSemaphores[submit->signalCount++] = semaphore;
+    }
+}
+
+// Submits the whole batch with one vkQueueSubmit, every submission signals its
+// own value. Returns the value of the last one, 0 if the batch was empty.
+static uint64_t sync_flush(SyncQueue *sync, SyncBatch *batch)
+{
+    if (!batch->count)
+    {
+        return 0;
+    }
+
+    VkSubmitInfo submitInfos[SYNC_MAX_BATCH] = {};
+    VkTimelineSemaphoreSubmitInfo timelineInfos[SYNC_MAX_BATCH] = {};
+    VkSemaphore waitSemaphores[SYNC_MAX_BATCH][SYNC_MAX_WAITS];
+    VkPipelineStageFlags waitStages[SYNC_MAX_BATCH][SYNC_MAX_WAITS];
+    uint64_t waitValues[SYNC_MAX_BATCH][SYNC_MAX_WAITS];
+    VkSemaphore signalSemaphores[SYNC_MAX_BATCH][SYNC_MAX_SIGNALS];
+    uint64_t signalValues[SYNC_MAX_BATCH][SYNC_MAX_SIGNALS] = {};
+
+    for (uint32_t i = 0; i < batch->count; i++)
+    {
+        SyncSubmit *submit = &batch->submits[i];
+        submit->value = sync->nextValue++;
+
+        uint32_t waitCount = 0;
+        for (uint32_t j = 0; j < submit->waitCount; j++)
+        {
+            SyncQueue *other = submit->waitQueues[j];
+            if (other && !other->useTimeline)
+            {
+                // Without timelines there is no GPU side wait on another queue
+                sync_wait(other, submit->waitValues[j]);
+                continue;
+            }
+
+            waitSemaphores[i][waitCount] = submit->waitSemaphores[j];
+            waitStages[i][waitCount] = submit->waitStages[j];
+            waitValues[i][waitCount] = submit->waitValues[j];
+            waitCount++;
+        }
+
+        uint32_t signalCount = submit->signalCount;
+        for (uint32_t j = 0; j < signalCount; j++)
+        {
+            signalSemaphores[i][j] = submit->signalSemaphores[j];
+        }
+
+        if (sync->useTimeline)
+        {
+            signalSemaphores[i][signalCount] = sync->timeline;
+            signalValues[i][signalCount] = submit->value;
+            signalCount++;
+
+            timelineInfos[i].sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            timelineInfos[i].waitSemaphoreValueCount = waitCount;
+            timelineInfos[i].pWaitSemaphoreValues = waitValues[i];
+            timelineInfos[i].signalSemaphoreValueCount = signalCount;
+            timelineInfos[i].pSignalSemaphoreValues = signalValues[i];
+            submitInfos[i].pNext = &timelineInfos[i];
+        }
+
+        submitInfos[i].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfos[i].commandBufferCount = submit->cmdCount;
+        submitInfos[i].pCommandBuffers = submit->cmds;
+        submitInfos[i].waitSemaphoreCount = waitCount;
+        submitInfos[i].pWaitSemaphores = waitSemaphores[i];
+        submitInfos[i].pWaitDstStageMask = waitStages[i];
+        submitInfos[i].signalSemaphoreCount = signalCount;
+        submitInfos[i].pSignalSemaphores = signalSemaphores[i];
+    }
+
+    uint64_t lastValue = sync->nextValue - 1;
+
+    VkFence fence = VK_NULL_HANDLE;
+    if (!sync->useTimeline)
+    {
+        // Recycle the oldest fence of the ring, waiting on exactly that fence
+        uint32_t idx = sync->fenceIdx;
+        sync->fenceIdx = (sync->fenceIdx + 1) % SYNC_FENCE_COUNT;
+
+        if (sync->fenceValues[idx])
+        {
+            VK_CHECK(sync->vk->vkWaitForFences(sync->device, 1, &sync->fences[idx], VK_TRUE, UINT64_MAX));
+            uint64_t value = sync->fenceValues[idx];
+            sync->completedValue = value > sync->completedValue ? value : sync->completedValue;
+            VK_CHECK(sync->vk->vkResetFences(sync->device, 1, &sync->fences[idx]));
+        }
+
+        sync->fenceValues[idx] = lastValue;
+        fence = sync->fences[idx];
+    }
+
+    VK_CHECK(sync->vk->vkQueueSubmit(sync->queue, batch->count, submitInfos, fence));
+
+    batch->count = 0;
+    return lastValue;
+}
+
+static void sync_queue_destroy(SyncQueue *sync)
+{
+    sync->vk->vkDestroySemaphore(sync->device, sync->timeline, 0);
+    for (uint32_t i = 0; i < SYNC_FENCE_COUNT; i++)
+    {
+        sync->vk->vkDestroyFence(sync->device, sync->fences[i], 0);
+    }
+}
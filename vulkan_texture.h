@@ -0,0 +1,760 @@
+#pragma once
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+
+// Textures from KTX2 containers holding pre-compressed BC1/BC7 mip chains.
+// The whole file stays in system memory, the GPU only holds the mips the
+// current view needs. A texture that needs more or fewer mips gets a new image
+// with just those levels, uploaded through staging on the transfer queue and
+// swapped in once the copy completed. Images are sized to their top resident
+// mip, normalized texture coordinates make that transparent to the shaders.
+
+#define TEXTURE_MAX_LEVELS 16
+#define TEXTURE_UPLOAD_SLOTS 4
+#define TEXTURE_MEMORY_BUDGET (64 * 1024 * 1024)
+#define TEXTURE_UPLOAD_BUDGET (8 * 1024 * 1024) // Bytes per frame
+
+struct Ktx2Level
+{
+    uint64_t offset; // Into data
+    uint64_t size;
+};
+
+struct Ktx2Image
+{
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t blockBytes; // Per 4x4 block, 0 for uncompressed formats
+    Ktx2Level levels[TEXTURE_MAX_LEVELS];
+    std::vector<char> data;
+};
+
+static uint32_t ktx2_block_bytes(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        return 8;
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+// Expected size of a mip level in bytes, 0 for unsupported formats
+static uint64_t ktx2_level_size(VkFormat format, uint32_t width, uint32_t height)
+{
+    uint32_t blockBytes = ktx2_block_bytes(format);
+    if (blockBytes)
+    {
+        return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+    }
+
+    if (format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB)
+    {
+        return (uint64_t)width * height * 4;
+    }
+
+    return 0;
+}
+
+static uint32_t ktx2_read_u32(const std::vector<char> &data, uint64_t offset)
+{
+    uint32_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+}
+
+static uint64_t ktx2_read_u64(const std::vector<char> &data, uint64_t offset)
+{
+    uint64_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+}
+
+// Single 2D images without supercompression, everything else is rejected
+static bool ktx2_parse(const char *name, std::vector<char> data, Ktx2Image *image)
+{
+    const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+    const uint64_t headerSize = 80;
+    const uint64_t levelIndexSize = 24;
+
+    if (data.size() < headerSize || memcmp(data.data(), identifier, sizeof(identifier)))
+    {
+        std::cerr << "Not a KTX2 file: " << name << std::endl;
+        return false;
+    }
+
+    image->format = (VkFormat)ktx2_read_u32(data, 12);
+    image->width = ktx2_read_u32(data, 20);
+    image->height = ktx2_read_u32(data, 24);
+    uint32_t depth = ktx2_read_u32(data, 28);
+    uint32_t layerCount = ktx2_read_u32(data, 32);
+    uint32_t faceCount = ktx2_read_u32(data, 36);
+    image->levelCount = ktx2_read_u32(data, 40);
+    uint32_t supercompression = ktx2_read_u32(data, 44);
+
+    // A level count of 0 asks the loader to generate mips, we just use the one level
+    image->levelCount = image->levelCount ? image->levelCount : 1;
+    image->blockBytes = ktx2_block_bytes(image->format);
+
+    if (depth > 1 || layerCount > 1 || faceCount != 1 || supercompression ||
+        !image->width || !image->height || image->levelCount > TEXTURE_MAX_LEVELS ||
+        !ktx2_level_size(image->format, 1, 1) ||
+        data.size() < headerSize + image->levelCount * levelIndexSize)
+    {
+        std::cerr << "Unsupported KTX2 file: " << name << ", format " << image->format << std::endl;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < image->levelCount; i++)
+    {
+        uint64_t indexOffset = headerSize + i * levelIndexSize;
+        Ktx2Level &level = image->levels[i];
+        level.offset = ktx2_read_u64(data, indexOffset);
+        level.size = ktx2_read_u64(data, indexOffset + 8);
+
+        uint32_t width = image->width >> i ? image->width >> i : 1;
+        uint32_t height = image->height >> i ? image->height >> i : 1;
+        // Offset and size come from the file, their sum could wrap around
+        if (level.size != ktx2_level_size(image->format, width, height) ||
+            level.offset > data.size() || level.size > data.size() - level.offset)
+        {
+            std::cerr << "Corrupt KTX2 Mip Level " << i << ": " << name << std::endl;
+            return false;
+        }
+    }
+
+    image->data = std::move(data);
+    return true;
+}
+
+// Only 32 bit fields, the struct is hashed as raw bytes
+struct SamplerDesc
+{
+    VkFilter filter;
+    VkSamplerMipmapMode mipmapMode;
+    VkSamplerAddressMode addressMode;
+    VkBool32 anisotropy;
+};
+
+struct SamplerCache
+{
+    VkDevice device;
+    float maxAnisotropy; // 0 if the feature is disabled
+    std::unordered_map<uint64_t, VkSampler> samplers;
+    uint32_t hits;
+    uint32_t misses;
+};
+
+static VkSampler sampler_cache_get(SamplerCache *cache, const SamplerDesc &desc)
+{
+    // FNV-1a
+    uint64_t key = 14695981039346656037ull;
+    const uint8_t *bytes = (const uint8_t *)&desc;
+    for (uint32_t i = 0; i < sizeof(SamplerDesc); i++)
+    {
+        key ^= bytes[i];
+        key *= 1099511628211ull;
+    }
+
+    auto it = cache->samplers.find(key);
+    if (it != cache->samplers.end())
+    {
+        cache->hits++;
+        return it->second;
+    }
+    cache->misses++;
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = desc.filter;
+    samplerInfo.minFilter = desc.filter;
+    samplerInfo.mipmapMode = desc.mipmapMode;
+    samplerInfo.addressModeU = desc.addressMode;
+    samplerInfo.addressModeV = desc.addressMode;
+    samplerInfo.addressModeW = desc.addressMode;
+    samplerInfo.anisotropyEnable = desc.anisotropy && cache->maxAnisotropy > 1.0f;
+    samplerInfo.maxAnisotropy = samplerInfo.anisotropyEnable ? cache->maxAnisotropy : 1.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkSampler sampler = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateSampler(cache->device, &samplerInfo, 0, &sampler));
+    cache->samplers[key] = sampler;
+
+    return sampler;
+}
+
+struct TextureImage
+{
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkDeviceSize size;
+    uint32_t topMip; // Level of the source the image starts at
+};
+
+struct Texture
+{
+    Ktx2Image source;
+    TextureImage resident; // image is null until the first upload completed
+    TextureImage pending;  // Being uploaded, replaces resident once done
+    uint64_t pendingValue;
+
+    uint32_t requestedMip; // What the view needs
+    uint32_t targetMip;    // What fits into the budget
+};
+
+// Replaced images can still be read by frames in flight
+struct RetiredImage
+{
+    TextureImage image;
+    uint64_t retireValue;
+};
+
+struct TextureUpload
+{
+    VkCommandBuffer cmd;
+    Buffer staging;
+    uint64_t value; // 0 means free
+    uint32_t textureIdx;
+};
+
+struct TextureStats
+{
+    VkDeviceSize residentBytes;
+    VkDeviceSize requestedBytes; // If the budget was unlimited
+    uint64_t uploadedBytes;
+    uint32_t uploads;
+    uint32_t budgetDrops; // Mips not made resident because of the budget
+
+    // Upload bandwidth over the last second
+    double bandwidthMBs;
+    double windowStart;
+    uint64_t windowBytes;
+};
+
+struct TextureManager
+{
+    VkDevice device;
+    VkPhysicalDevice gpu;
+    const VkDispatch *vk;
+    SyncQueue *transferSync;
+    SyncQueue *graphicsSync;
+    uint32_t queueFamilies[2];
+    uint32_t queueFamilyCount;
+
+    VkCommandPool commandPool;
+    TextureUpload uploads[TEXTURE_UPLOAD_SLOTS];
+    SyncBatch batch;
+
+    // Transfer value of the newest swapped in images, the frame waits on it
+    uint64_t acquireValue;
+
+    std::deque<Texture> textures;
+    std::vector<RetiredImage> retired;
+    SamplerCache samplers;
+    VkDeviceSize budget;
+    uint32_t defaultTexture;
+
+    std::chrono::high_resolution_clock::time_point startTime;
+    TextureStats stats;
+};
+
+static VkDeviceSize texture_mip_bytes(const Texture &texture, uint32_t topMip)
+{
+    VkDeviceSize size = 0;
+    for (uint32_t i = topMip; i < texture.source.levelCount; i++)
+    {
+        size += texture.source.levels[i].size;
+    }
+    return size;
+}
+
+static void texture_destroy_image(VkDevice device, TextureImage *image)
+{
+    if (!image->image)
+    {
+        return;
+    }
+
+    memory_track_free(image->memory);
+    vkDestroyImageView(device, image->view, 0);
+    vkDestroyImage(device, image->image, 0);
+    vkFreeMemory(device, image->memory, 0);
+    *image = {};
+}
+
+static bool texture_create_image(TextureManager *manager, const Texture &texture, uint32_t topMip, TextureImage *image)
+{
+    const Ktx2Image &source = texture.source;
+
+    *image = {};
+    image->topMip = topMip;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = source.format;
+    imageInfo.extent.width = source.width >> topMip ? source.width >> topMip : 1;
+    imageInfo.extent.height = source.height >> topMip ? source.height >> topMip : 1;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = source.levelCount - topMip;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // Written on the transfer queue, sampled on the graphics queue
+    if (manager->queueFamilyCount > 1)
+    {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = manager->queueFamilyCount;
+        imageInfo.pQueueFamilyIndices = manager->queueFamilies;
+    }
+
+    VK_CHECK_FATAL(vkCreateImage(manager->device, &imageInfo, 0, &image->image));
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(manager->device, image->image, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex = vk_get_memory_type_index(manager->gpu, memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (vkAllocateMemory(manager->device, &allocInfo, 0, &image->memory) != VK_SUCCESS)
+    {
+        memory_track_failure(allocInfo.allocationSize, allocInfo.memoryTypeIndex, "Texture");
+        vkDestroyImage(manager->device, image->image, 0);
+        *image = {};
+        return false;
+    }
+    memory_track_alloc(image->memory, MEMORY_RESOURCE_IMAGE, allocInfo.allocationSize,
+                       allocInfo.memoryTypeIndex, imageInfo.usage, "Texture");
+    image->size = allocInfo.allocationSize;
+
+    VK_CHECK(vkBindImageMemory(manager->device, image->image, image->memory, 0));
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image->image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = source.format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = imageInfo.mipLevels;
+    viewInfo.subresourceRange.layerCount = 1;
+    VK_CHECK(vkCreateImageView(manager->device, &viewInfo, 0, &image->view));
+
+    return true;
+}
+
+// Records the upload of the mips from topMip down, returns false if there
+// was no free slot or the image couldn't be created
+static bool texture_upload(TextureManager *manager, uint32_t textureIdx, uint32_t topMip)
+{
+    Texture &texture = manager->textures[textureIdx];
+    const Ktx2Image &source = texture.source;
+    const VkDispatch *vk = manager->vk;
+
+    TextureUpload *upload = 0;
+    for (uint32_t i = 0; i < TEXTURE_UPLOAD_SLOTS; i++)
+    {
+        if (!manager->uploads[i].value)
+        {
+            upload = &manager->uploads[i];
+            break;
+        }
+    }
+
+    if (!upload || !texture_create_image(manager, texture, topMip, &texture.pending))
+    {
+        return false;
+    }
+
+    // Copy offsets have to be aligned to the block size
+    VkDeviceSize stagingSize = 0;
+    for (uint32_t i = topMip; i < source.levelCount; i++)
+    {
+        stagingSize += (source.levels[i].size + 15) & ~15ull;
+    }
+
+    upload->staging = vk_allocate_buffer(
+        manager->device, manager->gpu, stagingSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Texture Staging");
+
+    if (!upload->staging.data)
+    {
+        texture_destroy_image(manager->device, &texture.pending);
+        return false;
+    }
+
+    VkBufferImageCopy regions[TEXTURE_MAX_LEVELS] = {};
+    uint32_t regionCount = 0;
+    VkDeviceSize offset = 0;
+    for (uint32_t i = topMip; i < source.levelCount; i++)
+    {
+        memcpy((char *)upload->staging.data + offset, source.data.data() + source.levels[i].offset, source.levels[i].size);
+
+        VkBufferImageCopy &region = regions[regionCount];
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = regionCount;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent.width = source.width >> i ? source.width >> i : 1;
+        region.imageExtent.height = source.height >> i ? source.height >> i : 1;
+        region.imageExtent.depth = 1;
+
+        regionCount++;
+        offset += (source.levels[i].size + 15) & ~15ull;
+    }
+
+    VkCommandBuffer cmd = upload->cmd;
+    vk->vkResetCommandBuffer(cmd, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vk->vkBeginCommandBuffer(cmd, &beginInfo));
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = texture.pending.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = regionCount;
+    barrier.subresourceRange.layerCount = 1;
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, 0, 0, 0, 1, &barrier);
+
+    vk->vkCmdCopyBufferToImage(cmd, upload->staging.buffer, texture.pending.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions);
+
+    // The transfer queue knows no shader stages, the graphics queue waits on
+    // the timeline at the fragment shader instead
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vk->vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, 0, 0, 0, 1, &barrier);
+
+    VK_CHECK(vk->vkEndCommandBuffer(cmd));
+
+    SyncSubmit *submit = sync_batch_add(manager->transferSync, &manager->batch);
+    sync_submit_add_cmd(submit, cmd);
+    upload->value = sync_flush(manager->transferSync, &manager->batch);
+    upload->textureIdx = textureIdx;
+    texture.pendingValue = upload->value;
+
+    manager->stats.uploads++;
+    manager->stats.uploadedBytes += offset;
+    manager->stats.windowBytes += offset;
+    return true;
+}
+
+// Keeps the source in system memory and starts with the smallest mip
+static uint32_t texture_create(TextureManager *manager, Ktx2Image source)
+{
+    Texture texture = {};
+    texture.source = std::move(source);
+    texture.requestedMip = texture.source.levelCount - 1;
+    texture.targetMip = texture.requestedMip;
+
+    manager->textures.push_back(std::move(texture));
+    return manager->textures.size() - 1;
+}
+
+// Returns the texture id, INVALID_IDX if the file couldn't be loaded
+static uint32_t texture_load(TextureManager *manager, const char *path)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open Texture: " << path << std::endl;
+        return INVALID_IDX;
+    }
+
+    std::vector<char> data((size_t)file.tellg());
+    file.seekg(0);
+    file.read(data.data(), data.size());
+
+    Ktx2Image image = {};
+    if (!ktx2_parse(path, std::move(data), &image))
+    {
+        return INVALID_IDX;
+    }
+
+    VkFormatProperties formatProps;
+    vkGetPhysicalDeviceFormatProperties(manager->gpu, image.format, &formatProps);
+    if (!(formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+    {
+        std::cerr << "Texture Format " << image.format << " not supported by the GPU: " << path << std::endl;
+        return INVALID_IDX;
+    }
+
+    return texture_create(manager, std::move(image));
+}
+
+// Tells the residency which mip the view needs, from the size of the textured
+// surface on screen in pixels
+static void texture_request(TextureManager *manager, uint32_t textureIdx, float screenPixels)
+{
+    Texture &texture = manager->textures[textureIdx];
+
+    uint32_t size = texture.source.width > texture.source.height ? texture.source.width : texture.source.height;
+    float mip = screenPixels > 1.0f ? log2f(size / screenPixels) : (float)TEXTURE_MAX_LEVELS;
+
+    mip = mip < 0.0f ? 0.0f : mip;
+    texture.requestedMip = (uint32_t)mip < texture.source.levelCount ? (uint32_t)mip : texture.source.levelCount - 1;
+}
+
+static VkImageView texture_view(TextureManager *manager, uint32_t textureIdx)
+{
+    if (textureIdx != INVALID_IDX && manager->textures[textureIdx].resident.image)
+    {
+        return manager->textures[textureIdx].resident.view;
+    }
+    return manager->textures[manager->defaultTexture].resident.view;
+}
+
+// Call once per frame after the last frame was waited on. Swaps in finished
+// uploads and starts new ones, returns true if a view changed and the
+// descriptors have to be updated.
+static bool texture_update(TextureManager *manager)
+{
+    bool viewsChanged = false;
+
+    // Finished Uploads
+    for (uint32_t i = 0; i < TEXTURE_UPLOAD_SLOTS; i++)
+    {
+        TextureUpload &upload = manager->uploads[i];
+        if (!upload.value || !sync_is_complete(manager->transferSync, upload.value))
+        {
+            continue;
+        }
+
+        Texture &texture = manager->textures[upload.textureIdx];
+        if (texture.resident.image)
+        {
+            // The last submitted frame can still sample the old image
+            manager->retired.push_back({texture.resident, manager->graphicsSync->nextValue - 1});
+        }
+        texture.resident = texture.pending;
+        texture.pending = {};
+        texture.pendingValue = 0;
+
+        vk_free_buffer(manager->device, &upload.staging);
+        manager->acquireValue = upload.value > manager->acquireValue ? upload.value : manager->acquireValue;
+        upload.value = 0;
+        viewsChanged = true;
+    }
+
+    for (uint32_t i = 0; i < manager->retired.size();)
+    {
+        if (!sync_is_complete(manager->graphicsSync, manager->retired[i].retireValue))
+        {
+            i++;
+            continue;
+        }
+
+        texture_destroy_image(manager->device, &manager->retired[i].image);
+        manager->retired[i] = manager->retired.back();
+        manager->retired.pop_back();
+    }
+
+    // Fit the requested mips into the budget by dropping the top mip of the
+    // texture that costs the most, until everything fits
+    {
+        VkDeviceSize total = 0;
+        for (Texture &texture : manager->textures)
+        {
+            texture.targetMip = texture.requestedMip;
+            total += texture_mip_bytes(texture, texture.targetMip);
+        }
+        manager->stats.requestedBytes = total;
+        manager->stats.budgetDrops = 0;
+
+        while (total > manager->budget)
+        {
+            Texture *largest = 0;
+            VkDeviceSize largestBytes = 0;
+            for (Texture &texture : manager->textures)
+            {
+                VkDeviceSize bytes = texture_mip_bytes(texture, texture.targetMip);
+                if (texture.targetMip + 1 < texture.source.levelCount && bytes > largestBytes)
+                {
+                    largest = &texture;
+                    largestBytes = bytes;
+                }
+            }
+
+            if (!largest)
+            {
+                break;
+            }
+
+            total -= largest->source.levels[largest->targetMip].size;
+            largest->targetMip++;
+            manager->stats.budgetDrops++;
+        }
+    }
+
+    // New Uploads, at least one per frame even if it is over the budget
+    uint64_t uploadedBefore = manager->stats.uploadedBytes;
+    for (uint32_t i = 0; i < manager->textures.size(); i++)
+    {
+        Texture &texture = manager->textures[i];
+        bool isResident = texture.resident.image && texture.resident.topMip == texture.targetMip;
+        if (isResident || texture.pendingValue)
+        {
+            continue;
+        }
+
+        if (manager->stats.uploadedBytes > uploadedBefore &&
+            manager->stats.uploadedBytes - uploadedBefore + texture_mip_bytes(texture, texture.targetMip) > TEXTURE_UPLOAD_BUDGET)
+        {
+            break;
+        }
+
+        if (!texture_upload(manager, i, texture.targetMip))
+        {
+            break;
+        }
+    }
+
+    // Stats
+    {
+        manager->stats.residentBytes = 0;
+        for (Texture &texture : manager->textures)
+        {
+            manager->stats.residentBytes += texture.resident.size;
+        }
+
+        double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - manager->startTime).count();
+        if (time - manager->stats.windowStart >= 1.0)
+        {
+            manager->stats.bandwidthMBs = manager->stats.windowBytes / (1024.0 * 1024.0) / (time - manager->stats.windowStart);
+            manager->stats.windowStart = time;
+            manager->stats.windowBytes = 0;
+        }
+    }
+
+    return viewsChanged;
+}
+
+static bool texture_manager_init(
+    TextureManager *manager,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    const VkDispatch *vk,
+    SyncQueue *transferSync,
+    SyncQueue *graphicsSync,
+    uint32_t graphicsIdx,
+    uint32_t transferIdx,
+    float maxAnisotropy)
+{
+    manager->device = device;
+    manager->gpu = gpu;
+    manager->vk = vk;
+    manager->transferSync = transferSync;
+    manager->graphicsSync = graphicsSync;
+    manager->queueFamilies[0] = graphicsIdx;
+    manager->queueFamilies[1] = transferIdx;
+    manager->queueFamilyCount = graphicsIdx != transferIdx ? 2 : 1;
+    manager->budget = TEXTURE_MEMORY_BUDGET;
+    manager->samplers.device = device;
+    manager->samplers.maxAnisotropy = maxAnisotropy;
+    manager->startTime = std::chrono::high_resolution_clock::now();
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = transferIdx;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VK_CHECK_FATAL(vk->vkCreateCommandPool(device, &poolInfo, 0, &manager->commandPool));
+
+    for (uint32_t i = 0; i < TEXTURE_UPLOAD_SLOTS; i++)
+    {
+        VkCommandBufferAllocateInfo allocInfo = cmd_alloc_info(manager->commandPool);
+        VK_CHECK_FATAL(vk->vkAllocateCommandBuffers(device, &allocInfo, &manager->uploads[i].cmd));
+    }
+
+    // White 1x1, bound wherever a texture isn't resident yet. It has to be
+    // there before the first frame, so this waits on the upload.
+    {
+        Ktx2Image white = {};
+        white.format = VK_FORMAT_R8G8B8A8_UNORM;
+        white.width = 1;
+        white.height = 1;
+        white.levelCount = 1;
+        white.levels[0].size = 4;
+        white.data = {(char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF};
+
+        manager->defaultTexture = texture_create(manager, std::move(white));
+        texture_update(manager);
+        sync_wait(transferSync, manager->textures[manager->defaultTexture].pendingValue);
+        texture_update(manager);
+
+        if (!manager->textures[manager->defaultTexture].resident.image)
+        {
+            std::cerr << "Failed to create the Default Texture" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void texture_print_stats(TextureManager *manager)
+{
+    TextureStats &stats = manager->stats;
+    std::cout << "Textures: " << manager->textures.size() << " textures, "
+              << stats.residentBytes / 1024 << "KB resident of " << manager->budget / 1024 << "KB budget, "
+              << stats.requestedBytes / 1024 << "KB requested, " << stats.budgetDrops << " mips over budget, "
+              << stats.uploads << " uploads (" << stats.uploadedBytes / 1024 << "KB), "
+              << stats.bandwidthMBs << "MB/s, samplers " << manager->samplers.samplers.size()
+              << " (" << manager->samplers.hits << " hits)" << std::endl;
+}
+
+// Needs an idle device
+static void texture_manager_shutdown(TextureManager *manager)
+{
+    for (Texture &texture : manager->textures)
+    {
+        texture_destroy_image(manager->device, &texture.resident);
+        texture_destroy_image(manager->device, &texture.pending);
+    }
+    for (RetiredImage &retired : manager->retired)
+    {
+        texture_destroy_image(manager->device, &retired.image);
+    }
+    for (uint32_t i = 0; i < TEXTURE_UPLOAD_SLOTS; i++)
+    {
+        if (manager->uploads[i].staging.buffer)
+        {
+            vk_free_buffer(manager->device, &manager->uploads[i].staging);
+        }
+    }
+    for (auto &it : manager->samplers.samplers)
+    {
+        vkDestroySampler(manager->device, it.second, 0);
+    }
+
+    manager->vk->vkDestroyCommandPool(manager->device, manager->commandPool, 0);
+}
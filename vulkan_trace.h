@@ -0,0 +1,903 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+// Captures the high level commands of every frame into a binary trace, the
+// replay runs them again without a window as fast as the GPU allows. The trace
+// only holds what the renderer decides per frame: shaders, pipeline states,
+// mesh data, UBO contents and draws. Vulkan objects are created by the replay.
+//
+// File layout: TraceHeader, then records of TraceRecord + payload. Meshes are
+// written once when they show up in the Geometry Arena, a frame only adds
+// what changed since the last one.
+
+#define TRACE_MAGIC 0x5443564B // "KVCT"
+#define TRACE_VERSION 2
+
+// World matrices the replay holds for the draws of one frame
+#define TRACE_MAX_FRAME_DRAWS 64
+
+enum TraceCommand
+{
+    TRACE_CMD_SHADERS,       // u32 vertSize, vertex SPIR-V, u32 fragSize, fragment SPIR-V
+    TRACE_CMD_FRAME_BEGIN,   // u32 width, u32 height, VkClearColorValue
+    TRACE_CMD_MESH_UPLOAD,   // u32 meshId, u32 vertexCount, u32 indexCount, vertices, indices
+    TRACE_CMD_MESH_REMOVE,   // u32 meshId
+    TRACE_CMD_PIPELINE,      // PipelineState
+    TRACE_CMD_UBO,           // u32 offset, data
+    TRACE_CMD_DRAW_GEOMETRY, // mat4 world, all meshes of the arena
+    TRACE_CMD_FRAME_END,
+};
+
+struct TraceHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format; // VkFormat of the render target
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameCount; // Patched by trace_end()
+};
+
+struct TraceRecord
+{
+    uint32_t command;
+    uint32_t size; // Payload bytes following the record
+};
+
+struct TraceWriter
+{
+    std::ofstream file;
+    bool recording;
+
+    // Records of the current frame, written out at trace_frame_end()
+    std::vector<char> frameData;
+
+    // Meshes of the arena the trace already knows about, by mesh id
+    std::vector<bool> meshCaptured;
+
+    PipelineState lastState;
+    bool stateCaptured;
+
+    uint32_t frameCount;
+    uint64_t bytesWritten;
+    uint64_t meshBytes;
+};
+
+static void trace_write(TraceWriter *trace, TraceCommand command, const void *data, uint32_t size)
+{
+    TraceRecord record = {(uint32_t)command, size};
+    const char *bytes = (const char *)&record;
+    trace->frameData.insert(trace->frameData.end(), bytes, bytes + sizeof(record));
+    trace->frameData.insert(trace->frameData.end(), (const char *)data, (const char *)data + size);
+}
+
+static void trace_flush(TraceWriter *trace)
+{
+    trace->file.write(trace->frameData.data(), trace->frameData.size());
+    trace->bytesWritten += trace->frameData.size();
+    trace->frameData.clear();
+}
+
+static bool trace_begin(
+    TraceWriter *trace,
+    const char *path,
+    VkFormat format,
+    uint32_t width,
+    uint32_t height,
+    const std::vector<char> &vertexCode,
+    const std::vector<char> &fragmentCode)
+{
+    trace->file.open(path, std::ios::binary | std::ios::trunc);
+    if (!trace->file.is_open())
+    {
+        std::cerr << "Failed to open Trace " << path << std::endl;
+        return false;
+    }
+
+    TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, (uint32_t)format, width, height, 0};
+    trace->file.write((const char *)&header, sizeof(header));
+    trace->bytesWritten = sizeof(header);
+
+    std::vector<char> shaders;
+    uint32_t vertSize = vertexCode.size();
+    uint32_t fragSize = fragmentCode.size();
+    shaders.insert(shaders.end(), (const char *)&vertSize, (const char *)&vertSize + 4);
+    shaders.insert(shaders.end(), vertexCode.begin(), vertexCode.end());
+    shaders.insert(shaders.end(), (const char *)&fragSize, (const char *)&fragSize + 4);
+    shaders.insert(shaders.end(), fragmentCode.begin(), fragmentCode.end());
+    trace_write(trace, TRACE_CMD_SHADERS, shaders.data(), shaders.size());
+    trace_flush(trace);
+
+    trace->recording = true;
+    return true;
+}
+
+static void trace_frame_begin(TraceWriter *trace, uint32_t width, uint32_t height, VkClearColorValue clearColor)
+{
+    if (!trace->recording)
+    {
+        return;
+    }
+
+    struct
+    {
+        uint32_t width;
+        uint32_t height;
+        VkClearColorValue clearColor;
+    } payload = {width, height, clearColor};
+    trace_write(trace, TRACE_CMD_FRAME_BEGIN, &payload, sizeof(payload));
+}
+
+// Diffs the alive meshes against the ones already in the trace. An id is
+// only reused after geometry_collect(), so a removal is always seen first.
+// The arena needs a host copy, the Device Local buffers can't be read.
+static void trace_geometry(TraceWriter *trace, GeometryArena *arena)
+{
+    if (!trace->recording || arena->hostVertices.empty())
+    {
+        return;
+    }
+
+    trace->meshCaptured.resize(arena->meshes.size(), false);
+
+    for (uint32_t meshId = 0; meshId < trace->meshCaptured.size(); meshId++)
+    {
+        bool alive = meshId < arena->meshes.size() && arena->meshes[meshId].alive;
+        if (trace->meshCaptured[meshId] == alive)
+        {
+            continue;
+        }
+
+        if (!alive)
+        {
+            trace_write(trace, TRACE_CMD_MESH_REMOVE, &meshId, sizeof(meshId));
+        }
+        else
+        {
+            // From the host copy of the arena, streamed meshes never pass the CPU otherwise
+            GeometryMesh &mesh = arena->meshes[meshId];
+            uint32_t vertexBytes = mesh.vertexCount * sizeof(VertexColor);
+            uint32_t indexBytes = mesh.indexCount * sizeof(uint32_t);
+
+            std::vector<char> payload(12 + vertexBytes + indexBytes);
+            uint32_t counts[3] = {meshId, mesh.vertexCount, mesh.indexCount};
+            memcpy(payload.data(), counts, 12);
+            memcpy(payload.data() + 12, arena->hostVertices.data() + mesh.vertexOffset, vertexBytes);
+            memcpy(payload.data() + 12 + vertexBytes, arena->hostIndices.data() + mesh.firstIndex, indexBytes);
+
+            trace_write(trace, TRACE_CMD_MESH_UPLOAD, payload.data(), payload.size());
+            trace->meshBytes += payload.size();
+        }
+
+        trace->meshCaptured[meshId] = alive;
+    }
+}
+
+static void trace_pipeline(TraceWriter *trace, const PipelineState &state)
+{
+    if (!trace->recording || (trace->stateCaptured && !memcmp(&trace->lastState, &state, sizeof(state))))
+    {
+        return;
+    }
+
+    trace_write(trace, TRACE_CMD_PIPELINE, &state, sizeof(state));
+    trace->lastState = state;
+    trace->stateCaptured = true;
+}
+
+static void trace_ubo(TraceWriter *trace, uint32_t offset, const void *data, uint32_t size)
+{
+    if (!trace->recording)
+    {
+        return;
+    }
+
+    std::vector<char> payload(4 + size);
+    memcpy(payload.data(), &offset, 4);
+    memcpy(payload.data() + 4, data, size);
+    trace_write(trace, TRACE_CMD_UBO, payload.data(), payload.size());
+}
+
+static void trace_draw_geometry(TraceWriter *trace, const glm::mat4 &world)
+{
+    if (trace->recording)
+    {
+        trace_write(trace, TRACE_CMD_DRAW_GEOMETRY, &world, sizeof(world));
+    }
+}
+
+static void trace_frame_end(TraceWriter *trace)
+{
+    if (!trace->recording)
+    {
+        return;
+    }
+
+    trace_write(trace, TRACE_CMD_FRAME_END, 0, 0);
+    trace_flush(trace);
+    trace->frameCount++;
+}
+
+static void trace_end(TraceWriter *trace)
+{
+    if (!trace->recording)
+    {
+        return;
+    }
+
+    // A frame that never ended isn't part of the trace
+    trace->frameData.clear();
+
+    trace->file.seekp(offsetof(TraceHeader, frameCount));
+    trace->file.write((const char *)&trace->frameCount, sizeof(trace->frameCount));
+    trace->file.close();
+    trace->recording = false;
+
+    std::cout << "Trace: " << trace->frameCount << " frames, "
+              << trace->bytesWritten / 1024 << "KB ("
+              << trace->meshBytes / 1024 << "KB meshes)" << std::endl;
+}
+
+// ##########################################################
+// 				Replay
+// ##########################################################
+
+struct ReplayContext
+{
+    VkDispatch vk;
+    VkInstance instance;
+    VkPhysicalDevice gpu;
+    VkDevice device;
+    VkQueue queue;
+    int graphicsIdx;
+    uint32_t timestampValidBits;
+
+    VkRenderPass renderPass;
+    VkFramebuffer framebuffer;
+    DynamicResolution target; // Only its Render Target is used
+    VkCommandPool commandPool;
+    VkCommandBuffer cmd;
+    SyncQueue sync;
+    SyncBatch batch;
+    uint64_t frameValue;
+
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descPool;
+    VkDescriptorSet descSet;
+    VkPipelineLayout pipeLayout;
+    PipelineLibrary pipelines;
+    TextureManager textures;
+    Buffer ubo;
+    Buffer worlds; // Binding 1, one slot per draw of the frame
+    ClusteredLighting lighting;
+    ShadowMaps shadows;
+    GeometryArena geometry;
+
+    // Mesh ids of the trace to mesh ids of the replay arena
+    std::unordered_map<uint32_t, uint32_t> meshIds;
+};
+
+// Same device setup as init_vulkan(), minus Surface and Swapchain. No
+// validation layers either, they would dominate the measured frame times.
+static bool replay_init(ReplayContext *replay, const TraceHeader &header,
+                        std::vector<char> vertexCode, std::vector<char> fragmentCode)
+{
+    // Instance
+    {
+        VkApplicationInfo appInfo = {};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.apiVersion = VK_API_VERSION_1_2;
+
+        VkInstanceCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        info.pApplicationInfo = &appInfo;
+
+        VK_CHECK_FATAL(vkCreateInstance(&info, 0, &replay->instance));
+
+        vk_load_instance_functions(replay->instance, &replay->vk);
+    }
+
+    // Choose GPU, the first one with a Graphics Queue
+    {
+        replay->graphicsIdx = -1;
+
+        uint32_t gpuCount = 0;
+        VkPhysicalDevice gpus[10];
+        VK_CHECK_FATAL(replay->vk.vkEnumeratePhysicalDevices(replay->instance, &gpuCount, 0));
+        VK_CHECK_FATAL(replay->vk.vkEnumeratePhysicalDevices(replay->instance, &gpuCount, gpus));
+
+        for (uint32_t i = 0; i < gpuCount && replay->graphicsIdx < 0; i++)
+        {
+            uint32_t queueFamilyCount = 0;
+            VkQueueFamilyProperties queueProps[10];
+            replay->vk.vkGetPhysicalDeviceQueueFamilyProperties(gpus[i], &queueFamilyCount, 0);
+            replay->vk.vkGetPhysicalDeviceQueueFamilyProperties(gpus[i], &queueFamilyCount, queueProps);
+
+            for (uint32_t j = 0; j < queueFamilyCount; j++)
+            {
+                if (queueProps[j].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+                {
+                    replay->graphicsIdx = j;
+                    replay->timestampValidBits = queueProps[j].timestampValidBits;
+                    replay->gpu = gpus[i];
+                    break;
+                }
+            }
+        }
+
+        if (replay->graphicsIdx < 0)
+        {
+            std::cerr << "No GPU with a Graphics Queue for the Replay" << std::endl;
+            return false;
+        }
+    }
+
+    // Logical Device
+    bool multiDrawSupport;
+    {
+        float queuePriority = 1.0f;
+
+        VkPhysicalDeviceFeatures gpuFeatures;
+        replay->vk.vkGetPhysicalDeviceFeatures(replay->gpu, &gpuFeatures);
+
+        VkPhysicalDeviceFeatures enabledFeatures = {};
+        enabledFeatures.multiDrawIndirect = gpuFeatures.multiDrawIndirect;
+        multiDrawSupport = gpuFeatures.multiDrawIndirect;
+
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        {
+            VkPhysicalDeviceProperties gpuProps;
+            replay->vk.vkGetPhysicalDeviceProperties(replay->gpu, &gpuProps);
+
+            if (gpuProps.apiVersion >= VK_API_VERSION_1_2)
+            {
+                VkPhysicalDeviceFeatures2 features = {};
+                features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+                features.pNext = &timelineFeatures;
+                replay->vk.vkGetPhysicalDeviceFeatures2(replay->gpu, &features);
+            }
+        }
+
+        VkDeviceQueueCreateInfo queueInfo = {};
+        queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfo.queueFamilyIndex = replay->graphicsIdx;
+        queueInfo.queueCount = 1;
+        queueInfo.pQueuePriorities = &queuePriority;
+
+        VkDeviceCreateInfo deviceInfo = {};
+        deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        deviceInfo.pQueueCreateInfos = &queueInfo;
+        deviceInfo.queueCreateInfoCount = 1;
+        deviceInfo.pEnabledFeatures = &enabledFeatures;
+        deviceInfo.pNext = timelineFeatures.timelineSemaphore ? &timelineFeatures : 0;
+
+        VK_CHECK_FATAL(replay->vk.vkCreateDevice(replay->gpu, &deviceInfo, 0, &replay->device));
+
+        if (!vk_load_device_functions(replay->device, &replay->vk))
+        {
+            return false;
+        }
+
+        replay->vk.vkGetDeviceQueue(replay->device, replay->graphicsIdx, 0, &replay->queue);
+        memory_tracker_init(replay->gpu, false);
+
+        if (!sync_queue_init(&replay->sync, &replay->vk, replay->device, replay->queue, timelineFeatures.timelineSemaphore))
+        {
+            return false;
+        }
+    }
+
+    // Render Pass, compatible with the one the trace was captured with
+    {
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = (VkFormat)header.format;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpassDesc = {};
+        subpassDesc.colorAttachmentCount = 1;
+        subpassDesc.pColorAttachments = &colorAttachmentRef;
+
+        VkRenderPassCreateInfo rpInfo = {};
+        rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        rpInfo.pAttachments = &colorAttachment;
+        rpInfo.attachmentCount = 1;
+        rpInfo.subpassCount = 1;
+        rpInfo.pSubpasses = &subpassDesc;
+
+        VK_CHECK_FATAL(replay->vk.vkCreateRenderPass(replay->device, &rpInfo, 0, &replay->renderPass));
+    }
+
+    // Render Target and Frame Buffer
+    {
+        if (!drs_init(&replay->target, &replay->vk, replay->device, replay->gpu,
+                      (VkFormat)header.format, header.width, header.height,
+                      replay->timestampValidBits))
+        {
+            return false;
+        }
+
+        VkFramebufferCreateInfo fbInfo = {};
+        fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        fbInfo.renderPass = replay->renderPass;
+        fbInfo.width = header.width;
+        fbInfo.height = header.height;
+        fbInfo.layers = 1;
+        fbInfo.attachmentCount = 1;
+        fbInfo.pAttachments = &replay->target.targetView;
+        VK_CHECK_FATAL(replay->vk.vkCreateFramebuffer(replay->device, &fbInfo, 0, &replay->framebuffer));
+    }
+
+    // Command Buffer
+    {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = replay->graphicsIdx;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VK_CHECK_FATAL(replay->vk.vkCreateCommandPool(replay->device, &poolInfo, 0, &replay->commandPool));
+
+        VkCommandBufferAllocateInfo allocInfo = cmd_alloc_info(replay->commandPool);
+        VK_CHECK_FATAL(replay->vk.vkAllocateCommandBuffers(replay->device, &allocInfo, &replay->cmd));
+    }
+
+    // Textures aren't part of the trace, binding 2 gets the white default
+    if (!texture_manager_init(&replay->textures, replay->device, replay->gpu, &replay->vk,
+                              &replay->sync, &replay->sync, replay->graphicsIdx, replay->graphicsIdx, 0.0f))
+    {
+        return false;
+    }
+
+    // Descriptors and Pipelines, same layout as init_vulkan()
+    {
+        VkDescriptorSetLayoutBinding layoutBindings[] = {
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1, 0),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1, 1),
+            layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 2),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 3),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 4),
+            layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 5),
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 6),
+            layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 7),
+            layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 8)};
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = ArraySize(layoutBindings);
+        layoutInfo.pBindings = layoutBindings;
+        VK_CHECK_FATAL(replay->vk.vkCreateDescriptorSetLayout(replay->device, &layoutInfo, 0, &replay->setLayout));
+
+        VkPushConstantRange pushConstant = {};
+        pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstant.size = sizeof(DrawConstants);
+
+        VkPipelineLayoutCreateInfo pipeLayoutInfo = {};
+        pipeLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipeLayoutInfo.setLayoutCount = 1;
+        pipeLayoutInfo.pSetLayouts = &replay->setLayout;
+        pipeLayoutInfo.pushConstantRangeCount = 1;
+        pipeLayoutInfo.pPushConstantRanges = &pushConstant;
+        VK_CHECK_FATAL(replay->vk.vkCreatePipelineLayout(replay->device, &pipeLayoutInfo, 0, &replay->pipeLayout));
+
+        PipelineState fallbackState = {};
+        fallbackState.vertexFormat = VERTEX_FORMAT_POSITION_COLOR;
+        fallbackState.cullMode = VK_CULL_MODE_FRONT_BIT;
+        if (!pipeline_library_init(&replay->pipelines, replay->device, replay->renderPass, replay->pipeLayout,
+                                   std::move(vertexCode), std::move(fragmentCode), fallbackState))
+        {
+            return false;
+        }
+
+        replay->ubo = vk_allocate_buffer(
+            replay->device, replay->gpu, sizeof(GlobalUBO),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            "Replay UBO");
+
+        replay->worlds = vk_allocate_buffer(
+            replay->device, replay->gpu, TRACE_MAX_FRAME_DRAWS * sizeof(glm::mat4),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            "Replay World Matrices");
+
+        VkDescriptorPoolSize poolSizes[] = {
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2}};
+
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = ArraySize(poolSizes);
+        poolInfo.pPoolSizes = poolSizes;
+        VK_CHECK_FATAL(replay->vk.vkCreateDescriptorPool(replay->device, &poolInfo, 0, &replay->descPool));
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.pSetLayouts = &replay->setLayout;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.descriptorPool = replay->descPool;
+        VK_CHECK_FATAL(replay->vk.vkAllocateDescriptorSets(replay->device, &allocInfo, &replay->descSet));
+
+        VkDescriptorBufferInfo bufferInfo = {};
+        bufferInfo.buffer = replay->ubo.buffer;
+        bufferInfo.range = sizeof(GlobalUBO);
+
+        VkDescriptorBufferInfo worldsInfo = {};
+        worldsInfo.buffer = replay->worlds.buffer;
+        worldsInfo.range = VK_WHOLE_SIZE;
+
+        VkDescriptorImageInfo imageInfo = {};
+        imageInfo.sampler = sampler_cache_get(
+            &replay->textures.samplers,
+            {VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_FALSE});
+        imageInfo.imageView = texture_view(&replay->textures, replay->textures.defaultTexture);
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkWriteDescriptorSet writes[3] = {};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        writes[0].descriptorCount = 1;
+        writes[0].dstBinding = 0;
+        writes[0].pBufferInfo = &bufferInfo;
+        writes[0].dstSet = replay->descSet;
+        writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[1].descriptorCount = 1;
+        writes[1].dstBinding = 2;
+        writes[1].pImageInfo = &imageInfo;
+        writes[1].dstSet = replay->descSet;
+        writes[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[2].descriptorCount = 1;
+        writes[2].dstBinding = 1;
+        writes[2].pBufferInfo = &worldsInfo;
+        writes[2].dstSet = replay->descSet;
+        replay->vk.vkUpdateDescriptorSets(replay->device, ArraySize(writes), writes, 0, 0);
+
+        // Lights aren't part of the trace either, without any the shader
+        // only applies the ambient term
+        if (!lighting_init(&replay->lighting, &replay->vk, replay->device, replay->gpu, 0,
+                           "shaders_vulkan/lighting_cluster.comp.spv"))
+        {
+            return false;
+        }
+        lighting_write_descriptors(&replay->lighting, replay->descSet, 3);
+
+        // Neither are the shadow casters, the sun lights without shadows
+        if (!shadow_init(&replay->shadows, &replay->vk, replay->device, replay->gpu, 0,
+                         "shaders_vulkan/shadow.vert.spv"))
+        {
+            return false;
+        }
+        replay->shadows.cascadeCount = 0;
+        shadow_write_descriptors(&replay->shadows, replay->descSet, 7);
+    }
+
+    geometry_init(&replay->geometry, replay->device, replay->gpu,
+                  GEOMETRY_MAX_VERTICES, GEOMETRY_MAX_INDICES, GEOMETRY_MAX_DRAWS,
+                  multiDrawSupport, 0, 0);
+
+    return true;
+}
+
+static void replay_shutdown(ReplayContext *replay)
+{
+    VK_CHECK(replay->vk.vkDeviceWaitIdle(replay->device));
+
+    pipeline_library_shutdown(&replay->pipelines);
+    texture_manager_shutdown(&replay->textures);
+    geometry_destroy(&replay->geometry, replay->device);
+    vk_free_buffer(replay->device, &replay->ubo);
+    vk_free_buffer(replay->device, &replay->worlds);
+    lighting_shutdown(&replay->lighting);
+    shadow_shutdown(&replay->shadows);
+    replay->vk.vkDestroyFramebuffer(replay->device, replay->framebuffer, 0);
+    drs_shutdown(&replay->target, &replay->vk, replay->device);
+    replay->vk.vkDestroyCommandPool(replay->device, replay->commandPool, 0);
+    sync_queue_destroy(&replay->sync);
+}
+
+// Runs the trace loops times, frames are submitted back to back with one in
+// flight like the renderer. Returns false if the file isn't a valid trace.
+static bool replay_trace(const char *path, uint32_t loops)
+{
+    if (!std::filesystem::exists(path))
+    {
+        std::cerr << "Trace not found: " << path << std::endl;
+        return false;
+    }
+    std::vector<char> data = read_file(path);
+
+    TraceHeader header = {};
+    if (data.size() >= sizeof(header))
+    {
+        memcpy(&header, data.data(), sizeof(header));
+    }
+    if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION)
+    {
+        std::cerr << "Not a Trace of this version: " << path << std::endl;
+        return false;
+    }
+
+    // The first record are always the shaders
+    uint32_t recordsStart = sizeof(header);
+    std::vector<char> vertexCode, fragmentCode;
+    {
+        TraceRecord record = {};
+        if (data.size() >= recordsStart + sizeof(record))
+        {
+            memcpy(&record, data.data() + recordsStart, sizeof(record));
+        }
+        if (record.command != TRACE_CMD_SHADERS || data.size() < recordsStart + sizeof(record) + record.size)
+        {
+            std::cerr << "Trace without Shaders: " << path << std::endl;
+            return false;
+        }
+
+        const char *payload = data.data() + recordsStart + sizeof(record);
+        uint32_t vertSize, fragSize;
+        memcpy(&vertSize, payload, 4);
+        vertexCode.assign(payload + 4, payload + 4 + vertSize);
+        memcpy(&fragSize, payload + 4 + vertSize, 4);
+        fragmentCode.assign(payload + 8 + vertSize, payload + 8 + vertSize + fragSize);
+
+        recordsStart += sizeof(record) + record.size;
+    }
+
+    ReplayContext *replay = new ReplayContext();
+    if (!replay_init(replay, header, std::move(vertexCode), std::move(fragmentCode)))
+    {
+        std::cerr << "Failed to initialise the Replay" << std::endl;
+        delete replay;
+        return false;
+    }
+
+    std::cout << "Replaying " << path << ": " << header.frameCount << " frames, "
+              << header.width << "x" << header.height << ", " << loops << " loops" << std::endl;
+
+    std::vector<double> frameMs;
+    frameMs.reserve((size_t)header.frameCount * loops);
+    PipelineState state = replay->pipelines.variants[replay->pipelines.fallbackKey].state;
+    uint32_t drawCalls = 0;
+    bool valid = true;
+
+    // The Render Pass begins with the first draw, the meshes uploaded in the
+    // frame are copied before that
+    VkClearValue clearValue = {};
+    VkRenderPassBeginInfo rpBeginInfo = {};
+    bool passBegun = false;
+    uint32_t frameDraws = 0;
+
+    auto replayStart = std::chrono::high_resolution_clock::now();
+    auto frameStart = replayStart;
+
+    for (uint32_t loop = 0; loop < loops && valid; loop++)
+    {
+        uint64_t offset = recordsStart;
+        while (offset + sizeof(TraceRecord) <= data.size())
+        {
+            TraceRecord record;
+            memcpy(&record, data.data() + offset, sizeof(record));
+            const char *payload = data.data() + offset + sizeof(record);
+            offset += sizeof(record) + record.size;
+            if (offset > data.size())
+            {
+                std::cerr << "Trace truncated" << std::endl;
+                valid = false;
+                break;
+            }
+
+            VkCommandBuffer cmd = replay->cmd;
+
+            switch (record.command)
+            {
+            case TRACE_CMD_FRAME_BEGIN:
+            {
+                struct
+                {
+                    uint32_t width;
+                    uint32_t height;
+                    VkClearColorValue clearColor;
+                } frame;
+                memcpy(&frame, payload, sizeof(frame));
+
+                frameStart = std::chrono::high_resolution_clock::now();
+
+                // One frame in flight, then the UBO and Command Buffer can be reused
+                sync_wait(&replay->sync, replay->frameValue);
+                geometry_collect(&replay->geometry, &replay->sync);
+
+                VkCommandBufferBeginInfo beginInfo = {};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                replay->vk.vkResetCommandBuffer(cmd, 0);
+                VK_CHECK(replay->vk.vkBeginCommandBuffer(cmd, &beginInfo));
+
+                // Only gives the atlas its layout, no cascades are rendered
+                shadow_render(&replay->shadows, cmd);
+
+                clearValue.color = frame.clearColor;
+
+                rpBeginInfo = {};
+                rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                rpBeginInfo.renderArea.extent = {frame.width, frame.height};
+                rpBeginInfo.clearValueCount = 1;
+                rpBeginInfo.pClearValues = &clearValue;
+                rpBeginInfo.renderPass = replay->renderPass;
+                rpBeginInfo.framebuffer = replay->framebuffer;
+                passBegun = false;
+                frameDraws = 0;
+
+                VkViewport viewport = {};
+                viewport.maxDepth = 1.0f;
+                viewport.width = frame.width;
+                viewport.height = frame.height;
+
+                VkRect2D scissor = {};
+                scissor.extent = {frame.width, frame.height};
+
+                replay->vk.vkCmdSetViewport(cmd, 0, 1, &viewport);
+                replay->vk.vkCmdSetScissor(cmd, 0, 1, &scissor);
+                break;
+            }
+
+            case TRACE_CMD_MESH_UPLOAD:
+            {
+                uint32_t counts[3];
+                memcpy(counts, payload, 12);
+
+                uint32_t meshId = geometry_add_mesh(
+                    &replay->geometry,
+                    (const VertexColor *)(payload + 12), counts[1],
+                    (const uint32_t *)(payload + 12 + counts[1] * sizeof(VertexColor)), counts[2]);
+                replay->meshIds[counts[0]] = meshId;
+                break;
+            }
+
+            case TRACE_CMD_MESH_REMOVE:
+            {
+                uint32_t traceId;
+                memcpy(&traceId, payload, 4);
+
+                // The last submitted frame is complete already, nothing reads the mesh anymore
+                auto it = replay->meshIds.find(traceId);
+                if (it != replay->meshIds.end())
+                {
+                    geometry_remove_mesh(&replay->geometry, it->second, replay->frameValue);
+                    replay->meshIds.erase(it);
+                }
+                break;
+            }
+
+            case TRACE_CMD_PIPELINE:
+            {
+                memcpy(&state, payload, sizeof(state));
+                break;
+            }
+
+            case TRACE_CMD_UBO:
+            {
+                uint32_t uboOffset;
+                memcpy(&uboOffset, payload, 4);
+                if (record.size >= 4 && uboOffset + record.size - 4 <= replay->ubo.size)
+                {
+                    memcpy((char *)replay->ubo.data + uboOffset, payload + 4, record.size - 4);
+                }
+                break;
+            }
+
+            case TRACE_CMD_DRAW_GEOMETRY:
+            {
+                if (record.size != sizeof(glm::mat4) || frameDraws >= TRACE_MAX_FRAME_DRAWS)
+                {
+                    std::cerr << "Bad Trace Draw, " << frameDraws << " in the frame" << std::endl;
+                    valid = false;
+                    break;
+                }
+
+                // The last frame completed, its slots are free again
+                DrawConstants draw = {frameDraws++};
+                memcpy((glm::mat4 *)replay->worlds.data + draw.nodeIndex, payload, sizeof(glm::mat4));
+
+                geometry_update(&replay->geometry);
+
+                if (!passBegun)
+                {
+                    geometry_record_uploads(&replay->geometry, &replay->vk, cmd, &replay->sync);
+                    replay->vk.vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+                    passBegun = true;
+                }
+
+                // Waiting on a missing variant keeps the replay deterministic
+                VkPipeline pipeline = pipeline_library_get(&replay->pipelines, state, true);
+                replay->vk.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+                replay->vk.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, replay->pipeLayout,
+                                                   0, 1, &replay->descSet, 0, 0);
+                replay->vk.vkCmdPushConstants(cmd, replay->pipeLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                              sizeof(draw), &draw);
+                geometry_draw(&replay->geometry, &replay->vk, cmd);
+                drawCalls++;
+                break;
+            }
+
+            case TRACE_CMD_FRAME_END:
+            {
+                // Still clears a frame without draws
+                if (!passBegun)
+                {
+                    geometry_record_uploads(&replay->geometry, &replay->vk, cmd, &replay->sync);
+                    replay->vk.vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+                    passBegun = true;
+                }
+
+                replay->vk.vkCmdEndRenderPass(cmd);
+                VK_CHECK(replay->vk.vkEndCommandBuffer(cmd));
+
+                SyncSubmit *submit = sync_batch_add(&replay->sync, &replay->batch);
+                sync_submit_add_cmd(submit, cmd);
+                replay->frameValue = sync_flush(&replay->sync, &replay->batch);
+
+                frameMs.push_back(std::chrono::duration<double, std::milli>(
+                                      std::chrono::high_resolution_clock::now() - frameStart)
+                                      .count());
+                break;
+            }
+
+            default:
+            {
+                std::cerr << "Unknown Trace Command " << record.command << std::endl;
+                valid = false;
+                break;
+            }
+            }
+
+            if (!valid)
+            {
+                break;
+            }
+        }
+
+        // Every loop starts from an empty arena like the capture did
+        for (auto &it : replay->meshIds)
+        {
+            geometry_remove_mesh(&replay->geometry, it.second, replay->frameValue);
+        }
+        replay->meshIds.clear();
+    }
+
+    sync_wait(&replay->sync, replay->frameValue);
+    double totalMs = std::chrono::duration<double, std::milli>(
+                         std::chrono::high_resolution_clock::now() - replayStart)
+                         .count();
+
+    if (frameMs.size())
+    {
+        std::vector<double> sorted = frameMs;
+        std::sort(sorted.begin(), sorted.end());
+        double p99 = sorted[(sorted.size() - 1) * 99 / 100];
+
+        std::cout << "Replay: " << frameMs.size() << " frames, " << drawCalls << " draws in "
+                  << totalMs << "ms, " << frameMs.size() * 1000.0 / totalMs << " fps, "
+                  << "avg " << totalMs / frameMs.size() << "ms, "
+                  << "min " << sorted.front() << "ms, p99 " << p99 << "ms, max " << sorted.back() << "ms" << std::endl;
+    }
+    pipeline_library_print_stats(&replay->pipelines);
+
+    replay_shutdown(replay);
+    delete replay;
+
+    return valid;
+}
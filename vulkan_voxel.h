@@ -0,0 +1,686 @@
+#pragma once
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+// Voxel world split into chunks of VOXEL_CHUNK_SIZE^3. A chunk stores a palette
+// of the types it contains and bit packed indices into it, a chunk of only air
+// or only stone needs no indices at all. Edited chunks are marked dirty and
+// meshed again on worker threads. Greedy meshing drops hidden faces and merges
+// coplanar faces of the same type into rectangles. The meshes go into a
+// Geometry Arena of their own and are drawn with a single indirect draw.
+
+#define VOXEL_CHUNK_SIZE 32
+#define VOXEL_CHUNK_VOLUME (VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE)
+#define VOXEL_PADDED_SIZE (VOXEL_CHUNK_SIZE + 2) // One layer of the neighbours on each side
+#define VOXEL_MAX_MESH_THREADS 4
+#define VOXEL_MAX_VERTICES (1 << 21)
+#define VOXEL_MAX_INDICES (1 << 22)
+
+typedef uint8_t Voxel;
+
+enum VoxelType
+{
+    VOXEL_AIR,
+    VOXEL_STONE,
+    VOXEL_DIRT,
+    VOXEL_GRASS,
+    VOXEL_SAND,
+    VOXEL_TYPE_COUNT
+};
+
+static const glm::vec3 VOXEL_COLORS[VOXEL_TYPE_COUNT] = {
+    {0.0f, 0.0f, 0.0f},
+    {0.5f, 0.5f, 0.5f},
+    {0.45f, 0.3f, 0.15f},
+    {0.3f, 0.6f, 0.2f},
+    {0.85f, 0.8f, 0.55f}};
+
+struct VoxelChunk
+{
+    // Indices of bitsPerVoxel bits into the palette, 0 bits if the chunk has a
+    // single type. The width is a power of two, so no index spans two words.
+    std::vector<Voxel> palette;
+    std::vector<uint64_t> indices;
+    uint32_t bitsPerVoxel;
+
+    // Render thread only
+    uint32_t meshId; // INVALID_IDX without faces
+    bool dirty;
+    bool meshing;
+
+    // Of the current mesh
+    uint32_t quadCount;
+    uint32_t faceCount; // Visible faces before merging
+    uint32_t solidCount;
+};
+
+struct VoxelMesh
+{
+    uint32_t chunkIdx;
+    std::vector<VertexColor> vertices;
+    std::vector<uint32_t> indices;
+    uint32_t faceCount;
+    uint32_t solidCount;
+    double ms;
+};
+
+struct VoxelStats
+{
+    uint64_t chunksMeshed;
+    double totalMeshMs; // Summed over all workers
+};
+
+struct VoxelWorld
+{
+    VkDevice device;
+    SyncQueue *sync;
+    GeometryArena arena;
+
+    uint32_t sizeX, sizeY, sizeZ; // In chunks
+    std::vector<VoxelChunk> chunks;
+
+    // Workers read the voxels, edits write them
+    std::shared_mutex voxelMutex;
+
+    // Render thread only
+    std::vector<uint32_t> dirtyChunks;
+    uint32_t meshingCount;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    bool running;
+
+    // Guarded by the mutex
+    std::deque<uint32_t> jobs;
+    std::deque<VoxelMesh> meshes;
+    VoxelStats stats;
+};
+
+static glm::vec3 voxel_color(Voxel voxel)
+{
+    if (voxel < VOXEL_TYPE_COUNT)
+    {
+        return VOXEL_COLORS[voxel];
+    }
+
+    // Types without a color of their own still get told apart
+    return glm::vec3((voxel * 37) % 256, (voxel * 91) % 256, (voxel * 173) % 256) / 255.0f;
+}
+
+static uint32_t voxel_chunk_palette_idx(const VoxelChunk &chunk, uint32_t idx)
+{
+    if (!chunk.bitsPerVoxel)
+    {
+        return 0;
+    }
+
+    uint32_t bit = idx * chunk.bitsPerVoxel;
+    uint64_t mask = (1ull << chunk.bitsPerVoxel) - 1;
+    return (chunk.indices[bit / 64] >> (bit % 64)) & mask;
+}
+
+static Voxel voxel_chunk_get(const VoxelChunk &chunk, uint32_t idx)
+{
+    return chunk.palette[voxel_chunk_palette_idx(chunk, idx)];
+}
+
+static void voxel_chunk_write_idx(VoxelChunk *chunk, uint32_t idx, uint32_t paletteIdx)
+{
+    uint32_t bit = idx * chunk->bitsPerVoxel;
+    uint64_t mask = (1ull << chunk->bitsPerVoxel) - 1;
+    uint64_t &word = chunk->indices[bit / 64];
+    word = (word & ~(mask << (bit % 64))) | ((uint64_t)paletteIdx << (bit % 64));
+}
+
+static void voxel_chunk_repack(VoxelChunk *chunk, uint32_t bitsPerVoxel)
+{
+    VoxelChunk packed = {};
+    packed.bitsPerVoxel = bitsPerVoxel;
+    packed.indices.resize(VOXEL_CHUNK_VOLUME * bitsPerVoxel / 64);
+
+    for (uint32_t i = 0; i < VOXEL_CHUNK_VOLUME && chunk->bitsPerVoxel; i++)
+    {
+        voxel_chunk_write_idx(&packed, i, voxel_chunk_palette_idx(*chunk, i));
+    }
+
+    chunk->indices = std::move(packed.indices);
+    chunk->bitsPerVoxel = bitsPerVoxel;
+}
+
+// The palette only grows, a type that disappeared keeps its entry until
+// the chunk gets assigned again
+static void voxel_chunk_set(VoxelChunk *chunk, uint32_t idx, Voxel voxel)
+{
+    uint32_t paletteIdx = 0;
+    while (paletteIdx < chunk->palette.size() && chunk->palette[paletteIdx] != voxel)
+    {
+        paletteIdx++;
+    }
+
+    if (paletteIdx == chunk->palette.size())
+    {
+        chunk->palette.push_back(voxel);
+        if (chunk->palette.size() > (1u << chunk->bitsPerVoxel))
+        {
+            voxel_chunk_repack(chunk, chunk->bitsPerVoxel ? chunk->bitsPerVoxel * 2 : 1);
+        }
+    }
+
+    if (chunk->bitsPerVoxel)
+    {
+        voxel_chunk_write_idx(chunk, idx, paletteIdx);
+    }
+}
+
+// Replaces all voxels of the chunk, the palette is rebuilt from scratch
+static void voxel_chunk_assign(VoxelChunk *chunk, const Voxel *voxels)
+{
+    uint8_t lookup[256];
+    bool used[256] = {};
+
+    chunk->palette.clear();
+    for (uint32_t i = 0; i < VOXEL_CHUNK_VOLUME; i++)
+    {
+        if (!used[voxels[i]])
+        {
+            used[voxels[i]] = true;
+            lookup[voxels[i]] = chunk->palette.size();
+            chunk->palette.push_back(voxels[i]);
+        }
+    }
+
+    uint32_t bitsPerVoxel = 0;
+    while ((1u << bitsPerVoxel) < chunk->palette.size())
+    {
+        bitsPerVoxel = bitsPerVoxel ? bitsPerVoxel * 2 : 1;
+    }
+
+    chunk->bitsPerVoxel = bitsPerVoxel;
+    chunk->indices.assign(VOXEL_CHUNK_VOLUME * bitsPerVoxel / 64, 0);
+    for (uint32_t i = 0; i < VOXEL_CHUNK_VOLUME && bitsPerVoxel; i++)
+    {
+        voxel_chunk_write_idx(chunk, i, lookup[voxels[i]]);
+    }
+}
+
+static uint32_t voxel_chunk_idx(VoxelWorld *world, uint32_t cx, uint32_t cy, uint32_t cz)
+{
+    return cx + cy * world->sizeX + cz * world->sizeX * world->sizeY;
+}
+
+// World coordinates, everything outside the world is air
+static Voxel voxel_get(VoxelWorld *world, int x, int y, int z)
+{
+    if (x < 0 || y < 0 || z < 0 ||
+        x >= int(world->sizeX * VOXEL_CHUNK_SIZE) ||
+        y >= int(world->sizeY * VOXEL_CHUNK_SIZE) ||
+        z >= int(world->sizeZ * VOXEL_CHUNK_SIZE))
+    {
+        return VOXEL_AIR;
+    }
+
+    VoxelChunk &chunk = world->chunks[voxel_chunk_idx(world, x / VOXEL_CHUNK_SIZE, y / VOXEL_CHUNK_SIZE, z / VOXEL_CHUNK_SIZE)];
+    uint32_t lx = x % VOXEL_CHUNK_SIZE, ly = y % VOXEL_CHUNK_SIZE, lz = z % VOXEL_CHUNK_SIZE;
+    return voxel_chunk_get(chunk, lx + ly * VOXEL_CHUNK_SIZE + lz * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE);
+}
+
+static void voxel_mark_dirty(VoxelWorld *world, int cx, int cy, int cz)
+{
+    if (cx < 0 || cy < 0 || cz < 0 || cx >= int(world->sizeX) || cy >= int(world->sizeY) || cz >= int(world->sizeZ))
+    {
+        return;
+    }
+
+    uint32_t chunkIdx = voxel_chunk_idx(world, cx, cy, cz);
+    if (!world->chunks[chunkIdx].dirty)
+    {
+        world->chunks[chunkIdx].dirty = true;
+        world->dirtyChunks.push_back(chunkIdx);
+    }
+}
+
+// Render thread only. Neighbouring chunks are re-meshed too if the voxel is on
+// their border, their faces towards it might change.
+static void voxel_set(VoxelWorld *world, int x, int y, int z, Voxel voxel)
+{
+    if (x < 0 || y < 0 || z < 0 ||
+        x >= int(world->sizeX * VOXEL_CHUNK_SIZE) ||
+        y >= int(world->sizeY * VOXEL_CHUNK_SIZE) ||
+        z >= int(world->sizeZ * VOXEL_CHUNK_SIZE))
+    {
+        return;
+    }
+
+    int cx = x / VOXEL_CHUNK_SIZE, cy = y / VOXEL_CHUNK_SIZE, cz = z / VOXEL_CHUNK_SIZE;
+    int lx = x % VOXEL_CHUNK_SIZE, ly = y % VOXEL_CHUNK_SIZE, lz = z % VOXEL_CHUNK_SIZE;
+    {
+        std::unique_lock<std::shared_mutex> lock(world->voxelMutex);
+        voxel_chunk_set(&world->chunks[voxel_chunk_idx(world, cx, cy, cz)],
+                        lx + ly * VOXEL_CHUNK_SIZE + lz * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE, voxel);
+    }
+
+    voxel_mark_dirty(world, cx, cy, cz);
+    if (lx == 0) voxel_mark_dirty(world, cx - 1, cy, cz);
+    if (ly == 0) voxel_mark_dirty(world, cx, cy - 1, cz);
+    if (lz == 0) voxel_mark_dirty(world, cx, cy, cz - 1);
+    if (lx == VOXEL_CHUNK_SIZE - 1) voxel_mark_dirty(world, cx + 1, cy, cz);
+    if (ly == VOXEL_CHUNK_SIZE - 1) voxel_mark_dirty(world, cx, cy + 1, cz);
+    if (lz == VOXEL_CHUNK_SIZE - 1) voxel_mark_dirty(world, cx, cy, cz + 1);
+}
+
+// Render thread only, voxels are indexed x + y * SIZE + z * SIZE * SIZE
+static void voxel_set_chunk(VoxelWorld *world, uint32_t cx, uint32_t cy, uint32_t cz, const Voxel *voxels)
+{
+    {
+        std::unique_lock<std::shared_mutex> lock(world->voxelMutex);
+        voxel_chunk_assign(&world->chunks[voxel_chunk_idx(world, cx, cy, cz)], voxels);
+    }
+
+    voxel_mark_dirty(world, cx, cy, cz);
+    voxel_mark_dirty(world, cx - 1, cy, cz);
+    voxel_mark_dirty(world, cx + 1, cy, cz);
+    voxel_mark_dirty(world, cx, cy - 1, cz);
+    voxel_mark_dirty(world, cx, cy + 1, cz);
+    voxel_mark_dirty(world, cx, cy, cz - 1);
+    voxel_mark_dirty(world, cx, cy, cz + 1);
+}
+
+// Rolling hills of grass on dirt on stone, sand in the valleys and caves below
+static Voxel voxel_terrain(int x, int y, int z)
+{
+    float height = 40.0f + 12.0f * sinf(x * 0.05f) + 10.0f * cosf(z * 0.07f) + 5.0f * sinf((x + z) * 0.13f);
+    if (y > height)
+    {
+        return VOXEL_AIR;
+    }
+    if (y < height - 6.0f && sinf(x * 0.1f) * sinf(y * 0.15f) * sinf(z * 0.1f) > 0.5f)
+    {
+        return VOXEL_AIR;
+    }
+    if (y > height - 1.0f)
+    {
+        return height < 30.0f ? VOXEL_SAND : VOXEL_GRASS;
+    }
+    return y > height - 4.0f ? VOXEL_DIRT : VOXEL_STONE;
+}
+
+// Fills every chunk with voxel_terrain(), the chunks mesh over the next
+// frames
+static void voxel_generate_terrain(VoxelWorld *world)
+{
+    const int S = VOXEL_CHUNK_SIZE;
+
+    std::vector<Voxel> voxels(VOXEL_CHUNK_VOLUME);
+    for (uint32_t cz = 0; cz < world->sizeZ; cz++)
+    {
+        for (uint32_t cy = 0; cy < world->sizeY; cy++)
+        {
+            for (uint32_t cx = 0; cx < world->sizeX; cx++)
+            {
+                for (int i = 0; i < VOXEL_CHUNK_VOLUME; i++)
+                {
+                    voxels[i] = voxel_terrain(cx * S + i % S, cy * S + (i / S) % S, cz * S + i / (S * S));
+                }
+                voxel_set_chunk(world, cx, cy, cz, voxels.data());
+            }
+        }
+    }
+}
+
+// Unpacks the chunk and the adjacent layer of its neighbours, the mesher
+// then never has to look up another chunk
+static void voxel_copy_padded(VoxelWorld *world, uint32_t chunkIdx, Voxel *padded)
+{
+    const int S = VOXEL_CHUNK_SIZE, P = VOXEL_PADDED_SIZE;
+
+    VoxelChunk &chunk = world->chunks[chunkIdx];
+    int cx = chunkIdx % world->sizeX;
+    int cy = (chunkIdx / world->sizeX) % world->sizeY;
+    int cz = chunkIdx / (world->sizeX * world->sizeY);
+
+    for (int z = 0; z < P; z++)
+    {
+        for (int y = 0; y < P; y++)
+        {
+            for (int x = 0; x < P; x++)
+            {
+                bool inside = x > 0 && y > 0 && z > 0 && x <= S && y <= S && z <= S;
+                padded[x + y * P + z * P * P] =
+                    inside ? voxel_chunk_get(chunk, (x - 1) + (y - 1) * S + (z - 1) * S * S)
+                           : voxel_get(world, cx * S + x - 1, cy * S + y - 1, cz * S + z - 1);
+            }
+        }
+    }
+}
+
+// Greedy meshing, per axis and direction every layer gets a mask of the
+// visible faces which is then covered with as few rectangles as possible
+static void voxel_mesh_chunk(const Voxel *padded, glm::vec3 origin, VoxelMesh *mesh)
+{
+    const int S = VOXEL_CHUNK_SIZE, P = VOXEL_PADDED_SIZE;
+    const int strides[3] = {1, P, P * P};
+
+    // Top faces full brightness, the sides and bottom darker to tell them apart
+    const float shades[3][2] = {{0.8f, 0.8f}, {0.5f, 1.0f}, {0.65f, 0.65f}};
+
+    for (int i = 0; i < VOXEL_CHUNK_VOLUME; i++)
+    {
+        int x = i % S, y = (i / S) % S, z = i / (S * S);
+        mesh->solidCount += padded[(x + 1) + (y + 1) * P + (z + 1) * P * P] != VOXEL_AIR;
+    }
+    if (!mesh->solidCount)
+    {
+        return;
+    }
+
+    Voxel mask[VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE];
+
+    for (int d = 0; d < 3; d++)
+    {
+        int u = (d + 1) % 3;
+        int v = (d + 2) % 3;
+
+        for (int side = 0; side < 2; side++)
+        {
+            int dir = side ? 1 : -1;
+
+            for (int layer = 0; layer < S; layer++)
+            {
+                // A face is visible if the neighbour in its direction is air
+                for (int j = 0; j < S; j++)
+                {
+                    for (int i = 0; i < S; i++)
+                    {
+                        int pos[3];
+                        pos[d] = layer + 1;
+                        pos[u] = i + 1;
+                        pos[v] = j + 1;
+                        int p = pos[0] + pos[1] * P + pos[2] * P * P;
+
+                        Voxel voxel = padded[p];
+                        bool visible = voxel != VOXEL_AIR && padded[p + dir * strides[d]] == VOXEL_AIR;
+                        mask[i + j * S] = visible ? voxel : VOXEL_AIR;
+                        mesh->faceCount += visible;
+                    }
+                }
+
+                for (int j = 0; j < S; j++)
+                {
+                    for (int i = 0; i < S;)
+                    {
+                        Voxel type = mask[i + j * S];
+                        if (type == VOXEL_AIR)
+                        {
+                            i++;
+                            continue;
+                        }
+
+                        int w = 1;
+                        while (i + w < S && mask[i + w + j * S] == type)
+                        {
+                            w++;
+                        }
+
+                        int h = 1;
+                        for (; j + h < S; h++)
+                        {
+                            int k = 0;
+                            while (k < w && mask[i + k + (j + h) * S] == type)
+                            {
+                                k++;
+                            }
+                            if (k < w)
+                            {
+                                break;
+                            }
+                        }
+
+                        for (int y = 0; y < h; y++)
+                        {
+                            memset(&mask[i + (j + y) * S], VOXEL_AIR, w);
+                        }
+
+                        glm::vec3 corner = origin;
+                        corner[d] += layer + side;
+                        corner[u] += i;
+                        corner[v] += j;
+
+                        glm::vec3 du(0.0f), dv(0.0f);
+                        du[u] = w;
+                        dv[v] = h;
+
+                        glm::vec3 color = voxel_color(type) * shades[d][side];
+                        uint32_t base = mesh->vertices.size();
+                        mesh->vertices.push_back({corner, color});
+                        mesh->vertices.push_back({corner + du, color});
+                        mesh->vertices.push_back({corner + du + dv, color});
+                        mesh->vertices.push_back({corner + dv, color});
+
+                        // Counter clockwise seen from outside, like the cube
+                        uint32_t quad[2][6] = {{0, 2, 1, 0, 3, 2}, {0, 1, 2, 0, 2, 3}};
+                        for (uint32_t k = 0; k < 6; k++)
+                        {
+                            mesh->indices.push_back(base + quad[side][k]);
+                        }
+
+                        i += w;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void voxel_mesh_thread(VoxelWorld *world)
+{
+    std::vector<Voxel> padded(VOXEL_PADDED_SIZE * VOXEL_PADDED_SIZE * VOXEL_PADDED_SIZE);
+
+    std::unique_lock<std::mutex> lock(world->mutex);
+
+    while (true)
+    {
+        world->jobAvailable.wait(lock, [world]
+                                 { return !world->running || !world->jobs.empty(); });
+        if (!world->running)
+        {
+            return;
+        }
+
+        uint32_t chunkIdx = world->jobs.front();
+        world->jobs.pop_front();
+
+        lock.unlock();
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        {
+            std::shared_lock<std::shared_mutex> voxelLock(world->voxelMutex);
+            voxel_copy_padded(world, chunkIdx, padded.data());
+        }
+
+        glm::vec3 origin = glm::vec3(chunkIdx % world->sizeX,
+                                     (chunkIdx / world->sizeX) % world->sizeY,
+                                     chunkIdx / (world->sizeX * world->sizeY)) *
+                           float(VOXEL_CHUNK_SIZE);
+
+        VoxelMesh mesh = {};
+        mesh.chunkIdx = chunkIdx;
+        voxel_mesh_chunk(padded.data(), origin, &mesh);
+        mesh.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        lock.lock();
+
+        world->stats.chunksMeshed++;
+        world->stats.totalMeshMs += mesh.ms;
+        world->meshes.push_back(std::move(mesh));
+    }
+}
+
+static void voxel_world_init(
+    VoxelWorld *world,
+    VkDevice device,
+    VkPhysicalDevice gpu,
+    SyncQueue *sync,
+    uint32_t sizeX,
+    uint32_t sizeY,
+    uint32_t sizeZ,
+    bool multiDraw)
+{
+    world->device = device;
+    world->sync = sync;
+    world->sizeX = sizeX;
+    world->sizeY = sizeY;
+    world->sizeZ = sizeZ;
+
+    world->chunks.resize(sizeX * sizeY * sizeZ);
+    for (VoxelChunk &chunk : world->chunks)
+    {
+        chunk.palette = {VOXEL_AIR};
+        chunk.meshId = INVALID_IDX;
+    }
+
+    // At most one mesh per chunk
+    geometry_init(&world->arena, device, gpu, VOXEL_MAX_VERTICES, VOXEL_MAX_INDICES,
+                  world->chunks.size(), multiDraw, 0, 0);
+
+    uint32_t threadCount = std::thread::hardware_concurrency();
+    threadCount = threadCount > 1 ? threadCount - 1 : 1;
+    threadCount = threadCount > VOXEL_MAX_MESH_THREADS ? VOXEL_MAX_MESH_THREADS : threadCount;
+
+    world->running = true;
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        world->threads.push_back(std::thread(voxel_mesh_thread, world));
+    }
+}
+
+// Once per frame, after the wait on the last frame. Finished meshes replace
+// the old ones of their chunks, dirty chunks go to the workers.
+static void voxel_update(VoxelWorld *world, uint64_t retireValue)
+{
+    if (!world->running)
+    {
+        return;
+    }
+
+    geometry_collect(&world->arena, world->sync);
+
+    std::deque<VoxelMesh> meshes;
+    {
+        std::lock_guard<std::mutex> lock(world->mutex);
+        meshes.swap(world->meshes);
+    }
+
+    for (VoxelMesh &mesh : meshes)
+    {
+        VoxelChunk &chunk = world->chunks[mesh.chunkIdx];
+        chunk.meshing = false;
+        world->meshingCount--;
+
+        if (chunk.meshId != INVALID_IDX)
+        {
+            geometry_remove_mesh(&world->arena, chunk.meshId, retireValue);
+            chunk.meshId = INVALID_IDX;
+        }
+        if (mesh.indices.size())
+        {
+            chunk.meshId = geometry_add_mesh(&world->arena, mesh.vertices.data(), mesh.vertices.size(),
+                                             mesh.indices.data(), mesh.indices.size());
+        }
+
+        chunk.quadCount = chunk.meshId != INVALID_IDX ? mesh.indices.size() / 6 : 0;
+        chunk.faceCount = mesh.faceCount;
+        chunk.solidCount = mesh.solidCount;
+    }
+
+    // Chunks still being meshed stay dirty and go out once their mesh is back
+    if (world->dirtyChunks.size())
+    {
+        std::vector<uint32_t> stillDirty;
+        {
+            std::lock_guard<std::mutex> lock(world->mutex);
+            for (uint32_t chunkIdx : world->dirtyChunks)
+            {
+                VoxelChunk &chunk = world->chunks[chunkIdx];
+                if (chunk.meshing)
+                {
+                    stillDirty.push_back(chunkIdx);
+                    continue;
+                }
+
+                chunk.dirty = false;
+                chunk.meshing = true;
+                world->meshingCount++;
+                world->jobs.push_back(chunkIdx);
+            }
+        }
+        world->jobAvailable.notify_all();
+        world->dirtyChunks.swap(stillDirty);
+    }
+
+    geometry_update(&world->arena);
+}
+
+static bool voxel_idle(VoxelWorld *world)
+{
+    return world->dirtyChunks.empty() && !world->meshingCount;
+}
+
+static void voxel_print_stats(VoxelWorld *world)
+{
+    if (world->chunks.empty())
+    {
+        return;
+    }
+
+    uint64_t quads = 0, faces = 0, solid = 0, bytes = 0;
+    for (VoxelChunk &chunk : world->chunks)
+    {
+        quads += chunk.quadCount;
+        faces += chunk.faceCount;
+        solid += chunk.solidCount;
+        bytes += chunk.palette.size() + chunk.indices.size() * sizeof(uint64_t);
+    }
+
+    std::lock_guard<std::mutex> lock(world->mutex);
+
+    VoxelStats &stats = world->stats;
+    std::cout << "Voxels: " << world->chunks.size() << " chunks, " << stats.chunksMeshed << " meshed, "
+              << "avg " << (stats.chunksMeshed ? stats.totalMeshMs / stats.chunksMeshed : 0.0) << "ms per chunk, "
+              << quads * 2 << " triangles (" << faces * 2 << " culled, " << solid * 12 << " naive), "
+              << bytes / 1024 << "KB voxels (" << world->chunks.size() * VOXEL_CHUNK_VOLUME / 1024 << "KB dense)" << std::endl;
+}
+
+static void voxel_world_shutdown(VoxelWorld *world)
+{
+    if (world->chunks.empty())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(world->mutex);
+        world->running = false;
+    }
+    world->jobAvailable.notify_all();
+
+    for (std::thread &thread : world->threads)
+    {
+        thread.join();
+    }
+    world->threads.clear();
+
+    geometry_destroy(&world->arena, world->device);
+
+    world->chunks.clear();
+    world->dirtyChunks.clear();
+    world->jobs.clear();
+    world->meshes.clear();
+    world->meshingCount = 0;
+}